@@ -0,0 +1,216 @@
+/* af_unix_splice_bench.c
+ *
+ * Moves a file through a unix stream socketpair twice, once with
+ * read(2)/write(2) on both ends and once with sendfile(2) into the
+ * socket and splice(2) out of it through a pipe to /dev/null, and
+ * reports throughput and the system CPU time each path used; see
+ * Documentation/networking/af_unix.txt.
+ *
+ * Compile with
+ *	gcc -O2 -Wall af_unix_splice_bench.c -o af_unix_splice_bench
+ *
+ * Run with
+ *	af_unix_splice_bench file [passes] [blocksize]
+ *
+ * The file should be in the page cache (cat it once first), so that
+ * disk reads do not hide the difference.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+
+#define err(fmt, arg...)			\
+	do {					\
+		fprintf(stderr, fmt, ##arg);	\
+		exit(1);			\
+	} while (0)
+
+static size_t bs = 64 * 1024;
+static char *buf;
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double tv_sec(struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void write_copy(int in, int sock, off_t size)
+{
+	ssize_t n, m, done;
+
+	while (size > 0) {
+		n = read(in, buf, bs);
+		if (n <= 0)
+			err("read: %s\n", n ? strerror(errno) : "short file");
+		for (done = 0; done < n; done += m) {
+			m = write(sock, buf + done, n - done);
+			if (m < 0)
+				err("write: %s\n", strerror(errno));
+		}
+		size -= n;
+	}
+}
+
+static void write_sendfile(int in, int sock, off_t size)
+{
+	ssize_t n;
+
+	while (size > 0) {
+		n = sendfile(sock, in, NULL, size < bs ? size : bs);
+		if (n <= 0)
+			err("sendfile: %s\n", n ? strerror(errno) : "short file");
+		size -= n;
+	}
+}
+
+static void read_copy(int sock, off_t size)
+{
+	ssize_t n;
+
+	while (size > 0) {
+		n = read(sock, buf, bs);
+		if (n <= 0)
+			err("read: %s\n", n ? strerror(errno) : "short read");
+		size -= n;
+	}
+}
+
+static void read_splice(int sock, off_t size)
+{
+	int pfd[2], null;
+	ssize_t n, m;
+
+	if (pipe(pfd) < 0)
+		err("pipe: %s\n", strerror(errno));
+	null = open("/dev/null", O_WRONLY);
+	if (null < 0)
+		err("/dev/null: %s\n", strerror(errno));
+
+	while (size > 0) {
+		n = splice(sock, NULL, pfd[1], NULL, bs, SPLICE_F_MOVE);
+		if (n <= 0)
+			err("splice in: %s\n", n ? strerror(errno) : "short read");
+		size -= n;
+		while (n > 0) {
+			m = splice(pfd[0], NULL, null, NULL, n, SPLICE_F_MOVE);
+			if (m <= 0)
+				err("splice out: %s\n", strerror(errno));
+			n -= m;
+		}
+	}
+	close(null);
+	close(pfd[0]);
+	close(pfd[1]);
+}
+
+/*
+ * One run: the parent writes, a child reads.  Returns the elapsed time
+ * and stores the system time of both processes in *sys.
+ */
+static double run(const char *path, off_t size, int passes, int spliced,
+		  double *sys)
+{
+	struct rusage ru_self0, ru_self1, ru_child;
+	int sv[2], in, i, status;
+	double t0, t;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		err("socketpair: %s\n", strerror(errno));
+
+	pid = fork();
+	if (pid < 0)
+		err("fork: %s\n", strerror(errno));
+	if (!pid) {
+		/* Reads may span passes, so count all of them as one */
+		close(sv[0]);
+		if (spliced)
+			read_splice(sv[1], size * passes);
+		else
+			read_copy(sv[1], size * passes);
+		_exit(0);
+	}
+	close(sv[1]);
+
+	getrusage(RUSAGE_SELF, &ru_self0);
+	t0 = now();
+	for (i = 0; i < passes; i++) {
+		in = open(path, O_RDONLY);
+		if (in < 0)
+			err("%s: %s\n", path, strerror(errno));
+		if (spliced)
+			write_sendfile(in, sv[0], size);
+		else
+			write_copy(in, sv[0], size);
+		close(in);
+	}
+	if (wait4(pid, &status, 0, &ru_child) < 0 ||
+	    !WIFEXITED(status) || WEXITSTATUS(status))
+		err("reader failed\n");
+	t = now() - t0;
+	getrusage(RUSAGE_SELF, &ru_self1);
+	close(sv[0]);
+
+	*sys = tv_sec(&ru_self1.ru_stime) - tv_sec(&ru_self0.ru_stime) +
+	       tv_sec(&ru_child.ru_stime);
+	return t;
+}
+
+static void report(const char *name, double bytes, double t, double sys)
+{
+	printf("%-8s %9.1f MB/s  %6.3f s sys  %6.2f ns sys/byte\n",
+	       name, bytes / t / 1e6, sys, sys * 1e9 / bytes);
+}
+
+int main(int argc, char *argv[])
+{
+	struct stat st;
+	double bytes, t, sys;
+	int passes = 10;
+
+	if (argc < 2 || argc > 4)
+		err("usage: af_unix_splice_bench file [passes] [blocksize]\n");
+	if (argc > 2)
+		passes = atoi(argv[2]);
+	if (argc > 3)
+		bs = strtoul(argv[3], NULL, 0);
+	if (passes <= 0 || !bs)
+		err("bad passes or blocksize\n");
+
+	if (stat(argv[1], &st) < 0)
+		err("%s: %s\n", argv[1], strerror(errno));
+	if (!st.st_size)
+		err("%s: empty\n", argv[1]);
+	buf = malloc(bs);
+	if (!buf)
+		err("out of memory\n");
+
+	bytes = (double)st.st_size * passes;
+	printf("%lld bytes x %d passes, %zu byte blocks\n",
+	       (long long)st.st_size, passes, bs);
+
+	t = run(argv[1], st.st_size, passes, 0, &sys);
+	report("copy", bytes, t, sys);
+	t = run(argv[1], st.st_size, passes, 1, &sys);
+	report("splice", bytes, t, sys);
+	return 0;
+}
@@ -0,0 +1,121 @@
+#!/bin/sh
+#
+# bridge_bench.sh - forwarding rate of the bridge fast path, driven by
+# pktgen over veth pairs; see Documentation/networking/bridge.txt.
+#
+# Needs root, CONFIG_BRIDGE, CONFIG_VETH, CONFIG_NET_PKTGEN, ip(8) and
+# brctl(8).
+#
+# Usage: bridge_bench.sh [cpus] [count] [pkt_size]
+#
+# The pktgen thread of each of the first <cpus> CPUs sends <count> frames
+# of <pkt_size> bytes into a bridge port of its own, addressed to a host
+# behind another port of its own, so the CPUs share nothing but the
+# bridge.  Prints the rate of each thread and what the bridge forwarded.
+
+cpus=${1:-$(grep -c '^processor' /proc/cpuinfo)}
+count=${2:-10000000}
+size=${3:-60}
+br=brbench0
+pg=/proc/net/pktgen
+
+pgset()
+{
+	echo "$2" > "$1"
+	if ! grep -q "Result: OK" "$1"; then
+		echo "$1: $2 failed" >&2
+		exit 1
+	fi
+}
+
+cleanup()
+{
+	for t in $pg/kpktgend_*; do
+		echo "rem_device_all" > $t
+	done
+	i=0
+	while [ $i -lt $cpus ]; do
+		ip link del bbi$i 2>/dev/null
+		ip link del bbo$i 2>/dev/null
+		i=$((i + 1))
+	done
+	ip link set dev $br down 2>/dev/null
+	brctl delbr $br 2>/dev/null
+}
+
+[ -d $pg ] || modprobe pktgen || exit 1
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+brctl addbr $br || exit 1
+brctl stp $br off
+brctl setfd $br 0
+brctl setageing $br 3600
+
+# bbi<n> -> bbp<n> [bridge] bbo<n> -> bbs<n>
+i=0
+while [ $i -lt $cpus ]; do
+	ip link add bbi$i type veth peer name bbp$i || exit 1
+	ip link add bbo$i type veth peer name bbs$i || exit 1
+	brctl addif $br bbp$i
+	brctl addif $br bbo$i
+	for d in bbi$i bbp$i bbo$i bbs$i; do
+		ip link set dev $d arp off up
+	done
+	i=$((i + 1))
+done
+ip link set dev $br up
+sleep 1
+
+# One frame from each sink teaches the bridge where it is, so that the
+# measured traffic is forwarded rather than flooded.
+cpu0=$pg/kpktgend_$(grep -m1 '^processor' /proc/cpuinfo | awk '{print $3}')
+pgset $cpu0 "rem_device_all"
+i=0
+while [ $i -lt $cpus ]; do
+	pgset $cpu0 "add_device bbs$i"
+	pgset $pg/bbs$i "count 1"
+	i=$((i + 1))
+done
+echo "start" > $pg/pgctrl
+pgset $cpu0 "rem_device_all"
+
+i=0
+for c in $(grep '^processor' /proc/cpuinfo | awk '{print $3}'); do
+	[ $i -lt $cpus ] || break
+	t=$pg/kpktgend_$c
+	pgset $t "rem_device_all"
+	pgset $t "add_device bbi$i"
+	pgset $pg/bbi$i "count $count"
+	pgset $pg/bbi$i "pkt_size $size"
+	pgset $pg/bbi$i "delay 0"
+	pgset $pg/bbi$i "clone_skb 0"
+	pgset $pg/bbi$i "dst_mac $(cat /sys/class/net/bbs$i/address)"
+	i=$((i + 1))
+done
+[ $i -eq $cpus ] || { echo "only $i CPUs online" >&2; exit 1; }
+
+fwd()
+{
+	n=0
+	i=0
+	while [ $i -lt $cpus ]; do
+		n=$((n + $(cat /sys/class/net/bbo$i/brport/tx_packets)))
+		i=$((i + 1))
+	done
+	echo $n
+}
+
+before=$(fwd)
+t0=$(date +%s.%N)
+echo "start" > $pg/pgctrl
+t1=$(date +%s.%N)
+after=$(fwd)
+
+i=0
+while [ $i -lt $cpus ]; do
+	echo "bbi$i: $(grep -o '[0-9]*pps' $pg/bbi$i)"
+	i=$((i + 1))
+done
+echo "$cpus CPUs, $size byte frames: $((after - before)) forwarded," \
+     "$(awk "BEGIN { printf \"%d\", ($after - $before) / ($t1 - $t0) }") pps"
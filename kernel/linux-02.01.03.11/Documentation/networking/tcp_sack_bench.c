@@ -0,0 +1,219 @@
+/* tcp_sack_bench.c
+ *
+ * Bulk TCP transfer that reports what SACK processing costs the sender:
+ * throughput, retransmitted segments and the share of CPU time the
+ * machine spent in softirq, where incoming ACKs and their SACK blocks
+ * are handled.  Meant to be run over a path with a large
+ * bandwidth-delay product and some loss, e.g. one emulated with netem;
+ * see Documentation/networking/tcp.txt.
+ *
+ * Compile with
+ *	gcc -O2 -Wall tcp_sack_bench.c -o tcp_sack_bench
+ *
+ * Receiver:	tcp_sack_bench -s [-p port]
+ * Sender:	tcp_sack_bench -c host [-p port] [-t seconds] [-b sndbuf]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define BUFSZ	(64 * 1024)
+
+static char buf[BUFSZ];
+
+#define err(fmt, arg...)			\
+	do {					\
+		fprintf(stderr, fmt, ##arg);	\
+		exit(1);			\
+	} while (0)
+
+struct cpu_sample {
+	unsigned long long softirq;
+	unsigned long long total;
+};
+
+/* The aggregate "cpu" line of /proc/stat */
+static void read_cpu(struct cpu_sample *s)
+{
+	unsigned long long v[8] = { 0, };
+	FILE *f;
+	int i;
+
+	f = fopen("/proc/stat", "r");
+	if (!f || fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+			 &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6],
+			 &v[7]) < 7)
+		err("cannot parse /proc/stat\n");
+	fclose(f);
+
+	s->softirq = v[6];
+	s->total = 0;
+	for (i = 0; i < 8; i++)
+		s->total += v[i];
+}
+
+/* RetransSegs from the Tcp: lines of /proc/net/snmp */
+static unsigned long long read_retrans(void)
+{
+	char names[1024], values[1024];
+	char *n, *v, *ns, *vs;
+	unsigned long long ret = 0;
+	FILE *f;
+
+	f = fopen("/proc/net/snmp", "r");
+	if (!f)
+		err("cannot open /proc/net/snmp\n");
+	while (fgets(names, sizeof(names), f)) {
+		if (strncmp(names, "Tcp:", 4) ||
+		    !fgets(values, sizeof(values), f))
+			continue;
+		n = strtok_r(names, " \n", &ns);
+		v = strtok_r(values, " \n", &vs);
+		while (n && v) {
+			if (!strcmp(n, "RetransSegs"))
+				ret = strtoull(v, NULL, 10);
+			n = strtok_r(NULL, " \n", &ns);
+			v = strtok_r(NULL, " \n", &vs);
+		}
+		break;
+	}
+	fclose(f);
+	return ret;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void receiver(int port)
+{
+	struct sockaddr_in sin;
+	int fd, c, one = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		err("socket: %s\n", strerror(errno));
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(fd, 1) < 0)
+		err("bind/listen: %s\n", strerror(errno));
+
+	for (;;) {
+		c = accept(fd, NULL, NULL);
+		if (c < 0)
+			err("accept: %s\n", strerror(errno));
+		while (read(c, buf, sizeof(buf)) > 0)
+			;
+		close(c);
+	}
+}
+
+static void sender(const char *host, int port, int secs, int sndbuf)
+{
+	struct cpu_sample c0, c1;
+	unsigned long long r0, r1, bytes = 0;
+	struct addrinfo hints, *ai;
+	char service[16];
+	double t0, t;
+	ssize_t n;
+	int fd;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(service, sizeof(service), "%d", port);
+	if (getaddrinfo(host, service, &hints, &ai))
+		err("cannot resolve %s\n", host);
+
+	fd = socket(ai->ai_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		err("socket: %s\n", strerror(errno));
+	if (sndbuf &&
+	    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0)
+		err("SO_SNDBUF: %s\n", strerror(errno));
+	if (connect(fd, ai->ai_addr, ai->ai_addrlen) < 0)
+		err("connect: %s\n", strerror(errno));
+	freeaddrinfo(ai);
+
+	read_cpu(&c0);
+	r0 = read_retrans();
+	t0 = now();
+	do {
+		n = write(fd, buf, sizeof(buf));
+		if (n < 0)
+			err("write: %s\n", strerror(errno));
+		bytes += n;
+		t = now() - t0;
+	} while (t < secs);
+	read_cpu(&c1);
+	r1 = read_retrans();
+	close(fd);
+
+	printf("%.1f Mbit/s, %llu segments retransmitted, "
+	       "%.1f%% of CPU time in softirq\n",
+	       bytes * 8 / t / 1e6, r1 - r0,
+	       c1.total == c0.total ? 0.0 :
+	       100.0 * (c1.softirq - c0.softirq) / (c1.total - c0.total));
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: tcp_sack_bench -s [-p port]\n"
+		"       tcp_sack_bench -c host [-p port] [-t seconds] "
+		"[-b sndbuf]\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *host = NULL;
+	int server = 0, port = 5001, secs = 60, sndbuf = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "sc:p:t:b:")) != -1) {
+		switch (c) {
+		case 's':
+			server = 1;
+			break;
+		case 'c':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 'b':
+			sndbuf = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (server == !!host)
+		usage();
+
+	if (server)
+		receiver(port);
+	else
+		sender(host, port, secs, sndbuf);
+	return 0;
+}
@@ -0,0 +1,648 @@
+/*
+ * pcrypt - Parallel crypto wrapper.
+ *
+ * Requests submitted to a pcrypt(...) AEAD instance are handed out round
+ * robin to a set of CPUs, where the underlying algorithm runs in parallel.
+ * Completed requests go through a reorder buffer and are completed in the
+ * order in which they were submitted, on the CPU that submitted them, so
+ * users such as IPsec see no reordering of their packets.  Ordering is
+ * kept per tfm, so one SA's slow request never holds back another's.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ */
+
+#include <crypto/algapi.h>
+#include <crypto/internal/aead.h>
+#include <linux/cpumask.h>
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+/* Requests in flight per engine before we start refusing new ones */
+#define PCRYPT_MAX_INFLIGHT	1000
+
+static char *cpus;
+module_param(cpus, charp, 0444);
+MODULE_PARM_DESC(cpus, "CPUs to run the parallel work on (cpulist, "
+			"default: all CPUs online at load time)");
+
+enum {
+	PCRYPT_ENCRYPT,
+	PCRYPT_DECRYPT,
+	PCRYPT_GIVENCRYPT,
+};
+
+struct pcrypt_request {
+	struct list_head list;
+	struct pcrypt_engine *engine;
+	struct aead_request *req;
+	unsigned int seq_nr;
+	int cb_cpu;
+	int op;
+	int err;
+
+	/* Must be last, the child's request context follows it */
+	struct aead_givcrypt_request creq;
+};
+
+struct pcrypt_queue {
+	spinlock_t lock;
+	struct list_head list;
+	struct work_struct work;
+	struct pcrypt_engine *engine;
+	int cpu;
+};
+
+struct pcrypt_engine_cpu {
+	/* Requests waiting to be run on this CPU */
+	struct pcrypt_queue parallel;
+	/* Finished requests waiting for their turn, sorted by seq_nr */
+	spinlock_t reorder_lock;
+	struct list_head reorder;
+	/* Requests in order, to be completed on this CPU */
+	struct pcrypt_queue serial;
+};
+
+/*
+ * Each tfm has its own engines, one per direction, so that a request only
+ * ever waits in the reorder buffer behind earlier requests of the same
+ * tfm (the same SA, for IPsec) and direction.  seq_nr is handed out at
+ * submission; processed is the next number to leave the reorder buffer
+ * and only changes under reorder_lock.
+ */
+struct pcrypt_engine {
+	atomic_t seq_nr;
+	atomic_t inflight;
+	unsigned int processed;
+	spinlock_t reorder_lock;
+	struct pcrypt_engine_cpu *cpu;
+};
+
+struct pcrypt_instance_ctx {
+	struct crypto_aead_spawn spawn;
+};
+
+struct pcrypt_aead_ctx {
+	struct crypto_aead *child;
+	struct pcrypt_engine enc;
+	struct pcrypt_engine dec;
+};
+
+static struct workqueue_struct *pcrypt_wq;
+
+/* Logical index -> CPU, fixed at load time */
+static int *pcrypt_cpumap;
+static unsigned int pcrypt_ncpus;
+
+static inline struct pcrypt_engine_cpu *pcrypt_seq_cpu(
+	struct pcrypt_engine *e, unsigned int seq_nr)
+{
+	return per_cpu_ptr(e->cpu, pcrypt_cpumap[seq_nr % pcrypt_ncpus]);
+}
+
+static void pcrypt_queue_work(struct pcrypt_queue *q)
+{
+	/*
+	 * Should the CPU be gone, any CPU will do: the queue is drained by
+	 * whoever runs its work and the reorder buffer keeps the order.
+	 */
+	if (cpu_online(q->cpu))
+		queue_work_on(q->cpu, pcrypt_wq, &q->work);
+	else
+		queue_work(pcrypt_wq, &q->work);
+}
+
+static void pcrypt_queue_add(struct pcrypt_queue *q,
+			     struct pcrypt_request *preq)
+{
+	spin_lock_bh(&q->lock);
+	list_add_tail(&preq->list, &q->list);
+	spin_unlock_bh(&q->lock);
+
+	pcrypt_queue_work(q);
+}
+
+static struct pcrypt_request *pcrypt_reorder_peek(
+	struct pcrypt_engine_cpu *pc, unsigned int seq_nr)
+{
+	struct pcrypt_request *preq;
+
+	if (list_empty(&pc->reorder))
+		return NULL;
+
+	preq = list_first_entry(&pc->reorder, struct pcrypt_request, list);
+	return preq->seq_nr == seq_nr ? preq : NULL;
+}
+
+/*
+ * Move every request whose turn it is from the reorder buffer to the
+ * serial queue of its submitting CPU.  Whoever holds reorder_lock does the
+ * work for everybody; the others just leave their request behind.
+ */
+static void pcrypt_reorder(struct pcrypt_engine *e)
+{
+	struct pcrypt_engine_cpu *pc;
+	struct pcrypt_request *preq;
+
+again:
+	if (!spin_trylock_bh(&e->reorder_lock))
+		return;
+
+	for (;;) {
+		pc = pcrypt_seq_cpu(e, e->processed);
+
+		spin_lock(&pc->reorder_lock);
+		preq = pcrypt_reorder_peek(pc, e->processed);
+		if (preq)
+			list_del(&preq->list);
+		spin_unlock(&pc->reorder_lock);
+
+		if (!preq)
+			break;
+
+		e->processed++;
+		pcrypt_queue_add(&per_cpu_ptr(e->cpu, preq->cb_cpu)->serial,
+				 preq);
+	}
+
+	spin_unlock_bh(&e->reorder_lock);
+
+	/*
+	 * The request we are waiting for may have been added while we were
+	 * still holding reorder_lock, in which case its owner gave up on the
+	 * trylock above.  Look again so it does not get stuck.
+	 */
+	smp_mb();
+
+	pc = pcrypt_seq_cpu(e, e->processed);
+	spin_lock_bh(&pc->reorder_lock);
+	preq = pcrypt_reorder_peek(pc, e->processed);
+	spin_unlock_bh(&pc->reorder_lock);
+
+	if (preq)
+		goto again;
+}
+
+static void pcrypt_done(struct pcrypt_request *preq, int err)
+{
+	struct pcrypt_engine *e = preq->engine;
+	struct pcrypt_engine_cpu *pc = pcrypt_seq_cpu(e, preq->seq_nr);
+	struct pcrypt_request *pos;
+
+	preq->err = err;
+
+	/* Completions of an async child may come back in any order */
+	spin_lock_bh(&pc->reorder_lock);
+	list_for_each_entry_reverse(pos, &pc->reorder, list) {
+		if ((int)(pos->seq_nr - preq->seq_nr) < 0)
+			break;
+	}
+	list_add(&preq->list, &pos->list);
+	spin_unlock_bh(&pc->reorder_lock);
+
+	pcrypt_reorder(e);
+}
+
+static void pcrypt_aead_done(struct crypto_async_request *areq, int err)
+{
+	struct pcrypt_request *preq = areq->data;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	pcrypt_done(preq, err);
+}
+
+static int pcrypt_do_crypt(struct pcrypt_request *preq)
+{
+	switch (preq->op) {
+	case PCRYPT_ENCRYPT:
+		return crypto_aead_encrypt(&preq->creq.areq);
+	case PCRYPT_DECRYPT:
+		return crypto_aead_decrypt(&preq->creq.areq);
+	default:
+		return crypto_aead_givencrypt(&preq->creq);
+	}
+}
+
+static void pcrypt_parallel(struct work_struct *work)
+{
+	struct pcrypt_queue *q = container_of(work, struct pcrypt_queue, work);
+	struct pcrypt_request *preq, *n;
+	LIST_HEAD(list);
+	int err;
+
+	local_bh_disable();
+
+	spin_lock(&q->lock);
+	list_splice_init(&q->list, &list);
+	spin_unlock(&q->lock);
+
+	list_for_each_entry_safe(preq, n, &list, list) {
+		list_del(&preq->list);
+
+		/* -EBUSY: backlogged by the child, it will call us back */
+		err = pcrypt_do_crypt(preq);
+		if (err == -EINPROGRESS || err == -EBUSY)
+			continue;
+
+		pcrypt_done(preq, err);
+	}
+
+	local_bh_enable();
+}
+
+static void pcrypt_serial(struct work_struct *work)
+{
+	struct pcrypt_queue *q = container_of(work, struct pcrypt_queue, work);
+	struct pcrypt_engine *e = q->engine;
+	struct pcrypt_request *preq, *n;
+	LIST_HEAD(list);
+
+	local_bh_disable();
+
+	spin_lock(&q->lock);
+	list_splice_init(&q->list, &list);
+	spin_unlock(&q->lock);
+
+	list_for_each_entry_safe(preq, n, &list, list) {
+		list_del(&preq->list);
+		atomic_dec(&e->inflight);
+		aead_request_complete(preq->req, preq->err);
+	}
+
+	local_bh_enable();
+}
+
+static int pcrypt_submit(struct aead_request *req, int op)
+{
+	struct pcrypt_request *preq = aead_request_ctx(req);
+	struct crypto_aead *aead = crypto_aead_reqtfm(req);
+	struct pcrypt_aead_ctx *ctx = crypto_aead_ctx(aead);
+	struct aead_request *creq = &preq->creq.areq;
+	struct pcrypt_engine *e;
+	struct pcrypt_engine_cpu *pc;
+
+	e = op == PCRYPT_DECRYPT ? &ctx->dec : &ctx->enc;
+
+	/* A caller that allows backlogging expects us to keep the request */
+	if (atomic_inc_return(&e->inflight) > PCRYPT_MAX_INFLIGHT &&
+	    !(req->base.flags & CRYPTO_TFM_REQ_MAY_BACKLOG)) {
+		atomic_dec(&e->inflight);
+		return -EBUSY;
+	}
+
+	/*
+	 * The child may complete from the parallel work, which cannot sleep.
+	 * Once queued the request must reach the reorder buffer, so the
+	 * child has to backlog it rather than drop it when it is busy.
+	 */
+	aead_request_set_tfm(creq, ctx->child);
+	aead_request_set_callback(creq,
+				  (req->base.flags & ~CRYPTO_TFM_REQ_MAY_SLEEP) |
+				  CRYPTO_TFM_REQ_MAY_BACKLOG,
+				  pcrypt_aead_done, preq);
+	aead_request_set_crypt(creq, req->src, req->dst, req->cryptlen,
+			       req->iv);
+	aead_request_set_assoc(creq, req->assoc, req->assoclen);
+
+	preq->engine = e;
+	preq->req = req;
+	preq->op = op;
+	preq->cb_cpu = get_cpu();
+	preq->seq_nr = atomic_inc_return(&e->seq_nr) - 1;
+
+	/*
+	 * From here on the request must make it to the reorder buffer,
+	 * otherwise everything behind it waits forever.
+	 */
+	pc = pcrypt_seq_cpu(e, preq->seq_nr);
+	pcrypt_queue_add(&pc->parallel, preq);
+	put_cpu();
+
+	return -EINPROGRESS;
+}
+
+static int pcrypt_aead_encrypt(struct aead_request *req)
+{
+	return pcrypt_submit(req, PCRYPT_ENCRYPT);
+}
+
+static int pcrypt_aead_decrypt(struct aead_request *req)
+{
+	return pcrypt_submit(req, PCRYPT_DECRYPT);
+}
+
+static int pcrypt_aead_givencrypt(struct aead_givcrypt_request *req)
+{
+	struct pcrypt_request *preq = aead_givcrypt_reqctx(req);
+
+	aead_givcrypt_set_giv(&preq->creq, req->giv, req->seq);
+
+	return pcrypt_submit(&req->areq, PCRYPT_GIVENCRYPT);
+}
+
+static int pcrypt_aead_setkey(struct crypto_aead *parent,
+			      const u8 *key, unsigned int keylen)
+{
+	struct pcrypt_aead_ctx *ctx = crypto_aead_ctx(parent);
+	struct crypto_aead *child = ctx->child;
+	int err;
+
+	crypto_aead_clear_flags(child, CRYPTO_TFM_REQ_MASK);
+	crypto_aead_set_flags(child, crypto_aead_get_flags(parent) &
+				     CRYPTO_TFM_REQ_MASK);
+	err = crypto_aead_setkey(child, key, keylen);
+	crypto_aead_set_flags(parent, crypto_aead_get_flags(child) &
+				      CRYPTO_TFM_RES_MASK);
+
+	return err;
+}
+
+static int pcrypt_aead_setauthsize(struct crypto_aead *parent,
+				   unsigned int authsize)
+{
+	struct pcrypt_aead_ctx *ctx = crypto_aead_ctx(parent);
+
+	return crypto_aead_setauthsize(ctx->child, authsize);
+}
+
+static void pcrypt_queue_init(struct pcrypt_queue *q, struct pcrypt_engine *e,
+			      int cpu, work_func_t fn)
+{
+	spin_lock_init(&q->lock);
+	INIT_LIST_HEAD(&q->list);
+	INIT_WORK(&q->work, fn);
+	q->engine = e;
+	q->cpu = cpu;
+}
+
+static int pcrypt_engine_init(struct pcrypt_engine *e)
+{
+	int cpu;
+
+	e->cpu = alloc_percpu(struct pcrypt_engine_cpu);
+	if (!e->cpu)
+		return -ENOMEM;
+
+	atomic_set(&e->seq_nr, 0);
+	atomic_set(&e->inflight, 0);
+	e->processed = 0;
+	spin_lock_init(&e->reorder_lock);
+
+	for_each_possible_cpu(cpu) {
+		struct pcrypt_engine_cpu *pc = per_cpu_ptr(e->cpu, cpu);
+
+		pcrypt_queue_init(&pc->parallel, e, cpu, pcrypt_parallel);
+		pcrypt_queue_init(&pc->serial, e, cpu, pcrypt_serial);
+		spin_lock_init(&pc->reorder_lock);
+		INIT_LIST_HEAD(&pc->reorder);
+	}
+
+	return 0;
+}
+
+static void pcrypt_engine_free(struct pcrypt_engine *e)
+{
+	int cpu;
+
+	/* All requests are done; their work items may still be running */
+	for_each_possible_cpu(cpu) {
+		struct pcrypt_engine_cpu *pc = per_cpu_ptr(e->cpu, cpu);
+
+		cancel_work_sync(&pc->parallel.work);
+		cancel_work_sync(&pc->serial.work);
+	}
+
+	free_percpu(e->cpu);
+}
+
+static int pcrypt_aead_init_tfm(struct crypto_tfm *tfm)
+{
+	struct crypto_instance *inst = (void *)tfm->__crt_alg;
+	struct pcrypt_instance_ctx *ictx = crypto_instance_ctx(inst);
+	struct pcrypt_aead_ctx *ctx = crypto_tfm_ctx(tfm);
+	struct crypto_aead *aead;
+	int err;
+
+	err = pcrypt_engine_init(&ctx->enc);
+	if (err)
+		return err;
+
+	err = pcrypt_engine_init(&ctx->dec);
+	if (err)
+		goto err_free_enc;
+
+	aead = crypto_spawn_aead(&ictx->spawn);
+	err = PTR_ERR(aead);
+	if (IS_ERR(aead))
+		goto err_free_dec;
+
+	ctx->child = aead;
+	tfm->crt_aead.reqsize = sizeof(struct pcrypt_request) +
+				crypto_aead_reqsize(aead);
+
+	return 0;
+
+err_free_dec:
+	free_percpu(ctx->dec.cpu);
+err_free_enc:
+	free_percpu(ctx->enc.cpu);
+	return err;
+}
+
+static void pcrypt_aead_exit_tfm(struct crypto_tfm *tfm)
+{
+	struct pcrypt_aead_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	pcrypt_engine_free(&ctx->dec);
+	pcrypt_engine_free(&ctx->enc);
+	crypto_free_aead(ctx->child);
+}
+
+static struct crypto_instance *pcrypt_alloc(struct rtattr **tb)
+{
+	struct crypto_attr_type *algt;
+	struct crypto_instance *inst;
+	struct pcrypt_instance_ctx *ictx;
+	struct crypto_alg *alg;
+	const char *name;
+	int err;
+
+	algt = crypto_get_attr_type(tb);
+	err = PTR_ERR(algt);
+	if (IS_ERR(algt))
+		return ERR_PTR(err);
+
+	if ((algt->type ^ CRYPTO_ALG_TYPE_AEAD) & algt->mask)
+		return ERR_PTR(-EINVAL);
+
+	name = crypto_attr_alg_name(tb[1]);
+	err = PTR_ERR(name);
+	if (IS_ERR(name))
+		return ERR_PTR(err);
+
+	inst = kzalloc(sizeof(*inst) + sizeof(*ictx), GFP_KERNEL);
+	if (!inst)
+		return ERR_PTR(-ENOMEM);
+
+	ictx = crypto_instance_ctx(inst);
+	crypto_set_aead_spawn(&ictx->spawn, inst);
+	err = crypto_grab_aead(&ictx->spawn, name, 0, 0);
+	if (err)
+		goto out_free_inst;
+
+	alg = crypto_aead_spawn_alg(&ictx->spawn);
+
+	/*
+	 * Only users asking for pcrypt(...) by name get it; everybody else
+	 * keeps getting the plain algorithm.
+	 */
+	err = -ENAMETOOLONG;
+	if (snprintf(inst->alg.cra_name, CRYPTO_MAX_ALG_NAME,
+		     "pcrypt(%s)", alg->cra_name) >= CRYPTO_MAX_ALG_NAME)
+		goto out_drop_alg;
+
+	if (snprintf(inst->alg.cra_driver_name, CRYPTO_MAX_ALG_NAME,
+		     "pcrypt(%s)", alg->cra_driver_name) >=
+	    CRYPTO_MAX_ALG_NAME)
+		goto out_drop_alg;
+
+	inst->alg.cra_flags = CRYPTO_ALG_TYPE_AEAD | CRYPTO_ALG_ASYNC;
+	inst->alg.cra_priority = alg->cra_priority + 100;
+	inst->alg.cra_blocksize = alg->cra_blocksize;
+	inst->alg.cra_alignmask = alg->cra_alignmask;
+	inst->alg.cra_type = &crypto_aead_type;
+
+	inst->alg.cra_aead.ivsize = alg->cra_aead.ivsize;
+	inst->alg.cra_aead.maxauthsize = alg->cra_aead.maxauthsize;
+	inst->alg.cra_aead.geniv = alg->cra_aead.geniv;
+
+	inst->alg.cra_ctxsize = sizeof(struct pcrypt_aead_ctx);
+
+	inst->alg.cra_init = pcrypt_aead_init_tfm;
+	inst->alg.cra_exit = pcrypt_aead_exit_tfm;
+
+	inst->alg.cra_aead.setkey = pcrypt_aead_setkey;
+	inst->alg.cra_aead.setauthsize = pcrypt_aead_setauthsize;
+	inst->alg.cra_aead.encrypt = pcrypt_aead_encrypt;
+	inst->alg.cra_aead.decrypt = pcrypt_aead_decrypt;
+	inst->alg.cra_aead.givencrypt = pcrypt_aead_givencrypt;
+
+out:
+	return inst;
+
+out_drop_alg:
+	crypto_drop_aead(&ictx->spawn);
+out_free_inst:
+	kfree(inst);
+	inst = ERR_PTR(err);
+	goto out;
+}
+
+static void pcrypt_free(struct crypto_instance *inst)
+{
+	struct pcrypt_instance_ctx *ictx = crypto_instance_ctx(inst);
+
+	crypto_drop_aead(&ictx->spawn);
+	kfree(inst);
+}
+
+static struct crypto_template pcrypt_tmpl = {
+	.name = "pcrypt",
+	.alloc = pcrypt_alloc,
+	.free = pcrypt_free,
+	.module = THIS_MODULE,
+};
+
+static int __init pcrypt_cpumap_init(void)
+{
+	cpumask_var_t mask;
+	int cpu;
+	int err;
+
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+
+	if (cpus) {
+		err = cpulist_parse(cpus, mask);
+		if (err)
+			goto out;
+		cpumask_and(mask, mask, cpu_possible_mask);
+	} else
+		cpumask_copy(mask, cpu_online_mask);
+
+	err = -EINVAL;
+	if (cpumask_empty(mask))
+		goto out;
+
+	err = -ENOMEM;
+	pcrypt_cpumap = kcalloc(cpumask_weight(mask), sizeof(int), GFP_KERNEL);
+	if (!pcrypt_cpumap)
+		goto out;
+
+	pcrypt_ncpus = 0;
+	for_each_cpu(cpu, mask)
+		pcrypt_cpumap[pcrypt_ncpus++] = cpu;
+
+	err = 0;
+
+out:
+	free_cpumask_var(mask);
+	return err;
+}
+
+static int __init pcrypt_init(void)
+{
+	int err;
+
+	err = pcrypt_cpumap_init();
+	if (err)
+		goto out;
+
+	err = -ENOMEM;
+	pcrypt_wq = create_workqueue("pcrypt");
+	if (!pcrypt_wq)
+		goto err_free_cpumap;
+
+	err = crypto_register_template(&pcrypt_tmpl);
+	if (err)
+		goto err_destroy_wq;
+
+out:
+	return err;
+
+err_destroy_wq:
+	destroy_workqueue(pcrypt_wq);
+err_free_cpumap:
+	kfree(pcrypt_cpumap);
+	goto out;
+}
+
+static void __exit pcrypt_exit(void)
+{
+	crypto_unregister_template(&pcrypt_tmpl);
+
+	/* No tfm is left, so nothing can be queued any more */
+	destroy_workqueue(pcrypt_wq);
+
+	kfree(pcrypt_cpumap);
+}
+
+module_init(pcrypt_init);
+module_exit(pcrypt_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Parallel crypto wrapper");
+MODULE_ALIAS("pcrypt");
@@ -503,6 +503,13 @@ static bool e1000_clean_rx_irq(struct e1000_adapter *adapter,
 		total_rx_bytes += length;
 		total_rx_packets++;
 
+		/* Dropped or sent on by the RX filter: reuse the buffer */
+		if (netif_rx_filter(netdev, skb->data, length)) {
+			/* recycle */
+			buffer_info->skb = skb;
+			goto next_desc;
+		}
+
 		/*
 		 * code added for copybreak, this should improve
 		 * performance for small packets with large amounts
@@ -3978,7 +3985,18 @@ static void e1000_tx_queue(struct e1000_adapter *adapter,
 	wmb();
 
 	tx_ring->next_to_use = i;
-	writel(i, adapter->hw.hw_addr + tx_ring->tail);
+}
+
+/*
+ * Hand everything queued so far to the hardware.  Deferred while the
+ * stack says more packets follow (skb->xmit_more); must be called with
+ * tx_queue_lock held.
+ */
+static void e1000_tx_doorbell(struct e1000_adapter *adapter)
+{
+	struct e1000_ring *tx_ring = adapter->tx_ring;
+
+	writel(tx_ring->next_to_use, adapter->hw.hw_addr + tx_ring->tail);
 	/*
 	 * we need this if more than one processor can write to our tail
 	 * at a time, it synchronizes IO on IA64/Altix systems
@@ -4075,16 +4093,15 @@ static int e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	int count = 0;
 	int tso;
 	unsigned int f;
+	bool more = skb->xmit_more;
 
 	if (test_bit(__E1000_DOWN, &adapter->state)) {
 		dev_kfree_skb_any(skb);
 		return NETDEV_TX_OK;
 	}
 
-	if (skb->len <= 0) {
-		dev_kfree_skb_any(skb);
-		return NETDEV_TX_OK;
-	}
+	if (skb->len <= 0)
+		goto drop;
 
 	mss = skb_shinfo(skb)->gso_size;
 	/*
@@ -4116,8 +4133,7 @@ static int e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 			pull_size = min((unsigned int)4, skb->data_len);
 			if (!__pskb_pull_tail(skb, pull_size)) {
 				e_err("__pskb_pull_tail failed.\n");
-				dev_kfree_skb_any(skb);
-				return NETDEV_TX_OK;
+				goto drop;
 			}
 			len = skb->len - skb->data_len;
 		}
@@ -4147,6 +4163,8 @@ static int e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	 * head, otherwise try next time
 	 */
 	if (e1000_maybe_stop_tx(netdev, count + 2)) {
+		/* flush what earlier packets of this batch left behind */
+		e1000_tx_doorbell(adapter);
 		spin_unlock_irqrestore(&adapter->tx_queue_lock, irq_flags);
 		return NETDEV_TX_BUSY;
 	}
@@ -4161,6 +4179,8 @@ static int e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	tso = e1000_tso(adapter, skb);
 	if (tso < 0) {
 		dev_kfree_skb_any(skb);
+		if (!more)
+			e1000_tx_doorbell(adapter);
 		spin_unlock_irqrestore(&adapter->tx_queue_lock, irq_flags);
 		return NETDEV_TX_OK;
 	}
@@ -4182,6 +4202,8 @@ static int e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	if (count < 0) {
 		/* handle pci_map_single() error in e1000_tx_map */
 		dev_kfree_skb_any(skb);
+		if (!more)
+			e1000_tx_doorbell(adapter);
 		spin_unlock_irqrestore(&adapter->tx_queue_lock, irq_flags);
 		return NETDEV_TX_OK;
 	}
@@ -4193,8 +4215,24 @@ static int e1000_xmit_frame(struct sk_buff *skb, struct net_device *netdev)
 	/* Make sure there is space in the ring for the next send. */
 	e1000_maybe_stop_tx(netdev, MAX_SKB_FRAGS + 2);
 
+	/*
+	 * The rest of the batch will not come if the queue is stopped, so
+	 * the doorbell cannot wait for it.
+	 */
+	if (!more || netif_queue_stopped(netdev))
+		e1000_tx_doorbell(adapter);
+
 	spin_unlock_irqrestore(&adapter->tx_queue_lock, irq_flags);
 	return NETDEV_TX_OK;
+
+drop:
+	dev_kfree_skb_any(skb);
+	if (!more) {
+		spin_lock_irqsave(&adapter->tx_queue_lock, irq_flags);
+		e1000_tx_doorbell(adapter);
+		spin_unlock_irqrestore(&adapter->tx_queue_lock, irq_flags);
+	}
+	return NETDEV_TX_OK;
 }
 
 /**
@@ -63,6 +63,9 @@ struct virtnet_info
 	/* Host will merge rx buffers for big packets (shake it! shake it!) */
 	bool mergeable_rx_bufs;
 
+	/* Buffers went back on the ring without a kick yet. */
+	bool rx_reposted;
+
 	/* Receive & send queues. */
 	struct sk_buff_head recv;
 	struct sk_buff_head send;
@@ -118,6 +121,76 @@ static void skb_xmit_done(struct virtqueue *svq)
 	tasklet_schedule(&vi->tasklet);
 }
 
+/* Put a receive buffer the stack never saw back on the ring, as it was. */
+static void repost_recv_skb(struct virtnet_info *vi, struct sk_buff *skb)
+{
+	struct scatterlist sg[2+MAX_SKB_FRAGS];
+	int num, err;
+
+	if (vi->mergeable_rx_bufs) {
+		sg_init_one(sg, page_address(skb_shinfo(skb)->frags[0].page),
+			    PAGE_SIZE);
+		num = 1;
+	} else {
+		sg_init_table(sg, 2+MAX_SKB_FRAGS);
+		sg_init_one(sg, skb_vnet_hdr(skb),
+			    sizeof(struct virtio_net_hdr));
+		num = skb_to_sgvec(skb, sg+1, 0, skb->len) + 1;
+	}
+
+	skb_queue_head(&vi->recv, skb);
+	err = vi->rvq->vq_ops->add_buf(vi->rvq, sg, 0, num, skb);
+	if (err) {
+		skb_unlink(skb, &vi->recv);
+		trim_pages(vi, skb);
+		kfree_skb(skb);
+		return;
+	}
+	vi->num++;
+	vi->rx_reposted = true;
+}
+
+/*
+ * Run the device RX filter on a frame that arrived in a single buffer.
+ * Returns 1 if the filter consumed it; the buffer is then reposted.
+ * Frames spread over several buffers, and GSO ones, go to the stack.
+ */
+static int receive_filter(struct net_device *dev, struct sk_buff *skb,
+			  unsigned len)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+	struct virtio_net_hdr *hdr;
+	void *data;
+
+	if (vi->mergeable_rx_bufs) {
+		struct virtio_net_hdr_mrg_rxbuf *mhdr;
+
+		mhdr = page_address(skb_shinfo(skb)->frags[0].page);
+		if (mhdr->num_buffers != 1 || len > PAGE_SIZE)
+			return 0;
+		hdr = &mhdr->hdr;
+		data = mhdr + 1;
+		len -= sizeof(*mhdr);
+	} else {
+		hdr = skb_vnet_hdr(skb);
+		len -= sizeof(*hdr);
+		if (len > MAX_PACKET_LEN)
+			return 0;
+		data = skb->data;
+	}
+
+	if (hdr->gso_type != VIRTIO_NET_HDR_GSO_NONE)
+		return 0;
+
+	if (!netif_rx_filter(dev, data, len))
+		return 0;
+
+	dev->stats.rx_bytes += len;
+	dev->stats.rx_packets++;
+	repost_recv_skb(vi, skb);
+	return 1;
+}
+
 static void receive_skb(struct net_device *dev, struct sk_buff *skb,
 			unsigned len)
 {
@@ -132,6 +205,9 @@ static void receive_skb(struct net_device *dev, struct sk_buff *skb,
 		goto drop;
 	}
 
+	if (dev->rx_filter && receive_filter(dev, skb, len))
+		return;
+
 	if (vi->mergeable_rx_bufs) {
 		struct virtio_net_hdr_mrg_rxbuf *mhdr = skb_vnet_hdr(skb);
 		unsigned int copy;
@@ -400,6 +476,9 @@ again:
 	 * to start a timer trying to fill more. */
 	if (vi->num < vi->max / 2)
 		try_fill_recv(vi);
+	else if (vi->rx_reposted)
+		vi->rvq->vq_ops->kick(vi->rvq);
+	vi->rx_reposted = false;
 
 	/* Out of packets? */
 	if (received < budget) {
@@ -518,6 +597,7 @@ static void xmit_tasklet(unsigned long data)
 static int start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	bool more = skb && skb->xmit_more;
 
 again:
 	/* Free up any pending old buffers before queueing new ones. */
@@ -540,7 +620,9 @@ again:
 		}
 	}
 done:
-	vi->svq->vq_ops->kick(vi->svq);
+	/* Notify the host once per batch, unless the batch is cut short. */
+	if (!more || netif_queue_stopped(dev))
+		vi->svq->vq_ops->kick(vi->svq);
 	return NETDEV_TX_OK;
 
 stop_queue:
@@ -548,8 +630,9 @@ stop_queue:
 	netif_stop_queue(dev);
 
 	/* Activate callback for using skbs: if this returns false it
-	 * means some were used in the meantime. */
-	if (unlikely(!vi->svq->vq_ops->enable_cb(vi->svq))) {
+	 * means some were used in the meantime.  We don't need an interrupt
+	 * for every skb, only once most of the ring has been consumed. */
+	if (unlikely(!vi->svq->vq_ops->enable_cb_delayed(vi->svq))) {
 		vi->svq->vq_ops->disable_cb(vi->svq);
 		netif_start_queue(dev);
 		goto again;
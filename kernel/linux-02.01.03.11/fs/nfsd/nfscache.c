@@ -16,57 +16,154 @@
 #include <linux/string.h>
 #include <linux/spinlock.h>
 #include <linux/list.h>
+#include <linux/highmem.h>
+#include <linux/swap.h>
+#include <linux/log2.h>
+#include <linux/seq_file.h>
+#include <net/checksum.h>
 
 #include <linux/sunrpc/svc.h>
 #include <linux/nfsd/nfsd.h>
 #include <linux/nfsd/cache.h>
 
-/* Size of reply cache. Common values are:
+#define NFSDDBG_FACILITY	NFSDDBG_REPCACHE
+
+/*
+ * The cache is split into buckets by xid, each with its own lock and its
+ * own LRU list, so that nfsd threads working on different requests do not
+ * serialize on a single lock.  Entries are allocated as requests come in,
+ * up to a limit derived from the amount of memory.  For reference, the
+ * old fixed sizes were:
  * 4.3BSD:	128
  * 4.4BSD:	256
  * Solaris2:	1024
  * DEC Unix:	512-4096
  */
-#define CACHESIZE		1024
-#define HASHSIZE		64
-#define REQHASH(xid)		(((((__force __u32)xid) >> 24) ^ ((__force __u32)xid)) & (HASHSIZE-1))
+#define RC_MINSIZE		1024
+#define RC_MAXSIZE		(256 * 1024)
+
+/* Average number of entries per bucket the table is sized for */
+#define RC_BUCKETDEPTH		8
+
+/* Entries are kept for at most this long */
+#define RC_EXPIRE		(120 * HZ)
+
+/* Bytes of the call arguments checksummed to tell apart calls that share an xid */
+#define RC_CSUMLEN		256U
+
+struct nfsd_drc_bucket {
+	struct list_head	lru_head;
+	spinlock_t		cache_lock;
+};
+
+static struct kmem_cache	*drc_slab;
+static struct nfsd_drc_bucket	*drc_hashtbl;
+static unsigned int		drc_hashmask;
+static unsigned int		max_drc_entries;
+static atomic_t			num_drc_entries;
 
-static struct hlist_head *	hash_list;
-static struct list_head 	lru_head;
-static int			cache_disabled = 1;
+/* Statistics, see /proc/fs/nfsd/reply_cache_stats */
+static atomic_t			drc_mem_usage;
+static atomic_t			payload_misses;
+static atomic_t			drc_evictions;
+static unsigned int		longest_chain;
+static unsigned int		longest_chain_cachesize;
 
 static int	nfsd_cache_append(struct svc_rqst *rqstp, struct kvec *vec);
+static int	nfsd_reply_cache_shrink(int nr_to_scan, gfp_t gfp_mask);
 
-/* 
+static struct shrinker nfsd_reply_cache_shrinker = {
+	.shrink	= nfsd_reply_cache_shrink,
+	.seeks	= 1,
+};
+
+/*
  * locking for the reply cache:
  * A cache entry is "single use" if c_state == RC_INPROG
- * Otherwise, it when accessing _prev or _next, the lock must be held.
+ * Otherwise, when accessing c_lru, the lock of the entry's bucket
+ * must be held.
  */
-static DEFINE_SPINLOCK(cache_lock);
 
-int nfsd_reply_cache_init(void)
+/*
+ * Size the cache to the square root of low memory: 16k entries per GB of
+ * RAM for small machines, growing more slowly beyond that, and capped.
+ */
+static unsigned int
+nfsd_cache_size_limit(void)
+{
+	unsigned long limit;
+
+	limit = (16 * int_sqrt(nr_free_buffer_pages())) << (PAGE_SHIFT - 10);
+	return clamp_t(unsigned long, limit, RC_MINSIZE, RC_MAXSIZE);
+}
+
+static inline struct nfsd_drc_bucket *
+nfsd_cache_bucket_find(__be32 xid)
+{
+	u32 h = (__force u32)xid;
+
+	return &drc_hashtbl[((h >> 24) ^ (h >> 12) ^ h) & drc_hashmask];
+}
+
+static struct svc_cacherep *
+nfsd_reply_cache_alloc(void)
 {
 	struct svc_cacherep	*rp;
-	int			i;
-
-	INIT_LIST_HEAD(&lru_head);
-	i = CACHESIZE;
-	while (i) {
-		rp = kmalloc(sizeof(*rp), GFP_KERNEL);
-		if (!rp)
-			goto out_nomem;
-		list_add(&rp->c_lru, &lru_head);
+
+	rp = kmem_cache_alloc(drc_slab, GFP_KERNEL);
+	if (rp) {
 		rp->c_state = RC_UNUSED;
 		rp->c_type = RC_NOCACHE;
-		INIT_HLIST_NODE(&rp->c_hash);
-		i--;
+		INIT_LIST_HEAD(&rp->c_lru);
 	}
+	return rp;
+}
+
+static void
+nfsd_reply_cache_free_locked(struct svc_cacherep *rp)
+{
+	if (rp->c_type == RC_REPLBUFF && rp->c_replvec.iov_base) {
+		atomic_sub(rp->c_replvec.iov_len, &drc_mem_usage);
+		kfree(rp->c_replvec.iov_base);
+	}
+	list_del(&rp->c_lru);
+	atomic_dec(&num_drc_entries);
+	atomic_sub(sizeof(*rp), &drc_mem_usage);
+	kmem_cache_free(drc_slab, rp);
+}
 
-	hash_list = kcalloc (HASHSIZE, sizeof(struct hlist_head), GFP_KERNEL);
-	if (!hash_list)
+static void
+nfsd_reply_cache_free(struct nfsd_drc_bucket *b, struct svc_cacherep *rp)
+{
+	spin_lock(&b->cache_lock);
+	nfsd_reply_cache_free_locked(rp);
+	spin_unlock(&b->cache_lock);
+}
+
+int nfsd_reply_cache_init(void)
+{
+	unsigned int		hashsize;
+	unsigned int		i;
+
+	max_drc_entries = nfsd_cache_size_limit();
+	atomic_set(&num_drc_entries, 0);
+	hashsize = roundup_pow_of_two(max_drc_entries / RC_BUCKETDEPTH);
+
+	drc_slab = kmem_cache_create("nfsd_drc", sizeof(struct svc_cacherep),
+					0, 0, NULL);
+	if (!drc_slab)
+		goto out_nomem;
+
+	drc_hashtbl = kcalloc(hashsize, sizeof(*drc_hashtbl), GFP_KERNEL);
+	if (!drc_hashtbl)
 		goto out_nomem;
+	for (i = 0; i < hashsize; i++) {
+		INIT_LIST_HEAD(&drc_hashtbl[i].lru_head);
+		spin_lock_init(&drc_hashtbl[i].cache_lock);
+	}
+	drc_hashmask = hashsize - 1;
 
-	cache_disabled = 0;
+	register_shrinker(&nfsd_reply_cache_shrinker);
 	return 0;
 out_nomem:
 	printk(KERN_ERR "nfsd: failed to allocate reply cache\n");
@@ -77,132 +174,238 @@ out_nomem:
 void nfsd_reply_cache_shutdown(void)
 {
 	struct svc_cacherep	*rp;
-
-	while (!list_empty(&lru_head)) {
-		rp = list_entry(lru_head.next, struct svc_cacherep, c_lru);
-		if (rp->c_state == RC_DONE && rp->c_type == RC_REPLBUFF)
-			kfree(rp->c_replvec.iov_base);
-		list_del(&rp->c_lru);
-		kfree(rp);
+	unsigned int		i;
+
+	if (drc_hashtbl) {
+		unregister_shrinker(&nfsd_reply_cache_shrinker);
+		for (i = 0; i <= drc_hashmask; i++) {
+			struct list_head *head = &drc_hashtbl[i].lru_head;
+
+			while (!list_empty(head)) {
+				rp = list_first_entry(head, struct svc_cacherep,
+						      c_lru);
+				nfsd_reply_cache_free_locked(rp);
+			}
+		}
 	}
 
-	cache_disabled = 1;
+	kfree(drc_hashtbl);
+	drc_hashtbl = NULL;
+	drc_hashmask = 0;
 
-	kfree (hash_list);
-	hash_list = NULL;
+	if (drc_slab) {
+		kmem_cache_destroy(drc_slab);
+		drc_slab = NULL;
+	}
 }
 
 /*
- * Move cache entry to end of LRU list
+ * Move cache entry to end of LRU list, and note when it was last used
  */
 static void
-lru_put_end(struct svc_cacherep *rp)
+lru_put_end(struct nfsd_drc_bucket *b, struct svc_cacherep *rp)
 {
-	list_move_tail(&rp->c_lru, &lru_head);
+	rp->c_timestamp = jiffies;
+	list_move_tail(&rp->c_lru, &b->lru_head);
 }
 
 /*
- * Move a cache entry from one hash list to another
+ * Walk the bucket's LRU list from the oldest end and free entries that
+ * have expired, or all completed ones while the cache is over its limit.
+ * Entries in progress are skipped.  Returns the number of entries freed.
  */
-static void
-hash_refile(struct svc_cacherep *rp)
+static int
+prune_bucket(struct nfsd_drc_bucket *b)
+{
+	struct svc_cacherep	*rp, *tmp;
+	int			freed = 0;
+
+	list_for_each_entry_safe(rp, tmp, &b->lru_head, c_lru) {
+		if (rp->c_state == RC_INPROG)
+			continue;
+		if (atomic_read(&num_drc_entries) <= max_drc_entries &&
+		    time_before(jiffies, rp->c_timestamp + RC_EXPIRE))
+			break;
+		nfsd_reply_cache_free_locked(rp);
+		freed++;
+	}
+	return freed;
+}
+
+static int
+nfsd_reply_cache_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	unsigned int i;
+	int freed = 0;
+
+	if (nr_to_scan && drc_hashtbl) {
+		for (i = 0; i <= drc_hashmask; i++) {
+			struct nfsd_drc_bucket *b = &drc_hashtbl[i];
+
+			if (list_empty(&b->lru_head))
+				continue;
+			spin_lock(&b->cache_lock);
+			freed += prune_bucket(b);
+			spin_unlock(&b->cache_lock);
+		}
+		atomic_add(freed, &drc_evictions);
+	}
+	return atomic_read(&num_drc_entries);
+}
+
+/*
+ * Checksum the first RC_CSUMLEN bytes of the call arguments, which may
+ * run from the head kvec into the page array.
+ */
+static __wsum
+nfsd_cache_csum(struct svc_rqst *rqstp)
+{
+	struct xdr_buf	*buf = &rqstp->rq_arg;
+	const unsigned char *p = buf->head[0].iov_base;
+	size_t		csum_len = min_t(size_t, buf->head[0].iov_len +
+						 buf->page_len, RC_CSUMLEN);
+	size_t		len = min(buf->head[0].iov_len, csum_len);
+	unsigned int	base, idx;
+	__wsum		csum;
+
+	csum = csum_partial(p, len, 0);
+	csum_len -= len;
+
+	idx = buf->page_base >> PAGE_SHIFT;
+	base = buf->page_base & ~PAGE_MASK;
+	while (csum_len) {
+		p = page_address(buf->pages[idx]) + base;
+		len = min_t(size_t, PAGE_SIZE - base, csum_len);
+		csum = csum_partial(p, len, csum);
+		csum_len -= len;
+		base = 0;
+		idx++;
+	}
+	return csum;
+}
+
+static int
+nfsd_cache_match(struct svc_rqst *rqstp, __wsum csum, struct svc_cacherep *rp)
+{
+	/* Check RPC XID first */
+	if (rqstp->rq_xid != rp->c_xid)
+		return 0;
+	if (rqstp->rq_proc != rp->c_proc ||
+	    rqstp->rq_prot != rp->c_prot ||
+	    rqstp->rq_vers != rp->c_vers ||
+	    memcmp(&rqstp->rq_addr, &rp->c_addr, sizeof(rp->c_addr)))
+		return 0;
+
+	/* Same xid from the same client, but not the same call */
+	if (rqstp->rq_arg.len != rp->c_len || csum != rp->c_csum) {
+		atomic_inc(&payload_misses);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Search a bucket for a matching entry.  Must be called with the bucket's
+ * cache_lock held.
+ */
+static struct svc_cacherep *
+nfsd_cache_search(struct nfsd_drc_bucket *b, struct svc_rqst *rqstp,
+		  __wsum csum)
 {
-	hlist_del_init(&rp->c_hash);
-	hlist_add_head(&rp->c_hash, hash_list + REQHASH(rp->c_xid));
+	struct svc_cacherep	*rp, *ret = NULL;
+	unsigned int		entries = 0;
+
+	list_for_each_entry(rp, &b->lru_head, c_lru) {
+		entries++;
+		if (nfsd_cache_match(rqstp, csum, rp)) {
+			ret = rp;
+			break;
+		}
+	}
+
+	/* tally hash chain length stats */
+	if (entries > longest_chain) {
+		longest_chain = entries;
+		longest_chain_cachesize = atomic_read(&num_drc_entries);
+	} else if (entries == longest_chain) {
+		/* prefer the lowest cachesize for this chain length */
+		longest_chain_cachesize = min_t(unsigned int,
+				longest_chain_cachesize,
+				atomic_read(&num_drc_entries));
+	}
+	return ret;
 }
 
 /*
  * Try to find an entry matching the current call in the cache. When none
- * is found, we grab the oldest unlocked entry off the LRU list.
- * Note that no operation within the loop may sleep.
+ * is found, a new entry is inserted for it.  Since that is the common case,
+ * the entry is allocated before taking the bucket lock, and freed again
+ * on a hit.
+ * Note that no operation within the locked section may sleep.
  */
 int
 nfsd_cache_lookup(struct svc_rqst *rqstp, int type)
 {
-	struct hlist_node	*hn;
-	struct hlist_head 	*rh;
-	struct svc_cacherep	*rp;
+	struct nfsd_drc_bucket	*b;
+	struct svc_cacherep	*rp, *found;
 	__be32			xid = rqstp->rq_xid;
-	u32			proto =  rqstp->rq_prot,
-				vers = rqstp->rq_vers,
-				proc = rqstp->rq_proc;
 	unsigned long		age;
-	int rtn;
+	__wsum			csum;
+	int			rtn = RC_DOIT;
 
 	rqstp->rq_cacherep = NULL;
-	if (cache_disabled || type == RC_NOCACHE) {
+	if (!drc_hashtbl || type == RC_NOCACHE) {
 		nfsdstats.rcnocache++;
-		return RC_DOIT;
+		return rtn;
 	}
 
-	spin_lock(&cache_lock);
-	rtn = RC_DOIT;
+	csum = nfsd_cache_csum(rqstp);
+	b = nfsd_cache_bucket_find(xid);
 
-	rh = &hash_list[REQHASH(xid)];
-	hlist_for_each_entry(rp, hn, rh, c_hash) {
-		if (rp->c_state != RC_UNUSED &&
-		    xid == rp->c_xid && proc == rp->c_proc &&
-		    proto == rp->c_prot && vers == rp->c_vers &&
-		    time_before(jiffies, rp->c_timestamp + 120*HZ) &&
-		    memcmp((char*)&rqstp->rq_addr, (char*)&rp->c_addr, sizeof(rp->c_addr))==0) {
-			nfsdstats.rchits++;
-			goto found_entry;
-		}
+	rp = nfsd_reply_cache_alloc();
+	spin_lock(&b->cache_lock);
+	if (likely(rp)) {
+		atomic_inc(&num_drc_entries);
+		atomic_add(sizeof(*rp), &drc_mem_usage);
 	}
-	nfsdstats.rcmisses++;
 
-	/* This loop shouldn't take more than a few iterations normally */
-	{
-	int	safe = 0;
-	list_for_each_entry(rp, &lru_head, c_lru) {
-		if (rp->c_state != RC_INPROG)
-			break;
-		if (safe++ > CACHESIZE) {
-			printk("nfsd: loop in repcache LRU list\n");
-			cache_disabled = 1;
-			goto out;
-		}
-	}
-	}
+	/* go ahead and prune the cache */
+	atomic_add(prune_bucket(b), &drc_evictions);
 
-	/* This should not happen */
-	if (rp == NULL) {
-		static int	complaints;
+	found = nfsd_cache_search(b, rqstp, csum);
+	if (found) {
+		if (likely(rp))
+			nfsd_reply_cache_free_locked(rp);
+		rp = found;
+		goto found_entry;
+	}
 
-		printk(KERN_WARNING "nfsd: all repcache entries locked!\n");
-		if (++complaints > 5) {
-			printk(KERN_WARNING "nfsd: disabling repcache.\n");
-			cache_disabled = 1;
-		}
+	if (!rp) {
+		dprintk("nfsd: unable to allocate DRC entry!\n");
 		goto out;
 	}
 
+	nfsdstats.rcmisses++;
 	rqstp->rq_cacherep = rp;
 	rp->c_state = RC_INPROG;
 	rp->c_xid = xid;
-	rp->c_proc = proc;
+	rp->c_proc = rqstp->rq_proc;
 	memcpy(&rp->c_addr, svc_addr_in(rqstp), sizeof(rp->c_addr));
-	rp->c_prot = proto;
-	rp->c_vers = vers;
-	rp->c_timestamp = jiffies;
-
-	hash_refile(rp);
+	rp->c_prot = rqstp->rq_prot;
+	rp->c_vers = rqstp->rq_vers;
+	rp->c_len = rqstp->rq_arg.len;
+	rp->c_csum = csum;
 
-	/* release any buffer */
-	if (rp->c_type == RC_REPLBUFF) {
-		kfree(rp->c_replvec.iov_base);
-		rp->c_replvec.iov_base = NULL;
-	}
-	rp->c_type = RC_NOCACHE;
+	lru_put_end(b, rp);
  out:
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
 	return rtn;
 
 found_entry:
+	nfsdstats.rchits++;
 	/* We found a matching entry which is either in progress or done. */
 	age = jiffies - rp->c_timestamp;
-	rp->c_timestamp = jiffies;
-	lru_put_end(rp);
+	lru_put_end(b, rp);
 
 	rtn = RC_DROPIT;
 	/* Request being processed or excessive rexmits */
@@ -230,7 +433,7 @@ found_entry:
 		break;
 	default:
 		printk(KERN_WARNING "nfsd: bad repcache type %d\n", rp->c_type);
-		rp->c_state = RC_UNUSED;
+		nfsd_reply_cache_free_locked(rp);
 	}
 
 	goto out;
@@ -255,19 +458,22 @@ found_entry:
 void
 nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, __be32 *statp)
 {
-	struct svc_cacherep *rp;
+	struct svc_cacherep *rp = rqstp->rq_cacherep;
 	struct kvec	*resv = &rqstp->rq_res.head[0], *cachv;
+	struct nfsd_drc_bucket *b;
 	int		len;
 
-	if (!(rp = rqstp->rq_cacherep) || cache_disabled)
+	if (!rp)
 		return;
 
+	b = nfsd_cache_bucket_find(rp->c_xid);
+
 	len = resv->iov_len - ((char*)statp - (char*)resv->iov_base);
 	len >>= 2;
-	
+
 	/* Don't cache excessive amounts of data and XDR failures */
 	if (!statp || len > (256 >> 2)) {
-		rp->c_state = RC_UNUSED;
+		nfsd_reply_cache_free(b, rp);
 		return;
 	}
 
@@ -281,22 +487,23 @@ nfsd_cache_update(struct svc_rqst *rqstp, int cachetype, __be32 *statp)
 		cachv = &rp->c_replvec;
 		cachv->iov_base = kmalloc(len << 2, GFP_KERNEL);
 		if (!cachv->iov_base) {
-			spin_lock(&cache_lock);
-			rp->c_state = RC_UNUSED;
-			spin_unlock(&cache_lock);
+			nfsd_reply_cache_free(b, rp);
 			return;
 		}
 		cachv->iov_len = len << 2;
 		memcpy(cachv->iov_base, statp, len << 2);
+		atomic_add(cachv->iov_len, &drc_mem_usage);
 		break;
+	case RC_NOCACHE:
+		nfsd_reply_cache_free(b, rp);
+		return;
 	}
-	spin_lock(&cache_lock);
-	lru_put_end(rp);
+	spin_lock(&b->cache_lock);
+	lru_put_end(b, rp);
 	rp->c_secure = rqstp->rq_secure;
 	rp->c_type = cachetype;
 	rp->c_state = RC_DONE;
-	rp->c_timestamp = jiffies;
-	spin_unlock(&cache_lock);
+	spin_unlock(&b->cache_lock);
 	return;
 }
 
@@ -319,3 +526,34 @@ nfsd_cache_append(struct svc_rqst *rqstp, struct kvec *data)
 	vec->iov_len += data->iov_len;
 	return 1;
 }
+
+/*
+ * Show the reply cache statistics in /proc/fs/nfsd/reply_cache_stats.
+ * The hit, miss and nocache counts are the ones also reported in the
+ * "rc" line of /proc/net/rpc/nfsd.
+ */
+static int nfsd_reply_cache_stats_show(struct seq_file *m, void *v)
+{
+	seq_printf(m, "max entries:           %u\n", max_drc_entries);
+	seq_printf(m, "num entries:           %u\n",
+			atomic_read(&num_drc_entries));
+	seq_printf(m, "hash buckets:          %u\n",
+			drc_hashtbl ? drc_hashmask + 1 : 0);
+	seq_printf(m, "mem usage:             %u\n",
+			atomic_read(&drc_mem_usage));
+	seq_printf(m, "cache hits:            %u\n", nfsdstats.rchits);
+	seq_printf(m, "cache misses:          %u\n", nfsdstats.rcmisses);
+	seq_printf(m, "not cached:            %u\n", nfsdstats.rcnocache);
+	seq_printf(m, "payload misses:        %u\n",
+			atomic_read(&payload_misses));
+	seq_printf(m, "evictions:             %u\n",
+			atomic_read(&drc_evictions));
+	seq_printf(m, "longest chain len:     %u\n", longest_chain);
+	seq_printf(m, "cachesize at longest:  %u\n", longest_chain_cachesize);
+	return 0;
+}
+
+int nfsd_reply_cache_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nfsd_reply_cache_stats_show, NULL);
+}
@@ -60,9 +60,13 @@ enum {
 	NFSD_FO_UnlockFS,
 	NFSD_Threads,
 	NFSD_Pool_Threads,
+	NFSD_Pool_Threads_Min,
+	NFSD_Pool_Threads_Max,
+	NFSD_Pool_Stats,
 	NFSD_Versions,
 	NFSD_Ports,
 	NFSD_MaxBlkSize,
+	NFSD_Reply_Cache_Stats,
 	/*
 	 * The below MUST come last.  Otherwise we leave a hole in nfsd_files[]
 	 * with !CONFIG_NFSD_V4 and simple_fill_super() goes oops
@@ -88,6 +92,8 @@ static ssize_t write_unlock_ip(struct file *file, char *buf, size_t size);
 static ssize_t write_unlock_fs(struct file *file, char *buf, size_t size);
 static ssize_t write_threads(struct file *file, char *buf, size_t size);
 static ssize_t write_pool_threads(struct file *file, char *buf, size_t size);
+static ssize_t write_pool_threads_min(struct file *file, char *buf, size_t size);
+static ssize_t write_pool_threads_max(struct file *file, char *buf, size_t size);
 static ssize_t write_versions(struct file *file, char *buf, size_t size);
 static ssize_t write_ports(struct file *file, char *buf, size_t size);
 static ssize_t write_maxblksize(struct file *file, char *buf, size_t size);
@@ -109,6 +115,8 @@ static ssize_t (*write_op[])(struct file *, char *, size_t) = {
 	[NFSD_FO_UnlockFS] = write_unlock_fs,
 	[NFSD_Threads] = write_threads,
 	[NFSD_Pool_Threads] = write_pool_threads,
+	[NFSD_Pool_Threads_Min] = write_pool_threads_min,
+	[NFSD_Pool_Threads_Max] = write_pool_threads_max,
 	[NFSD_Versions] = write_versions,
 	[NFSD_Ports] = write_ports,
 	[NFSD_MaxBlkSize] = write_maxblksize,
@@ -172,6 +180,22 @@ static const struct file_operations exports_operations = {
 	.owner		= THIS_MODULE,
 };
 
+static const struct file_operations pool_stats_operations = {
+	.open		= nfsd_pool_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= nfsd_pool_stats_release,
+	.owner		= THIS_MODULE,
+};
+
+static const struct file_operations reply_cache_stats_operations = {
+	.open		= nfsd_reply_cache_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+	.owner		= THIS_MODULE,
+};
+
 /*----------------------------------------------------------------------------*/
 /*
  * payload - write methods
@@ -837,6 +861,131 @@ static ssize_t __write_versions(struct file *file, char *buf, size_t size)
 	return len;
 }
 
+static ssize_t __write_pool_threads_limit(char *buf, size_t size, int setmax)
+{
+	char *mesg = buf;
+	int i;
+	int rv;
+	int len;
+	int npools;
+	int *min, *max, *limit;
+
+	mutex_lock(&nfsd_mutex);
+	npools = nfsd_nrpools();
+	if (npools == 0) {
+		/* NFS is shut down: there are no pools to size */
+		mutex_unlock(&nfsd_mutex);
+		strcpy(buf, "0\n");
+		return strlen(buf);
+	}
+
+	rv = -ENOMEM;
+	min = kcalloc(npools, sizeof(int), GFP_KERNEL);
+	max = kcalloc(npools, sizeof(int), GFP_KERNEL);
+	if (min == NULL || max == NULL)
+		goto out_free;
+
+	rv = nfsd_get_pool_limits(npools, min, max);
+	if (rv)
+		goto out_free;
+	limit = setmax ? max : min;
+
+	if (size > 0) {
+		for (i = 0; i < npools; i++) {
+			rv = get_int(&mesg, &limit[i]);
+			if (rv == -ENOENT)
+				break;		/* fewer numbers than pools */
+			if (rv)
+				goto out_free;	/* syntax error */
+			rv = -EINVAL;
+			if (limit[i] < 0)
+				goto out_free;
+		}
+		rv = nfsd_set_pool_limits(i, min, max);
+		if (rv)
+			goto out_free;
+		rv = nfsd_get_pool_limits(npools, min, max);
+		if (rv)
+			goto out_free;
+	}
+
+	mesg = buf;
+	size = SIMPLE_TRANSACTION_LIMIT;
+	for (i = 0; i < npools && size > 0; i++) {
+		snprintf(mesg, size, "%d%c", limit[i], (i == npools-1 ? '\n' : ' '));
+		len = strlen(mesg);
+		size -= len;
+		mesg += len;
+	}
+	rv = mesg - buf;
+
+out_free:
+	kfree(min);
+	kfree(max);
+	mutex_unlock(&nfsd_mutex);
+	return rv;
+}
+
+/**
+ * write_pool_threads_min - Set or report the minimum threads per dynamic pool
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ *
+ * OR
+ *
+ * Input:
+ * 			buf:		C string containing whitespace-
+ * 					separated unsigned integer values
+ *					representing the least number of
+ *					NFSD threads to keep in each pool
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated C
+ *			string containing the minimum of each pool;
+ *			return code is the size in bytes of the string
+ *	On error:	return code is zero or a negative errno value
+ *
+ * Only pools made dynamic through pool_threads_max use the minimum,
+ * which is at least one.
+ */
+static ssize_t write_pool_threads_min(struct file *file, char *buf, size_t size)
+{
+	return __write_pool_threads_limit(buf, size, 0);
+}
+
+/**
+ * write_pool_threads_max - Set or report the maximum threads per dynamic pool
+ *
+ * Input:
+ *			buf:		ignored
+ *			size:		zero
+ *
+ * OR
+ *
+ * Input:
+ * 			buf:		C string containing whitespace-
+ * 					separated unsigned integer values
+ *					representing the most NFSD threads
+ *					each pool may grow to
+ *			size:		non-zero length of C string in @buf
+ * Output:
+ *	On success:	passed-in buffer filled with '\n'-terminated C
+ *			string containing the maximum of each pool;
+ *			return code is the size in bytes of the string
+ *	On error:	return code is zero or a negative errno value
+ *
+ * A non-zero maximum makes a pool dynamic: it gains threads while
+ * requests queue for longer than sunrpc.spawn_delay_ms, and loses those
+ * idle for sunrpc.thread_idle_timeout seconds, staying between its
+ * minimum and maximum.  Zero fixes the pool at its current size.
+ */
+static ssize_t write_pool_threads_max(struct file *file, char *buf, size_t size)
+{
+	return __write_pool_threads_limit(buf, size, 1);
+}
+
 /**
  * write_versions - Set or report the available NFS protocol versions
  *
@@ -1246,9 +1395,13 @@ static int nfsd_fill_super(struct super_block * sb, void * data, int silent)
 		[NFSD_Fh] = {"filehandle", &transaction_ops, S_IWUSR|S_IRUSR},
 		[NFSD_Threads] = {"threads", &transaction_ops, S_IWUSR|S_IRUSR},
 		[NFSD_Pool_Threads] = {"pool_threads", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_Pool_Threads_Min] = {"pool_threads_min", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_Pool_Threads_Max] = {"pool_threads_max", &transaction_ops, S_IWUSR|S_IRUSR},
+		[NFSD_Pool_Stats] = {"pool_stats", &pool_stats_operations, S_IRUGO},
 		[NFSD_Versions] = {"versions", &transaction_ops, S_IWUSR|S_IRUSR},
 		[NFSD_Ports] = {"portlist", &transaction_ops, S_IWUSR|S_IRUGO},
 		[NFSD_MaxBlkSize] = {"max_block_size", &transaction_ops, S_IWUSR|S_IRUGO},
+		[NFSD_Reply_Cache_Stats] = {"reply_cache_stats", &reply_cache_stats_operations, S_IRUGO},
 #ifdef CONFIG_NFSD_V4
 		[NFSD_Leasetime] = {"nfsv4leasetime", &transaction_ops, S_IWUSR|S_IRUSR},
 		[NFSD_RecoveryDir] = {"nfsv4recoverydir", &transaction_ops, S_IWUSR|S_IRUSR},
@@ -22,6 +22,7 @@
 #include <linux/freezer.h>
 #include <linux/fs_struct.h>
 #include <linux/kthread.h>
+#include <linux/seq_file.h>
 
 #include <linux/sunrpc/types.h>
 #include <linux/sunrpc/stats.h>
@@ -233,6 +234,8 @@ int nfsd_create_serv(void)
 				      nfsd_last_thread, nfsd, THIS_MODULE);
 	if (nfsd_serv == NULL)
 		err = -ENOMEM;
+	else
+		nfsd_serv->sv_thread_mutex = &nfsd_mutex;
 
 	do_gettimeofday(&nfssvc_boot);		/* record boot time */
 	return err;
@@ -339,6 +342,49 @@ int nfsd_set_nrthreads(int n, int *nthreads)
 	return err;
 }
 
+int nfsd_get_pool_limits(int n, int *min, int *max)
+{
+	int i;
+
+	if (nfsd_serv != NULL) {
+		for (i = 0; i < nfsd_serv->sv_nrpools && i < n; i++) {
+			min[i] = nfsd_serv->sv_pools[i].sp_min_threads;
+			max[i] = nfsd_serv->sv_pools[i].sp_max_threads;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Size the first n pools dynamically, between min[i] and max[i]
+ * threads, or fix their size again where max[i] is zero.
+ */
+int nfsd_set_pool_limits(int n, int *min, int *max)
+{
+	int i;
+	int err = 0;
+
+	WARN_ON(!mutex_is_locked(&nfsd_mutex));
+
+	if (nfsd_serv == NULL || n <= 0)
+		return 0;
+
+	if (n > nfsd_serv->sv_nrpools)
+		n = nfsd_serv->sv_nrpools;
+
+	for (i = 0; i < n; i++) {
+		if (max[i] > NFSD_MAXSERVS)
+			max[i] = NFSD_MAXSERVS;
+		err = svc_set_pool_limits(nfsd_serv, &nfsd_serv->sv_pools[i],
+					  min[i], max[i]);
+		if (err)
+			break;
+	}
+
+	return err;
+}
+
 int
 nfsd_svc(unsigned short port, int nrservs)
 {
@@ -368,6 +414,15 @@ nfsd_svc(unsigned short port, int nrservs)
 	if (error)
 		goto failure;
 
+	/* Shutting down: dynamic pools must not spawn new threads */
+	if (nrservs == 0) {
+		int i;
+
+		for (i = 0; i < nfsd_serv->sv_nrpools; i++)
+			svc_set_pool_limits(nfsd_serv,
+					    &nfsd_serv->sv_pools[i], 0, 0);
+	}
+
 	error = svc_set_num_threads(nfsd_serv, NULL, nrservs);
  failure:
 	svc_destroy(nfsd_serv);		/* Release server */
@@ -574,3 +629,31 @@ nfsd_dispatch(struct svc_rqst *rqstp, __be32 *statp)
 	nfsd_cache_update(rqstp, proc->pc_cachetype, statp + 1);
 	return 1;
 }
+
+int nfsd_pool_stats_open(struct inode *inode, struct file *file)
+{
+	int ret;
+
+	mutex_lock(&nfsd_mutex);
+	if (nfsd_serv == NULL) {
+		mutex_unlock(&nfsd_mutex);
+		return -ENODEV;
+	}
+	/* hold the service while the file is open */
+	svc_get(nfsd_serv);
+	ret = svc_pool_stats_open(nfsd_serv, file);
+	if (ret)
+		svc_destroy(nfsd_serv);
+	mutex_unlock(&nfsd_mutex);
+	return ret;
+}
+
+int nfsd_pool_stats_release(struct inode *inode, struct file *file)
+{
+	int ret = seq_release(inode, file);
+
+	mutex_lock(&nfsd_mutex);
+	svc_destroy(nfsd_serv);
+	mutex_unlock(&nfsd_mutex);
+	return ret;
+}
@@ -127,6 +127,19 @@ struct sock_fprog	/* Required for SO_ATTACH_FILTER. */
 #define SKF_NET_OFF   (-0x100000)
 #define SKF_LL_OFF    (-0x200000)
 
+/*
+ * Return values of a device RX filter (SIOCSIFRXFILTER).  The program
+ * runs on the frame as the driver received it, link layer header at
+ * offset 0.  The action is in the low byte; a redirect has the ifindex
+ * of the device to send the frame out of in the bits above it.
+ */
+#define RXF_DROP		0
+#define RXF_PASS		1	/* receive as usual */
+#define RXF_TX			2	/* send back out of the device */
+#define RXF_REDIRECT		3	/* send out of another device */
+#define RXF_ACTION(ret)		((ret) & 0xff)
+#define RXF_IFINDEX(ret)	((ret) >> 8)
+
 #ifdef __KERNEL__
 struct sk_filter
 {
@@ -143,13 +156,18 @@ static inline unsigned int sk_filter_len(const struct sk_filter *fp)
 
 struct sk_buff;
 struct sock;
+struct net_device;
 
 extern int sk_filter(struct sock *sk, struct sk_buff *skb);
 extern unsigned int sk_run_filter(struct sk_buff *skb,
 				  struct sock_filter *filter, int flen);
+extern unsigned int sk_run_filter_buf(const void *data, unsigned int len,
+				      struct sock_filter *filter, int flen);
 extern int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk);
 extern int sk_detach_filter(struct sock *sk);
 extern int sk_chk_filter(struct sock_filter *filter, int flen);
+extern int dev_set_rx_filter(struct net_device *dev,
+			     struct sock_fprog __user *ufprog);
 #endif /* __KERNEL__ */
 
 #endif /* __LINUX_FILTER_H__ */
@@ -178,6 +178,7 @@ enum {
 struct neighbour;
 struct neigh_parms;
 struct sk_buff;
+struct sk_filter;
 
 struct netif_rx_stats
 {
@@ -760,6 +761,9 @@ struct net_device
 
 	struct netdev_queue	rx_queue;
 
+	/* Run by the driver on every frame, see netif_rx_filter() */
+	struct sk_filter	*rx_filter;
+
 	struct netdev_queue	*_tx ____cacheline_aligned_in_smp;
 
 	/* Number of TX queues allocated at alloc_netdev_mq() time  */
@@ -1372,6 +1376,36 @@ extern int		netif_rx(struct sk_buff *skb);
 extern int		netif_rx_ni(struct sk_buff *skb);
 #define HAVE_NETIF_RECEIVE_SKB 1
 extern int		netif_receive_skb(struct sk_buff *skb);
+extern int		__netif_rx_filter(struct net_device *dev,
+					  struct sk_filter *fp,
+					  const void *data, unsigned int len);
+
+/**
+ *	netif_rx_filter - run the device's RX filter on a received frame
+ *	@dev: receiving device
+ *	@data: the frame in the driver's receive buffer
+ *	@len: length of the frame
+ *
+ *	For drivers, before the frame is turned into an skb.  Returns 0 if
+ *	it is to be received as usual, 1 if the filter dropped it or sent
+ *	a copy out of a device.  The driver can then reuse the buffer.
+ */
+static inline int netif_rx_filter(struct net_device *dev, const void *data,
+				  unsigned int len)
+{
+	struct sk_filter *fp;
+	int ret = 0;
+
+	if (likely(!dev->rx_filter))
+		return 0;
+
+	rcu_read_lock();
+	fp = rcu_dereference(dev->rx_filter);
+	if (fp)
+		ret = __netif_rx_filter(dev, fp, data, len);
+	rcu_read_unlock();
+	return ret;
+}
 extern void		napi_gro_flush(struct napi_struct *napi);
 extern int		dev_gro_receive(struct napi_struct *napi,
 					struct sk_buff *skb);
@@ -1802,6 +1836,7 @@ extern const struct net_device_stats *dev_get_stats(struct net_device *dev);
 
 extern int		netdev_max_backlog;
 extern int		weight_p;
+extern int		netdev_tx_bulk;
 extern int		netdev_set_master(struct net_device *dev, struct net_device *master);
 extern int skb_checksum_help(struct sk_buff *skb);
 extern struct sk_buff *skb_gso_segment(struct sk_buff *skb, int features);
@@ -103,12 +103,51 @@ struct nlmsgerr
 #define NETLINK_ADD_MEMBERSHIP	1
 #define NETLINK_DROP_MEMBERSHIP	2
 #define NETLINK_PKTINFO		3
+#define NETLINK_RX_RING		6
+#define NETLINK_TX_RING		7
 
 struct nl_pktinfo
 {
 	__u32	group;
 };
 
+/*
+ * Memory mapped rings, see Documentation/networking/netlink_mmap.txt.
+ * Every frame starts with a struct nl_mmap_hdr, the message follows
+ * at NL_MMAP_HDRLEN.
+ */
+struct nl_mmap_req
+{
+	unsigned int	nm_block_size;
+	unsigned int	nm_block_nr;
+	unsigned int	nm_frame_size;
+	unsigned int	nm_frame_nr;
+};
+
+struct nl_mmap_hdr
+{
+	unsigned int	nm_status;
+	unsigned int	nm_len;
+	__u32		nm_group;
+	/* credentials */
+	__u32		nm_pid;
+	__u32		nm_uid;
+	__u32		nm_gid;
+};
+
+enum nl_mmap_status {
+	NL_MMAP_STATUS_UNUSED,		/* owned by the kernel */
+	NL_MMAP_STATUS_RESERVED,	/* being filled in by its owner */
+	NL_MMAP_STATUS_VALID,		/* holds a message */
+	NL_MMAP_STATUS_COPY,		/* message too big, use recvmsg() */
+	NL_MMAP_STATUS_SKIP,		/* ignore this frame */
+};
+
+#define NL_MMAP_MSG_ALIGNMENT	NLMSG_ALIGNTO
+#define NL_MMAP_MSG_ALIGN(len)	(((len)+NL_MMAP_MSG_ALIGNMENT-1) & \
+				 ~(NL_MMAP_MSG_ALIGNMENT-1))
+#define NL_MMAP_HDRLEN		NL_MMAP_MSG_ALIGN(sizeof(struct nl_mmap_hdr))
+
 #define NET_MAJOR 36		/* Major 36 is reserved for networking 						*/
 
 enum {
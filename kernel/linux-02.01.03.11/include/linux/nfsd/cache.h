@@ -14,11 +14,10 @@
 #include <linux/uio.h>
 
 /*
- * Representation of a reply cache entry. The first two members *must*
- * be hash_next and hash_prev.
+ * Representation of a reply cache entry. c_lru links the entry into the
+ * LRU list of its hash bucket, which is also what lookups walk.
  */
 struct svc_cacherep {
-	struct hlist_node	c_hash;
 	struct list_head	c_lru;
 
 	unsigned char		c_state,	/* unused, inprog, done */
@@ -29,6 +28,8 @@ struct svc_cacherep {
 	u32			c_prot;
 	u32			c_proc;
 	u32			c_vers;
+	unsigned int		c_len;		/* length of call arguments */
+	__wsum			c_csum;		/* checksum of their head */
 	unsigned long		c_timestamp;
 	union {
 		struct kvec	u_vec;
@@ -71,9 +72,13 @@ enum {
  */
 #define RC_DELAY		(HZ/5)
 
+struct inode;
+struct file;
+
 int	nfsd_reply_cache_init(void);
 void	nfsd_reply_cache_shutdown(void);
 int	nfsd_cache_lookup(struct svc_rqst *, int);
 void	nfsd_cache_update(struct svc_rqst *, int, __be32 *);
+int	nfsd_reply_cache_stats_open(struct inode *, struct file *);
 
 #endif /* NFSCACHE_H */
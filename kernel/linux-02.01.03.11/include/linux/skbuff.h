@@ -28,6 +28,7 @@
 #include <linux/rcupdate.h>
 #include <linux/dmaengine.h>
 #include <linux/hrtimer.h>
+#include <linux/rbtree.h>
 
 #define HAVE_ALLOC_SKB		/* For the drivers to know */
 #define HAVE_ALIGNABLE_SKB	/* Ditto 8)		   */
@@ -204,6 +205,7 @@ typedef unsigned char *sk_buff_data_t;
  *	struct sk_buff - socket buffer
  *	@next: Next buffer in list
  *	@prev: Previous buffer in list
+ *	@rbnode: Node in an index of the list (TCP write queue)
  *	@sk: Socket we are owned by
  *	@tstamp: Time we arrived
  *	@dev: Device we arrived on/are leaving by
@@ -253,6 +255,8 @@ typedef unsigned char *sk_buff_data_t;
  *	@requeue: set to indicate that the wireless core should attempt
  *		a software retry on this frame if we failed to
  *		receive an ACK for it
+ *	@xmit_more: more packets for the same queue follow this one, the
+ *		driver may defer telling the hardware about it
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
@@ -263,6 +267,7 @@ struct sk_buff {
 	/* These two members must be first. */
 	struct sk_buff		*next;
 	struct sk_buff		*prev;
+	struct rb_node		rbnode;
 
 	struct sock		*sk;
 	ktime_t			tstamp;
@@ -331,7 +336,8 @@ struct sk_buff {
 	__u8			do_not_encrypt:1;
 	__u8			requeue:1;
 #endif
-	/* 0/13/14 bit hole */
+	__u8			xmit_more:1;
+	/* 0/12/13 bit hole */
 
 #ifdef CONFIG_NET_DMA
 	dma_cookie_t		dma_cookie;
@@ -1676,6 +1682,7 @@ extern __wsum	       skb_copy_and_csum_bits(const struct sk_buff *skb,
 					      int offset, u8 *to, int len,
 					      __wsum csum);
 extern int             skb_splice_bits(struct sk_buff *skb,
+						struct sock *sk,
 						unsigned int offset,
 						struct pipe_inode_info *pipe,
 						unsigned int len,
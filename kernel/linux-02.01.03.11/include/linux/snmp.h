@@ -219,6 +219,10 @@ enum
 	LINUX_MIB_SACKSHIFTED,
 	LINUX_MIB_SACKMERGED,
 	LINUX_MIB_SACKSHIFTFALLBACK,
+	LINUX_MIB_TCPEARLYRETRANS,		/* TCPEarlyRetrans */
+	LINUX_MIB_TCPLOSSPROBES,		/* TCPLossProbes */
+	LINUX_MIB_TCPLOSSPROBERECOVERY,		/* TCPLossProbeRecovery */
+	LINUX_MIB_TCPRCVCOALESCE,		/* TCPRcvCoalesce */
 	__LINUX_MIB_MAX
 };
 
@@ -298,6 +298,7 @@ struct ucred {
 #define SOL_PPPOL2TP	273
 #define SOL_BLUETOOTH	274
 #define SOL_PNPIPE	275
+#define SOL_TLS		276
 
 /* IPX options */
 #define IPX_TYPE	1
@@ -20,6 +20,19 @@
 
 struct rpc_inode;
 
+/*
+ * A client may spread its tasks over several transports to the same
+ * server (see rpc_create_args.nconnect).  The set is shared with clones.
+ */
+#define RPC_MAX_XPRTS		16
+
+struct rpc_xprt_switch {
+	struct kref		xps_kref;
+	atomic_t		xps_next;	/* where the next search starts */
+	unsigned int		xps_nxprts;
+	struct rpc_xprt *	xps_xprt[0];	/* [0] is the client's cl_xprt */
+};
+
 /*
  * The high-level client handle
  */
@@ -29,6 +42,7 @@ struct rpc_clnt {
 	struct list_head	cl_tasks;	/* List of tasks */
 	spinlock_t		cl_lock;	/* spinlock */
 	struct rpc_xprt *	cl_xprt;	/* transport */
+	struct rpc_xprt_switch *cl_xps;		/* all transports, or NULL */
 	struct rpc_procinfo *	cl_procinfo;	/* procedure info */
 	u32			cl_prog,	/* RPC program number */
 				cl_vers,	/* RPC version number */
@@ -110,6 +124,7 @@ struct rpc_create_args {
 	rpc_authflavor_t	authflavor;
 	unsigned long		flags;
 	char			*client_name;
+	unsigned int		nconnect;	/* stream transports to open */
 };
 
 /* Values for "flags" field */
@@ -124,6 +139,8 @@ struct rpc_clnt *rpc_create(struct rpc_create_args *args);
 struct rpc_clnt	*rpc_bind_new_program(struct rpc_clnt *,
 				struct rpc_program *, u32);
 struct rpc_clnt *rpc_clone_client(struct rpc_clnt *);
+struct rpc_xprt	*rpc_task_get_xprt(struct rpc_clnt *);
+void		rpc_task_put_xprt(struct rpc_xprt *);
 void		rpc_shutdown_client(struct rpc_clnt *);
 void		rpc_release_client(struct rpc_clnt *);
 
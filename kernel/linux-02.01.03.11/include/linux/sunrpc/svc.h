@@ -18,12 +18,25 @@
 #include <linux/sunrpc/svcauth.h>
 #include <linux/wait.h>
 #include <linux/mm.h>
+#include <linux/workqueue.h>
 
 /*
  * This is the RPC server thread function prototype
  */
 typedef int		(*svc_thread_fn)(void *);
 
+/* statistics for svc_pool structures */
+struct svc_pool_stats {
+	unsigned long	packets;	/* transports enqueued with work */
+	unsigned long	sockets_queued;	/* ... which found no idle thread */
+	unsigned long	threads_woken;	/* ... which were handed to one */
+	unsigned long	threads_timedout;
+	unsigned long	threads_spawned;
+	unsigned long	threads_retired;
+	u64		queue_time_us;	/* total time spent queued */
+	unsigned long	queue_time_max_us;
+};
+
 /*
  *
  * RPC service thread pool.
@@ -33,6 +46,11 @@ typedef int		(*svc_thread_fn)(void *);
  * services that can benefit from it (i.e. nfs but not lockd) will
  * have one pool per NUMA node.  This optimisation reduces cross-
  * node traffic on multi-node NUMA NFS servers.
+ *
+ * A pool with a non-zero sp_max_threads is sized dynamically: a
+ * thread is added when a transport has waited too long for an idle
+ * one, and threads that stay idle exit, as long as the pool stays
+ * within sp_min_threads..sp_max_threads.
  */
 struct svc_pool {
 	unsigned int		sp_id;	    	/* pool id; also node id on NUMA */
@@ -41,6 +59,14 @@ struct svc_pool {
 	struct list_head	sp_sockets;	/* pending sockets */
 	unsigned int		sp_nrthreads;	/* # of threads in pool */
 	struct list_head	sp_all_threads;	/* all server threads */
+	struct svc_pool_stats	sp_stats;	/* statistics on pool operation */
+
+	unsigned int		sp_min_threads;	/* dynamic sizing limits; */
+	unsigned int		sp_max_threads;	/* max == 0: fixed size */
+	unsigned long		sp_flags;
+#define	SP_SPAWN_PENDING	0		/* sp_spawn_work is queued */
+	struct delayed_work	sp_spawn_work;	/* adds threads */
+	struct svc_serv *	sp_serv;	/* owning service */
 } ____cacheline_aligned_in_smp;
 
 /*
@@ -84,6 +110,9 @@ struct svc_serv {
 	struct module *		sv_module;	/* optional module to count when
 						 * adding threads */
 	svc_thread_fn		sv_function;	/* main function for threads */
+	struct mutex *		sv_thread_mutex;/* serializes thread count
+						 * changes; needed for
+						 * dynamic pools */
 };
 
 /*
@@ -235,7 +264,8 @@ struct svc_rqst {
 	u32			rq_proc;	/* procedure number */
 	u32			rq_prot;	/* IP protocol */
 	unsigned short
-				rq_secure  : 1;	/* secure port */
+				rq_secure  : 1,	/* secure port */
+				rq_retired : 1;	/* left its dynamic pool */
 
 	union svc_addr_u	rq_daddr;	/* dest addr of request
 						 *  - reply from here */
@@ -394,6 +424,12 @@ struct svc_serv *  svc_create_pooled(struct svc_program *, unsigned int,
 			sa_family_t, void (*shutdown)(struct svc_serv *),
 			svc_thread_fn, struct module *);
 int		   svc_set_num_threads(struct svc_serv *, struct svc_pool *, int);
+int		   svc_set_pool_limits(struct svc_serv *, struct svc_pool *,
+				       unsigned int, unsigned int);
+void		   svc_pool_wake_spawner(struct svc_pool *);
+long		   svc_pool_idle_timeout(struct svc_pool *, long);
+int		   svc_pool_retire_thread(struct svc_pool *, struct svc_rqst *);
+int		   svc_pool_stats_open(struct svc_serv *serv, struct file *file);
 void		   svc_destroy(struct svc_serv *);
 int		   svc_process(struct svc_rqst *);
 int		   svc_register(const struct svc_serv *, const unsigned short,
@@ -147,6 +147,7 @@ struct rpc_xprt {
 	unsigned long		state;		/* transport state */
 	unsigned char		shutdown   : 1,	/* being shut down */
 				resvport   : 1; /* use a reserved port */
+	atomic_t		queuelen;	/* tasks assigned to us */
 	unsigned int		bind_index;	/* bind function index */
 
 	/*
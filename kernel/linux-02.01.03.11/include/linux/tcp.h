@@ -96,6 +96,9 @@ enum {
 #define TCP_QUICKACK		12	/* Block/reenable quick acks */
 #define TCP_CONGESTION		13	/* Congestion control algorithm */
 #define TCP_MD5SIG		14	/* TCP MD5 Signature (RFC2385) */
+#define TCP_ZEROCOPY_RECEIVE	15	/* Map received pages, see below */
+#define TCP_ULP			16	/* Attach an upper layer protocol */
+#define TCP_RELAY		17	/* Forward received data to a socket */
 
 #define TCPI_OPT_TIMESTAMPS	1
 #define TCPI_OPT_SACK		2
@@ -170,10 +173,52 @@ struct tcp_md5sig {
 	__u8	tcpm_key[TCP_MD5SIG_MAXKEYLEN];		/* key (binary) */
 };
 
+/* for TCP_ZEROCOPY_RECEIVE socket option, on a region mmap()ed from the
+ * socket: maps up to length bytes of in-order data at address and returns
+ * how many were mapped; recv_skip_hint bytes then have to be read with
+ * recv() before mapping can continue.
+ */
+struct tcp_zerocopy_receive {
+	__u64	address;		/* in: page aligned address	*/
+	__u32	length;			/* in/out: bytes to map/mapped	*/
+	__u32	recv_skip_hint;		/* out: bytes to copy instead	*/
+};
+
+/* for TCP_RELAY setsockopt: received data is sent on, in the kernel, on
+ * the TCP socket fd until max_bytes have been forwarded, the optional
+ * BPF program returns 0 for a segment, the stream ends or fd = -1 is set.
+ */
+struct tcp_relay_req {
+	__s32	fd;			/* destination, -1 to detach	*/
+	__u32	prog_len;		/* BPF instructions, 0 for none	*/
+	__u64	prog;			/* struct sock_filter * 	*/
+	__u64	max_bytes;		/* 0 for no limit		*/
+};
+
+/* Why the last relay of a socket ended */
+enum {
+	TCP_RELAY_END_NONE,		/* still attached, or never was */
+	TCP_RELAY_END_USER,		/* detached with fd = -1	*/
+	TCP_RELAY_END_LIMIT,		/* max_bytes were forwarded	*/
+	TCP_RELAY_END_VERDICT,		/* program or urgent data	*/
+	TCP_RELAY_END_EOF,		/* the peer closed its side	*/
+	TCP_RELAY_END_ERROR,		/* see error			*/
+};
+
+/* for TCP_RELAY getsockopt */
+struct tcp_relay_info {
+	__u64	bytes;			/* forwarded over all relays	*/
+	__u32	attached;
+	__u32	end;			/* TCP_RELAY_END_*		*/
+	__s32	error;
+	__u32	__pad;
+};
+
 #ifdef __KERNEL__
 
 #include <linux/skbuff.h>
 #include <linux/dmaengine.h>
+#include <linux/interrupt.h>
 #include <net/sock.h>
 #include <net/inet_connection_sock.h>
 #include <net/inet_timewait_sock.h>
@@ -317,6 +362,8 @@ struct tcp_sock {
 	u32	snd_up;		/* Urgent pointer		*/
 
 	u8	keepalive_probes; /* num of allowed keep alive probes	*/
+	u8	do_early_retrans; /* Enable RFC5827 early retransmit	*/
+	u32	tlp_high_seq;	/* snd_nxt at the time of TLP retransmit */
 /*
  *      Options received (usually on last packet, some only on SYN packets).
  */
@@ -358,6 +405,7 @@ struct tcp_sock {
 					 * (validity guaranteed only if
 					 * sacked_out > 0)
 					 */
+	struct rb_root write_queue_rb;	/* sk_write_queue in queue order */
 
 	int     lost_cnt_hint;
 	u32     retransmit_high;	/* L-bits may be on up to this seqno */
@@ -400,6 +448,36 @@ struct tcp_sock {
 		u32		  probe_seq_end;
 	} mtu_probe;
 
+/* Delivery rate sampling, see net/ipv4/tcp_rate.c */
+	u32	delivered;	/* Packets delivered, incl. retransmits	*/
+	u32	lost;		/* Packets ever marked lost		*/
+	u32	app_limited;	/* limited until "delivered" reaches this */
+	u32	first_tx_mstamp;  /* start of window send phase, usecs	*/
+	u32	delivered_mstamp; /* when "delivered" last grew, usecs	*/
+	u32	rate_delivered;	/* last sample: packets delivered	*/
+	u32	rate_interval_us; /* last sample: its interval, usecs	*/
+	u32	rtt_min_us;	/* lowest RTT sampled, usecs		*/
+	u8	rate_app_limited; /* last sample was app-limited	*/
+
+/* Pacing, on while the congestion control sets pacing_rate */
+	u8	pacing_ref;	/* timer/queue/deferral hold a reference */
+	u32	pacing_rate;	/* bytes per second, 0 when not paced	*/
+	unsigned long		pacing_flags;	/* TCP_PACING_* bits	*/
+	struct list_head	pacing_node;	/* on a CPU's pacing queue */
+	struct hrtimer		pacing_timer;
+
+/* Zero-copy receive, see tcp_zerocopy_receive() */
+	struct mm_struct *zerocopy_mm;	/* mm the pages are mapped into	*/
+	pgoff_t	zerocopy_pgoff;	/* their offset in the socket mapping	*/
+	u32	zerocopy_mapped; /* bytes mapped, charged to sk_rmem_alloc */
+
+/* Socket relay, see net/ipv4/tcp_relay.c */
+	struct tcp_relay	*relay;	   /* forwards what we receive	*/
+	struct tcp_relay	*relay_in; /* forwards into this socket	*/
+	u64	relay_bytes;	/* total forwarded from this socket	*/
+	u8	relay_end;	/* TCP_RELAY_END_* of the last relay	*/
+	int	relay_err;
+
 #ifdef CONFIG_TCP_MD5SIG
 /* TCP AF-Specific parts; only used by MD5 Signature support so far */
 	struct tcp_sock_af_ops	*af_specific;
@@ -78,6 +78,11 @@ struct udp_sock {
 	 * For encapsulation sockets.
 	 */
 	int (*encap_rcv)(struct sock *sk, struct sk_buff *skb);
+	/*
+	 * Secondary hash on (local address, port), see udp_lib_get_port().
+	 */
+	unsigned int		 udp_portaddr_hash;
+	struct hlist_nulls_node	 udp_portaddr_node;
 };
 
 static inline struct udp_sock *udp_sk(const struct sock *sk)
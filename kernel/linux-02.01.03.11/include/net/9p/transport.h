@@ -26,6 +26,10 @@
 #ifndef NET_9P_TRANSPORT_H
 #define NET_9P_TRANSPORT_H
 
+/* Size of the request/reply buffers used for zero-copy requests, which
+ * only ever carry the message headers. */
+#define P9_ZC_HDR_SZ 4096
+
 /**
  * struct p9_trans_module - transport module interface
  * @list: used to maintain a list of currently available transports
@@ -34,6 +38,8 @@
  * @def: set if this transport should be considered the default
  * @create: member function to create a new connection on this transport
  * @request: member function to issue a request to the transport
+ * @zc_request: member function to issue a request whose payload is mapped
+ *	directly from/to the caller's buffer; returns once the reply arrived
  * @cancel: member function to cancel a request (if it hasn't been sent)
  *
  * This is the basic API for a transport module which is registered by the
@@ -52,6 +58,8 @@ struct p9_trans_module {
 	int (*create)(struct p9_client *, const char *, char *);
 	void (*close) (struct p9_client *);
 	int (*request) (struct p9_client *, struct p9_req_t *req);
+	int (*zc_request)(struct p9_client *, struct p9_req_t *,
+			  char *, char *, int, int, int, int);
 	int (*cancel) (struct p9_client *, struct p9_req_t *req);
 };
 
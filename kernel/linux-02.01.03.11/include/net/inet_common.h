@@ -26,6 +26,9 @@ extern int			inet_sendmsg(struct kiocb *iocb,
 					     struct socket *sock, 
 					     struct msghdr *msg, 
 					     size_t size);
+extern ssize_t			inet_sendpage(struct socket *sock,
+					      struct page *page, int offset,
+					      size_t size, int flags);
 extern int			inet_shutdown(struct socket *sock, int how);
 extern int			inet_listen(struct socket *sock, int backlog);
 
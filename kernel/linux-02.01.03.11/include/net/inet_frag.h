@@ -1,10 +1,15 @@
 #ifndef __NET_FRAG_H__
 #define __NET_FRAG_H__
 
+#include <linux/percpu_counter.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
+
 struct netns_frags {
-	int			nqueues;
-	atomic_t		mem;
-	struct list_head	lru_list;
+	atomic_t		nqueues;
+	/* Memory accounting is per-CPU; see frag_mem_limit() */
+	struct percpu_counter	mem;
 
 	/* sysctls */
 	int			timeout;
@@ -15,7 +20,6 @@ struct netns_frags {
 struct inet_frag_queue {
 	struct hlist_node	list;
 	struct netns_frags	*net;
-	struct list_head	lru_list;   /* lru list member */
 	spinlock_t		lock;
 	atomic_t		refcnt;
 	struct timer_list	timer;      /* when will this queue expire? */
@@ -25,21 +29,54 @@ struct inet_frag_queue {
 	int			meat;
 	__u8			last_in;    /* first/last segment arrived? */
 
+#define INET_FRAG_EVICTED	8
 #define INET_FRAG_COMPLETE	4
 #define INET_FRAG_FIRST_IN	2
 #define INET_FRAG_LAST_IN	1
 };
 
+/* Initial and maximal number of hash buckets; the table grows by doubling. */
 #define INETFRAGS_HASHSZ		64
+#define INETFRAGS_MAXHASHSZ		16384
+
+/* Averaged number of queues per bucket above which the table grows. */
+#define INETFRAGS_MAXDEPTH		2
+
+/* Per worker run: buckets scanned, and queues evicted at most. */
+#define INETFRAGS_EVICT_BUCKETS		128
+#define INETFRAGS_EVICT_MAX		512
+
+struct inet_frag_bucket {
+	struct hlist_head	chain;
+	spinlock_t		chain_lock;
+};
+
+struct inet_frag_hash {
+	unsigned int		mask;
+	struct rcu_head		rcu;
+	struct inet_frag_bucket	buckets[0];
+};
 
 struct inet_frags {
-	struct hlist_head	hash[INETFRAGS_HASHSZ];
-	rwlock_t		lock;
+	/* Readers pin the table with rcu_read_lock_bh() and validate the
+	 * bucket they locked against rnd_seqlock; the table and rnd only
+	 * change under the write side of it.
+	 */
+	struct inet_frag_hash	*hash;
+	seqlock_t		rnd_seqlock;
 	u32			rnd;
 	int			qsize;
 	int			secret_interval;
 	struct timer_list	secret_timer;
 
+	/* Eviction, secret rebuild and table growth run from here */
+	struct work_struct	frags_work;
+	unsigned int		next_bucket;
+	int			rebuild;
+	int			grow;
+	/* Queues of all namespaces, as they all share the table */
+	atomic_t		nqueues;
+
 	unsigned int		(*hashfn)(struct inet_frag_queue *);
 	void			(*constructor)(struct inet_frag_queue *q,
 						void *arg);
@@ -50,16 +87,15 @@ struct inet_frags {
 	void			(*frag_expire)(unsigned long data);
 };
 
-void inet_frags_init(struct inet_frags *);
+int inet_frags_init(struct inet_frags *);
 void inet_frags_fini(struct inet_frags *);
 
-void inet_frags_init_net(struct netns_frags *nf);
+int inet_frags_init_net(struct netns_frags *nf);
 void inet_frags_exit_net(struct netns_frags *nf, struct inet_frags *f);
 
 void inet_frag_kill(struct inet_frag_queue *q, struct inet_frags *f);
 void inet_frag_destroy(struct inet_frag_queue *q,
 				struct inet_frags *f, int *work);
-int inet_frag_evictor(struct netns_frags *nf, struct inet_frags *f);
 struct inet_frag_queue *inet_frag_find(struct netns_frags *nf,
 		struct inet_frags *f, void *key, unsigned int hash);
 
@@ -69,4 +105,39 @@ static inline void inet_frag_put(struct inet_frag_queue *q, struct inet_frags *f
 		inet_frag_destroy(q, f, NULL);
 }
 
+/* Memory Tracking Functions. */
+
+/*
+ * Fragment memory is charged to a per-CPU counter that is folded into the
+ * shared count every FRAG_MEM_BATCH bytes.  frag_mem_limit() is therefore
+ * off by at most FRAG_MEM_BATCH per CPU, which is what the thresholds are
+ * checked against.  The add/sub helpers must be called with BH disabled.
+ */
+#define FRAG_MEM_BATCH		(32 * 1024)
+
+static inline int frag_mem_limit(struct netns_frags *nf)
+{
+	return percpu_counter_read(&nf->mem);
+}
+
+static inline void sub_frag_mem_limit(struct netns_frags *nf, int i)
+{
+	__percpu_counter_add(&nf->mem, -i, FRAG_MEM_BATCH);
+}
+
+static inline void add_frag_mem_limit(struct netns_frags *nf, int i)
+{
+	__percpu_counter_add(&nf->mem, i, FRAG_MEM_BATCH);
+}
+
+static inline int sum_frag_mem_limit(struct netns_frags *nf)
+{
+	int res;
+
+	local_bh_disable();
+	res = percpu_counter_sum_positive(&nf->mem);
+	local_bh_enable();
+	return res;
+}
+
 #endif
@@ -11,43 +11,51 @@
 #include <linux/init.h>
 #include <linux/jiffies.h>
 #include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
 #include <asm/atomic.h>
 
+struct net;
+
 struct inet_peer
 {
 	/* group together avl_left,avl_right,v4daddr to speedup lookups */
 	struct inet_peer	*avl_left, *avl_right;
 	__be32			v4daddr;	/* peer's address */
-	__u16			avl_height;
-	__u16			ip_id_count;	/* IP ID for the next packet */
-	struct list_head	unused;
+	__u32			avl_height;
 	__u32			dtime;		/* the time of last use of not
 						 * referenced entries */
-	atomic_t		refcnt;
+	atomic_t		refcnt;		/* -1 once unlinked from the pool */
+	atomic_t		ip_id_count;	/* IP ID for the next packet */
 	atomic_t		rid;		/* Frag reception counter */
+	int			orphan;		/* the owning namespace is gone */
 	__u32			tcp_ts;
 	unsigned long		tcp_ts_stamp;
+	union {
+		struct inet_peer	*gc_next;
+		struct rcu_head		rcu;
+	};
+};
+
+struct inet_peer_base {
+	struct inet_peer	*root;
+	seqlock_t		lock;
+	int			total;
 };
 
 void			inet_initpeers(void) __init;
 
 /* can be called with or without local BH being disabled */
-struct inet_peer	*inet_getpeer(__be32 daddr, int create);
+struct inet_peer	*inet_getpeer(struct net *net, __be32 daddr, int create);
 
 /* can be called from BH context or outside */
 extern void inet_putpeer(struct inet_peer *p);
 
-extern spinlock_t inet_peer_idlock;
 /* can be called with or without local BH being disabled */
 static inline __u16	inet_getid(struct inet_peer *p, int more)
 {
-	__u16 id;
-
-	spin_lock_bh(&inet_peer_idlock);
-	id = p->ip_id_count;
-	p->ip_id_count += 1 + more;
-	spin_unlock_bh(&inet_peer_idlock);
-	return id;
+	more++;
+	return atomic_add_return(more, &p->ip_id_count) - more;
 }
 
 #endif /* _NET_INETPEER_H */
@@ -18,6 +18,7 @@
 #include <linux/ipv6_route.h>
 #include <linux/rtnetlink.h>
 #include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 #include <net/dst.h>
 #include <net/flow.h>
 #include <net/netlink.h>
@@ -59,6 +60,7 @@ struct fib6_node
 	__u16			fn_flags;
 	__u32			fn_sernum;
 	struct rt6_info		*rr_ptr;
+	struct rcu_head		rcu;
 };
 
 #ifndef CONFIG_IPV6_SUBTREES
@@ -80,6 +82,31 @@ struct rt6key
 
 struct fib6_table;
 
+/*
+ *	Exception table: the host clones (COW'ed on-link routes, PMTU
+ *	and redirect entries) of a route hang off it in a small hash
+ *	rather than being inserted into the tree.  Each bucket is kept
+ *	at most FIB6_MAX_DEPTH deep by evicting its oldest entry.
+ */
+
+#define FIB6_EXCEPTION_BUCKET_SIZE_SHIFT	10
+#define FIB6_EXCEPTION_BUCKET_SIZE	(1 << FIB6_EXCEPTION_BUCKET_SIZE_SHIFT)
+#define FIB6_MAX_DEPTH			5
+
+struct rt6_exception_bucket
+{
+	struct hlist_head	chain;
+	int			depth;
+};
+
+struct rt6_exception
+{
+	struct hlist_node	hlist;
+	struct rt6_info		*rt6i;
+	unsigned long		stamp;
+	struct rcu_head		rcu;
+};
+
 struct rt6_info
 {
 	union {
@@ -114,6 +141,12 @@ struct rt6_info
 #endif
 
 	struct rt6key			rt6i_src;
+
+	/* Route owning this exception entry, cleared once it is unlinked */
+	struct rt6_info			*rt6i_from;
+	/* nr_cpu_ids private copies handed out instead of the route itself */
+	struct rt6_info			**rt6i_pcpu;
+	struct rt6_exception_bucket	*rt6i_exception_bucket;
 };
 
 static inline struct inet6_dev *ip6_dst_idev(struct dst_entry *dst)
@@ -128,10 +161,18 @@ struct fib6_walker_t
 	struct rt6_info *leaf;
 	unsigned char state;
 	unsigned char prune;
+	/* entries of leaf a suspended dump already took: itself, then clones */
+	int skip;
 	int (*func)(struct fib6_walker_t *);
 	void *args;
 };
 
+struct fib6_gc_args
+{
+	int			timeout;
+	int			more;
+};
+
 struct rt6_statistics {
 	__u32		fib_nodes;
 	__u32		fib_route_nodes;
@@ -151,6 +192,11 @@ struct rt6_statistics {
  */
 
 
+/*
+ * Lookups walk the tree under rcu_read_lock_bh(); tb6_lock is only
+ * taken by writers, walkers and dumps.  Nodes and routes unlinked
+ * from the tree are freed after a grace period.
+ */
 struct fib6_table {
 	struct hlist_node	tb6_hlist;
 	u32			tb6_id;
@@ -207,6 +253,8 @@ extern int			fib6_add(struct fib6_node *root,
 extern int			fib6_del(struct rt6_info *rt,
 					 struct nl_info *info);
 
+extern void			fib6_update_sernum(struct rt6_info *rt);
+
 extern void			inet6_rt_notify(int event, struct rt6_info *rt,
 						struct nl_info *info);
 
@@ -111,6 +111,13 @@ struct rt6_rtnl_dump_arg
 };
 
 extern int rt6_dump_route(struct rt6_info *rt, void *p_arg);
+extern int rt6_dump_exceptions(struct rt6_info *rt, void *p_arg,
+			       int *skip);
+extern int rt6_remove_exception_rt(struct rt6_info *rt);
+extern void rt6_flush_exceptions(struct rt6_info *rt);
+extern void rt6_age_exceptions(struct rt6_info *rt,
+			       struct fib6_gc_args *gc_args);
+extern void rt6_free_cached(struct rt6_info *rt);
 extern void rt6_ifdown(struct net *net, struct net_device *dev);
 extern void rt6_mtu_change(struct net_device *dev, unsigned mtu);
 
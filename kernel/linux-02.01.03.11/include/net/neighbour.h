@@ -99,6 +99,7 @@ struct neigh_statistics
 struct neighbour
 {
 	struct neighbour	*next;
+	struct rcu_head		rcu;
 	struct neigh_table	*tbl;
 	struct neigh_parms	*parms;
 	struct net_device		*dev;
@@ -147,6 +148,15 @@ struct pneigh_entry
  *	neighbour table manipulation
  */
 
+/* Bucket array of a neigh_table, swapped as a whole on resize so that
+ * lockless lookups always see a consistent mask and hash seed. */
+struct neigh_hash_table
+{
+	struct neighbour	**hash_buckets;
+	unsigned int		hash_mask;
+	__u32			hash_rnd;
+	struct rcu_head		rcu;
+};
 
 struct neigh_table
 {
@@ -154,7 +164,9 @@ struct neigh_table
 	int			family;
 	int			entry_size;
 	int			key_len;
-	__u32			(*hash)(const void *pkey, const struct net_device *);
+	__u32			(*hash)(const void *pkey,
+					const struct net_device *dev,
+					__u32 hash_rnd);
 	int			(*constructor)(struct neighbour *);
 	int			(*pconstructor)(struct pneigh_entry *);
 	void			(*pdestructor)(struct pneigh_entry *);
@@ -175,9 +187,7 @@ struct neigh_table
 	unsigned long		last_rand;
 	struct kmem_cache		*kmem_cachep;
 	struct neigh_statistics	*stats;
-	struct neighbour	**hash_buckets;
-	unsigned int		hash_mask;
-	__u32			hash_rnd;
+	struct neigh_hash_table	*nht;
 	unsigned int		hash_chain_gc;
 	struct pneigh_entry	**phash_buckets;
 };
@@ -12,6 +12,7 @@ struct ipv4_devconf;
 struct fib_rules_ops;
 struct hlist_head;
 struct sock;
+struct inet_peer_base;
 
 struct netns_ipv4 {
 #ifdef CONFIG_SYSCTL
@@ -32,6 +33,7 @@ struct netns_ipv4 {
 	struct sock		*tcp_sock;
 
 	struct netns_frags	frags;
+	struct inet_peer_base	*peers;
 #ifdef CONFIG_NETFILTER
 	struct xt_table		*iptable_filter;
 	struct xt_table		*iptable_mangle;
@@ -146,6 +146,7 @@ struct sock_common {
   *	@sk_sleep: sock wait queue
   *	@sk_dst_cache: destination cache
   *	@sk_dst_lock: destination cache lock
+  *	@sk_rx_dst: input route of received packets, for early demux
   *	@sk_policy: flow policy
   *	@sk_rmem_alloc: receive queue bytes committed
   *	@sk_receive_queue: incoming packets
@@ -240,6 +241,7 @@ struct sock {
 	struct xfrm_policy	*sk_policy[2];
 #endif
 	rwlock_t		sk_dst_lock;
+	struct dst_entry	*sk_rx_dst;
 	atomic_t		sk_rmem_alloc;
 	atomic_t		sk_wmem_alloc;
 	atomic_t		sk_omem_alloc;
@@ -636,9 +638,13 @@ struct proto {
 	int			(*backlog_rcv) (struct sock *sk, 
 						struct sk_buff *skb);
 
+	/* Work deferred while the user owned the socket (optional) */
+	void			(*release_cb)(struct sock *sk);
+
 	/* Keeping track of sk's, looking them up, and port selection methods. */
 	void			(*hash)(struct sock *sk);
 	void			(*unhash)(struct sock *sk);
+	void			(*rehash)(struct sock *sk);
 	int			(*get_port)(struct sock *sk, unsigned short snum);
 
 	/* Keeping track of sockets in use */
@@ -649,6 +655,7 @@ struct proto {
 	/* Memory pressure */
 	void			(*enter_memory_pressure)(struct sock *sk);
 	atomic_t		*memory_allocated;	/* Current allocated memory. */
+	int			*per_cpu_fw_alloc;	/* Not yet in memory_allocated */
 	struct percpu_counter	*sockets_allocated;	/* Current number of sockets. */
 	/*
 	 * Pressure flag: try to collapse.
@@ -661,6 +668,8 @@ struct proto {
 	int			*sysctl_wmem;
 	int			*sysctl_rmem;
 	int			max_header;
+	int			no_autobind;	/* connected protocols bind
+						 * on connect, not on send */
 
 	struct kmem_cache	*slab;
 	unsigned int		obj_size;
@@ -933,6 +942,7 @@ extern struct sk_buff		*sock_rmalloc(struct sock *sk,
 					      gfp_t priority);
 extern void			sock_wfree(struct sk_buff *skb);
 extern void			sock_rfree(struct sk_buff *skb);
+extern void			sock_edemux(struct sk_buff *skb);
 
 extern int			sock_setsockopt(struct socket *sock, int level,
 						int op, char __user *optval,
@@ -1436,6 +1446,7 @@ extern __u32 sysctl_rmem_max;
 extern void sk_init(void);
 
 extern int sysctl_optmem_max;
+extern int sysctl_mem_pcpu_rsv;
 
 extern __u32 sysctl_wmem_default;
 extern __u32 sysctl_rmem_default;
@@ -236,6 +236,7 @@ extern int sysctl_tcp_base_mss;
 extern int sysctl_tcp_workaround_signed_windows;
 extern int sysctl_tcp_slow_start_after_idle;
 extern int sysctl_tcp_max_ssthresh;
+extern int sysctl_tcp_early_retrans;
 
 extern atomic_t tcp_memory_allocated;
 extern struct percpu_counter tcp_sockets_allocated;
@@ -276,15 +277,21 @@ extern void			tcp_v4_err(struct sk_buff *skb, u32);
 
 extern void			tcp_shutdown (struct sock *sk, int how);
 
+extern void			tcp_v4_early_demux(struct sk_buff *skb);
 extern int			tcp_v4_rcv(struct sk_buff *skb);
 
 extern int			tcp_v4_remember_stamp(struct sock *sk);
 
 extern int		    	tcp_v4_tw_remember_stamp(struct inet_timewait_sock *tw);
 
-extern int			tcp_sendmsg(struct kiocb *iocb, struct socket *sock,
+extern int			tcp_sendmsg(struct kiocb *iocb, struct sock *sk,
 					    struct msghdr *msg, size_t size);
-extern ssize_t			tcp_sendpage(struct socket *sock, struct page *page, int offset, size_t size, int flags);
+extern int			tcp_sendpage(struct sock *sk, struct page *page,
+					     int offset, size_t size, int flags);
+extern ssize_t			do_tcp_sendpages(struct sock *sk,
+						 struct page **pages,
+						 int poffset, size_t psize,
+						 int flags);
 
 extern int			tcp_ioctl(struct sock *sk, 
 					  int cmd, 
@@ -312,6 +319,13 @@ extern void			tcp_twsk_destructor(struct sock *sk);
 extern ssize_t			tcp_splice_read(struct socket *sk, loff_t *ppos,
 					        struct pipe_inode_info *pipe, size_t len, unsigned int flags);
 
+#ifdef CONFIG_MMU
+extern int			tcp_mmap(struct file *file, struct socket *sock,
+					 struct vm_area_struct *vma);
+#else
+#define tcp_mmap		sock_no_mmap
+#endif
+
 static inline void tcp_dec_quickack_mode(struct sock *sk,
 					 const unsigned int pkts)
 {
@@ -467,11 +481,15 @@ extern void tcp_send_fin(struct sock *sk);
 extern void tcp_send_active_reset(struct sock *sk, gfp_t priority);
 extern int  tcp_send_synack(struct sock *);
 extern void tcp_push_one(struct sock *, unsigned int mss_now);
+extern int tcp_schedule_loss_probe(struct sock *sk);
+extern void tcp_send_loss_probe(struct sock *sk);
 extern void tcp_send_ack(struct sock *sk);
 extern void tcp_send_delayed_ack(struct sock *sk);
 
 /* tcp_input.c */
 extern void tcp_cwnd_application_limited(struct sock *sk);
+extern void tcp_resume_early_retransmit(struct sock *sk);
+extern void tcp_rearm_rto(struct sock *sk);
 
 /* tcp_timer.c */
 extern void tcp_init_xmit_timers(struct sock *);
@@ -557,11 +575,22 @@ extern u32	__tcp_select_window(struct sock *sk);
  */
 struct tcp_skb_cb {
 	union {
-		struct inet_skb_parm	h4;
+		struct {
+			/* For outgoing frames, see tcp_rate_skb_sent() */
+			__u32	delivered;
+			__u32	first_tx_mstamp;
+			__u32	delivered_mstamp;
+			__u32	is_app_limited;
+			/* Packets in this skb's write_queue_rb subtree */
+			__u32	rb_pcount;
+		} tx;
+		union {
+			struct inet_skb_parm	h4;
 #if defined(CONFIG_IPV6) || defined (CONFIG_IPV6_MODULE)
-		struct inet6_skb_parm	h6;
+			struct inet6_skb_parm	h6;
 #endif
-	} header;	/* For incoming frames		*/
+		} header;	/* For incoming frames		*/
+	};
 	__u32		seq;		/* Starting sequence number	*/
 	__u32		end_seq;	/* SEQ + FIN + SYN + datalen	*/
 	__u32		when;		/* used to compute rtt's	*/
@@ -601,6 +630,23 @@ static inline int tcp_skb_pcount(const struct sk_buff *skb)
 	return skb_shinfo(skb)->gso_segs;
 }
 
+extern void tcp_write_queue_rb_update(struct sk_buff *skb);
+
+/* Changes to the pcount of a queued skb must reach write_queue_rb */
+static inline void tcp_skb_pcount_set(struct sk_buff *skb, int segs)
+{
+	if (skb_shinfo(skb)->gso_segs != segs) {
+		skb_shinfo(skb)->gso_segs = segs;
+		tcp_write_queue_rb_update(skb);
+	}
+}
+
+static inline void tcp_skb_pcount_add(struct sk_buff *skb, int segs)
+{
+	skb_shinfo(skb)->gso_segs += segs;
+	tcp_write_queue_rb_update(skb);
+}
+
 /* This is valid iff tcp_skb_pcount() > 1. */
 static inline int tcp_skb_mss(const struct sk_buff *skb)
 {
@@ -643,6 +689,23 @@ enum tcp_ca_event {
 #define TCP_CONG_NON_RESTRICTED 0x1
 #define TCP_CONG_RTT_STAMP	0x2
 
+/*
+ * A delivery rate sample, taken on every ACK: "delivered" packets were
+ * delivered over "interval_us".  Either is -1 if there is no valid sample.
+ */
+struct rate_sample {
+	u32	prior_mstamp;	/* start of the interval, usecs */
+	u32	prior_delivered; /* tp->delivered at prior_mstamp */
+	s32	delivered;	/* packets delivered over interval_us */
+	long	interval_us;	/* time for tp->delivered to grow by delivered */
+	long	rtt_us;		/* RTT of the last (S)ACKed packet, or -1 */
+	int	losses;		/* packets newly marked lost by this ACK */
+	u32	acked_sacked;	/* packets newly (S)ACKed by this ACK */
+	u32	prior_in_flight; /* packets in flight before this ACK */
+	int	is_app_limited;	/* sample is from an app-limited interval */
+	int	is_retrans;	/* sample is from a retransmitted packet */
+};
+
 struct tcp_congestion_ops {
 	struct list_head	list;
 	unsigned long flags;
@@ -656,7 +719,7 @@ struct tcp_congestion_ops {
 	u32 (*ssthresh)(struct sock *sk);
 	/* lower bound for congestion window (optional) */
 	u32 (*min_cwnd)(const struct sock *sk);
-	/* do new cwnd calculation (required) */
+	/* do new cwnd calculation (required, unless cong_control) */
 	void (*cong_avoid)(struct sock *sk, u32 ack, u32 in_flight);
 	/* call before changing ca_state (optional) */
 	void (*set_state)(struct sock *sk, u8 new_state);
@@ -668,6 +731,10 @@ struct tcp_congestion_ops {
 	void (*pkts_acked)(struct sock *sk, u32 num_acked, s32 rtt_us);
 	/* get info for inet_diag (optional) */
 	void (*get_info)(struct sock *sk, u32 ext, struct sk_buff *skb);
+	/* take over cwnd and pacing decisions on every ACK (optional,
+	 * replaces cong_avoid)
+	 */
+	void (*cong_control)(struct sock *sk, const struct rate_sample *rs);
 
 	char 		name[TCP_CA_NAME_MAX];
 	struct module 	*owner;
@@ -686,12 +753,68 @@ extern int tcp_set_allowed_congestion_control(char *allowed);
 extern int tcp_set_congestion_control(struct sock *sk, const char *name);
 extern void tcp_slow_start(struct tcp_sock *tp);
 
+/*
+ * Interface for upper layer protocols (ULPs) that take over a connected
+ * TCP socket, e.g. to frame and encrypt what is sent on it.  ->init()
+ * typically replaces sk->sk_prot with a copy that overrides some of the
+ * operations.
+ */
+#define TCP_ULP_NAME_MAX	16
+
+struct tcp_ulp_ops {
+	struct list_head	list;
+
+	/* take over the socket (required) */
+	int (*init)(struct sock *sk);
+	/* cleanup private data when the socket is destroyed (optional) */
+	void (*release)(struct sock *sk);
+
+	char			name[TCP_ULP_NAME_MAX];
+	struct module		*owner;
+};
+
+extern int tcp_register_ulp(struct tcp_ulp_ops *type);
+extern void tcp_unregister_ulp(struct tcp_ulp_ops *type);
+extern int tcp_set_ulp(struct sock *sk, const char *name);
+extern void tcp_cleanup_ulp(struct sock *sk);
+
+/* tcp_relay.c: forwarding received data to another socket */
+extern int tcp_relay_set(struct sock *sk, const struct tcp_relay_req *req);
+extern void tcp_relay_get_info(struct sock *sk, struct tcp_relay_info *info);
+extern void tcp_relay_release(struct sock *sk);
+extern void tcp_relay_init(void);
+
 extern struct tcp_congestion_ops tcp_init_congestion_ops;
 extern u32 tcp_reno_ssthresh(struct sock *sk);
 extern void tcp_reno_cong_avoid(struct sock *sk, u32 ack, u32 in_flight);
 extern u32 tcp_reno_min_cwnd(const struct sock *sk);
 extern struct tcp_congestion_ops tcp_reno;
 
+/* Delivery rate sampling, net/ipv4/tcp_rate.c.  Times are microseconds on
+ * the clock of skb->tstamp, truncated to 32 bits.
+ */
+static inline u32 tcp_clock_us(void)
+{
+	return (u32)ktime_to_us(ktime_get_real());
+}
+
+static inline u32 tcp_skb_timestamp_us(const struct sk_buff *skb)
+{
+	return (u32)ktime_to_us(skb->tstamp);
+}
+
+extern void tcp_rate_skb_sent(struct sock *sk, struct sk_buff *skb);
+extern void tcp_rate_skb_delivered(struct sock *sk, struct sk_buff *skb,
+				   struct rate_sample *rs);
+extern void tcp_rate_gen(struct sock *sk, u32 delivered, u32 lost,
+			 struct rate_sample *rs);
+extern void tcp_rate_check_app_limited(struct sock *sk);
+
+/* Pacing at tp->pacing_rate, net/ipv4/tcp_output.c */
+extern void tcp_init_pacing(struct sock *sk);
+extern void tcp_release_cb(struct sock *sk);
+extern void __init tcp_pacing_init(void);
+
 static inline void tcp_set_ca_state(struct sock *sk, const u8 ca_state)
 {
 	struct inet_connection_sock *icsk = inet_csk(sk);
@@ -782,6 +905,21 @@ static inline __u32 tcp_current_ssthresh(const struct sock *sk)
 extern void tcp_enter_cwr(struct sock *sk, const int set_ssthresh);
 extern __u32 tcp_init_cwnd(struct tcp_sock *tp, struct dst_entry *dst);
 
+/* Early retransmit (RFC 5827) is only safe while the reordering
+ * threshold is the default one.
+ */
+static inline void tcp_enable_early_retrans(struct tcp_sock *tp)
+{
+	tp->do_early_retrans = sysctl_tcp_early_retrans &&
+		sysctl_tcp_early_retrans < 4 &&
+		sysctl_tcp_reordering == 3;
+}
+
+static inline void tcp_disable_early_retrans(struct tcp_sock *tp)
+{
+	tp->do_early_retrans = 0;
+}
+
 /* Slow start with delack produces 3 packets of burst, so that
  * it is safe "de facto".  This will be the default - same as
  * the default reordering threshold - but if reordering increases,
@@ -1172,6 +1310,7 @@ static inline void tcp_write_queue_purge(struct sock *sk)
 
 	while ((skb = __skb_dequeue(&sk->sk_write_queue)) != NULL)
 		sk_wmem_free_skb(sk, skb);
+	tcp_sk(sk)->write_queue_rb = RB_ROOT;
 	sk_mem_reclaim(sk);
 }
 
@@ -1234,9 +1373,27 @@ static inline void tcp_init_send_head(struct sock *sk)
 	sk->sk_send_head = NULL;
 }
 
+/*
+ * Every skb on the write queue is also linked into tp->write_queue_rb,
+ * so that SACK processing can find a sequence in a large window without
+ * walking the list; see tcp_write_queue_find().  Each node also counts
+ * the packets of its subtree, so the number of packets between two skbs
+ * is known without visiting those in between.
+ */
+extern void tcp_write_queue_rb_link(struct sock *sk, struct sk_buff *skb);
+extern void tcp_write_queue_rb_unlink(struct sock *sk, struct sk_buff *skb);
+
+static inline u32 tcp_write_queue_rb_pcount(const struct rb_node *node)
+{
+	if (node == NULL)
+		return 0;
+	return TCP_SKB_CB(rb_entry(node, struct sk_buff, rbnode))->tx.rb_pcount;
+}
+
 static inline void __tcp_add_write_queue_tail(struct sock *sk, struct sk_buff *skb)
 {
 	__skb_queue_tail(&sk->sk_write_queue, skb);
+	tcp_write_queue_rb_link(sk, skb);
 }
 
 static inline void tcp_add_write_queue_tail(struct sock *sk, struct sk_buff *skb)
@@ -1255,6 +1412,7 @@ static inline void tcp_add_write_queue_tail(struct sock *sk, struct sk_buff *skb
 static inline void __tcp_add_write_queue_head(struct sock *sk, struct sk_buff *skb)
 {
 	__skb_queue_head(&sk->sk_write_queue, skb);
+	tcp_write_queue_rb_link(sk, skb);
 }
 
 /* Insert buff after skb on the write queue of sk.  */
@@ -1263,6 +1421,7 @@ static inline void tcp_insert_write_queue_after(struct sk_buff *skb,
 						struct sock *sk)
 {
 	__skb_queue_after(&sk->sk_write_queue, skb, buff);
+	tcp_write_queue_rb_link(sk, buff);
 }
 
 /* Insert new before skb on the write queue of sk.  */
@@ -1271,6 +1430,7 @@ static inline void tcp_insert_write_queue_before(struct sk_buff *new,
 						  struct sock *sk)
 {
 	__skb_queue_before(&sk->sk_write_queue, skb, new);
+	tcp_write_queue_rb_link(sk, new);
 
 	if (sk->sk_send_head == skb)
 		sk->sk_send_head = new;
@@ -1278,6 +1438,7 @@ static inline void tcp_insert_write_queue_before(struct sk_buff *new,
 
 static inline void tcp_unlink_write_queue(struct sk_buff *skb, struct sock *sk)
 {
+	tcp_write_queue_rb_unlink(sk, skb);
 	__skb_unlink(skb, &sk->sk_write_queue);
 }
 
@@ -0,0 +1,79 @@
+#ifndef _NET_TLS_H
+#define _NET_TLS_H
+
+#include <linux/types.h>
+#include <linux/crypto.h>
+#include <linux/scatterlist.h>
+#include <linux/workqueue.h>
+#include <linux/tls.h>
+#include <net/sock.h>
+#include <net/inet_connection_sock.h>
+
+/* TLS 1.2 record header: content type, version, length */
+#define TLS_HEADER_SIZE			5
+#define TLS_AAD_SPACE_SIZE		13
+#define TLS_MAX_PAYLOAD_SIZE		((size_t)1 << 14)
+
+#define TLS_RECORD_TYPE_DATA		0x17
+
+/* What an AES-GCM record adds to its payload: header, nonce and tag */
+#define TLS_PREPEND_SIZE		(TLS_HEADER_SIZE + \
+					 TLS_CIPHER_AES_GCM_128_IV_SIZE)
+#define TLS_OVERHEAD_SIZE		(TLS_PREPEND_SIZE + \
+					 TLS_CIPHER_AES_GCM_128_TAG_SIZE)
+
+#define TLS_MAX_REC_PAGES		DIV_ROUND_UP(TLS_MAX_PAYLOAD_SIZE + \
+						     TLS_OVERHEAD_SIZE, \
+						     PAGE_SIZE)
+
+/*
+ * Per-socket state of the TLS upper layer protocol, in
+ * inet_csk(sk)->icsk_ulp_data.  Protected by the socket lock.
+ */
+struct tls_context {
+	union {
+		struct tls_crypto_info crypto_send;
+		struct tls12_crypto_info_aes_gcm_128 crypto_send_aes_gcm_128;
+	};
+	int			tx_conf;	/* TLS_TX has been set */
+
+	struct crypto_aead	*aead_send;
+	struct aead_request	*aead_req;
+	u8			iv[TLS_CIPHER_AES_GCM_128_IV_SIZE];
+	u8			rec_seq[TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE];
+	u8			aad[TLS_AAD_SPACE_SIZE];
+	struct scatterlist	sg_aad;
+	struct scatterlist	sg_dst[TLS_MAX_REC_PAGES];
+
+	/*
+	 * An encrypted record that TCP has not taken in full yet: it is
+	 * pushed before anything else is sent, and on write space.
+	 */
+	struct page		*pending_pages[TLS_MAX_REC_PAGES];
+	int			pending_npages;
+	int			pending_offset;
+	int			pending_len;
+	int			in_tcp_sendpages;
+	struct work_struct	tx_work;
+	struct sock		*sk;
+
+	/* What the socket had before the ULP was attached */
+	struct proto		*sk_proto;
+	void			(*sk_write_space)(struct sock *sk);
+};
+
+static inline struct tls_context *tls_get_ctx(const struct sock *sk)
+{
+	return inet_csk(sk)->icsk_ulp_data;
+}
+
+int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx);
+void tls_sw_free_resources(struct tls_context *ctx);
+int tls_sw_sendmsg(struct kiocb *iocb, struct sock *sk,
+		   struct msghdr *msg, size_t size);
+int tls_sw_sendpage(struct sock *sk, struct page *page,
+		    int offset, size_t size, int flags);
+int tls_push_pending_record(struct sock *sk, int flags);
+void tls_free_pending_record(struct tls_context *ctx);
+
+#endif /* _NET_TLS_H */
@@ -50,15 +50,45 @@ struct udp_skb_cb {
 };
 #define UDP_SKB_CB(__skb)	((struct udp_skb_cb *)((__skb)->cb))
 
+/**
+ *	struct udp_hslot - UDP hash slot
+ *
+ *	@head:	head of list of sockets
+ *	@count:	number of sockets in 'head' list
+ *	@lock:	spinlock protecting changes to head/count
+ */
 struct udp_hslot {
 	struct hlist_nulls_head	head;
+	int			count;
 	spinlock_t		lock;
 } __attribute__((aligned(2 * sizeof(long))));
+
+/**
+ *	struct udp_table - UDP table
+ *
+ *	@hash:	primary hash table, keyed by local port
+ *	@hash2:	secondary hash table, keyed by (local address, local port)
+ *	@mask2:	number of slots in hash2 minus one
+ */
 struct udp_table {
 	struct udp_hslot	hash[UDP_HTABLE_SIZE];
+	struct udp_hslot	*hash2;
+	unsigned int		mask2;
 };
 extern struct udp_table udp_table;
-extern void udp_table_init(struct udp_table *);
+extern void udp_table_init(struct udp_table *, const char *);
+
+static inline struct udp_hslot *udp_hashslot2(struct udp_table *table,
+					      unsigned int hash)
+{
+	return &table->hash2[hash & table->mask2];
+}
+
+/*
+ * A primary chain longer than this is not walked for lookups or bind
+ * conflicts when the secondary chain is shorter.
+ */
+#define UDP_HSLOT_SCAN_MAX	10
 
 
 /* Note: this must match 'valbool' in sock_setsockopt */
@@ -118,6 +148,7 @@ static inline void udp_lib_hash(struct sock *sk)
 }
 
 extern void udp_lib_unhash(struct sock *sk);
+extern void udp_lib_rehash(struct sock *sk, unsigned int newhash);
 
 static inline void udp_lib_close(struct sock *sk, long timeout)
 {
@@ -125,7 +156,8 @@ static inline void udp_lib_close(struct sock *sk, long timeout)
 }
 
 extern int	udp_lib_get_port(struct sock *sk, unsigned short snum,
-		int (*)(const struct sock*,const struct sock*));
+		int (*)(const struct sock*,const struct sock*),
+		unsigned int hash2_nulladdr);
 
 /* net/ipv4/udp.c */
 extern int	udp_get_port(struct sock *sk, unsigned short snum,
@@ -136,6 +168,7 @@ extern int	udp_sendmsg(struct kiocb *iocb, struct sock *sk,
 			    struct msghdr *msg, size_t len);
 extern void	udp_flush_pending_frames(struct sock *sk);
 
+extern void	udp_v4_early_demux(struct sk_buff *skb);
 extern int	udp_rcv(struct sk_buff *skb);
 extern int	udp_ioctl(struct sock *sk, int cmd, unsigned long arg);
 extern int	udp_disconnect(struct sock *sk, int flags);
@@ -240,6 +240,21 @@ void kunmap_high(struct page *page)
 }
 
 EXPORT_SYMBOL(kunmap_high);
+
+/**
+ * kmap_to_page - find the page behind a kernel virtual address
+ * @vaddr: address in the lowmem direct map or returned by kmap()
+ */
+struct page *kmap_to_page(void *vaddr)
+{
+	unsigned long addr = (unsigned long)vaddr;
+
+	if (addr >= PKMAP_ADDR(0) && addr < PKMAP_ADDR(LAST_PKMAP))
+		return pte_page(pkmap_page_table[PKMAP_NR(addr)]);
+
+	return virt_to_page(addr);
+}
+EXPORT_SYMBOL(kmap_to_page);
 #endif
 
 #if defined(HASHED_PAGE_VIRTUAL)
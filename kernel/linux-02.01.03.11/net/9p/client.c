@@ -128,6 +128,7 @@ static int parse_opts(char *opts, struct p9_client *clnt)
  * p9_tag_alloc - lookup/allocate a request by tag
  * @c: client session to lookup tag within
  * @tag: numeric id for transaction
+ * @max_size: largest message the request buffers must be able to hold
  *
  * this is a simple array lookup, but will grow the
  * request_slots as necessary to accomodate transaction
@@ -139,11 +140,13 @@ static int parse_opts(char *opts, struct p9_client *clnt)
  *
  */
 
-static struct p9_req_t *p9_tag_alloc(struct p9_client *c, u16 tag)
+static struct p9_req_t *
+p9_tag_alloc(struct p9_client *c, u16 tag, unsigned int max_size)
 {
 	unsigned long flags;
 	int row, col;
 	struct p9_req_t *req;
+	int alloc_msize = min(c->msize, (int)max_size);
 
 	/* This looks up the original request by tag so we know which
 	 * buffer to read the data into */
@@ -174,30 +177,39 @@ static struct p9_req_t *p9_tag_alloc(struct p9_client *c, u16 tag)
 	col = tag % P9_ROW_MAXTAG;
 
 	req = &c->reqs[row][col];
-	if (!req->tc) {
+	if (!req->wq) {
 		req->wq = kmalloc(sizeof(wait_queue_head_t), GFP_KERNEL);
 		if (!req->wq) {
 			printk(KERN_ERR "Couldn't grow tag array\n");
 			return ERR_PTR(-ENOMEM);
 		}
 		init_waitqueue_head(req->wq);
-		req->tc = kmalloc(sizeof(struct p9_fcall)+c->msize,
+	}
+
+	/* Zero-copy requests only need room for the headers, so a slot
+	 * last used for one may be too small for a regular request. */
+	if (req->tc && req->tc->capacity < alloc_msize) {
+		kfree(req->tc);
+		kfree(req->rc);
+		req->tc = req->rc = NULL;
+	}
+
+	if (!req->tc) {
+		req->tc = kmalloc(sizeof(struct p9_fcall)+alloc_msize,
 								GFP_KERNEL);
-		req->rc = kmalloc(sizeof(struct p9_fcall)+c->msize,
+		req->rc = kmalloc(sizeof(struct p9_fcall)+alloc_msize,
 								GFP_KERNEL);
 		if ((!req->tc) || (!req->rc)) {
 			printk(KERN_ERR "Couldn't grow tag array\n");
 			kfree(req->tc);
 			kfree(req->rc);
-			kfree(req->wq);
 			req->tc = req->rc = NULL;
-			req->wq = NULL;
 			return ERR_PTR(-ENOMEM);
 		}
 		req->tc->sdata = (char *) req->tc + sizeof(struct p9_fcall);
-		req->tc->capacity = c->msize;
+		req->tc->capacity = alloc_msize;
 		req->rc->sdata = (char *) req->rc + sizeof(struct p9_fcall);
-		req->rc->capacity = c->msize;
+		req->rc->capacity = alloc_msize;
 	}
 
 	p9pdu_reset(req->tc);
@@ -458,6 +470,54 @@ static int p9_check_errors(struct p9_client *c, struct p9_req_t *req)
 	return err;
 }
 
+/**
+ * p9_check_zc_errors - check a zero-copy reply for an error return
+ * @c: current client instance
+ * @req: request to parse and check for error conditions
+ * @uidata: payload buffer the reply was received into
+ * @inlen: length of @uidata
+ * @in_hdrlen: number of reply bytes received into the request buffer
+ * @kern_buf: set if @uidata is a kernel buffer
+ *
+ * A zero-copy reply only lands its first @in_hdrlen bytes in req->rc; the
+ * remainder goes straight to the caller's buffer.  An Rerror can be longer
+ * than the header, so pull the spilled part back before parsing it.
+ */
+
+static int p9_check_zc_errors(struct p9_client *c, struct p9_req_t *req,
+			      char *uidata, int inlen, int in_hdrlen,
+			      int kern_buf)
+{
+	int8_t type;
+	int32_t size;
+	int err, len;
+
+	err = p9_parse_header(req->rc, &size, &type, NULL, 0);
+	if (err) {
+		P9_DPRINTK(P9_DEBUG_ERROR, "couldn't parse header %d\n", err);
+		return err;
+	}
+
+	if (type != P9_RERROR)
+		return 0;
+
+	if (size > req->rc->capacity)
+		return -EIO;
+
+	len = size - in_hdrlen;
+	if (len > 0) {
+		if (!uidata || len > inlen)
+			return -EIO;
+		if (kern_buf)
+			memcpy(req->rc->sdata + in_hdrlen, uidata, len);
+		else if (copy_from_user(req->rc->sdata + in_hdrlen,
+					(char __user *)uidata, len))
+			return -EFAULT;
+	}
+
+	return p9_check_errors(c, req);
+}
+
 /**
  * p9_client_flush - flush (cancel) a request
  * c: client state
@@ -501,11 +561,37 @@ static int p9_client_flush(struct p9_client *c, struct p9_req_t *oldreq)
  * Returns request structure (which client must free using p9_free_req)
  */
 
+static struct p9_req_t *
+p9_client_prepare_req(struct p9_client *c, int8_t type, unsigned int max_size,
+		      const char *fmt, va_list ap)
+{
+	int tag;
+	struct p9_req_t *req;
+
+	tag = P9_NOTAG;
+	if (type != P9_TVERSION) {
+		tag = p9_idpool_get(c->tagpool);
+		if (tag < 0)
+			return ERR_PTR(-ENOMEM);
+	}
+
+	req = p9_tag_alloc(c, tag, max_size);
+	if (IS_ERR(req))
+		return req;
+
+	/* marshall the data */
+	p9pdu_prepare(req->tc, tag, type);
+	p9pdu_vwritef(req->tc, c->dotu, fmt, ap);
+	p9pdu_finalize(req->tc);
+
+	return req;
+}
+
 static struct p9_req_t *
 p9_client_rpc(struct p9_client *c, int8_t type, const char *fmt, ...)
 {
 	va_list ap;
-	int tag, err;
+	int err;
 	struct p9_req_t *req;
 	unsigned long flags;
 	int sigpending;
@@ -522,39 +608,29 @@ p9_client_rpc(struct p9_client *c, int8_t type, const char *fmt, ...)
 	} else
 		sigpending = 0;
 
-	tag = P9_NOTAG;
-	if (type != P9_TVERSION) {
-		tag = p9_idpool_get(c->tagpool);
-		if (tag < 0)
-			return ERR_PTR(-ENOMEM);
-	}
-
-	req = p9_tag_alloc(c, tag);
-	if (IS_ERR(req))
-		return req;
-
-	/* marshall the data */
-	p9pdu_prepare(req->tc, tag, type);
 	va_start(ap, fmt);
-	err = p9pdu_vwritef(req->tc, c->dotu, fmt, ap);
+	req = p9_client_prepare_req(c, type, c->msize, fmt, ap);
 	va_end(ap);
-	p9pdu_finalize(req->tc);
+	if (IS_ERR(req))
+		return req;
 
 	err = c->trans_mod->request(c, req);
 	if (err < 0) {
-		c->status = Disconnected;
-		goto reterr;
+		/* interrupted while waiting for room to send it */
+		if (err != -ERESTARTSYS)
+			c->status = Disconnected;
+		goto recalc_sigpending;
 	}
 
 	/* if it was a flush we just transmitted, return our tag */
 	if (type == P9_TFLUSH)
 		return req;
 again:
-	P9_DPRINTK(P9_DEBUG_MUX, "wait %p tag: %d\n", req->wq, tag);
+	P9_DPRINTK(P9_DEBUG_MUX, "wait %p tag: %d\n", req->wq, req->tc->tag);
 	err = wait_event_interruptible(*req->wq,
 						req->status >= REQ_STATUS_RCVD);
 	P9_DPRINTK(P9_DEBUG_MUX, "wait %p tag: %d returned %d (flushed=%d)\n",
-						req->wq, tag, err, flushed);
+					req->wq, req->tc->tag, err, flushed);
 
 	if (req->status == REQ_STATUS_ERROR) {
 		P9_DPRINTK(P9_DEBUG_ERROR, "req_status error %d\n", req->t_err);
@@ -584,6 +660,7 @@ again:
 		}
 	}
 
+recalc_sigpending:
 	if (sigpending) {
 		spin_lock_irqsave(&current->sighand->siglock, flags);
 		recalc_sigpending();
@@ -606,6 +683,103 @@ reterr:
 	return ERR_PTR(err);
 }
 
+/**
+ * p9_client_zc_rpc - issue a zero-copy request and wait for a response
+ * @c: client session
+ * @type: type of request
+ * @uidata: buffer the reply payload should be received into
+ * @uodata: buffer the request payload should be sent from
+ * @inlen: length of the reply payload
+ * @olen: length of the request payload
+ * @in_hdrlen: length of the reply header received into the request buffer
+ * @kern_buf: set if @uidata/@uodata are kernel buffers
+ * @fmt: protocol format string (see protocol.c)
+ *
+ * Only the message headers go through the request buffers; the payload is
+ * handed to the transport to map directly.  Returns request structure
+ * (which client must free using p9_free_req)
+ */
+
+static struct p9_req_t *
+p9_client_zc_rpc(struct p9_client *c, int8_t type, char *uidata,
+		 char *uodata, int inlen, int olen, int in_hdrlen,
+		 int kern_buf, const char *fmt, ...)
+{
+	va_list ap;
+	int err;
+	struct p9_req_t *req;
+	unsigned long flags;
+	int sigpending = 0;
+
+	P9_DPRINTK(P9_DEBUG_MUX, "client %p op %d\n", c, type);
+
+	if (c->status != Connected)
+		return ERR_PTR(-EIO);
+
+	va_start(ap, fmt);
+	req = p9_client_prepare_req(c, type, P9_ZC_HDR_SZ, fmt, ap);
+	va_end(ap);
+	if (IS_ERR(req))
+		return req;
+
+	/* the transport returns once the reply is in place, or with
+	 * -ERESTARTSYS when interrupted */
+	err = c->trans_mod->zc_request(c, req, uidata, uodata,
+				       inlen, olen, in_hdrlen, kern_buf);
+	if (err == -ERESTARTSYS && req->status >= REQ_STATUS_SENT &&
+	    c->status == Connected) {
+		P9_DPRINTK(P9_DEBUG_MUX, "flushing\n");
+		spin_lock_irqsave(&c->lock, flags);
+		if (req->status == REQ_STATUS_SENT)
+			req->status = REQ_STATUS_FLSH;
+		spin_unlock_irqrestore(&c->lock, flags);
+		sigpending = 1;
+		clear_thread_flag(TIF_SIGPENDING);
+
+		/* The server answers the flush only once it is done with
+		 * the request, wait for either. */
+		if (req->status == REQ_STATUS_FLSH &&
+		    c->trans_mod->cancel(c, req) && !p9_client_flush(c, req)) {
+			while (wait_event_interruptible(*req->wq,
+					req->status >= REQ_STATUS_RCVD))
+				clear_thread_flag(TIF_SIGPENDING);
+		}
+		/* if we received the response anyway, don't signal error */
+		if (req->status == REQ_STATUS_RCVD)
+			err = 0;
+	}
+
+	if (sigpending) {
+		spin_lock_irqsave(&current->sighand->siglock, flags);
+		recalc_sigpending();
+		spin_unlock_irqrestore(&current->sighand->siglock, flags);
+	}
+
+	if (err < 0) {
+		if (err == -EIO)
+			c->status = Disconnected;
+		goto reterr;
+	}
+
+	if (req->status == REQ_STATUS_ERROR) {
+		P9_DPRINTK(P9_DEBUG_ERROR, "req_status error %d\n", req->t_err);
+		err = req->t_err;
+		goto reterr;
+	}
+
+	err = p9_check_zc_errors(c, req, uidata, inlen, in_hdrlen, kern_buf);
+	if (!err) {
+		P9_DPRINTK(P9_DEBUG_MUX, "exit: client %p op %d\n", c, type);
+		return req;
+	}
+
+reterr:
+	P9_DPRINTK(P9_DEBUG_MUX, "exit: client %p op %d error: %d\n", c, type,
+									err);
+	p9_free_req(c, req);
+	return ERR_PTR(err);
+}
+
 static struct p9_fid *p9_fid_create(struct p9_client *clnt)
 {
 	int ret;
@@ -1118,6 +1292,43 @@ p9_client_read(struct p9_fid *fid, char *data, char __user *udata, u64 offset,
 	if (count < rsize)
 		rsize = count;
 
+	/* Don't bother zerocopy for small IO (< 1024) */
+	if (clnt->trans_mod->zc_request && rsize > 1024) {
+		char *indata;
+		int kern_buf;
+
+		if (data) {
+			kern_buf = 1;
+			indata = data;
+		} else {
+			kern_buf = 0;
+			indata = (char __force *)udata;
+		}
+		/* response header len is 11
+		 * PDU Header(7) + IO Size (4)
+		 */
+		req = p9_client_zc_rpc(clnt, P9_TREAD, indata, NULL, rsize, 0,
+				       11, kern_buf, "dqd", fid->fid,
+				       offset, rsize);
+		if (IS_ERR(req)) {
+			err = PTR_ERR(req);
+			goto error;
+		}
+
+		err = p9pdu_readf(req->rc, clnt->dotu, "d", &count);
+		if (err) {
+			p9pdu_dump(1, req->rc);
+			goto free_and_error;
+		}
+		if (count > rsize)
+			count = rsize;
+
+		P9_DPRINTK(P9_DEBUG_9P, "<<< RREAD count %d\n", count);
+
+		p9_free_req(clnt, req);
+		return count;
+	}
+
 	req = p9_client_rpc(clnt, P9_TREAD, "dqd", fid->fid, offset, rsize);
 	if (IS_ERR(req)) {
 		err = PTR_ERR(req);
@@ -1175,7 +1386,23 @@ p9_client_write(struct p9_fid *fid, char *data, const char __user *udata,
 
 	if (count < rsize)
 		rsize = count;
-	if (data)
+
+	/* Don't bother zerocopy for small IO (< 1024) */
+	if (clnt->trans_mod->zc_request && rsize > 1024) {
+		char *odata;
+		int kern_buf;
+
+		if (data) {
+			kern_buf = 1;
+			odata = data;
+		} else {
+			kern_buf = 0;
+			odata = (char __force *)udata;
+		}
+		req = p9_client_zc_rpc(clnt, P9_TWRITE, NULL, odata, 0, rsize,
+				       P9_ZC_HDR_SZ, kern_buf, "dqd",
+				       fid->fid, offset, rsize);
+	} else if (data)
 		req = p9_client_rpc(clnt, P9_TWRITE, "dqD", fid->fid, offset,
 								rsize, data);
 	else
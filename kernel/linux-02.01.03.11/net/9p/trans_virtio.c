@@ -42,11 +42,23 @@
 #include <net/9p/client.h>
 #include <net/9p/transport.h>
 #include <linux/scatterlist.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/workqueue.h>
 #include <linux/virtio.h>
 #include <linux/virtio_9p.h>
 
 #define VIRTQUEUE_NUM	128
 
+/*
+ * Largest message, bounded by the scatterlist: a zero copy payload of
+ * msize bytes spans up to msize / PAGE_SIZE + 1 pages, next to at most
+ * two entries for each of the two header buffers.  The reply buffer of a
+ * regular request takes as many entries as a payload, which leaves seven
+ * for the request itself: large payloads always go zero copy.
+ */
+#define P9_VIRTIO_MAXSIZE	(PAGE_SIZE * (VIRTQUEUE_NUM - 8))
+
 /* a single mutex to manage channel initialization and attachment */
 static DEFINE_MUTEX(virtio_9p_lock);
 /* global which tracks highest initialized channel */
@@ -62,7 +74,9 @@ static int chan_index;
  * @tagpool: accounting for tag ids (and request slots)
  * @reqs: array of request slots
  * @max_tag: current number of request_slots allocated
- * @sg: scatter gather list which is used to pack a request (protected?)
+ * @ring_bufs_avail: flag to indicate there is some available in the ring buf
+ * @vc_wq: wait queue for waiting for thing to be added to ring buf
+ * @sg: scatter gather list which is used to pack a request (protected by @lock)
  *
  * We keep all per-channel information in a structure.
  * This structure is allocated within the devices dev->mem space.
@@ -79,11 +93,46 @@ static struct virtio_chan {
 	struct p9_client *client;
 	struct virtio_device *vdev;
 	struct virtqueue *vq;
+	int ring_bufs_avail;
+	wait_queue_head_t vc_wq;
 
 	/* Scatterlist: can be too big for stack. */
 	struct scatterlist sg[VIRTQUEUE_NUM];
 } channels[MAX_9P_CHAN];
 
+/**
+ * struct p9_virtio_zc - payload pages of a zero copy request
+ * @tag: tag of the request the pages belong to
+ * @kern_buf: set if the pages back a kernel buffer
+ * @done: the host has handed the buffer back (protected by the channel lock)
+ * @abandoned: the issuer stopped waiting for the reply; the pages are
+ *	released from @work once the host hands the buffer back
+ * @out_pages: pages of the request payload
+ * @out_nr_pages: number of entries in @out_pages
+ * @in_pages: pages of the reply payload
+ * @in_nr_pages: number of entries in @in_pages
+ * @work: releases the pages of an abandoned request
+ *
+ * The host may DMA into the payload pages until it returns the buffer,
+ * so each zero copy request holds a reference on them until then.  The
+ * structure is the token of the ring buffer, with P9_ZC_TOKEN set to
+ * tell it apart from the &p9_fcall of a regular request.
+ */
+
+struct p9_virtio_zc {
+	u16 tag;
+	int kern_buf;
+	int done;
+	int abandoned;
+	struct page **out_pages;
+	int out_nr_pages;
+	struct page **in_pages;
+	int in_nr_pages;
+	struct work_struct work;
+};
+
+#define P9_ZC_TOKEN	1UL
+
 /* How many bytes left in this page. */
 static unsigned int rest_of_page(void *data)
 {
@@ -124,16 +173,37 @@ static void p9_virtio_close(struct p9_client *client)
 static void req_done(struct virtqueue *vq)
 {
 	struct virtio_chan *chan = vq->vdev->priv;
-	struct p9_fcall *rc;
+	struct p9_virtio_zc *zc;
+	unsigned long token;
 	unsigned int len;
 	struct p9_req_t *req;
+	unsigned long flags;
+	u16 tag;
 
 	P9_DPRINTK(P9_DEBUG_TRANS, ": request done\n");
 
-	while ((rc = chan->vq->vq_ops->get_buf(chan->vq, &len)) != NULL) {
-		P9_DPRINTK(P9_DEBUG_TRANS, ": rc %p\n", rc);
-		P9_DPRINTK(P9_DEBUG_TRANS, ": lookup tag %d\n", rc->tag);
-		req = p9_tag_lookup(chan->client, rc->tag);
+	while (1) {
+		spin_lock_irqsave(&chan->lock, flags);
+		token = (unsigned long)chan->vq->vq_ops->get_buf(chan->vq,
+								 &len);
+		if (!token) {
+			spin_unlock_irqrestore(&chan->lock, flags);
+			break;
+		}
+		if (token & P9_ZC_TOKEN) {
+			zc = (struct p9_virtio_zc *)(token & ~P9_ZC_TOKEN);
+			tag = zc->tag;
+			zc->done = 1;
+			if (zc->abandoned)
+				schedule_work(&zc->work);
+		} else
+			tag = ((struct p9_fcall *)token)->tag;
+		chan->ring_bufs_avail = 1;
+		spin_unlock_irqrestore(&chan->lock, flags);
+		/* Wakeup if anyone waiting for VirtIO ring space. */
+		wake_up(&chan->vc_wq);
+		P9_DPRINTK(P9_DEBUG_TRANS, ": lookup tag %d\n", tag);
+		req = p9_tag_lookup(chan->client, tag);
 		p9_client_cb(chan->client, req);
 	}
 }
@@ -172,6 +242,39 @@ pack_sg_list(struct scatterlist *sg, int start, int limit, char *data,
 	return index-start;
 }
 
+/**
+ * pack_sg_list_p - pack a scatter gather list from an array of pages
+ * @sg: scatter/gather list to pack into
+ * @start: which segment of the sg_list to start at
+ * @limit: maximum segment to pack data to
+ * @pdata: a list of pages to add into sg.
+ * @nr_pages: number of pages to pack into the scatter/gather list
+ * @offs: offset of the data within the first page
+ * @count: amount of data to pack into the scatter/gather list
+ */
+
+static int
+pack_sg_list_p(struct scatterlist *sg, int start, int limit,
+	       struct page **pdata, int nr_pages, size_t offs, int count)
+{
+	int i = 0, s;
+	int data_off = offs;
+	int index = start;
+
+	BUG_ON(nr_pages > (limit - start));
+	while (nr_pages) {
+		s = PAGE_SIZE - data_off;
+		if (s > count)
+			s = count;
+		sg_set_page(&sg[index++], pdata[i++], s, data_off);
+		data_off = 0;
+		count -= s;
+		nr_pages--;
+	}
+
+	return index - start;
+}
+
 /* We don't currently allow canceling of virtio requests */
 static int p9_virtio_cancel(struct p9_client *client, struct p9_req_t *req)
 {
@@ -189,31 +292,279 @@ static int p9_virtio_cancel(struct p9_client *client, struct p9_req_t *req)
 static int
 p9_virtio_request(struct p9_client *client, struct p9_req_t *req)
 {
-	int in, out;
+	int in, out, err;
 	struct virtio_chan *chan = client->trans;
 	char *rdata = (char *)req->rc+sizeof(struct p9_fcall);
+	unsigned long flags;
 
 	P9_DPRINTK(P9_DEBUG_TRANS, "9p debug: virtio request\n");
 
+	req->status = REQ_STATUS_SENT;
+req_retry:
+	spin_lock_irqsave(&chan->lock, flags);
 	out = pack_sg_list(chan->sg, 0, VIRTQUEUE_NUM, req->tc->sdata,
 								req->tc->size);
-	in = pack_sg_list(chan->sg, out, VIRTQUEUE_NUM-out, rdata,
-								client->msize);
-
-	req->status = REQ_STATUS_SENT;
-
-	if (chan->vq->vq_ops->add_buf(chan->vq, chan->sg, out, in, req->tc)) {
+	in = pack_sg_list(chan->sg, out, VIRTQUEUE_NUM, rdata,
+							req->rc->capacity);
+
+	err = chan->vq->vq_ops->add_buf(chan->vq, chan->sg, out, in, req->tc);
+	if (err == -ENOSPC) {
+		chan->ring_bufs_avail = 0;
+		spin_unlock_irqrestore(&chan->lock, flags);
+		err = wait_event_interruptible(chan->vc_wq,
+					       chan->ring_bufs_avail);
+		if (err == -ERESTARTSYS) {
+			req->status = REQ_STATUS_UNSENT;
+			return err;
+		}
+		P9_DPRINTK(P9_DEBUG_TRANS, "9p:Retry virtio request\n");
+		goto req_retry;
+	} else if (err) {
+		spin_unlock_irqrestore(&chan->lock, flags);
 		P9_DPRINTK(P9_DEBUG_TRANS,
 			"9p debug: virtio rpc add_buf returned failure");
 		return -EIO;
 	}
 
 	chan->vq->vq_ops->kick(chan->vq);
+	spin_unlock_irqrestore(&chan->lock, flags);
 
 	P9_DPRINTK(P9_DEBUG_TRANS, "9p debug: virtio request kicked\n");
 	return 0;
 }
 
+/* How many pages does [data, data + len) touch. */
+static int p9_nr_pages(char *data, int len)
+{
+	unsigned long start_page, end_page;
+
+	start_page = (unsigned long)data >> PAGE_SHIFT;
+	end_page = ((unsigned long)data + len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	return end_page - start_page;
+}
+
+static void p9_release_pages(struct page **pages, int nr_pages, int dirty)
+{
+	int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (dirty)
+			set_page_dirty_lock(pages[i]);
+		put_page(pages[i]);
+	}
+}
+
+/**
+ * p9_get_mapped_pages - collect the pages backing a payload buffer
+ * @pages: array to fill in, large enough for p9_nr_pages() entries
+ * @data: start of the buffer
+ * @nr_pages: number of pages the buffer spans
+ * @write: set if the host will write into the buffer
+ * @kern_buf: set if @data is a kernel buffer
+ *
+ * User buffers are pinned with get_user_pages_fast().  Kernel buffers
+ * are resolved to their pages, which are referenced as well so that they
+ * outlive a request the issuer gave up on.  Returns 0 or a negative error.
+ */
+
+static int p9_get_mapped_pages(struct page **pages, char *data,
+			       int nr_pages, int write, int kern_buf)
+{
+	int i, err;
+
+	if (!kern_buf) {
+		err = get_user_pages_fast((unsigned long)data, nr_pages,
+					  write, pages);
+		if (err == nr_pages)
+			return 0;
+		if (err > 0)
+			p9_release_pages(pages, err, 0);
+		return -EFAULT;
+	}
+
+	data = (char *)((unsigned long)data & PAGE_MASK);
+	for (i = 0; i < nr_pages; i++) {
+		if (is_vmalloc_addr(data))
+			pages[i] = vmalloc_to_page(data);
+		else
+			pages[i] = kmap_to_page(data);
+		get_page(pages[i]);
+		data += PAGE_SIZE;
+	}
+	return 0;
+}
+
+static void p9_virtio_zc_release(struct p9_virtio_zc *zc)
+{
+	if (zc->out_pages)
+		p9_release_pages(zc->out_pages, zc->out_nr_pages, 0);
+	if (zc->in_pages)
+		p9_release_pages(zc->in_pages, zc->in_nr_pages,
+				 !zc->kern_buf);
+	kfree(zc->out_pages);
+	kfree(zc->in_pages);
+	kfree(zc);
+}
+
+static void p9_virtio_zc_work(struct work_struct *work)
+{
+	p9_virtio_zc_release(container_of(work, struct p9_virtio_zc, work));
+}
+
+/**
+ * p9_virtio_zc_request - issue a zero copy request
+ * @client: client instance issuing the request
+ * @req: request to be issued
+ * @uidata: user or kernel buffer the reply payload is received into
+ * @uodata: user or kernel buffer the request payload is sent from
+ * @inlen: read buffer size
+ * @outlen: write buffer size
+ * @in_hdr_len: reader header size, This is the size of response protocol data
+ * @kern_buf: set if the buffers are kernel buffers
+ *
+ * Only the headers go through the bounce buffers in @req; the payload pages
+ * are placed in the scatterlist directly.  Returns once the reply is in, or
+ * with -ERESTARTSYS if a signal arrived first.  In that case the request is
+ * still owned by the host and the caller has to flush it; its pages stay
+ * referenced until the host hands the buffer back.
+ */
+
+static int
+p9_virtio_zc_request(struct p9_client *client, struct p9_req_t *req,
+		     char *uidata, char *uodata, int inlen,
+		     int outlen, int in_hdr_len, int kern_buf)
+{
+	int in, out, err;
+	struct virtio_chan *chan = client->trans;
+	struct p9_virtio_zc *zc;
+	unsigned long flags;
+	__le32 sz;
+
+	P9_DPRINTK(P9_DEBUG_TRANS, "9p debug: virtio zc request\n");
+
+	if (in_hdr_len > req->rc->capacity)
+		in_hdr_len = req->rc->capacity;
+
+	zc = kzalloc(sizeof(*zc), GFP_NOFS);
+	if (!zc)
+		return -ENOMEM;
+	zc->tag = req->tc->tag;
+	zc->kern_buf = kern_buf;
+	INIT_WORK(&zc->work, p9_virtio_zc_work);
+
+	if (uodata) {
+		zc->out_nr_pages = p9_nr_pages(uodata, outlen);
+		zc->out_pages = kmalloc(sizeof(struct page *) *
+					zc->out_nr_pages, GFP_NOFS);
+		if (!zc->out_pages) {
+			err = -ENOMEM;
+			goto err_out;
+		}
+		err = p9_get_mapped_pages(zc->out_pages, uodata,
+					  zc->out_nr_pages, 0, kern_buf);
+		if (err) {
+			kfree(zc->out_pages);
+			zc->out_pages = NULL;
+			goto err_out;
+		}
+		/*
+		 * The size field of the message must include the length of
+		 * the header and the length of the data.  We didn't actually
+		 * know the length of the data until this point so add it in
+		 * now.
+		 */
+		sz = cpu_to_le32(req->tc->size + outlen);
+		memcpy(&req->tc->sdata[0], &sz, sizeof(sz));
+	}
+	if (uidata) {
+		zc->in_nr_pages = p9_nr_pages(uidata, inlen);
+		zc->in_pages = kmalloc(sizeof(struct page *) *
+				       zc->in_nr_pages, GFP_NOFS);
+		if (!zc->in_pages) {
+			err = -ENOMEM;
+			goto err_out;
+		}
+		err = p9_get_mapped_pages(zc->in_pages, uidata,
+					  zc->in_nr_pages, 1, kern_buf);
+		if (err) {
+			kfree(zc->in_pages);
+			zc->in_pages = NULL;
+			goto err_out;
+		}
+	}
+
+req_retry_pinned:
+	spin_lock_irqsave(&chan->lock, flags);
+	/* out data */
+	out = pack_sg_list(chan->sg, 0, VIRTQUEUE_NUM, req->tc->sdata,
+							req->tc->size);
+	if (zc->out_pages)
+		out += pack_sg_list_p(chan->sg, out, VIRTQUEUE_NUM,
+				      zc->out_pages, zc->out_nr_pages,
+				      offset_in_page(uodata), outlen);
+	/*
+	 * Take care of in data
+	 * For example TREAD have 11.
+	 * 11 is the read/write header = PDU Header(7) + IO Size (4).
+	 * Arrange in such a way that server places header in the
+	 * alloced memory and payload onto the user buffer.
+	 */
+	in = pack_sg_list(chan->sg, out, VIRTQUEUE_NUM, req->rc->sdata,
+							in_hdr_len);
+	if (zc->in_pages)
+		in += pack_sg_list_p(chan->sg, out + in, VIRTQUEUE_NUM,
+				     zc->in_pages, zc->in_nr_pages,
+				     offset_in_page(uidata), inlen);
+
+	/* The reply may complete the request as soon as it is queued */
+	req->status = REQ_STATUS_SENT;
+	err = chan->vq->vq_ops->add_buf(chan->vq, chan->sg, out, in,
+					(void *)((unsigned long)zc |
+						 P9_ZC_TOKEN));
+	if (err == -ENOSPC) {
+		req->status = REQ_STATUS_UNSENT;
+		chan->ring_bufs_avail = 0;
+		spin_unlock_irqrestore(&chan->lock, flags);
+		err = wait_event_interruptible(chan->vc_wq,
+					       chan->ring_bufs_avail);
+		if (err)
+			goto err_out;
+		P9_DPRINTK(P9_DEBUG_TRANS, "9p:Retry virtio request\n");
+		goto req_retry_pinned;
+	} else if (err) {
+		req->status = REQ_STATUS_UNSENT;
+		spin_unlock_irqrestore(&chan->lock, flags);
+		P9_DPRINTK(P9_DEBUG_TRANS,
+			"9p debug: virtio rpc add_buf returned failure");
+		err = -EIO;
+		goto err_out;
+	}
+
+	chan->vq->vq_ops->kick(chan->vq);
+	spin_unlock_irqrestore(&chan->lock, flags);
+	P9_DPRINTK(P9_DEBUG_TRANS, "9p debug: virtio request kicked\n");
+
+	err = wait_event_interruptible(*req->wq,
+				       req->status >= REQ_STATUS_RCVD);
+	if (err) {
+		spin_lock_irqsave(&chan->lock, flags);
+		if (!zc->done) {
+			/* req_done() releases the pages */
+			zc->abandoned = 1;
+			spin_unlock_irqrestore(&chan->lock, flags);
+			return err;
+		}
+		spin_unlock_irqrestore(&chan->lock, flags);
+		/* The buffer is back, req_done() is handing the reply over */
+		wait_event(*req->wq, req->status >= REQ_STATUS_RCVD);
+		err = 0;
+	}
+
+err_out:
+	p9_virtio_zc_release(zc);
+	return err;
+}
+
 /**
  * p9_virtio_probe - probe for existence of 9P virtio channels
  * @vdev: virtio device to probe
@@ -255,6 +606,9 @@ static int p9_virtio_probe(struct virtio_device *vdev)
 
 	sg_init_table(chan->sg, VIRTQUEUE_NUM);
 
+	init_waitqueue_head(&chan->vc_wq);
+	chan->ring_bufs_avail = 1;
+
 	chan->inuse = false;
 	chan->initialized = true;
 	return 0;
@@ -357,8 +711,9 @@ static struct p9_trans_module p9_virtio_trans = {
 	.create = p9_virtio_create,
 	.close = p9_virtio_close,
 	.request = p9_virtio_request,
+	.zc_request = p9_virtio_zc_request,
 	.cancel = p9_virtio_cancel,
-	.maxsize = PAGE_SIZE*16,
+	.maxsize = P9_VIRTIO_MAXSIZE,
 	.def = 0,
 	.owner = THIS_MODULE,
 };
@@ -379,6 +734,8 @@ static void __exit p9_virtio_cleanup(void)
 {
 	unregister_virtio_driver(&p9_virtio_drv);
 	v9fs_unregister_trans(&p9_virtio_trans);
+	/* Pages of abandoned zero copy requests */
+	flush_scheduled_work();
 }
 
 module_init(p9_virtio_init);
@@ -57,6 +57,13 @@ static inline unsigned long hold_time(const struct net_bridge *br)
 	return br->topology_change ? br->forward_delay : br->ageing_time;
 }
 
+/* How stale the age of an entry in use may get: a tenth of a second,
+ * or less with very short ageing times. */
+static inline unsigned long fdb_refresh_time(const struct net_bridge *br)
+{
+	return min_t(unsigned long, HZ / 10, hold_time(br) / 2);
+}
+
 static inline int has_expired(const struct net_bridge *br,
 				  const struct net_bridge_fdb_entry *fdb)
 {
@@ -327,12 +334,13 @@ static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
 	if (fdb) {
 		memcpy(fdb->addr.addr, addr, ETH_ALEN);
 		atomic_set(&fdb->use_count, 1);
-		hlist_add_head_rcu(&fdb->hlist, head);
-
 		fdb->dst = source;
 		fdb->is_local = is_local;
 		fdb->is_static = is_local;
 		fdb->ageing_timer = jiffies;
+
+		/* lockless readers may see it as soon as it is linked */
+		hlist_add_head_rcu(&fdb->hlist, head);
 	}
 	return fdb;
 }
@@ -401,9 +409,16 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 				       " own address as source address\n",
 				       source->dev->name);
 		} else {
-			/* fastpath: update of existing entry */
-			fdb->dst = source;
-			fdb->ageing_timer = jiffies;
+			/* fastpath: update of existing entry, lockless.
+			 * Only write when something changed, and refresh the
+			 * age at most every fdb_refresh_time(), so that the
+			 * entry's cacheline stays shared across CPUs.
+			 */
+			if (unlikely(fdb->dst != source))
+				fdb->dst = source;
+			if (time_after(jiffies, fdb->ageing_timer +
+					       fdb_refresh_time(br)))
+				fdb->ageing_timer = jiffies;
 		}
 	} else {
 		spin_lock(&br->hash_lock);
@@ -56,8 +56,18 @@ int br_forward_finish(struct sk_buff *skb)
 
 }
 
+static inline void br_port_count_tx(const struct net_bridge_port *to,
+				    const struct sk_buff *skb)
+{
+	struct br_cpu_netstats *stats = br_stats_this_cpu(to->stats);
+
+	stats->tx_packets++;
+	stats->tx_bytes += skb->len;
+}
+
 static void __br_deliver(const struct net_bridge_port *to, struct sk_buff *skb)
 {
+	br_port_count_tx(to, skb);
 	skb->dev = to->dev;
 	NF_HOOK(PF_BRIDGE, NF_BR_LOCAL_OUT, skb, NULL, skb->dev,
 			br_forward_finish);
@@ -67,6 +77,7 @@ static void __br_forward(const struct net_bridge_port *to, struct sk_buff *skb)
 {
 	struct net_device *indev;
 
+	br_port_count_tx(to, skb);
 	indev = skb->dev;
 	skb->dev = to->dev;
 	skb_forward_csum(skb);
@@ -89,6 +89,7 @@ static void release_nbp(struct kobject *kobj)
 {
 	struct net_bridge_port *p
 		= container_of(kobj, struct net_bridge_port, kobj);
+	free_percpu(p->stats);
 	kfree(p);
 }
 
@@ -183,6 +184,12 @@ static struct net_device *new_bridge_dev(struct net *net, const char *name)
 	br = netdev_priv(dev);
 	br->dev = dev;
 
+	br->stats = alloc_percpu(struct br_cpu_netstats);
+	if (!br->stats) {
+		free_netdev(dev);
+		return NULL;
+	}
+
 	spin_lock_init(&br->lock);
 	INIT_LIST_HEAD(&br->port_list);
 	spin_lock_init(&br->hash_lock);
@@ -250,6 +257,12 @@ static struct net_bridge_port *new_nbp(struct net_bridge *br,
 	if (p == NULL)
 		return ERR_PTR(-ENOMEM);
 
+	p->stats = alloc_percpu(struct br_cpu_netstats);
+	if (p->stats == NULL) {
+		kfree(p);
+		return ERR_PTR(-ENOMEM);
+	}
+
 	p->br = br;
 	dev_hold(dev);
 	p->dev = dev;
@@ -291,7 +304,7 @@ int br_add_bridge(struct net *net, const char *name)
 	return ret;
 
 out_free:
-	free_netdev(dev);
+	br_dev_free(dev);
 	goto out;
 }
 
@@ -426,10 +439,14 @@ err2:
 err1:
 	kobject_del(&p->kobj);
 err0:
+	/* the kobject owns the port now, release_nbp() frees it */
 	kobject_put(&p->kobj);
 	dev_set_promiscuity(dev, -1);
+	dev_put(dev);
+	return err;
 put_back:
 	dev_put(dev);
+	free_percpu(p->stats);
 	kfree(p);
 	return err;
 }
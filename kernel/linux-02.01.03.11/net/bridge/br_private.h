@@ -15,6 +15,7 @@
 
 #include <linux/netdevice.h>
 #include <linux/if_bridge.h>
+#include <linux/percpu.h>
 #include <net/route.h>
 
 #define BR_HASH_BITS 8
@@ -45,6 +46,16 @@ struct mac_addr
 	unsigned char	addr[6];
 };
 
+/* Per-CPU packet counters of a bridge or of one of its ports */
+struct br_cpu_netstats
+{
+	unsigned long			rx_packets;
+	unsigned long			rx_bytes;
+	unsigned long			tx_packets;
+	unsigned long			tx_bytes;
+	unsigned long			multicast;
+};
+
 struct net_bridge_fdb_entry
 {
 	struct hlist_node		hlist;
@@ -82,6 +93,8 @@ struct net_bridge_port
 	struct timer_list		message_age_timer;
 	struct kobject			kobj;
 	struct rcu_head			rcu;
+
+	struct br_cpu_netstats		*stats;
 };
 
 struct net_bridge
@@ -89,6 +102,7 @@ struct net_bridge
 	spinlock_t			lock;
 	struct list_head		port_list;
 	struct net_device		*dev;
+	struct br_cpu_netstats		*stats;
 	spinlock_t			hash_lock;
 	struct hlist_head		hash[BR_HASH_SIZE];
 	struct list_head		age_list;
@@ -141,7 +155,17 @@ static inline int br_is_root_bridge(const struct net_bridge *br)
 
 /* br_device.c */
 extern void br_dev_setup(struct net_device *dev);
+extern void br_dev_free(struct net_device *dev);
 extern int br_dev_xmit(struct sk_buff *skb, struct net_device *dev);
+extern void br_stats_sum(const struct br_cpu_netstats *stats,
+			 struct br_cpu_netstats *sum);
+
+/* Callers run with BH or preemption disabled */
+static inline struct br_cpu_netstats *br_stats_this_cpu(
+	struct br_cpu_netstats *stats)
+{
+	return per_cpu_ptr(stats, smp_processor_id());
+}
 
 /* br_fdb.c */
 extern int br_fdb_init(void);
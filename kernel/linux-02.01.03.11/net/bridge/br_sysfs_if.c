@@ -143,6 +143,21 @@ static ssize_t store_flush(struct net_bridge_port *p, unsigned long v)
 }
 static BRPORT_ATTR(flush, S_IWUSR, NULL, store_flush);
 
+#define BRPORT_STAT_ATTR(_name)						\
+static ssize_t show_##_name(struct net_bridge_port *p, char *buf)	\
+{									\
+	struct br_cpu_netstats sum;					\
+									\
+	br_stats_sum(p->stats, &sum);					\
+	return sprintf(buf, "%lu\n", sum._name);			\
+}									\
+static BRPORT_ATTR(_name, S_IRUGO, show_##_name, NULL)
+
+BRPORT_STAT_ATTR(rx_packets);
+BRPORT_STAT_ATTR(rx_bytes);
+BRPORT_STAT_ATTR(tx_packets);
+BRPORT_STAT_ATTR(tx_bytes);
+
 static struct brport_attribute *brport_attrs[] = {
 	&brport_attr_path_cost,
 	&brport_attr_priority,
@@ -159,6 +174,10 @@ static struct brport_attribute *brport_attrs[] = {
 	&brport_attr_forward_delay_timer,
 	&brport_attr_hold_timer,
 	&brport_attr_flush,
+	&brport_attr_rx_packets,
+	&brport_attr_rx_bytes,
+	&brport_attr_tx_packets,
+	&brport_attr_tx_bytes,
 	NULL
 };
 
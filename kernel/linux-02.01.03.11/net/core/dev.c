@@ -126,6 +126,7 @@
 #include <linux/in.h>
 #include <linux/jhash.h>
 #include <linux/random.h>
+#include <linux/filter.h>
 
 #include "net-sysfs.h"
 
@@ -1691,6 +1692,8 @@ gso:
 
 		skb->next = nskb->next;
 		nskb->next = NULL;
+		/* the segments of one GSO packet are a batch of their own */
+		nskb->xmit_more = skb->next ? 1 : skb->xmit_more;
 		rc = ops->ndo_start_xmit(nskb, dev);
 		if (unlikely(rc)) {
 			nskb->next = skb->next;
@@ -1809,6 +1812,9 @@ int dev_queue_xmit(struct sk_buff *skb)
 	struct Qdisc *q;
 	int rc = -ENOMEM;
 
+	/* Set by qdisc_restart() only, whatever a stacked device left here */
+	skb->xmit_more = 0;
+
 	/* GSO will handle the following emulations directly. */
 	if (netif_needs_gso(dev, skb))
 		goto gso;
@@ -3930,6 +3936,9 @@ static int dev_ifsioc(struct net *net, struct ifreq *ifr, unsigned int cmd)
 			ifr->ifr_newname[IFNAMSIZ-1] = '\0';
 			return dev_change_name(dev, ifr->ifr_newname);
 
+		case SIOCSIFRXFILTER:
+			return dev_set_rx_filter(dev, ifr->ifr_data);
+
 		/*
 		 *	Unknown or private ioctl
 		 */
@@ -4102,6 +4111,7 @@ int dev_ioctl(struct net *net, unsigned int cmd, void __user *arg)
 		case SIOCBONDCHANGEACTIVE:
 		case SIOCBRADDIF:
 		case SIOCBRDELIF:
+		case SIOCSIFRXFILTER:
 			if (!capable(CAP_NET_ADMIN))
 				return -EPERM;
 			/* fall through */
@@ -4202,6 +4212,10 @@ static void rollback_registered(struct net_device *dev)
 	/* Shutdown queueing discipline. */
 	dev_shutdown(dev);
 
+	/* Closed and out of receive processing: nothing runs the filter */
+	kfree(dev->rx_filter);
+	dev->rx_filter = NULL;
+
 
 	/* Notify protocols, that we are about to destroy
 	   this device. They should clean all the things.
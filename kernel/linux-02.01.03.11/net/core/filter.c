@@ -24,7 +24,9 @@
 #include <linux/in.h>
 #include <linux/inet.h>
 #include <linux/netdevice.h>
+#include <linux/etherdevice.h>
 #include <linux/if_packet.h>
+#include <linux/rtnetlink.h>
 #include <net/ip.h>
 #include <net/protocol.h>
 #include <net/netlink.h>
@@ -64,6 +66,15 @@ static inline void *load_pointer(struct sk_buff *skb, int k,
 	}
 }
 
+/* A flat buffer only has absolute offsets from its start */
+static inline void *load_buf_pointer(const u8 *data, unsigned int len,
+				     int k, unsigned int size)
+{
+	if (k < 0 || (unsigned int)k > len || size > len - k)
+		return NULL;
+	return (void *)(data + k);
+}
+
 /**
  *	sk_filter - run a packet through a socket filter
  *	@sk: sock associated with &sk_buff
@@ -98,18 +109,14 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 }
 EXPORT_SYMBOL(sk_filter);
 
-/**
- *	sk_run_filter - run a filter on a socket
- *	@skb: buffer to run the filter on
- *	@filter: filter to apply
- *	@flen: length of filter
- *
- * Decode and apply filter instructions to the skb->data.
- * Return length to keep, 0 for none. skb is the data we are
- * filtering, filter is the array of filter instructions, and
- * len is the number of filter blocks in the array.
+/*
+ * The interpreter, for an skb or, when raw is set, for the flat buffer
+ * data/len.  raw is a constant in both callers, so each gets its own
+ * copy without the test.
  */
-unsigned int sk_run_filter(struct sk_buff *skb, struct sock_filter *filter, int flen)
+static __always_inline unsigned int __sk_run_filter(struct sk_buff *skb,
+		const u8 *data, unsigned int len,
+		struct sock_filter *filter, int flen, const int raw)
 {
 	struct sock_filter *fentry;	/* We walk down these */
 	void *ptr;
@@ -210,7 +217,8 @@ unsigned int sk_run_filter(struct sk_buff *skb, struct sock_filter *filter, int
 		case BPF_LD|BPF_W|BPF_ABS:
 			k = fentry->k;
 load_w:
-			ptr = load_pointer(skb, k, 4, &tmp);
+			ptr = raw ? load_buf_pointer(data, len, k, 4) :
+				    load_pointer(skb, k, 4, &tmp);
 			if (ptr != NULL) {
 				A = get_unaligned_be32(ptr);
 				continue;
@@ -219,7 +227,8 @@ load_w:
 		case BPF_LD|BPF_H|BPF_ABS:
 			k = fentry->k;
 load_h:
-			ptr = load_pointer(skb, k, 2, &tmp);
+			ptr = raw ? load_buf_pointer(data, len, k, 2) :
+				    load_pointer(skb, k, 2, &tmp);
 			if (ptr != NULL) {
 				A = get_unaligned_be16(ptr);
 				continue;
@@ -228,17 +237,18 @@ load_h:
 		case BPF_LD|BPF_B|BPF_ABS:
 			k = fentry->k;
 load_b:
-			ptr = load_pointer(skb, k, 1, &tmp);
+			ptr = raw ? load_buf_pointer(data, len, k, 1) :
+				    load_pointer(skb, k, 1, &tmp);
 			if (ptr != NULL) {
 				A = *(u8 *)ptr;
 				continue;
 			}
 			break;
 		case BPF_LD|BPF_W|BPF_LEN:
-			A = skb->len;
+			A = raw ? len : skb->len;
 			continue;
 		case BPF_LDX|BPF_W|BPF_LEN:
-			X = skb->len;
+			X = raw ? len : skb->len;
 			continue;
 		case BPF_LD|BPF_W|BPF_IND:
 			k = X + fentry->k;
@@ -250,7 +260,8 @@ load_b:
 			k = X + fentry->k;
 			goto load_b;
 		case BPF_LDX|BPF_B|BPF_MSH:
-			ptr = load_pointer(skb, fentry->k, 1, &tmp);
+			ptr = raw ? load_buf_pointer(data, len, fentry->k, 1) :
+				    load_pointer(skb, fentry->k, 1, &tmp);
 			if (ptr != NULL) {
 				X = (*(u8 *)ptr & 0xf) << 2;
 				continue;
@@ -289,6 +300,10 @@ load_b:
 			return 0;
 		}
 
+		/* Out of the buffer; dev_set_rx_filter() refused ancillary loads */
+		if (raw)
+			return 0;
+
 		/*
 		 * Handle ancillary data, which are impossible
 		 * (or very difficult) to get parsing packet contents.
@@ -345,8 +360,42 @@ load_b:
 
 	return 0;
 }
+
+/**
+ *	sk_run_filter - run a filter on a socket
+ *	@skb: buffer to run the filter on
+ *	@filter: filter to apply
+ *	@flen: length of filter
+ *
+ * Decode and apply filter instructions to the skb->data.
+ * Return length to keep, 0 for none. skb is the data we are
+ * filtering, filter is the array of filter instructions, and
+ * len is the number of filter blocks in the array.
+ */
+unsigned int sk_run_filter(struct sk_buff *skb, struct sock_filter *filter, int flen)
+{
+	return __sk_run_filter(skb, NULL, 0, filter, flen, 0);
+}
 EXPORT_SYMBOL(sk_run_filter);
 
+/**
+ *	sk_run_filter_buf - run a filter on a flat buffer
+ *	@data: start of the frame, its link layer header
+ *	@len: length of the frame
+ *	@filter: filter to apply
+ *	@flen: length of filter
+ *
+ * Like sk_run_filter(), for a frame that has no skb yet.  Only loads at
+ * non-negative offsets into the frame are possible; the program ends
+ * with a return value of 0 on any other load.
+ */
+unsigned int sk_run_filter_buf(const void *data, unsigned int len,
+			       struct sock_filter *filter, int flen)
+{
+	return __sk_run_filter(NULL, data, len, filter, flen, 1);
+}
+EXPORT_SYMBOL(sk_run_filter_buf);
+
 /**
  *	sk_chk_filter - verify socket filter code
  *	@filter: filter to verify
@@ -539,3 +588,130 @@ int sk_detach_filter(struct sock *sk)
 	rcu_read_unlock_bh();
 	return ret;
 }
+
+/*
+ * A device filter runs before there is an skb, so it has no ancillary
+ * data and no network header: refuse absolute loads at the negative
+ * offsets (SKF_AD_OFF, SKF_NET_OFF, SKF_LL_OFF) that would ask for them,
+ * rather than let them end the program with RXF_DROP on every frame.
+ */
+static int rx_filter_chk(struct sock_filter *filter, int flen)
+{
+	int pc;
+
+	for (pc = 0; pc < flen; pc++) {
+		switch (filter[pc].code) {
+		case BPF_LD|BPF_W|BPF_ABS:
+		case BPF_LD|BPF_H|BPF_ABS:
+		case BPF_LD|BPF_B|BPF_ABS:
+		case BPF_LDX|BPF_B|BPF_MSH:
+			if ((int)filter[pc].k < 0)
+				return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+/**
+ *	dev_set_rx_filter - attach a driver level RX filter to a device
+ *	@dev: device
+ *	@ufprog: the program in user space, or %NULL to detach
+ *
+ * The program is run by drivers that support it on every received frame
+ * before anything else is done with it, see netif_rx_filter().  Must be
+ * called with the RTNL held.
+ */
+int dev_set_rx_filter(struct net_device *dev, struct sock_fprog __user *ufprog)
+{
+	struct sk_filter *fp = NULL, *old_fp;
+	struct sock_fprog fprog;
+	unsigned int fsize;
+	int err;
+
+	ASSERT_RTNL();
+
+	if (ufprog) {
+		if (copy_from_user(&fprog, ufprog, sizeof(fprog)))
+			return -EFAULT;
+		if (fprog.filter == NULL || fprog.len > BPF_MAXINSNS)
+			return -EINVAL;
+
+		fsize = sizeof(struct sock_filter) * fprog.len;
+		fp = kmalloc(fsize + sizeof(*fp), GFP_KERNEL);
+		if (!fp)
+			return -ENOMEM;
+		if (copy_from_user(fp->insns, fprog.filter, fsize)) {
+			kfree(fp);
+			return -EFAULT;
+		}
+		atomic_set(&fp->refcnt, 1);
+		fp->len = fprog.len;
+
+		err = sk_chk_filter(fp->insns, fp->len);
+		if (!err)
+			err = rx_filter_chk(fp->insns, fp->len);
+		if (err) {
+			kfree(fp);
+			return err;
+		}
+	}
+
+	old_fp = dev->rx_filter;
+	rcu_assign_pointer(dev->rx_filter, fp);
+	if (old_fp) {
+		synchronize_net();
+		kfree(old_fp);
+	}
+	return 0;
+}
+
+/* Send a copy of the frame out of dev, as if it came from the stack. */
+static void rx_filter_xmit(struct net_device *dev, const void *data,
+			   unsigned int len)
+{
+	struct sk_buff *skb;
+
+	if (!(dev->flags & IFF_UP) || len > dev->mtu + dev->hard_header_len)
+		return;
+
+	skb = alloc_skb(len + LL_RESERVED_SPACE(dev), GFP_ATOMIC);
+	if (!skb)
+		return;
+	skb_reserve(skb, LL_RESERVED_SPACE(dev));
+	memcpy(skb_put(skb, len), data, len);
+	skb_reset_mac_header(skb);
+	skb->dev = dev;
+	if (len >= ETH_HLEN)
+		skb->protocol = ((struct ethhdr *)data)->h_proto;
+	dev_queue_xmit(skb);
+}
+
+/*
+ * Slow part of netif_rx_filter(): run the program and carry out what it
+ * returned.  Returns 1 if the frame was consumed.
+ */
+int __netif_rx_filter(struct net_device *dev, struct sk_filter *fp,
+		      const void *data, unsigned int len)
+{
+	unsigned int ret = sk_run_filter_buf(data, len, fp->insns, fp->len);
+	struct net_device *to;
+
+	switch (RXF_ACTION(ret)) {
+	case RXF_PASS:
+		return 0;
+	case RXF_TX:
+		rx_filter_xmit(dev, data, len);
+		break;
+	case RXF_REDIRECT:
+		to = dev_get_by_index(dev_net(dev), RXF_IFINDEX(ret));
+		if (to) {
+			rx_filter_xmit(to, data, len);
+			dev_put(to);
+		}
+		break;
+	default:
+		break;
+	}
+	return 1;
+}
+EXPORT_SYMBOL(__netif_rx_filter);
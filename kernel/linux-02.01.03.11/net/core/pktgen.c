@@ -274,6 +274,10 @@ struct pktgen_dev {
 				 * For instance, if you want to send 1024 identical packets
 				 * before creating a new packet, set clone_skb to 1024.
 				 */
+	unsigned int burst;	/* Copies of the packet handed to the driver
+				 * back to back, all but the last with
+				 * skb->xmit_more set.
+				 */
 
 	char dst_min[IP_NAME_SZ];	/* IP, ie 1.2.3.4 */
 	char dst_max[IP_NAME_SZ];	/* IP, ie 1.2.3.4 */
@@ -528,6 +532,8 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 	seq_printf(seq, "     flows: %u flowlen: %u\n", pkt_dev->cflows,
 		   pkt_dev->lflow);
 
+	seq_printf(seq, "     burst: %u\n", pkt_dev->burst);
+
 	seq_printf(seq,
 		   "     queue_map_min: %u  queue_map_max: %u\n",
 		   pkt_dev->queue_map_min,
@@ -1024,6 +1030,17 @@ static ssize_t pktgen_if_write(struct file *file,
 		sprintf(pg_result, "OK: clone_skb=%d", pkt_dev->clone_skb);
 		return count;
 	}
+	if (!strcmp(name, "burst")) {
+		len = num_arg(&user_buffer[i], 10, &value);
+		if (len < 0) {
+			return len;
+		}
+		i += len;
+		pkt_dev->burst = value < 1 ? 1 : value;
+
+		sprintf(pg_result, "OK: burst=%u", pkt_dev->burst);
+		return count;
+	}
 	if (!strcmp(name, "count")) {
 		len = num_arg(&user_buffer[i], 10, &value);
 		if (len < 0) {
@@ -3359,6 +3376,7 @@ static __inline__ void pktgen_xmit(struct pktgen_dev *pkt_dev)
 	struct netdev_queue *txq;
 	__u64 idle_start = 0;
 	u16 queue_map;
+	unsigned int burst;
 	int ret;
 
 	if (pkt_dev->delay_us || pkt_dev->delay_ns) {
@@ -3435,12 +3453,17 @@ static __inline__ void pktgen_xmit(struct pktgen_dev *pkt_dev)
 	queue_map = skb_get_queue_mapping(pkt_dev->skb);
 	txq = netdev_get_tx_queue(odev, queue_map);
 
+	burst = pkt_dev->burst;
+	if (pkt_dev->count && burst > pkt_dev->count - pkt_dev->sofar)
+		burst = pkt_dev->count - pkt_dev->sofar;
+
 	__netif_tx_lock_bh(txq);
 	if (!netif_tx_queue_stopped(txq) &&
 	    !netif_tx_queue_frozen(txq)) {
 
 		atomic_inc(&(pkt_dev->skb->users));
 	      retry_now:
+		pkt_dev->skb->xmit_more = burst > 1;
 		ret = (*xmit)(pkt_dev->skb, odev);
 		if (likely(ret == NETDEV_TX_OK)) {
 			pkt_dev->last_ok = 1;
@@ -3448,6 +3471,12 @@ static __inline__ void pktgen_xmit(struct pktgen_dev *pkt_dev)
 			pkt_dev->seq_num++;
 			pkt_dev->tx_bytes += pkt_dev->cur_pkt_size;
 
+			if (--burst > 0 &&
+			    !netif_tx_queue_stopped(txq) &&
+			    !netif_tx_queue_frozen(txq)) {
+				atomic_inc(&(pkt_dev->skb->users));
+				goto retry_now;
+			}
 		} else if (ret == NETDEV_TX_LOCKED
 			   && (odev->features & NETIF_F_LLTX)) {
 			cpu_relax();
@@ -3656,6 +3685,7 @@ static int pktgen_add_device(struct pktgen_thread *t, const char *ifname)
 	pkt_dev->max_pkt_size = ETH_ZLEN;
 	pkt_dev->nfrags = 0;
 	pkt_dev->clone_skb = pg_clone_skb_d;
+	pkt_dev->burst = 1;
 	pkt_dev->delay_us = pg_delay_d / 1000;
 	pkt_dev->delay_ns = pg_delay_d % 1000;
 	pkt_dev->count = pg_count_d;
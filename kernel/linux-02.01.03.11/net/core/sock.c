@@ -212,6 +212,9 @@ __u32 sysctl_rmem_default __read_mostly = SK_RMEM_MAX;
 /* Maximal space eaten by iovec or ancilliary data plus some space */
 int sysctl_optmem_max __read_mostly = sizeof(unsigned long)*(2*UIO_MAXIOV+512);
 
+/* Pages a CPU may charge or uncharge before memory_allocated is updated */
+int sysctl_mem_pcpu_rsv __read_mostly = 1 << (20 - PAGE_SHIFT);
+
 static int sock_set_timeout(long *timeo_p, char __user *optval, int optlen)
 {
 	struct timeval tv;
@@ -1030,6 +1033,7 @@ struct sock *sk_clone(const struct sock *sk, const gfp_t priority)
 				af_family_clock_key_strings[newsk->sk_family]);
 
 		newsk->sk_dst_cache	= NULL;
+		newsk->sk_rx_dst	= NULL;
 		newsk->sk_wmem_queued	= 0;
 		newsk->sk_forward_alloc = 0;
 		newsk->sk_send_head	= NULL;
@@ -1140,6 +1144,15 @@ void sock_rfree(struct sk_buff *skb)
 	sk_mem_uncharge(skb->sk, skb->truesize);
 }
 
+/*
+ * Destructor of a packet the socket was found for before routing, when
+ * it is freed before the protocol took the socket over.
+ */
+void sock_edemux(struct sk_buff *skb)
+{
+	sock_put(skb->sk);
+}
+
 
 int sock_i_uid(struct sock *sk)
 {
@@ -1414,6 +1427,52 @@ int sk_wait_data(struct sock *sk, long *timeo)
 
 EXPORT_SYMBOL(sk_wait_data);
 
+/*
+ * Charges to prot->memory_allocated go through a per-CPU reserve and reach
+ * the shared counter only once sysctl_mem_pcpu_rsv pages have piled up
+ * either way, so the pressure checks against sysctl_mem[] may be off by
+ * that much per CPU.  Both are used from process and softirq context.
+ */
+static void sk_memory_allocated_add(struct proto *prot, int amt)
+{
+	unsigned long flags;
+	int *reserve;
+
+	if (unlikely(!prot->per_cpu_fw_alloc)) {
+		atomic_add(amt, prot->memory_allocated);
+		return;
+	}
+
+	local_irq_save(flags);
+	reserve = per_cpu_ptr(prot->per_cpu_fw_alloc, smp_processor_id());
+	*reserve += amt;
+	if (*reserve >= sysctl_mem_pcpu_rsv) {
+		atomic_add(*reserve, prot->memory_allocated);
+		*reserve = 0;
+	}
+	local_irq_restore(flags);
+}
+
+static void sk_memory_allocated_sub(struct proto *prot, int amt)
+{
+	unsigned long flags;
+	int *reserve;
+
+	if (unlikely(!prot->per_cpu_fw_alloc)) {
+		atomic_sub(amt, prot->memory_allocated);
+		return;
+	}
+
+	local_irq_save(flags);
+	reserve = per_cpu_ptr(prot->per_cpu_fw_alloc, smp_processor_id());
+	*reserve -= amt;
+	if (*reserve <= -sysctl_mem_pcpu_rsv) {
+		atomic_add(*reserve, prot->memory_allocated);
+		*reserve = 0;
+	}
+	local_irq_restore(flags);
+}
+
 /**
  *	__sk_mem_schedule - increase sk_forward_alloc and memory_allocated
  *	@sk: socket
@@ -1431,7 +1490,8 @@ int __sk_mem_schedule(struct sock *sk, int size, int kind)
 	int allocated;
 
 	sk->sk_forward_alloc += amt * SK_MEM_QUANTUM;
-	allocated = atomic_add_return(amt, prot->memory_allocated);
+	sk_memory_allocated_add(prot, amt);
+	allocated = atomic_read(prot->memory_allocated);
 
 	/* Under limit. */
 	if (allocated <= prot->sysctl_mem[0]) {
@@ -1489,7 +1549,7 @@ suppress_allocation:
 
 	/* Alas. Undo changes. */
 	sk->sk_forward_alloc -= amt * SK_MEM_QUANTUM;
-	atomic_sub(amt, prot->memory_allocated);
+	sk_memory_allocated_sub(prot, amt);
 	return 0;
 }
 
@@ -1503,8 +1563,8 @@ void __sk_mem_reclaim(struct sock *sk)
 {
 	struct proto *prot = sk->sk_prot;
 
-	atomic_sub(sk->sk_forward_alloc >> SK_MEM_QUANTUM_SHIFT,
-		   prot->memory_allocated);
+	sk_memory_allocated_sub(prot,
+				sk->sk_forward_alloc >> SK_MEM_QUANTUM_SHIFT);
 	sk->sk_forward_alloc &= SK_MEM_QUANTUM - 1;
 
 	if (prot->memory_pressure && *prot->memory_pressure &&
@@ -1774,6 +1834,8 @@ void release_sock(struct sock *sk)
 	spin_lock_bh(&sk->sk_lock.slock);
 	if (sk->sk_backlog.tail)
 		__release_sock(sk);
+	if (sk->sk_prot->release_cb)
+		sk->sk_prot->release_cb(sk);
 	sk->sk_lock.owned = 0;
 	if (waitqueue_active(&sk->sk_lock.wq))
 		wake_up(&sk->sk_lock.wq);
@@ -2039,6 +2101,15 @@ static inline void release_proto_idx(struct proto *prot)
 
 int proto_register(struct proto *prot, int alloc_slab)
 {
+	if (prot->memory_allocated && !prot->per_cpu_fw_alloc) {
+		prot->per_cpu_fw_alloc = alloc_percpu(int);
+		if (prot->per_cpu_fw_alloc == NULL) {
+			printk(KERN_CRIT "%s: Can't allocate memory reserves!\n",
+			       prot->name);
+			goto out;
+		}
+	}
+
 	if (alloc_slab) {
 		prot->slab = kmem_cache_create(prot->name, prot->obj_size, 0,
 					SLAB_HWCACHE_ALIGN | prot->slab_flags,
@@ -2047,7 +2118,7 @@ int proto_register(struct proto *prot, int alloc_slab)
 		if (prot->slab == NULL) {
 			printk(KERN_CRIT "%s: Can't create sock SLAB cache!\n",
 			       prot->name);
-			goto out;
+			goto out_free_reserves;
 		}
 
 		if (prot->rsk_prot != NULL) {
@@ -2108,6 +2179,11 @@ out_free_request_sock_slab_name:
 out_free_sock_slab:
 	kmem_cache_destroy(prot->slab);
 	prot->slab = NULL;
+out_free_reserves:
+	if (prot->per_cpu_fw_alloc) {
+		free_percpu(prot->per_cpu_fw_alloc);
+		prot->per_cpu_fw_alloc = NULL;
+	}
 out:
 	return -ENOBUFS;
 }
@@ -2137,6 +2213,17 @@ void proto_unregister(struct proto *prot)
 		kfree(prot->twsk_prot->twsk_slab_name);
 		prot->twsk_prot->twsk_slab = NULL;
 	}
+
+	if (prot->per_cpu_fw_alloc != NULL) {
+		int cpu;
+
+		/* hand back what the CPUs still hold */
+		for_each_possible_cpu(cpu)
+			atomic_add(*per_cpu_ptr(prot->per_cpu_fw_alloc, cpu),
+				   prot->memory_allocated);
+		free_percpu(prot->per_cpu_fw_alloc);
+		prot->per_cpu_fw_alloc = NULL;
+	}
 }
 
 EXPORT_SYMBOL(proto_unregister);
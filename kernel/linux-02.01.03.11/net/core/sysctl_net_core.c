@@ -13,6 +13,10 @@
 #include <linux/init.h>
 #include <net/sock.h>
 
+static int zero;
+static int one = 1;
+static int tx_bulk_max = 256;
+
 static struct ctl_table net_core_table[] = {
 #ifdef CONFIG_NET
 	{
@@ -97,6 +101,25 @@ static struct ctl_table net_core_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec
 	},
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "netdev_tx_bulk",
+		.data		= &netdev_tx_bulk,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &one,
+		.extra2		= &tx_bulk_max,
+	},
+	{
+		.ctl_name	= CTL_UNNUMBERED,
+		.procname	= "mem_pcpu_rsv",
+		.data		= &sysctl_mem_pcpu_rsv,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &zero,
+	},
 	{
 		.ctl_name	= NET_CORE_WARNINGS,
 		.procname	= "warnings",
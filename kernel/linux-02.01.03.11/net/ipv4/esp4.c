@@ -445,9 +445,16 @@ static int esp_init_aead(struct xfrm_state *x)
 {
 	struct esp_data *esp = x->data;
 	struct crypto_aead *aead;
+	char aead_name[CRYPTO_MAX_ALG_NAME];
 	int err;
 
-	aead = crypto_alloc_aead(x->aead->alg_name, 0, 0);
+	err = -ENAMETOOLONG;
+	if (snprintf(aead_name, CRYPTO_MAX_ALG_NAME,
+		     x->props.flags & XFRM_STATE_PCRYPT ? "pcrypt(%s)" : "%s",
+		     x->aead->alg_name) >= CRYPTO_MAX_ALG_NAME)
+		goto error;
+
+	aead = crypto_alloc_aead(aead_name, 0, 0);
 	err = PTR_ERR(aead);
 	if (IS_ERR(aead))
 		goto error;
@@ -484,7 +491,9 @@ static int esp_init_authenc(struct xfrm_state *x)
 		goto error;
 
 	err = -ENAMETOOLONG;
-	if (snprintf(authenc_name, CRYPTO_MAX_ALG_NAME, "authenc(%s,%s)",
+	if (snprintf(authenc_name, CRYPTO_MAX_ALG_NAME,
+		     x->props.flags & XFRM_STATE_PCRYPT ?
+		     "pcrypt(authenc(%s,%s))" : "authenc(%s,%s)",
 		     x->aalg ? x->aalg->alg_name : "digest_null",
 		     x->ealg->alg_name) >= CRYPTO_MAX_ALG_NAME)
 		goto error;
@@ -19,87 +19,306 @@
 #include <linux/random.h>
 #include <linux/skbuff.h>
 #include <linux/rtnetlink.h>
+#include <linux/slab.h>
 
 #include <net/inet_frag.h>
 
-static void inet_frag_secret_rebuild(unsigned long dummy)
+static struct inet_frag_hash *inet_frag_hash_alloc(unsigned int size,
+						   gfp_t gfp)
 {
-	struct inet_frags *f = (struct inet_frags *)dummy;
-	unsigned long now = jiffies;
-	int i;
+	struct inet_frag_hash *h;
+	unsigned int i;
+
+	h = kmalloc(sizeof(*h) + size * sizeof(struct inet_frag_bucket), gfp);
+	if (h == NULL)
+		return NULL;
+
+	h->mask = size - 1;
+	for (i = 0; i < size; i++) {
+		INIT_HLIST_HEAD(&h->buckets[i].chain);
+		spin_lock_init(&h->buckets[i].chain_lock);
+	}
+	return h;
+}
+
+static void inet_frag_hash_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct inet_frag_hash, rcu));
+}
+
+/*
+ * Pick a new secret and relink every queue; when nh is given, the queues
+ * are moved to that (larger) table which then replaces the current one.
+ * Called from the worker, i.e. in process context.
+ */
+static void inet_frag_secret_rebuild(struct inet_frags *f,
+				     struct inet_frag_hash *nh)
+{
+	struct inet_frag_hash *oh;
+	unsigned int i;
+
+	write_seqlock_bh(&f->rnd_seqlock);
+	oh = f->hash;
+	if (nh != NULL && nh->mask <= oh->mask) {
+		/* someone else grew the table meanwhile */
+		kfree(nh);
+		nh = NULL;
+	}
+	if (nh == NULL)
+		nh = oh;
 
-	write_lock(&f->lock);
 	get_random_bytes(&f->rnd, sizeof(u32));
-	for (i = 0; i < INETFRAGS_HASHSZ; i++) {
+	for (i = 0; i <= oh->mask; i++) {
+		struct inet_frag_bucket *hb = &oh->buckets[i];
 		struct inet_frag_queue *q;
 		struct hlist_node *p, *n;
 
-		hlist_for_each_entry_safe(q, p, n, &f->hash[i], list) {
-			unsigned int hval = f->hashfn(q);
-
-			if (hval != i) {
+		spin_lock(&hb->chain_lock);
+		hlist_for_each_entry_safe(q, p, n, &hb->chain, list) {
+			struct inet_frag_bucket *hb_dest;
+
+			hb_dest = &nh->buckets[f->hashfn(q) & nh->mask];
+			if (hb_dest != hb) {
+				/* This is the only place where a second
+				 * chain_lock is taken while holding one.
+				 * Readers never hold two, and writers are
+				 * serialised by rnd_seqlock, so this can
+				 * not deadlock.
+				 */
+				spin_lock_nested(&hb_dest->chain_lock,
+						 SINGLE_DEPTH_NESTING);
 				hlist_del(&q->list);
-
-				/* Relink to new hash chain. */
-				hlist_add_head(&q->list, &f->hash[hval]);
+				hlist_add_head(&q->list, &hb_dest->chain);
+				spin_unlock(&hb_dest->chain_lock);
 			}
 		}
+		spin_unlock(&hb->chain_lock);
+	}
+
+	if (nh != oh)
+		rcu_assign_pointer(f->hash, nh);
+	write_sequnlock_bh(&f->rnd_seqlock);
+
+	if (nh != oh)
+		call_rcu_bh(&oh->rcu, inet_frag_hash_free_rcu);
+}
+
+static void inet_frag_secret_timer(unsigned long dummy)
+{
+	struct inet_frags *f = (struct inet_frags *)dummy;
+
+	f->rebuild = 1;
+	schedule_work(&f->frags_work);
+	mod_timer(&f->secret_timer, jiffies + f->secret_interval);
+}
+
+static inline void inet_frag_schedule_worker(struct inet_frags *f)
+{
+	if (unlikely(!work_pending(&f->frags_work)))
+		schedule_work(&f->frags_work);
+}
+
+static inline int inet_fragq_should_evict(const struct inet_frag_queue *q)
+{
+	return q->net->low_thresh == 0 ||
+	       frag_mem_limit(q->net) >= q->net->low_thresh;
+}
+
+#define INETFRAGS_EVICT_BATCH	16
+
+/*
+ * Evict the queues of bucket i that belong to a namespace over its low
+ * threshold.  Up to INETFRAGS_EVICT_BATCH victims are collected under
+ * the chain lock, which pins the table only for that long; each one is
+ * then torn down with BH disabled just around itself, so that a long
+ * walk does not keep softirqs off.  Evicted queues go through
+ * f->frag_expire() with INET_FRAG_EVICTED set, as if their timer fired.
+ * If sync is set, also wait for timers that are already running, so
+ * that no queue of the namespace survives us.
+ * Called from process context.
+ */
+static unsigned int inet_evict_bucket(struct inet_frags *f, unsigned int i,
+				      int sync)
+{
+	struct inet_frag_queue *fq, *victims[INETFRAGS_EVICT_BATCH];
+	struct inet_frag_hash *h;
+	struct inet_frag_bucket *hb;
+	struct hlist_node *n;
+	unsigned int j, nr, evicted = 0;
+
+again:
+	nr = 0;
+	rcu_read_lock_bh();
+	h = rcu_dereference(f->hash);
+	hb = &h->buckets[i & h->mask];
+	spin_lock(&hb->chain_lock);
+	hlist_for_each_entry(fq, n, &hb->chain, list) {
+		if (!inet_fragq_should_evict(fq))
+			continue;
+		atomic_inc(&fq->refcnt);
+		victims[nr++] = fq;
+		if (nr == INETFRAGS_EVICT_BATCH)
+			break;
+	}
+	spin_unlock(&hb->chain_lock);
+	rcu_read_unlock_bh();
+
+	for (j = 0; j < nr; j++) {
+		fq = victims[j];
+		local_bh_disable();
+		if (del_timer(&fq->timer)) {
+			/* We now own the timer's reference, which
+			 * frag_expire() drops. */
+			spin_lock(&fq->lock);
+			fq->last_in |= INET_FRAG_EVICTED;
+			spin_unlock(&fq->lock);
+			f->frag_expire((unsigned long)fq);
+			evicted++;
+		} else if (sync) {
+			local_bh_enable();
+			del_timer_sync(&fq->timer);
+			local_bh_disable();
+		}
+		inet_frag_put(fq, f);
+		local_bh_enable();
 	}
-	write_unlock(&f->lock);
+	if (nr == INETFRAGS_EVICT_BATCH)
+		goto again;
 
-	mod_timer(&f->secret_timer, now + f->secret_interval);
+	return evicted;
 }
 
-void inet_frags_init(struct inet_frags *f)
+static void inet_frag_worker(struct work_struct *work)
 {
-	int i;
+	struct inet_frags *f = container_of(work, struct inet_frags,
+					    frags_work);
+	struct inet_frag_hash *h, *nh = NULL;
+	unsigned int budget = INETFRAGS_EVICT_BUCKETS;
+	unsigned int i, size, evicted = 0;
+
+	for (i = f->next_bucket; budget; --budget) {
+		evicted += inet_evict_bucket(f, i++, 0);
+		if (evicted > INETFRAGS_EVICT_MAX)
+			break;
+	}
+
+	rcu_read_lock_bh();
+	h = rcu_dereference(f->hash);
+	f->next_bucket = i & h->mask;
+	size = h->mask + 1;
+	rcu_read_unlock_bh();
 
-	for (i = 0; i < INETFRAGS_HASHSZ; i++)
-		INIT_HLIST_HEAD(&f->hash[i]);
+	if (f->grow) {
+		f->grow = 0;
+		nh = inet_frag_hash_alloc(2 * size, GFP_KERNEL);
+	}
+	if (f->rebuild || nh != NULL) {
+		f->rebuild = 0;
+		inet_frag_secret_rebuild(f, nh);
+	}
+}
 
-	rwlock_init(&f->lock);
+int inet_frags_init(struct inet_frags *f)
+{
+	f->hash = inet_frag_hash_alloc(INETFRAGS_HASHSZ, GFP_KERNEL);
+	if (f->hash == NULL)
+		return -ENOMEM;
+
+	seqlock_init(&f->rnd_seqlock);
+	INIT_WORK(&f->frags_work, inet_frag_worker);
+	f->next_bucket = 0;
+	f->rebuild = 0;
+	f->grow = 0;
+	atomic_set(&f->nqueues, 0);
 
 	f->rnd = (u32) ((num_physpages ^ (num_physpages>>7)) ^
 				   (jiffies ^ (jiffies >> 6)));
 
-	setup_timer(&f->secret_timer, inet_frag_secret_rebuild,
+	setup_timer(&f->secret_timer, inet_frag_secret_timer,
 			(unsigned long)f);
 	f->secret_timer.expires = jiffies + f->secret_interval;
 	add_timer(&f->secret_timer);
+	return 0;
 }
 EXPORT_SYMBOL(inet_frags_init);
 
-void inet_frags_init_net(struct netns_frags *nf)
+int inet_frags_init_net(struct netns_frags *nf)
 {
-	nf->nqueues = 0;
-	atomic_set(&nf->mem, 0);
-	INIT_LIST_HEAD(&nf->lru_list);
+	atomic_set(&nf->nqueues, 0);
+	return percpu_counter_init(&nf->mem, 0);
 }
 EXPORT_SYMBOL(inet_frags_init_net);
 
+/* All namespaces using f must be gone already. */
 void inet_frags_fini(struct inet_frags *f)
 {
-	del_timer(&f->secret_timer);
+	del_timer_sync(&f->secret_timer);
+	cancel_work_sync(&f->frags_work);
+	rcu_barrier_bh();
+	kfree(f->hash);
 }
 EXPORT_SYMBOL(inet_frags_fini);
 
 void inet_frags_exit_net(struct netns_frags *nf, struct inet_frags *f)
 {
+	unsigned int seq, i, size;
+
 	nf->low_thresh = 0;
 
-	local_bh_disable();
-	inet_frag_evictor(nf, f);
-	local_bh_enable();
+	/* A rebuild moves queues between buckets; walk again if one ran */
+evict_again:
+	seq = read_seqbegin(&f->rnd_seqlock);
+	rcu_read_lock_bh();
+	size = rcu_dereference(f->hash)->mask + 1;
+	rcu_read_unlock_bh();
+	for (i = 0; i < size; i++)
+		inet_evict_bucket(f, i, 1);
+	if (read_seqretry(&f->rnd_seqlock, seq))
+		goto evict_again;
+
+	percpu_counter_destroy(&nf->mem);
 }
 EXPORT_SYMBOL(inet_frags_exit_net);
 
+/*
+ * Lock the bucket fq hashes to.  rnd and the table may change under us
+ * until we hold the chain lock and the sequence is still the same.
+ */
+static struct inet_frag_bucket *
+get_frag_bucket_locked(struct inet_frag_queue *fq, struct inet_frags *f)
+{
+	struct inet_frag_hash *h;
+	struct inet_frag_bucket *hb;
+	unsigned int seq;
+
+	rcu_read_lock_bh();
+restart:
+	seq = read_seqbegin(&f->rnd_seqlock);
+	h = rcu_dereference(f->hash);
+	hb = &h->buckets[f->hashfn(fq) & h->mask];
+	spin_lock(&hb->chain_lock);
+	if (read_seqretry(&f->rnd_seqlock, seq)) {
+		spin_unlock(&hb->chain_lock);
+		goto restart;
+	}
+	return hb;
+}
+
+static inline void put_frag_bucket(struct inet_frag_bucket *hb)
+{
+	spin_unlock(&hb->chain_lock);
+	rcu_read_unlock_bh();
+}
+
 static inline void fq_unlink(struct inet_frag_queue *fq, struct inet_frags *f)
 {
-	write_lock(&f->lock);
+	struct inet_frag_bucket *hb;
+
+	hb = get_frag_bucket_locked(fq, f);
 	hlist_del(&fq->list);
-	list_del(&fq->lru_list);
-	fq->net->nqueues--;
-	write_unlock(&f->lock);
+	put_frag_bucket(hb);
+	atomic_dec(&fq->net->nqueues);
+	atomic_dec(&f->nqueues);
 }
 
 void inet_frag_kill(struct inet_frag_queue *fq, struct inet_frags *f)
@@ -122,7 +341,7 @@ static inline void frag_kfree_skb(struct netns_frags *nf, struct inet_frags *f,
 	if (work)
 		*work -= skb->truesize;
 
-	atomic_sub(skb->truesize, &nf->mem);
+	sub_frag_mem_limit(nf, skb->truesize);
 	if (f->skb_free)
 		f->skb_free(skb);
 	kfree_skb(skb);
@@ -149,7 +368,7 @@ void inet_frag_destroy(struct inet_frag_queue *q, struct inet_frags *f,
 
 	if (work)
 		*work -= f->qsize;
-	atomic_sub(f->qsize, &nf->mem);
+	sub_frag_mem_limit(nf, f->qsize);
 
 	if (f->destructor)
 		f->destructor(q);
@@ -158,64 +377,32 @@ void inet_frag_destroy(struct inet_frag_queue *q, struct inet_frags *f,
 }
 EXPORT_SYMBOL(inet_frag_destroy);
 
-int inet_frag_evictor(struct netns_frags *nf, struct inet_frags *f)
-{
-	struct inet_frag_queue *q;
-	int work, evicted = 0;
-
-	work = atomic_read(&nf->mem) - nf->low_thresh;
-	while (work > 0) {
-		read_lock(&f->lock);
-		if (list_empty(&nf->lru_list)) {
-			read_unlock(&f->lock);
-			break;
-		}
-
-		q = list_first_entry(&nf->lru_list,
-				struct inet_frag_queue, lru_list);
-		atomic_inc(&q->refcnt);
-		read_unlock(&f->lock);
-
-		spin_lock(&q->lock);
-		if (!(q->last_in & INET_FRAG_COMPLETE))
-			inet_frag_kill(q, f);
-		spin_unlock(&q->lock);
-
-		if (atomic_dec_and_test(&q->refcnt))
-			inet_frag_destroy(q, f, &work);
-		evicted++;
-	}
-
-	return evicted;
-}
-EXPORT_SYMBOL(inet_frag_evictor);
-
 static struct inet_frag_queue *inet_frag_intern(struct netns_frags *nf,
 		struct inet_frag_queue *qp_in, struct inet_frags *f,
 		void *arg)
 {
+	struct inet_frag_bucket *hb;
 	struct inet_frag_queue *qp;
+	unsigned int size;
 #ifdef CONFIG_SMP
 	struct hlist_node *n;
 #endif
-	unsigned int hash;
 
-	write_lock(&f->lock);
 	/*
 	 * While we stayed w/o the lock other CPU could update
 	 * the rnd seed, so we need to re-calculate the hash
 	 * chain. Fortunatelly the qp_in can be used to get one.
 	 */
-	hash = f->hashfn(qp_in);
+	hb = get_frag_bucket_locked(qp_in, f);
 #ifdef CONFIG_SMP
 	/* With SMP race we have to recheck hash table, because
 	 * such entry could be created on other cpu, while we
-	 * promoted read lock to write lock.
+	 * released the hash bucket lock.
 	 */
-	hlist_for_each_entry(qp, n, &f->hash[hash], list) {
+	hlist_for_each_entry(qp, n, &hb->chain, list) {
 		if (qp->net == nf && f->match(qp, arg)) {
 			atomic_inc(&qp->refcnt);
-			write_unlock(&f->lock);
+			put_frag_bucket(hb);
 			qp_in->last_in |= INET_FRAG_COMPLETE;
 			inet_frag_put(qp_in, f);
 			return qp;
@@ -227,10 +414,17 @@ static struct inet_frag_queue *inet_frag_intern(struct netns_frags *nf,
 		atomic_inc(&qp->refcnt);
 
 	atomic_inc(&qp->refcnt);
-	hlist_add_head(&qp->list, &f->hash[hash]);
-	list_add_tail(&qp->lru_list, &nf->lru_list);
-	nf->nqueues++;
-	write_unlock(&f->lock);
+	hlist_add_head(&qp->list, &hb->chain);
+	put_frag_bucket(hb);
+
+	/* Called under rcu_read_lock_bh() from inet_frag_find() */
+	size = rcu_dereference(f->hash)->mask + 1;
+	atomic_inc(&nf->nqueues);
+	if (atomic_inc_return(&f->nqueues) > INETFRAGS_MAXDEPTH * size &&
+	    size < INETFRAGS_MAXHASHSZ && !f->grow) {
+		f->grow = 1;
+		inet_frag_schedule_worker(f);
+	}
 	return qp;
 }
 
@@ -239,16 +433,22 @@ static struct inet_frag_queue *inet_frag_alloc(struct netns_frags *nf,
 {
 	struct inet_frag_queue *q;
 
+	/* Don't start new datagrams while the worker catches up */
+	if (frag_mem_limit(nf) > nf->high_thresh) {
+		inet_frag_schedule_worker(f);
+		return NULL;
+	}
+
 	q = kzalloc(f->qsize, GFP_ATOMIC);
 	if (q == NULL)
 		return NULL;
 
+	q->net = nf;
 	f->constructor(q, arg);
-	atomic_add(f->qsize, &nf->mem);
+	add_frag_mem_limit(nf, f->qsize);
 	setup_timer(&q->timer, f->frag_expire, (unsigned long)q);
 	spin_lock_init(&q->lock);
 	atomic_set(&q->refcnt, 1);
-	q->net = nf;
 
 	return q;
 }
@@ -265,21 +465,39 @@ static struct inet_frag_queue *inet_frag_create(struct netns_frags *nf,
 	return inet_frag_intern(nf, q, f, arg);
 }
 
+/*
+ * hash is f->hashfn() of the queue looked for; it may have been computed
+ * with a stale secret, in which case we just create a duplicate-free new
+ * queue through inet_frag_intern().
+ */
 struct inet_frag_queue *inet_frag_find(struct netns_frags *nf,
 		struct inet_frags *f, void *key, unsigned int hash)
 {
+	struct inet_frag_hash *h;
+	struct inet_frag_bucket *hb;
 	struct inet_frag_queue *q;
 	struct hlist_node *n;
 
-	hlist_for_each_entry(q, n, &f->hash[hash], list) {
+	if (frag_mem_limit(nf) > nf->low_thresh)
+		inet_frag_schedule_worker(f);
+
+	rcu_read_lock_bh();
+	h = rcu_dereference(f->hash);
+	hb = &h->buckets[hash & h->mask];
+	spin_lock(&hb->chain_lock);
+	hlist_for_each_entry(q, n, &hb->chain, list) {
 		if (q->net == nf && f->match(q, key)) {
 			atomic_inc(&q->refcnt);
-			read_unlock(&f->lock);
+			spin_unlock(&hb->chain_lock);
+			rcu_read_unlock_bh();
 			return q;
 		}
 	}
-	read_unlock(&f->lock);
+	spin_unlock(&hb->chain_lock);
 
-	return inet_frag_create(nf, f, key);
+	q = inet_frag_create(nf, f, key);
+	rcu_read_unlock_bh();
+
+	return q;
 }
 EXPORT_SYMBOL(inet_frag_find);
@@ -12,11 +12,11 @@
 #include <linux/interrupt.h>
 #include <linux/spinlock.h>
 #include <linux/random.h>
-#include <linux/timer.h>
 #include <linux/time.h>
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/net.h>
+#include <net/net_namespace.h>
 #include <net/ip.h>
 #include <net/inetpeer.h>
 
@@ -40,9 +40,11 @@
  *  __ip_select_ident() in net/ipv4/route.c).
  *  Nodes are removed only when reference counter goes to 0.
  *  When it's happened the node may be removed when a sufficient amount of
- *  time has been passed since its last use.  The less-recently-used entry can
- *  also be removed if the pool is overloaded i.e. if the total amount of
- *  entries is greater-or-equal than the threshold.
+ *  time has been passed since its last use.  Unused entries are reclaimed
+ *  lazily: whenever the pool lock is taken for an insertion, the nodes met on
+ *  the lookup path are examined and the expired ones are unlinked.  If the
+ *  pool is overloaded i.e. if the total amount of entries is
+ *  greater-or-equal than the threshold, any unused node on the path goes.
  *
  *  Node pool is organised as an AVL tree.
  *  Such an implementation has been chosen not just for fun.  It's a way to
@@ -50,26 +52,27 @@
  *  amount of long living nodes in a single hash slot would significantly delay
  *  lookups performed with disabled BHs.
  *
+ *  There is one pool per network namespace.
+ *
  *  Serialisation issues.
- *  1.  Nodes may appear in the tree only with the pool write lock held.
- *  2.  Nodes may disappear from the tree only with the pool write lock held
- *      AND reference count being 0.
- *  3.  Nodes appears and disappears from unused node list only under
- *      "inet_peer_unused_lock".
- *  4.  Global variable peer_total is modified under the pool lock.
+ *  1.  Lookups walk the tree under rcu_read_lock_bh() without taking any
+ *      lock.  A walk racing with a rebalance may miss an existing node; such
+ *      a walk is detected with the pool seqlock and redone under the lock.
+ *  2.  Nodes may appear in the tree only with the pool seqlock held.
+ *  3.  Nodes may disappear from the tree only with the pool seqlock held
+ *      AND reference count being 0.  The count is then atomically switched
+ *      from 0 to -1 so that lockless lookups can not revive the node, and
+ *      the memory is freed after an RCU-bh grace period.
+ *  4.  inet_peer_base.total is modified under the pool seqlock.
  *  5.  struct inet_peer fields modification:
- *		avl_left, avl_right, avl_parent, avl_height: pool lock
- *		unused: unused node list lock
- *		refcnt: atomically against modifications on other CPU;
- *		   usually under some other lock to prevent node disappearing
- *		dtime: unused node list lock
+ *		avl_left, avl_right, avl_parent, avl_height: pool seqlock
+ *		refcnt: atomically against modifications on other CPU
+ *		dtime: set before the reference is dropped
  *		v4daddr: unchangeable
- *		ip_id_count: idlock
+ *		ip_id_count: atomic
+ *		orphan: set once, when the namespace goes away
  */
 
-/* Exported for inet_getid inline function.  */
-DEFINE_SPINLOCK(inet_peer_idlock);
-
 static struct kmem_cache *peer_cachep __read_mostly;
 
 #define node_height(x) x->avl_height
@@ -79,25 +82,70 @@ static struct inet_peer peer_fake_node = {
 	.avl_height	= 0
 };
 #define peer_avl_empty (&peer_fake_node)
-static struct inet_peer *peer_root = peer_avl_empty;
-static DEFINE_RWLOCK(peer_pool_lock);
 #define PEER_MAXDEPTH 40 /* sufficient for about 2^27 nodes */
 
-static int peer_total;
 /* Exported for sysctl_net_ipv4.  */
 int inet_peer_threshold __read_mostly = 65536 + 128;	/* start to throw entries more
 					 * aggressively at this stage */
 int inet_peer_minttl __read_mostly = 120 * HZ;	/* TTL under high load: 120 sec */
 int inet_peer_maxttl __read_mostly = 10 * 60 * HZ;	/* usual time to live: 10 min */
+/* There is no periodic collector any more; kept for the sysctl ABI. */
 int inet_peer_gc_mintime __read_mostly = 10 * HZ;
 int inet_peer_gc_maxtime __read_mostly = 120 * HZ;
 
-static LIST_HEAD(unused_peers);
-static DEFINE_SPINLOCK(inet_peer_unused_lock);
+static void inetpeer_free_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(peer_cachep, container_of(head, struct inet_peer, rcu));
+}
+
+static int __net_init inetpeer_net_init(struct net *net)
+{
+	struct inet_peer_base *base;
+
+	base = kmalloc(sizeof(*base), GFP_KERNEL);
+	if (base == NULL)
+		return -ENOMEM;
+
+	base->root = peer_avl_empty;
+	seqlock_init(&base->lock);
+	base->total = 0;
+	net->ipv4.peers = base;
+	return 0;
+}
+
+/*
+ * Mark every node of a dying pool as orphaned and free the unreferenced
+ * ones.  Nodes still held (e.g. by route cache entries waiting for dst_gc)
+ * are freed by the last inet_putpeer().  The recursion is bounded by the
+ * tree height.
+ */
+static void inetpeer_orphan_tree(struct inet_peer *p)
+{
+	if (p == peer_avl_empty)
+		return;
+
+	inetpeer_orphan_tree(p->avl_left);
+	inetpeer_orphan_tree(p->avl_right);
 
-static void peer_check_expire(unsigned long dummy);
-static DEFINE_TIMER(peer_periodic_timer, peer_check_expire, 0, 0);
+	p->orphan = 1;
+	smp_mb();
+	if (atomic_cmpxchg(&p->refcnt, 0, -1) == 0)
+		call_rcu_bh(&p->rcu, inetpeer_free_rcu);
+}
 
+static void __net_exit inetpeer_net_exit(struct net *net)
+{
+	struct inet_peer_base *base = net->ipv4.peers;
+
+	net->ipv4.peers = NULL;
+	inetpeer_orphan_tree(base->root);
+	kfree(base);
+}
+
+static struct pernet_operations inetpeer_net_ops = {
+	.init = inetpeer_net_init,
+	.exit = inetpeer_net_exit,
+};
 
 /* Called from ip_output.c:ip_init  */
 void __init inet_initpeers(void)
@@ -122,36 +170,23 @@ void __init inet_initpeers(void)
 			0, SLAB_HWCACHE_ALIGN|SLAB_PANIC,
 			NULL);
 
-	/* All the timers, started at system startup tend
-	   to synchronize. Perturb it a bit.
-	 */
-	peer_periodic_timer.expires = jiffies
-		+ net_random() % inet_peer_gc_maxtime
-		+ inet_peer_gc_maxtime;
-	add_timer(&peer_periodic_timer);
-}
-
-/* Called with or without local BH being disabled. */
-static void unlink_from_unused(struct inet_peer *p)
-{
-	spin_lock_bh(&inet_peer_unused_lock);
-	list_del_init(&p->unused);
-	spin_unlock_bh(&inet_peer_unused_lock);
+	if (register_pernet_subsys(&inetpeer_net_ops))
+		panic("Failed to create the inet_peer pool\n");
 }
 
 /*
- * Called with local BH disabled and the pool lock held.
+ * Called with local BH disabled and the pool seqlock held.
  * _stack is known to be NULL or not at compile time,
  * so compiler will optimize the if (_stack) tests.
  */
-#define lookup(_daddr, _stack) 					\
+#define lookup(_daddr, _stack, _base)				\
 ({								\
 	struct inet_peer *u, **v;				\
 	if (_stack != NULL) {					\
 		stackptr = _stack;				\
-		*stackptr++ = &peer_root;			\
+		*stackptr++ = &(_base)->root;			\
 	}							\
-	for (u = peer_root; u != peer_avl_empty; ) {		\
+	for (u = (_base)->root; u != peer_avl_empty; ) {	\
 		if (_daddr == u->v4daddr)			\
 			break;					\
 		if ((__force __u32)_daddr < (__force __u32)u->v4daddr)	\
@@ -165,7 +200,37 @@ static void unlink_from_unused(struct inet_peer *p)
 	u;							\
 })
 
-/* Called with local BH disabled and the pool write lock held. */
+/*
+ * Called with rcu_read_lock_bh() held.
+ * Because we hold no lock against a writer, it's quite possible we fall
+ * in an endless loop on a node being rotated, so the walk is bounded by
+ * PEER_MAXDEPTH.  Returns the node with a reference taken, or NULL.
+ */
+static struct inet_peer *lookup_rcu_bh(__be32 daddr, struct inet_peer_base *base)
+{
+	struct inet_peer *u = rcu_dereference(base->root);
+	int count = 0;
+
+	while (u != peer_avl_empty) {
+		if (daddr == u->v4daddr) {
+			/* A node whose count went to -1 has been unlinked
+			 * and is waiting for its grace period: don't revive
+			 * it, the caller will retry under the lock. */
+			if (unlikely(!atomic_add_unless(&u->refcnt, 1, -1)))
+				u = NULL;
+			return u;
+		}
+		if ((__force __u32)daddr < (__force __u32)u->v4daddr)
+			u = rcu_dereference(u->avl_left);
+		else
+			u = rcu_dereference(u->avl_right);
+		if (unlikely(++count == PEER_MAXDEPTH))
+			break;
+	}
+	return NULL;
+}
+
+/* Called with local BH disabled and the pool seqlock held. */
 #define lookup_rightempty(start)				\
 ({								\
 	struct inet_peer *u, **v;				\
@@ -179,7 +244,7 @@ static void unlink_from_unused(struct inet_peer *p)
 	u;							\
 })
 
-/* Called with local BH disabled and the pool write lock held.
+/* Called with local BH disabled and the pool seqlock held.
  * Variable names are the proof of operation correctness.
  * Look into mm/map_avl.c for more detail description of the ideas.  */
 static void peer_avl_rebalance(struct inet_peer **stack[],
@@ -257,207 +322,166 @@ static void peer_avl_rebalance(struct inet_peer **stack[],
 	}
 }
 
-/* Called with local BH disabled and the pool write lock held. */
-#define link_to_pool(n)						\
+/* Called with local BH disabled and the pool seqlock held. */
+#define link_to_pool(n, _base)					\
 do {								\
 	n->avl_height = 1;					\
 	n->avl_left = peer_avl_empty;				\
 	n->avl_right = peer_avl_empty;				\
-	**--stackptr = n;					\
+	/* lockless readers can catch us now */			\
+	rcu_assign_pointer(**--stackptr, n);			\
 	peer_avl_rebalance(stack, stackptr);			\
 } while(0)
 
-/* May be called with local BH enabled. */
-static void unlink_from_pool(struct inet_peer *p)
+/*
+ * Called with local BH disabled and the pool seqlock held, once the
+ * reference count of p has been switched from 0 to -1.
+ */
+static void unlink_from_pool(struct inet_peer *p, struct inet_peer_base *base,
+			     struct inet_peer **stack[PEER_MAXDEPTH])
 {
-	int do_free;
-
-	do_free = 0;
-
-	write_lock_bh(&peer_pool_lock);
-	/* Check the reference counter.  It was artificially incremented by 1
-	 * in cleanup() function to prevent sudden disappearing.  If the
-	 * reference count is still 1 then the node is referenced only as `p'
-	 * here and from the pool.  So under the exclusive pool lock it's safe
-	 * to remove the node and free it later. */
-	if (atomic_read(&p->refcnt) == 1) {
-		struct inet_peer **stack[PEER_MAXDEPTH];
-		struct inet_peer ***stackptr, ***delp;
-		if (lookup(p->v4daddr, stack) != p)
-			BUG();
-		delp = stackptr - 1; /* *delp[0] == p */
-		if (p->avl_left == peer_avl_empty) {
-			*delp[0] = p->avl_right;
-			--stackptr;
-		} else {
-			/* look for a node to insert instead of p */
-			struct inet_peer *t;
-			t = lookup_rightempty(p);
-			BUG_ON(*stackptr[-1] != t);
-			**--stackptr = t->avl_left;
-			/* t is removed, t->v4daddr > x->v4daddr for any
-			 * x in p->avl_left subtree.
-			 * Put t in the old place of p. */
-			*delp[0] = t;
-			t->avl_left = p->avl_left;
-			t->avl_right = p->avl_right;
-			t->avl_height = p->avl_height;
-			BUG_ON(delp[1] != &p->avl_left);
-			delp[1] = &t->avl_left; /* was &p->avl_left */
-		}
-		peer_avl_rebalance(stack, stackptr);
-		peer_total--;
-		do_free = 1;
+	struct inet_peer ***stackptr, ***delp;
+
+	if (lookup(p->v4daddr, stack, base) != p)
+		BUG();
+	delp = stackptr - 1; /* *delp[0] == p */
+	if (p->avl_left == peer_avl_empty) {
+		*delp[0] = p->avl_right;
+		--stackptr;
+	} else {
+		/* look for a node to insert instead of p */
+		struct inet_peer *t;
+		t = lookup_rightempty(p);
+		BUG_ON(*stackptr[-1] != t);
+		**--stackptr = t->avl_left;
+		/* t is removed, t->v4daddr > x->v4daddr for any
+		 * x in p->avl_left subtree.
+		 * Put t in the old place of p. */
+		*delp[0] = t;
+		t->avl_left = p->avl_left;
+		t->avl_right = p->avl_right;
+		t->avl_height = p->avl_height;
+		BUG_ON(delp[1] != &p->avl_left);
+		delp[1] = &t->avl_left; /* was &p->avl_left */
 	}
-	write_unlock_bh(&peer_pool_lock);
-
-	if (do_free)
-		kmem_cache_free(peer_cachep, p);
-	else
-		/* The node is used again.  Decrease the reference counter
-		 * back.  The loop "cleanup -> unlink_from_unused
-		 *   -> unlink_from_pool -> putpeer -> link_to_unused
-		 *   -> cleanup (for the same node)"
-		 * doesn't really exist because the entry will have a
-		 * recent deletion time and will not be cleaned again soon. */
-		inet_putpeer(p);
+	peer_avl_rebalance(stack, stackptr);
+	base->total--;
+	call_rcu_bh(&p->rcu, inetpeer_free_rcu);
 }
 
-/* May be called with local BH enabled. */
-static int cleanup_once(unsigned long ttl)
+/*
+ * Lazy reclaim.  Called with local BH disabled and the pool seqlock held,
+ * right after a lookup() that filled stack[] up to stackptr.  Only the
+ * nodes on that path are examined, which bounds the work done per insertion.
+ * Returns the number of nodes unlinked; the stack is stale if it is not 0.
+ */
+static int inet_peer_gc(struct inet_peer_base *base,
+			struct inet_peer **stack[PEER_MAXDEPTH],
+			struct inet_peer ***stackptr)
 {
-	struct inet_peer *p = NULL;
-
-	/* Remove the first entry from the list of unused nodes. */
-	spin_lock_bh(&inet_peer_unused_lock);
-	if (!list_empty(&unused_peers)) {
-		__u32 delta;
-
-		p = list_first_entry(&unused_peers, struct inet_peer, unused);
-		delta = (__u32)jiffies - p->dtime;
+	struct inet_peer *p, *gchead = NULL;
+	__u32 delta, ttl;
+	int cnt = 0;
 
-		if (delta < ttl) {
-			/* Do not prune fresh entries. */
-			spin_unlock_bh(&inet_peer_unused_lock);
-			return -1;
+	if (base->total >= inet_peer_threshold)
+		ttl = 0; /* be aggressive */
+	else
+		ttl = inet_peer_maxttl
+				- (inet_peer_maxttl - inet_peer_minttl) / HZ *
+					base->total / inet_peer_threshold * HZ;
+	stackptr--; /* last stack slot is peer_avl_empty */
+	while (stackptr > stack) {
+		stackptr--;
+		p = **stackptr;
+		if (atomic_read(&p->refcnt) == 0) {
+			smp_rmb();
+			delta = (__u32)jiffies - p->dtime;
+			if (delta >= ttl &&
+			    atomic_cmpxchg(&p->refcnt, 0, -1) == 0) {
+				p->gc_next = gchead;
+				gchead = p;
+			}
 		}
-
-		list_del_init(&p->unused);
-
-		/* Grab an extra reference to prevent node disappearing
-		 * before unlink_from_pool() call. */
-		atomic_inc(&p->refcnt);
 	}
-	spin_unlock_bh(&inet_peer_unused_lock);
-
-	if (p == NULL)
-		/* It means that the total number of USED entries has
-		 * grown over inet_peer_threshold.  It shouldn't really
-		 * happen because of entry limits in route cache. */
-		return -1;
-
-	unlink_from_pool(p);
-	return 0;
+	while ((p = gchead) != NULL) {
+		gchead = p->gc_next;
+		cnt++;
+		unlink_from_pool(p, base, stack);
+	}
+	return cnt;
 }
 
 /* Called with or without local BH being disabled. */
-struct inet_peer *inet_getpeer(__be32 daddr, int create)
+struct inet_peer *inet_getpeer(struct net *net, __be32 daddr, int create)
 {
-	struct inet_peer *p, *n;
+	struct inet_peer_base *base = net->ipv4.peers;
+	struct inet_peer *p;
 	struct inet_peer **stack[PEER_MAXDEPTH], ***stackptr;
+	unsigned int sequence;
+	int invalidated, gccnt = 0;
 
-	/* Look up for the address quickly. */
-	read_lock_bh(&peer_pool_lock);
-	p = lookup(daddr, NULL);
-	if (p != peer_avl_empty)
-		atomic_inc(&p->refcnt);
-	read_unlock_bh(&peer_pool_lock);
+	/* Attempt a lockless lookup first.
+	 * Because of a concurrent writer, we might not find an existing entry.
+	 */
+	rcu_read_lock_bh();
+	sequence = read_seqbegin(&base->lock);
+	p = lookup_rcu_bh(daddr, base);
+	invalidated = read_seqretry(&base->lock, sequence);
+	rcu_read_unlock_bh();
 
-	if (p != peer_avl_empty) {
-		/* The existing node has been found. */
-		/* Remove the entry from unused list if it was there. */
-		unlink_from_unused(p);
+	if (p)
 		return p;
-	}
-
-	if (!create)
-		return NULL;
 
-	/* Allocate the space outside the locked region. */
-	n = kmem_cache_alloc(peer_cachep, GFP_ATOMIC);
-	if (n == NULL)
+	/* If no writer did a change during our lookup, we can return early. */
+	if (!create && !invalidated)
 		return NULL;
-	n->v4daddr = daddr;
-	atomic_set(&n->refcnt, 1);
-	atomic_set(&n->rid, 0);
-	n->ip_id_count = secure_ip_id(daddr);
-	n->tcp_ts_stamp = 0;
-
-	write_lock_bh(&peer_pool_lock);
-	/* Check if an entry has suddenly appeared. */
-	p = lookup(daddr, stack);
-	if (p != peer_avl_empty)
-		goto out_free;
-
-	/* Link the node. */
-	link_to_pool(n);
-	INIT_LIST_HEAD(&n->unused);
-	peer_total++;
-	write_unlock_bh(&peer_pool_lock);
-
-	if (peer_total >= inet_peer_threshold)
-		/* Remove one less-recently-used entry. */
-		cleanup_once(0);
-
-	return n;
-
-out_free:
-	/* The appropriate node is already in the pool. */
-	atomic_inc(&p->refcnt);
-	write_unlock_bh(&peer_pool_lock);
-	/* Remove the entry from unused list if it was there. */
-	unlink_from_unused(p);
-	/* Free preallocated the preallocated node. */
-	kmem_cache_free(peer_cachep, n);
-	return p;
-}
 
-/* Called with local BH disabled. */
-static void peer_check_expire(unsigned long dummy)
-{
-	unsigned long now = jiffies;
-	int ttl;
-
-	if (peer_total >= inet_peer_threshold)
-		ttl = inet_peer_minttl;
-	else
-		ttl = inet_peer_maxttl
-				- (inet_peer_maxttl - inet_peer_minttl) / HZ *
-					peer_total / inet_peer_threshold * HZ;
-	while (!cleanup_once(ttl)) {
-		if (jiffies != now)
-			break;
+	/* Retry an exact lookup, taking the lock before.
+	 * At least, nodes should be hot in our cache.
+	 */
+	write_seqlock_bh(&base->lock);
+relookup:
+	p = lookup(daddr, stack, base);
+	if (p != peer_avl_empty) {
+		/* Nodes in the tree never have a count of -1 here:
+		 * it is only set under this lock, just before unlinking. */
+		atomic_inc(&p->refcnt);
+		write_sequnlock_bh(&base->lock);
+		return p;
 	}
+	if (!gccnt) {
+		gccnt = inet_peer_gc(base, stack, stackptr);
+		if (gccnt && create)
+			goto relookup;
+	}
+	p = create ? kmem_cache_alloc(peer_cachep, GFP_ATOMIC) : NULL;
+	if (p) {
+		p->v4daddr = daddr;
+		atomic_set(&p->refcnt, 1);
+		atomic_set(&p->rid, 0);
+		atomic_set(&p->ip_id_count, secure_ip_id(daddr));
+		p->orphan = 0;
+		p->tcp_ts_stamp = 0;
+
+		/* Link the node. */
+		link_to_pool(p, base);
+		base->total++;
+	}
+	write_sequnlock_bh(&base->lock);
 
-	/* Trigger the timer after inet_peer_gc_mintime .. inet_peer_gc_maxtime
-	 * interval depending on the total number of entries (more entries,
-	 * less interval). */
-	if (peer_total >= inet_peer_threshold)
-		peer_periodic_timer.expires = jiffies + inet_peer_gc_mintime;
-	else
-		peer_periodic_timer.expires = jiffies
-			+ inet_peer_gc_maxtime
-			- (inet_peer_gc_maxtime - inet_peer_gc_mintime) / HZ *
-				peer_total / inet_peer_threshold * HZ;
-	add_timer(&peer_periodic_timer);
+	return p;
 }
 
 void inet_putpeer(struct inet_peer *p)
 {
-	spin_lock_bh(&inet_peer_unused_lock);
+	p->dtime = (__u32)jiffies;
+	smp_mb__before_atomic_dec();
 	if (atomic_dec_and_test(&p->refcnt)) {
-		list_add_tail(&p->unused, &unused_peers);
-		p->dtime = (__u32)jiffies;
+		/* Pairs with the barrier in inetpeer_orphan_tree(): either
+		 * we see the orphan mark, or it sees our zero count. */
+		smp_mb__after_atomic_dec();
+		if (unlikely(p->orphan) &&
+		    atomic_cmpxchg(&p->refcnt, 0, -1) == 0)
+			call_rcu_bh(&p->rcu, inetpeer_free_rcu);
 	}
-	spin_unlock_bh(&inet_peer_unused_lock);
 }
@@ -320,11 +320,33 @@ drop:
 	return -1;
 }
 
+int sysctl_ip_early_demux __read_mostly = 1;
+
 static int ip_rcv_finish(struct sk_buff *skb)
 {
 	const struct iphdr *iph = ip_hdr(skb);
 	struct rtable *rt;
 
+	/*
+	 *	Let the protocol find the socket of an established flow
+	 *	first: it can attach the route it cached for that flow,
+	 *	and hands the socket on in skb->sk.
+	 */
+	if (sysctl_ip_early_demux && skb->dst == NULL && skb->sk == NULL &&
+	    !(iph->frag_off & htons(IP_MF | IP_OFFSET))) {
+		struct net_protocol *ipprot;
+
+		rcu_read_lock();
+		ipprot = rcu_dereference(inet_protos[iph->protocol &
+						     (MAX_INET_PROTOS - 1)]);
+		if (ipprot && ipprot->early_demux) {
+			ipprot->early_demux(skb);
+			/* must reload iph, skb->head might have changed */
+			iph = ip_hdr(skb);
+		}
+		rcu_read_unlock();
+	}
+
 	/*
 	 *	Initialise the virtual path cache for the packet. It describes
 	 *	how the packet travels inside Linux networking.
@@ -1239,7 +1239,7 @@ void rt_bind_peer(struct rtable *rt, int create)
 	static DEFINE_SPINLOCK(rt_peer_lock);
 	struct inet_peer *peer;
 
-	peer = inet_getpeer(rt->rt_dst, create);
+	peer = inet_getpeer(dev_net(rt->u.dst.dev), rt->rt_dst, create);
 
 	spin_lock_bh(&rt_peer_lock);
 	if (rt->peer == NULL) {
@@ -2307,6 +2307,61 @@ skip_cache:
 	return ip_route_input_slow(skb, daddr, saddr, tos, dev);
 }
 
+/*
+ * Early demux: a connected socket keeps the input route of the packets
+ * it receives in sk->sk_rx_dst, under the socket spinlock.  The route
+ * still stands for a later packet of the same flow if it came in on the
+ * same device with the same mark and TOS, and the cache was not flushed
+ * since: rt_cache_flush() moves rt_genid on and leaves the entries to the
+ * gc.
+ */
+static inline int ip_rx_dst_valid(struct rtable *rt, struct sk_buff *skb)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+
+	return !rt->u.dst.obsolete &&
+	       ((rt->fl.fl4_dst ^ iph->daddr) |
+		(rt->fl.fl4_src ^ iph->saddr) |
+		(rt->fl.iif ^ skb->dev->ifindex) |
+		(rt->fl.fl4_tos ^ (iph->tos & IPTOS_RT_MASK))) == 0 &&
+	       rt->fl.mark == skb->mark &&
+	       !rt_is_expired(rt);
+}
+
+/*
+ * Give skb the route cached on sk, if it is still good for it; the
+ * caller then has no input route lookup to do.
+ */
+void ip_sk_rx_dst_get(struct sock *sk, struct sk_buff *skb)
+{
+	struct dst_entry *dst;
+
+	bh_lock_sock(sk);
+	dst = sk->sk_rx_dst;
+	if (dst && ip_rx_dst_valid((struct rtable *)dst, skb)) {
+		dst_use(dst, jiffies);
+		skb->dst = dst;
+		RT_CACHE_STAT_INC(in_hit);
+	}
+	bh_unlock_sock(sk);
+}
+
+/*
+ * Cache the input route of skb, received on a connected socket, for
+ * the next packets.  The caller holds the socket spinlock.
+ */
+void ip_sk_rx_dst_set(struct sock *sk, struct sk_buff *skb)
+{
+	struct dst_entry *old = sk->sk_rx_dst;
+
+	if (old == skb->dst || skb->rtable->rt_type != RTN_LOCAL)
+		return;
+
+	dst_hold(skb->dst);
+	sk->sk_rx_dst = skb->dst;
+	dst_release(old);
+}
+
 static int __mkroute_output(struct rtable **result,
 			    struct fib_result *res,
 			    const struct flowi *fl,
@@ -2832,7 +2887,7 @@ static int rt_fill_info(struct sk_buff *skb, u32 pid, u32 seq, int event,
 	error = rt->u.dst.error;
 	expires = rt->u.dst.expires ? rt->u.dst.expires - jiffies : 0;
 	if (rt->peer) {
-		id = rt->peer->ip_id_count;
+		id = atomic_read(&rt->peer->ip_id_count) & 0xffff;
 		if (rt->peer->tcp_ts_stamp) {
 			ts = rt->peer->tcp_ts;
 			tsage = get_seconds() - rt->peer->tcp_ts_stamp;
@@ -524,7 +524,8 @@ static int tcp_splice_data_recv(read_descriptor_t *rd_desc, struct sk_buff *skb,
 	struct tcp_splice_state *tss = rd_desc->arg.data;
 	int ret;
 
-	ret = skb_splice_bits(skb, offset, tss->pipe, rd_desc->count, tss->flags);
+	ret = skb_splice_bits(skb, skb->sk, offset, tss->pipe, rd_desc->count,
+			      tss->flags);
 	if (ret > 0)
 		rd_desc->count -= ret;
 	return ret;
@@ -660,7 +661,7 @@ struct sk_buff *sk_stream_alloc_skb(struct sock *sk, int size, gfp_t gfp)
 	return NULL;
 }
 
-static ssize_t do_tcp_sendpages(struct sock *sk, struct page **pages, int poffset,
+ssize_t do_tcp_sendpages(struct sock *sk, struct page **pages, int poffset,
 			 size_t psize, int flags)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
@@ -675,6 +676,7 @@ static ssize_t do_tcp_sendpages(struct sock *sk, struct page **pages, int poffse
 			goto out_err;
 
 	clear_bit(SOCK_ASYNC_NOSPACE, &sk->sk_socket->flags);
+	tcp_rate_check_app_limited(sk);
 
 	mss_now = tcp_current_mss(sk, !(flags&MSG_OOB));
 	size_goal = tp->xmit_size_goal;
@@ -731,7 +733,7 @@ new_segment:
 		skb->ip_summed = CHECKSUM_PARTIAL;
 		tp->write_seq += copy;
 		TCP_SKB_CB(skb)->end_seq += copy;
-		skb_shinfo(skb)->gso_segs = 0;
+		tcp_skb_pcount_set(skb, 0);
 
 		if (!copied)
 			TCP_SKB_CB(skb)->flags &= ~TCPCB_FLAG_PSH;
@@ -776,15 +778,15 @@ out_err:
 	return sk_stream_error(sk, flags, err);
 }
 
-ssize_t tcp_sendpage(struct socket *sock, struct page *page, int offset,
-		     size_t size, int flags)
+int tcp_sendpage(struct sock *sk, struct page *page, int offset,
+		 size_t size, int flags)
 {
 	ssize_t res;
-	struct sock *sk = sock->sk;
 
 	if (!(sk->sk_route_caps & NETIF_F_SG) ||
 	    !(sk->sk_route_caps & NETIF_F_ALL_CSUM))
-		return sock_no_sendpage(sock, page, offset, size, flags);
+		return sock_no_sendpage(sk->sk_socket, page, offset, size,
+					flags);
 
 	lock_sock(sk);
 	TCP_CHECK_TIMER(sk);
@@ -817,10 +819,9 @@ static inline int select_size(struct sock *sk)
 	return tmp;
 }
 
-int tcp_sendmsg(struct kiocb *iocb, struct socket *sock, struct msghdr *msg,
+int tcp_sendmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		size_t size)
 {
-	struct sock *sk = sock->sk;
 	struct iovec *iov;
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct sk_buff *skb;
@@ -842,6 +843,7 @@ int tcp_sendmsg(struct kiocb *iocb, struct socket *sock, struct msghdr *msg,
 
 	/* This should be in poll */
 	clear_bit(SOCK_ASYNC_NOSPACE, &sk->sk_socket->flags);
+	tcp_rate_check_app_limited(sk);
 
 	mss_now = tcp_current_mss(sk, !(flags&MSG_OOB));
 	size_goal = tp->xmit_size_goal;
@@ -980,7 +982,7 @@ new_segment:
 
 			tp->write_seq += copy;
 			TCP_SKB_CB(skb)->end_seq += copy;
-			skb_shinfo(skb)->gso_segs = 0;
+			tcp_skb_pcount_set(skb, 0);
 
 			from += copy;
 			copied += copy;
@@ -1263,6 +1265,197 @@ int tcp_read_sock(struct sock *sk, read_descriptor_t *desc,
 	return copied;
 }
 
+#ifdef CONFIG_MMU
+/*
+ * Zero-copy receive.  The application mmap()s a read-only region of the
+ * socket and asks, with the TCP_ZEROCOPY_RECEIVE socket option, for the
+ * next in-order data to be mapped there.  Every page-sized, page-aligned
+ * payload fragment is inserted into the region in place of copying it;
+ * data in the linear part of an skb or in partial pages is left for
+ * recvmsg(), and recv_skip_hint tells the caller how much of it there is.
+ *
+ * The pages stay referenced by the mapping after their skbs are freed, so
+ * they are charged to sk_rmem_alloc (and thus shrink the receive window)
+ * for as long as they are mapped.  They are remembered by their offset in
+ * the socket's mapping, which finds them even after the region was split
+ * or moved.  Before the next call maps anything, or when a mapping that
+ * covers them goes away, all of them are unmapped and the charge dropped
+ * as a whole, so what is charged is always exactly what is mapped.
+ *
+ * Only one mm at a time can have pages mapped.  The zerocopy_* fields
+ * change under that mm's mmap_sem, held for reading with the socket lock
+ * by tcp_zerocopy_receive() and for writing around tcp_vm_close().
+ */
+static void tcp_zerocopy_release(struct sock *sk,
+				 struct address_space *mapping)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (!tp->zerocopy_mapped)
+		return;
+
+	unmap_mapping_range(mapping, (loff_t)tp->zerocopy_pgoff << PAGE_SHIFT,
+			    tp->zerocopy_mapped, 1);
+	atomic_sub(tp->zerocopy_mapped, &sk->sk_rmem_alloc);
+	tp->zerocopy_mapped = 0;
+	tp->zerocopy_mm = NULL;
+}
+
+static int tcp_vm_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+	/* Only pages put there by TCP_ZEROCOPY_RECEIVE are ever present */
+	return VM_FAULT_SIGBUS;
+}
+
+static void tcp_vm_close(struct vm_area_struct *vma)
+{
+	struct socket *sock = vma->vm_file->private_data;
+	struct tcp_sock *tp;
+	pgoff_t end;
+
+	if (!sock->sk)
+		return;
+
+	tp = tcp_sk(sock->sk);
+	if (!tp->zerocopy_mapped || tp->zerocopy_mm != vma->vm_mm)
+		return;
+
+	/* Only a mapping that covered some of the pages releases them */
+	end = vma->vm_pgoff + ((vma->vm_end - vma->vm_start) >> PAGE_SHIFT);
+	if (vma->vm_pgoff < tp->zerocopy_pgoff +
+			    (tp->zerocopy_mapped >> PAGE_SHIFT) &&
+	    end > tp->zerocopy_pgoff)
+		tcp_zerocopy_release(sock->sk, vma->vm_file->f_mapping);
+}
+
+static struct vm_operations_struct tcp_vm_ops = {
+	.fault	= tcp_vm_fault,
+	.close	= tcp_vm_close,
+};
+
+int tcp_mmap(struct file *file, struct socket *sock,
+	     struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & (VM_WRITE | VM_EXEC))
+		return -EPERM;
+	vma->vm_flags &= ~(VM_MAYWRITE | VM_MAYEXEC);
+
+	/* The pages are charged to this socket: keep them out of children */
+	vma->vm_flags |= VM_DONTCOPY;
+
+	vma->vm_ops = &tcp_vm_ops;
+	return 0;
+}
+EXPORT_SYMBOL(tcp_mmap);
+
+static int tcp_zerocopy_receive(struct sock *sk,
+				struct tcp_zerocopy_receive *zc)
+{
+	unsigned long address = (unsigned long)zc->address;
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct vm_area_struct *vma;
+	struct sk_buff *skb = NULL;
+	skb_frag_t *frags = NULL;
+	u32 seq = tp->copied_seq;
+	u32 length = 0, offset;
+	int ret = 0;
+
+	if (address & (PAGE_SIZE - 1) || address != zc->address)
+		return -EINVAL;
+
+	if (sk->sk_state == TCP_LISTEN)
+		return -ENOTCONN;
+
+	down_read(&current->mm->mmap_sem);
+
+	vma = find_vma(current->mm, address);
+	if (!vma || vma->vm_start > address || vma->vm_ops != &tcp_vm_ops) {
+		up_read(&current->mm->mmap_sem);
+		return -EINVAL;
+	}
+	if (tp->zerocopy_mapped && tp->zerocopy_mm != current->mm) {
+		up_read(&current->mm->mmap_sem);
+		return -EBUSY;
+	}
+	zc->length = min_t(unsigned long, zc->length, vma->vm_end - address);
+	zc->length &= ~(PAGE_SIZE - 1);
+	zc->recv_skip_hint = 0;
+
+	/* Whatever the previous call mapped has been consumed by now */
+	tcp_zerocopy_release(sk, vma->vm_file->f_mapping);
+
+	/* Urgent data is only ever delivered by recvmsg() */
+	if (tp->urg_data) {
+		zc->recv_skip_hint = tp->rcv_nxt - seq;
+		goto out;
+	}
+
+	while (length + PAGE_SIZE <= zc->length) {
+		if (zc->recv_skip_hint < PAGE_SIZE) {
+			if (skb) {
+				if (skb_queue_is_last(&sk->sk_receive_queue,
+						      skb))
+					break;
+				skb = skb->next;
+				offset = seq - TCP_SKB_CB(skb)->seq;
+			} else {
+				skb = tcp_recv_skb(sk, seq, &offset);
+				if (!skb)
+					break;
+			}
+			zc->recv_skip_hint = skb->len - offset;
+			offset -= skb_headlen(skb);
+			if ((int)offset < 0 || skb_shinfo(skb)->frag_list)
+				break;
+			frags = skb_shinfo(skb)->frags;
+			while (offset) {
+				if (frags->size > offset)
+					goto out;
+				offset -= frags->size;
+				frags++;
+			}
+		}
+		if (frags->size != PAGE_SIZE || frags->page_offset)
+			break;
+		if (vm_insert_page(vma, address + length, frags->page))
+			break;
+		length += PAGE_SIZE;
+		seq += PAGE_SIZE;
+		zc->recv_skip_hint -= PAGE_SIZE;
+		frags++;
+	}
+out:
+	/* Charge before a munmap() can release the pages */
+	if (length) {
+		tp->zerocopy_mm = current->mm;
+		tp->zerocopy_pgoff = vma->vm_pgoff +
+				     ((address - vma->vm_start) >> PAGE_SHIFT);
+		tp->zerocopy_mapped = length;
+		atomic_add(length, &sk->sk_rmem_alloc);
+	}
+	up_read(&current->mm->mmap_sem);
+
+	if (length) {
+		tp->copied_seq = seq;
+		tcp_rcv_space_adjust(sk);
+
+		while ((skb = skb_peek(&sk->sk_receive_queue)) != NULL &&
+		       !tcp_hdr(skb)->fin &&
+		       !after(TCP_SKB_CB(skb)->end_seq, seq))
+			sk_eat_skb(sk, skb, 0);
+
+		/* Clean up data we have read: This will do ACK frames. */
+		tcp_cleanup_rbuf(sk, length);
+		if (length == zc->length)
+			zc->recv_skip_hint = 0;
+	} else if (!zc->recv_skip_hint && sock_flag(sk, SOCK_DONE)) {
+		ret = -EIO;
+	}
+	zc->length = length;
+	return ret;
+}
+#endif
+
 /*
  *	This routine copies from a sock struct into the user buffer.
  *
@@ -1762,6 +1955,8 @@ void tcp_close(struct sock *sk, long timeout)
 	int data_was_unread = 0;
 	int state;
 
+	tcp_relay_release(sk);
+
 	lock_sock(sk);
 	sk->sk_shutdown = SHUTDOWN_MASK;
 
@@ -2017,6 +2212,35 @@ static int do_tcp_setsockopt(struct sock *sk, int level,
 		return err;
 	}
 
+	if (optname == TCP_ULP) {
+		char name[TCP_ULP_NAME_MAX];
+
+		if (optlen < 1)
+			return -EINVAL;
+
+		val = strncpy_from_user(name, optval,
+					min(TCP_ULP_NAME_MAX-1, optlen));
+		if (val < 0)
+			return -EFAULT;
+		name[val] = 0;
+
+		lock_sock(sk);
+		err = tcp_set_ulp(sk, name);
+		release_sock(sk);
+		return err;
+	}
+
+	/* Takes the locks of the two sockets itself */
+	if (optname == TCP_RELAY) {
+		struct tcp_relay_req req;
+
+		if (optlen != sizeof(req))
+			return -EINVAL;
+		if (copy_from_user(&req, optval, sizeof(req)))
+			return -EFAULT;
+		return tcp_relay_set(sk, &req);
+	}
+
 	if (optlen < sizeof(int))
 		return -EINVAL;
 
@@ -2346,6 +2570,56 @@ static int do_tcp_getsockopt(struct sock *sk, int level,
 		if (copy_to_user(optval, icsk->icsk_ca_ops->name, len))
 			return -EFAULT;
 		return 0;
+	case TCP_ULP:
+		if (get_user(len, optlen))
+			return -EFAULT;
+		len = min_t(unsigned int, len, TCP_ULP_NAME_MAX);
+		if (!icsk->icsk_ulp_ops) {
+			if (put_user(0, optlen))
+				return -EFAULT;
+			return 0;
+		}
+		if (put_user(len, optlen))
+			return -EFAULT;
+		if (copy_to_user(optval, icsk->icsk_ulp_ops->name, len))
+			return -EFAULT;
+		return 0;
+#ifdef CONFIG_MMU
+	case TCP_ZEROCOPY_RECEIVE: {
+		struct tcp_zerocopy_receive zc;
+		int err;
+
+		if (get_user(len, optlen))
+			return -EFAULT;
+		if (len != sizeof(zc))
+			return -EINVAL;
+		if (copy_from_user(&zc, optval, len))
+			return -EFAULT;
+		lock_sock(sk);
+		err = tcp_zerocopy_receive(sk, &zc);
+		release_sock(sk);
+		if (!err && copy_to_user(optval, &zc, len))
+			err = -EFAULT;
+		return err;
+	}
+#endif
+	case TCP_RELAY: {
+		struct tcp_relay_info info;
+
+		if (get_user(len, optlen))
+			return -EFAULT;
+		if (len < sizeof(info))
+			return -EINVAL;
+		len = sizeof(info);
+		lock_sock(sk);
+		tcp_relay_get_info(sk, &info);
+		release_sock(sk);
+		if (put_user(len, optlen))
+			return -EFAULT;
+		if (copy_to_user(optval, &info, len))
+			return -EFAULT;
+		return 0;
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -2883,6 +3157,8 @@ void __init tcp_init(void)
 	       tcp_hashinfo.ehash_size, tcp_hashinfo.bhash_size);
 
 	tcp_register_congestion_control(&tcp_reno);
+	tcp_relay_init();
+	tcp_pacing_init();
 }
 
 EXPORT_SYMBOL(tcp_close);
@@ -2895,5 +3171,6 @@ EXPORT_SYMBOL(tcp_recvmsg);
 EXPORT_SYMBOL(tcp_sendmsg);
 EXPORT_SYMBOL(tcp_splice_read);
 EXPORT_SYMBOL(tcp_sendpage);
+EXPORT_SYMBOL_GPL(do_tcp_sendpages);
 EXPORT_SYMBOL(tcp_setsockopt);
 EXPORT_SYMBOL(tcp_shutdown);
@@ -0,0 +1,545 @@
+/*
+ * TCP BBR congestion control
+ *
+ * BBR ("Bottleneck Bandwidth and RTT") builds an explicit model of the
+ * path from two estimates, refreshed on every ACK from the delivery rate
+ * samples of tcp_rate.c:
+ *
+ *   BtlBw   the windowed maximum of the delivery rate over the last
+ *           ten round trips, and
+ *   RTprop  the windowed minimum of the round-trip time over the last
+ *           ten seconds.
+ *
+ * It paces data at pacing_gain * BtlBw and caps the data in flight at
+ * cwnd_gain * BtlBw * RTprop.  The gains come from a small state machine:
+ *
+ *   STARTUP    ramp up at 2/ln(2) until the bandwidth stops growing by
+ *              at least 25% per round for three rounds,
+ *   DRAIN      pace at the inverse gain to empty the queue STARTUP built,
+ *   PROBE_BW   cycle the pacing gain through 5/4, 3/4, 1, 1, 1, 1, 1, 1
+ *              to probe for more bandwidth and drain what the probe
+ *              queued,
+ *   PROBE_RTT  if RTprop has not been refreshed for ten seconds, drop
+ *              to four packets in flight for 200ms to measure it.
+ *
+ * Loss is not taken as a congestion signal; in recovery the window only
+ * follows packet conservation.  The long-term bandwidth ("policer")
+ * estimator of the published algorithm is not implemented.
+ *
+ * See "BBR: Congestion-Based Congestion Control", Cardwell, Cheng, Gunn,
+ * Hassas Yeganeh, Jacobson, ACM Queue 14(5), 2016.
+ */
+
+#include <linux/module.h>
+#include <net/tcp.h>
+
+/* Bandwidth is in packets per usec, scaled by BW_UNIT. */
+#define BW_SCALE	24
+#define BW_UNIT		(1 << BW_SCALE)
+
+/* Gains are fixed point, scaled by BBR_UNIT. */
+#define BBR_SCALE	8
+#define BBR_UNIT	(1 << BBR_SCALE)
+
+enum bbr_mode {
+	BBR_STARTUP,
+	BBR_DRAIN,
+	BBR_PROBE_BW,
+	BBR_PROBE_RTT,
+};
+
+/* Running windowed max of (round, bandwidth), see bbr_max_bw_update() */
+struct bbr_sample {
+	u32	t;
+	u32	v;
+};
+
+struct bbr {
+	u32	min_rtt_us;		/* RTprop estimate */
+	u32	min_rtt_stamp;		/* when it was taken, jiffies */
+	u32	probe_rtt_done_stamp;	/* end of PROBE_RTT, jiffies */
+	struct bbr_sample bw[3];	/* BtlBw max filter */
+	u32	rtt_cnt;		/* packet-timed rounds elapsed */
+	u32	next_rtt_delivered;	/* tp->delivered at end of round */
+	u32	cycle_mstamp;		/* start of PROBE_BW gain phase, usec */
+	u32	prior_cwnd;		/* cwnd before recovery or PROBE_RTT */
+	u32	full_bw;		/* bandwidth at last 25% growth */
+	u32	mode:3,
+		prev_ca_state:3,
+		packet_conservation:1,
+		round_start:1,
+		idle_restart:1,
+		probe_rtt_round_done:1,
+		full_bw_reached:1,
+		full_bw_cnt:2,
+		cycle_idx:3,
+		unused:16;
+	u32	pacing_gain:10,
+		cwnd_gain:10,
+		unused_b:12;
+};
+
+#define CYCLE_LEN	8
+
+static const int bbr_bw_rtts = CYCLE_LEN + 2;	/* BtlBw window, rounds */
+static const u32 bbr_min_rtt_win_sec = 10;	/* RTprop window */
+static const u32 bbr_probe_rtt_mode_ms = 200;
+static const u32 bbr_cwnd_min_target = 4;
+
+/* 2/ln(2): the smallest gain that doubles the sending rate each round */
+static const int bbr_high_gain  = BBR_UNIT * 2885 / 1000 + 1;
+static const int bbr_drain_gain = BBR_UNIT * 1000 / 2885;
+static const int bbr_cwnd_gain  = BBR_UNIT * 2;
+static const int bbr_pacing_gain[CYCLE_LEN] = {
+	BBR_UNIT * 5 / 4,	/* probe for more available bw */
+	BBR_UNIT * 3 / 4,	/* drain queue and/or yield bw to other flows */
+	BBR_UNIT, BBR_UNIT, BBR_UNIT,
+	BBR_UNIT, BBR_UNIT, BBR_UNIT
+};
+
+/* Bandwidth must grow by this much per round to stay in STARTUP */
+static const u32 bbr_full_bw_thresh = BBR_UNIT * 5 / 4;
+static const u32 bbr_full_bw_cnt = 3;
+
+static u32 bbr_max_bw(const struct sock *sk)
+{
+	const struct bbr *bbr = inet_csk_ca(sk);
+
+	return bbr->bw[0].v;
+}
+
+/*
+ * Kathleen Nichols' windowed max: keep the best, second best and third
+ * best samples of the window so that when the best one ages out the next
+ * is already at hand.
+ */
+static void bbr_max_bw_update(struct bbr *bbr, u32 t, u32 v)
+{
+	struct bbr_sample val = { .t = t, .v = v };
+	struct bbr_sample *s = bbr->bw;
+	u32 dt;
+
+	if (unlikely(v >= s[0].v) || unlikely(t - s[2].t > bbr_bw_rtts)) {
+		s[2] = s[1] = s[0] = val;
+		return;
+	}
+
+	if (unlikely(v >= s[1].v))
+		s[2] = s[1] = val;
+	else if (unlikely(v >= s[2].v))
+		s[2] = val;
+
+	dt = t - s[0].t;
+	if (unlikely(dt > bbr_bw_rtts)) {
+		s[0] = s[1];
+		s[1] = s[2];
+		s[2] = val;
+		if (unlikely(t - s[0].t > bbr_bw_rtts)) {
+			s[0] = s[1];
+			s[1] = s[2];
+		}
+	} else if (unlikely(s[1].t == s[0].t) && dt > bbr_bw_rtts / 4) {
+		s[2] = s[1] = val;
+	} else if (unlikely(s[2].t == s[1].t) && dt > bbr_bw_rtts / 2) {
+		s[2] = val;
+	}
+}
+
+/* Convert bw and gain to bytes per second for tp->pacing_rate. */
+static u32 bbr_rate_bytes_per_sec(struct sock *sk, u64 rate, int gain)
+{
+	rate *= tcp_sk(sk)->mss_cache;
+	rate *= gain;
+	rate >>= BBR_SCALE;
+	rate *= USEC_PER_SEC;
+	rate >>= BW_SCALE;
+	return min_t(u64, rate, ~0U);
+}
+
+/* Pace at gain * bw.  Until the pipe is known to be full, never slow down. */
+static void bbr_set_pacing_rate(struct sock *sk, u32 bw, int gain)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 rate = bbr_rate_bytes_per_sec(sk, bw, gain);
+
+	if (rate && (bbr->full_bw_reached || rate > tp->pacing_rate))
+		tp->pacing_rate = rate;
+}
+
+/* The cwnd that keeps gain * BDP in flight, plus room for TSO and
+ * delayed ACKs.
+ */
+static u32 bbr_target_cwnd(struct sock *sk, u32 bw, int gain)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+	u64 w;
+	u32 cwnd;
+
+	/* No RTT sample yet: keep what we have */
+	if (unlikely(bbr->min_rtt_us == ~0U))
+		return tcp_sk(sk)->snd_cwnd;
+
+	w = (u64)bw * bbr->min_rtt_us;
+	w = ((w * gain) >> BBR_SCALE) + BW_UNIT - 1;
+	cwnd = w >> BW_SCALE;
+
+	cwnd += 3;
+	cwnd = (cwnd + 1) & ~1U;
+
+	return cwnd;
+}
+
+static void bbr_reset_startup_mode(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->mode = BBR_STARTUP;
+	bbr->pacing_gain = bbr_high_gain;
+	bbr->cwnd_gain = bbr_high_gain;
+}
+
+static void bbr_reset_probe_bw_mode(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->mode = BBR_PROBE_BW;
+	bbr->pacing_gain = BBR_UNIT;
+	bbr->cwnd_gain = bbr_cwnd_gain;
+	/* Start anywhere but in the draining phase */
+	bbr->cycle_idx = CYCLE_LEN - 1 - (net_random() % (CYCLE_LEN - 1));
+	bbr->cycle_mstamp = tcp_sk(sk)->delivered_mstamp;
+}
+
+static void bbr_reset_mode(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (!bbr->full_bw_reached)
+		bbr_reset_startup_mode(sk);
+	else
+		bbr_reset_probe_bw_mode(sk);
+}
+
+/* Count rounds and feed the bandwidth sample into the max filter. */
+static void bbr_update_bw(struct sock *sk, const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u64 bw;
+
+	bbr->round_start = 0;
+	if (rs->delivered < 0 || rs->interval_us <= 0)
+		return;
+
+	if (!before(rs->prior_delivered, bbr->next_rtt_delivered)) {
+		bbr->next_rtt_delivered = tp->delivered;
+		bbr->rtt_cnt++;
+		bbr->round_start = 1;
+		bbr->packet_conservation = 0;
+	}
+
+	bw = (u64)rs->delivered * BW_UNIT;
+	do_div(bw, rs->interval_us);
+
+	/* An app-limited sample only shows the bandwidth is at least that
+	 * high; it may still raise the estimate.
+	 */
+	if (!rs->is_app_limited || bw >= bbr_max_bw(sk))
+		bbr_max_bw_update(bbr, bbr->rtt_cnt, bw);
+}
+
+/* Has the pipe been full, i.e. did the bandwidth stop growing? */
+static void bbr_check_full_bw_reached(struct sock *sk,
+				      const struct rate_sample *rs)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 bw_thresh;
+
+	if (bbr->full_bw_reached || !bbr->round_start || rs->is_app_limited)
+		return;
+
+	bw_thresh = (u64)bbr->full_bw * bbr_full_bw_thresh >> BBR_SCALE;
+	if (bbr_max_bw(sk) >= bw_thresh) {
+		bbr->full_bw = bbr_max_bw(sk);
+		bbr->full_bw_cnt = 0;
+		return;
+	}
+	if (++bbr->full_bw_cnt >= bbr_full_bw_cnt)
+		bbr->full_bw_reached = 1;
+}
+
+/* Leave STARTUP once the pipe is full, and DRAIN once the queue is gone. */
+static void bbr_check_drain(struct sock *sk, const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (bbr->mode == BBR_STARTUP && bbr->full_bw_reached) {
+		bbr->mode = BBR_DRAIN;
+		bbr->pacing_gain = bbr_drain_gain;
+		bbr->cwnd_gain = bbr_high_gain;
+		tp->snd_ssthresh = bbr_target_cwnd(sk, bbr_max_bw(sk),
+						   BBR_UNIT);
+	}
+	if (bbr->mode == BBR_DRAIN &&
+	    tcp_packets_in_flight(tp) <=
+	    bbr_target_cwnd(sk, bbr_max_bw(sk), BBR_UNIT))
+		bbr_reset_probe_bw_mode(sk);
+}
+
+/* Advance the PROBE_BW gain cycle when the current phase has done its job. */
+static void bbr_update_cycle_phase(struct sock *sk,
+				   const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 inflight = rs->prior_in_flight;
+	u32 bw = bbr_max_bw(sk);
+	int full_length;
+
+	if (bbr->mode != BBR_PROBE_BW)
+		return;
+
+	full_length = (s32)(tp->delivered_mstamp - bbr->cycle_mstamp) >
+		      (s32)bbr->min_rtt_us;
+
+	if (bbr->pacing_gain == BBR_UNIT) {
+		if (!full_length)
+			return;
+	} else if (bbr->pacing_gain > BBR_UNIT) {
+		/* Probe until a queue shows or we lose packets */
+		if (!full_length ||
+		    (!rs->losses &&
+		     inflight < bbr_target_cwnd(sk, bw, bbr->pacing_gain)))
+			return;
+	} else {
+		/* Drain until the queue the probe built is gone */
+		if (!full_length &&
+		    inflight > bbr_target_cwnd(sk, bw, BBR_UNIT))
+			return;
+	}
+
+	bbr->cycle_idx = (bbr->cycle_idx + 1) & (CYCLE_LEN - 1);
+	bbr->cycle_mstamp = tp->delivered_mstamp;
+	bbr->pacing_gain = bbr_pacing_gain[bbr->cycle_idx];
+}
+
+/* Refresh RTprop, and go measure it in PROBE_RTT when it has gone stale. */
+static void bbr_update_min_rtt(struct sock *sk, const struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	int expired;
+
+	expired = after(tcp_time_stamp,
+			bbr->min_rtt_stamp + bbr_min_rtt_win_sec * HZ);
+	if (rs->rtt_us >= 0 &&
+	    (rs->rtt_us <= bbr->min_rtt_us || expired)) {
+		bbr->min_rtt_us = rs->rtt_us;
+		bbr->min_rtt_stamp = tcp_time_stamp;
+	}
+
+	if (expired && !bbr->idle_restart && bbr->mode != BBR_PROBE_RTT) {
+		bbr->mode = BBR_PROBE_RTT;
+		bbr->pacing_gain = BBR_UNIT;
+		bbr->cwnd_gain = BBR_UNIT;
+		bbr->prior_cwnd = max(bbr->prior_cwnd, tp->snd_cwnd);
+		bbr->probe_rtt_done_stamp = 0;
+	}
+
+	if (bbr->mode == BBR_PROBE_RTT) {
+		/* Ignore the low rate samples taken while in PROBE_RTT */
+		tp->app_limited = (tp->delivered + tcp_packets_in_flight(tp)) ? : 1;
+
+		if (!bbr->probe_rtt_done_stamp &&
+		    tcp_packets_in_flight(tp) <= bbr_cwnd_min_target) {
+			bbr->probe_rtt_done_stamp = tcp_time_stamp +
+				msecs_to_jiffies(bbr_probe_rtt_mode_ms) ? : 1;
+			bbr->probe_rtt_round_done = 0;
+			bbr->next_rtt_delivered = tp->delivered;
+		} else if (bbr->probe_rtt_done_stamp) {
+			if (bbr->round_start)
+				bbr->probe_rtt_round_done = 1;
+			if (bbr->probe_rtt_round_done &&
+			    after(tcp_time_stamp, bbr->probe_rtt_done_stamp)) {
+				bbr->min_rtt_stamp = tcp_time_stamp;
+				tp->snd_cwnd = max(tp->snd_cwnd,
+						   bbr->prior_cwnd);
+				bbr->prior_cwnd = 0;
+				bbr_reset_mode(sk);
+			}
+		}
+	}
+
+	if (rs->delivered > 0)
+		bbr->idle_restart = 0;
+}
+
+static void bbr_set_cwnd(struct sock *sk, const struct rate_sample *rs,
+			 u32 bw, int gain)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u8 state = inet_csk(sk)->icsk_ca_state;
+	u32 acked = rs->acked_sacked;
+	u32 cwnd = tp->snd_cwnd;
+	u32 target;
+
+	if (!acked)
+		return;
+
+	/* Recovery: take losses out of the window, and during the first
+	 * round only send as much as was delivered (packet conservation).
+	 * Afterwards, restore the window we had before.
+	 */
+	if (rs->losses > 0)
+		cwnd = max_t(s32, cwnd - rs->losses, 1);
+
+	if (state == TCP_CA_Recovery && bbr->prev_ca_state != TCP_CA_Recovery) {
+		bbr->packet_conservation = 1;
+		bbr->next_rtt_delivered = tp->delivered;
+		bbr->prior_cwnd = max(bbr->prior_cwnd, tp->snd_cwnd);
+		cwnd = tcp_packets_in_flight(tp) + acked;
+	} else if (bbr->prev_ca_state >= TCP_CA_Recovery &&
+		   state < TCP_CA_Recovery) {
+		cwnd = max(cwnd, bbr->prior_cwnd);
+		bbr->prior_cwnd = 0;
+		bbr->packet_conservation = 0;
+	}
+	bbr->prev_ca_state = state;
+
+	if (bbr->packet_conservation) {
+		cwnd = max(cwnd, tcp_packets_in_flight(tp) + acked);
+		goto done;
+	}
+
+	/* Grow towards the target; before the pipe is full, grow freely */
+	target = bbr_target_cwnd(sk, bw, gain);
+	if (bbr->full_bw_reached)
+		cwnd = min(cwnd + acked, target);
+	else if (cwnd < target || tp->delivered < bbr_cwnd_min_target)
+		cwnd = cwnd + acked;
+	cwnd = max(cwnd, bbr_cwnd_min_target);
+
+done:
+	tp->snd_cwnd = min(cwnd, tp->snd_cwnd_clamp);
+	if (bbr->mode == BBR_PROBE_RTT)
+		tp->snd_cwnd = min(tp->snd_cwnd, bbr_cwnd_min_target);
+}
+
+static void bbr_main(struct sock *sk, const struct rate_sample *rs)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+	u32 bw;
+
+	bbr_update_bw(sk, rs);
+	bbr_update_cycle_phase(sk, rs);
+	bbr_check_full_bw_reached(sk, rs);
+	bbr_check_drain(sk, rs);
+	bbr_update_min_rtt(sk, rs);
+
+	bw = bbr_max_bw(sk);
+	bbr_set_pacing_rate(sk, bw, bbr->pacing_gain);
+	bbr_set_cwnd(sk, rs, bw, bbr->cwnd_gain);
+}
+
+static void bbr_init(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+	u64 bw;
+	u32 rtt_us;
+
+	memset(bbr, 0, sizeof(*bbr));
+	bbr->min_rtt_us = ~0U;
+	bbr->min_rtt_stamp = tcp_time_stamp;
+	bbr->prev_ca_state = TCP_CA_Open;
+	bbr->next_rtt_delivered = tp->delivered;
+	tp->snd_ssthresh = 0x7fffffff;
+
+	/* Initial pacing rate: cwnd over the handshake RTT, at high gain */
+	rtt_us = tp->srtt ? jiffies_to_usecs(tp->srtt >> 3) : USEC_PER_MSEC;
+	bw = (u64)tp->snd_cwnd * BW_UNIT;
+	do_div(bw, max_t(u32, rtt_us, 1));
+	tp->pacing_rate = 0;
+	bbr_set_pacing_rate(sk, bw, bbr_high_gain);
+
+	bbr_reset_startup_mode(sk);
+}
+
+/* Loss is not a congestion signal: remember cwnd and keep ssthresh. */
+static u32 bbr_ssthresh(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->prior_cwnd = max(bbr->prior_cwnd, tcp_sk(sk)->snd_cwnd);
+	return tcp_sk(sk)->snd_ssthresh;
+}
+
+static u32 bbr_undo_cwnd(struct sock *sk)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	bbr->full_bw = 0;
+	bbr->full_bw_cnt = 0;
+	return tcp_sk(sk)->snd_cwnd;
+}
+
+static void bbr_set_state(struct sock *sk, u8 new_state)
+{
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	if (new_state == TCP_CA_Loss) {
+		/* RTO: start a new round, and re-check whether the pipe is
+		 * full, as the path may have changed.
+		 */
+		bbr->prev_ca_state = TCP_CA_Loss;
+		bbr->full_bw = 0;
+		bbr->round_start = 1;
+	}
+}
+
+static void bbr_cwnd_event(struct sock *sk, enum tcp_ca_event event)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct bbr *bbr = inet_csk_ca(sk);
+
+	/* Restart after idle: pace at the estimated bandwidth right away
+	 * rather than probing above it.
+	 */
+	if (event == CA_EVENT_TX_START && tp->app_limited) {
+		bbr->idle_restart = 1;
+		if (bbr->mode == BBR_PROBE_BW)
+			bbr_set_pacing_rate(sk, bbr_max_bw(sk), BBR_UNIT);
+	}
+}
+
+static struct tcp_congestion_ops tcp_bbr = {
+	.init		= bbr_init,
+	.ssthresh	= bbr_ssthresh,
+	.cong_control	= bbr_main,
+	.undo_cwnd	= bbr_undo_cwnd,
+	.set_state	= bbr_set_state,
+	.cwnd_event	= bbr_cwnd_event,
+
+	.owner		= THIS_MODULE,
+	.name		= "bbr",
+};
+
+static int __init bbr_register(void)
+{
+	BUILD_BUG_ON(sizeof(struct bbr) > ICSK_CA_PRIV_SIZE);
+	return tcp_register_congestion_control(&tcp_bbr);
+}
+
+static void __exit bbr_unregister(void)
+{
+	tcp_unregister_congestion_control(&tcp_bbr);
+}
+
+module_init(bbr_register);
+module_exit(bbr_unregister);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("TCP BBR (Bottleneck Bandwidth and RTT)");
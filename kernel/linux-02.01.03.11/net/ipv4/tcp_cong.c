@@ -38,8 +38,10 @@ int tcp_register_congestion_control(struct tcp_congestion_ops *ca)
 {
 	int ret = 0;
 
-	/* all algorithms must implement ssthresh and cong_avoid ops */
-	if (!ca->ssthresh || !ca->cong_avoid) {
+	/* all algorithms must implement ssthresh and cong_avoid or
+	 * cong_control ops
+	 */
+	if (!ca->ssthresh || !(ca->cong_avoid || ca->cong_control)) {
 		printk(KERN_ERR "TCP %s does not implement required ops\n",
 		       ca->name);
 		return -EINVAL;
@@ -105,6 +107,9 @@ void tcp_cleanup_congestion_control(struct sock *sk)
 	if (icsk->icsk_ca_ops->release)
 		icsk->icsk_ca_ops->release(sk);
 	module_put(icsk->icsk_ca_ops->owner);
+
+	/* Pacing is up to the congestion control in charge */
+	tcp_sk(sk)->pacing_rate = 0;
 }
 
 /* Used by sysctl to change default congestion control */
@@ -422,12 +422,16 @@ struct sock *tcp_create_openreq_child(struct sock *sk, struct request_sock *req,
 
 		newtp->frto_counter = 0;
 		newtp->frto_highmark = 0;
+		newtp->tlp_high_seq = 0;
+		tcp_enable_early_retrans(newtp);
 
 		newicsk->icsk_ca_ops = &tcp_init_congestion_ops;
 
 		tcp_set_ca_state(newsk, TCP_CA_Open);
 		tcp_init_xmit_timers(newsk);
 		skb_queue_head_init(&newtp->out_of_order_queue);
+		newtp->write_queue_rb = RB_ROOT;
+		tcp_init_pacing(newsk);
 		newtp->write_seq = treq->snt_isn + 1;
 		newtp->pushed_seq = newtp->write_seq;
 
@@ -61,6 +61,7 @@ int sysctl_tcp_slow_start_after_idle __read_mostly = 1;
 
 static void tcp_event_new_data_sent(struct sock *sk, struct sk_buff *skb)
 {
+	const struct inet_connection_sock *icsk = inet_csk(sk);
 	struct tcp_sock *tp = tcp_sk(sk);
 	unsigned int prior_packets = tp->packets_out;
 
@@ -72,9 +73,9 @@ static void tcp_event_new_data_sent(struct sock *sk, struct sk_buff *skb)
 		tp->frto_counter = 3;
 
 	tp->packets_out += tcp_skb_pcount(skb);
-	if (!prior_packets)
-		inet_csk_reset_xmit_timer(sk, ICSK_TIME_RETRANS,
-					  inet_csk(sk)->icsk_rto, TCP_RTO_MAX);
+	if (!prior_packets || icsk->icsk_pending == ICSK_TIME_EARLY_RETRANS ||
+	    icsk->icsk_pending == ICSK_TIME_LOSS_PROBE)
+		tcp_rearm_rto(sk);
 }
 
 /* SND.NXT, if window was not shrunk.
@@ -335,7 +336,7 @@ static void tcp_init_nondata_skb(struct sk_buff *skb, u32 seq, u8 flags)
 	TCP_SKB_CB(skb)->flags = flags;
 	TCP_SKB_CB(skb)->sacked = 0;
 
-	skb_shinfo(skb)->gso_segs = 1;
+	tcp_skb_pcount_set(skb, 1);
 	skb_shinfo(skb)->gso_size = 0;
 	skb_shinfo(skb)->gso_type = 0;
 
@@ -608,19 +609,26 @@ static int tcp_transmit_skb(struct sock *sk, struct sk_buff *skb, int clone_it,
 
 	BUG_ON(!skb || !tcp_skb_pcount(skb));
 
-	/* If congestion control is doing timestamping, we must
-	 * take such a timestamp before we potentially clone/copy.
+	/* Queued packets carry their send time, which RTT and delivery
+	 * rate samples are taken against; stamp it before we potentially
+	 * clone/copy.
 	 */
-	if (icsk->icsk_ca_ops->flags & TCP_CONG_RTT_STAMP)
+	if (likely(clone_it) ||
+	    (icsk->icsk_ca_ops->flags & TCP_CONG_RTT_STAMP))
 		__net_timestamp(skb);
 
 	if (likely(clone_it)) {
+		tcp_rate_skb_sent(sk, skb);
+
 		if (unlikely(skb_cloned(skb)))
 			skb = pskb_copy(skb, gfp_mask);
 		else
 			skb = skb_clone(skb, gfp_mask);
 		if (unlikely(!skb))
 			return -ENOBUFS;
+
+		/* IP expects a clean control block, not our tx snapshot */
+		memset(skb->cb, 0, offsetof(struct tcp_skb_cb, seq));
 	}
 
 	inet = inet_sk(sk);
@@ -706,6 +714,72 @@ static int tcp_transmit_skb(struct sock *sk, struct sk_buff *skb, int clone_it,
 	return net_xmit_eval(err);
 }
 
+static void tcp_write_queue_rb_augment(struct rb_node *node, void *data)
+{
+	struct sk_buff *skb = rb_entry(node, struct sk_buff, rbnode);
+
+	TCP_SKB_CB(skb)->tx.rb_pcount = tcp_skb_pcount(skb) +
+		tcp_write_queue_rb_pcount(node->rb_left) +
+		tcp_write_queue_rb_pcount(node->rb_right);
+}
+
+/* Link skb, already on the write queue list, into write_queue_rb right
+ * after its list predecessor.  Linking by position rather than by sequence
+ * keeps the tree in queue order even while tcp_mtu_probe() briefly has two
+ * skbs starting at the same sequence; appending at the tail is O(1) before
+ * rebalancing.
+ */
+void tcp_write_queue_rb_link(struct sock *sk, struct sk_buff *skb)
+{
+	struct rb_root *root = &tcp_sk(sk)->write_queue_rb;
+	struct rb_node **p, *parent;
+
+	if (skb->prev == (struct sk_buff *)&sk->sk_write_queue) {
+		parent = rb_first(root);
+		p = parent ? &parent->rb_left : &root->rb_node;
+	} else {
+		parent = &skb->prev->rbnode;
+		if (parent->rb_right) {
+			parent = parent->rb_right;
+			while (parent->rb_left)
+				parent = parent->rb_left;
+			p = &parent->rb_left;
+		} else {
+			p = &parent->rb_right;
+		}
+	}
+
+	rb_link_node(&skb->rbnode, parent, p);
+	rb_insert_color(&skb->rbnode, root);
+	rb_augment_insert(&skb->rbnode, tcp_write_queue_rb_augment, NULL);
+}
+EXPORT_SYMBOL(tcp_write_queue_rb_link);
+
+void tcp_write_queue_rb_unlink(struct sock *sk, struct sk_buff *skb)
+{
+	struct rb_node *deepest;
+
+	deepest = rb_augment_erase_begin(&skb->rbnode);
+	rb_erase(&skb->rbnode, &tcp_sk(sk)->write_queue_rb);
+	rb_augment_erase_end(deepest, tcp_write_queue_rb_augment, NULL);
+}
+EXPORT_SYMBOL(tcp_write_queue_rb_unlink);
+
+/* The pcount of skb changed; fix up the counts of its ancestors.  An skb
+ * not on the write queue yet is counted when it is linked.
+ */
+void tcp_write_queue_rb_update(struct sk_buff *skb)
+{
+	struct rb_node *node;
+
+	if (skb->next == NULL)
+		return;
+
+	for (node = &skb->rbnode; node; node = rb_parent(node))
+		tcp_write_queue_rb_augment(node, NULL);
+}
+EXPORT_SYMBOL(tcp_write_queue_rb_update);
+
 /* This routine just queue's the buffer
  *
  * NOTE: probe0 timer is not checked, do not forget tcp_push_pending_frames,
@@ -730,11 +804,11 @@ static void tcp_set_skb_tso_segs(struct sock *sk, struct sk_buff *skb,
 		/* Avoid the costly divide in the normal
 		 * non-TSO case.
 		 */
-		skb_shinfo(skb)->gso_segs = 1;
+		tcp_skb_pcount_set(skb, 1);
 		skb_shinfo(skb)->gso_size = 0;
 		skb_shinfo(skb)->gso_type = 0;
 	} else {
-		skb_shinfo(skb)->gso_segs = DIV_ROUND_UP(skb->len, mss_now);
+		tcp_skb_pcount_set(skb, DIV_ROUND_UP(skb->len, mss_now));
 		skb_shinfo(skb)->gso_size = mss_now;
 		skb_shinfo(skb)->gso_type = sk->sk_gso_type;
 	}
@@ -824,6 +898,7 @@ int tcp_fragment(struct sock *sk, struct sk_buff *skb, u32 len,
 	 */
 	TCP_SKB_CB(buff)->when = TCP_SKB_CB(skb)->when;
 	buff->tstamp = skb->tstamp;
+	TCP_SKB_CB(buff)->tx = TCP_SKB_CB(skb)->tx;
 
 	old_factor = tcp_skb_pcount(skb);
 
@@ -1523,6 +1598,167 @@ static int tcp_mtu_probe(struct sock *sk)
  * Returns 1, if no segments are in flight and we have queued segments, but
  * cannot send anything now because of SWS or another problem.
  */
+/*
+ * Pacing.  While the congestion control sets tp->pacing_rate, new data is
+ * not sent in bursts as the window opens but spaced out: after each
+ * transmit the pacing timer is armed for the time the packet takes to
+ * drain at pacing_rate, and tcp_write_xmit() sends nothing until it
+ * expires.  The hrtimer fires in hard interrupt context, so it only puts
+ * the socket on its CPU's pacing queue; the queue's tasklet does the push,
+ * or leaves it to tcp_release_cb() if the user owns the socket.
+ *
+ * tp->pacing_ref is a socket reference held, under the socket lock, for
+ * as long as the timer is armed, the socket is queued or a push is
+ * deferred.  The tasklet lives outside the socket, so dropping the last
+ * reference from it is fine.
+ */
+enum {
+	TCP_PACING_QUEUED,	/* on a CPU's pacing queue */
+	TCP_PACING_DEFERRED,	/* push from tcp_release_cb() */
+};
+
+struct tcp_pacing_queue {
+	struct tasklet_struct	tasklet;
+	struct list_head	head;
+};
+
+static DEFINE_PER_CPU(struct tcp_pacing_queue, tcp_pacing_queue);
+
+static enum hrtimer_restart tcp_pace_kick(struct hrtimer *timer)
+{
+	struct tcp_sock *tp = container_of(timer, struct tcp_sock,
+					   pacing_timer);
+	struct tcp_pacing_queue *pq;
+	unsigned long flags;
+
+	if (test_and_set_bit(TCP_PACING_QUEUED, &tp->pacing_flags))
+		return HRTIMER_NORESTART;
+
+	local_irq_save(flags);
+	pq = &__get_cpu_var(tcp_pacing_queue);
+	list_add_tail(&tp->pacing_node, &pq->head);
+	tasklet_schedule(&pq->tasklet);
+	local_irq_restore(flags);
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Called with the socket locked once the timer has fired; returns 1 if
+ * the caller must drop the pacing reference after unlocking.
+ */
+static int tcp_pacing_push(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (sk->sk_state != TCP_CLOSE)
+		tcp_push_pending_frames(sk);
+
+	if (!tp->pacing_ref || hrtimer_active(&tp->pacing_timer))
+		return 0;
+	/* A timer that just fired has queued the socket before going idle */
+	smp_rmb();
+	if (test_bit(TCP_PACING_QUEUED, &tp->pacing_flags) ||
+	    test_bit(TCP_PACING_DEFERRED, &tp->pacing_flags))
+		return 0;
+
+	tp->pacing_ref = 0;
+	return 1;
+}
+
+static void tcp_pacing_tasklet(unsigned long data)
+{
+	struct tcp_pacing_queue *pq = (struct tcp_pacing_queue *)data;
+	struct tcp_sock *tp, *next;
+	unsigned long flags;
+	LIST_HEAD(list);
+	int put;
+
+	local_irq_save(flags);
+	list_splice_init(&pq->head, &list);
+	local_irq_restore(flags);
+
+	list_for_each_entry_safe(tp, next, &list, pacing_node) {
+		struct sock *sk = (struct sock *)tp;
+
+		list_del(&tp->pacing_node);
+		smp_mb__before_clear_bit();
+		clear_bit(TCP_PACING_QUEUED, &tp->pacing_flags);
+
+		put = 0;
+		bh_lock_sock(sk);
+		if (!sock_owned_by_user(sk))
+			put = tcp_pacing_push(sk);
+		else
+			set_bit(TCP_PACING_DEFERRED, &tp->pacing_flags);
+		bh_unlock_sock(sk);
+
+		if (put)
+			sock_put(sk);
+	}
+}
+
+/*
+ * Called from release_sock() with the socket still owned: does the push
+ * that the pacing tasklet found the socket busy for.  The caller holds a
+ * reference of its own, so ours cannot be the last.
+ */
+void tcp_release_cb(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (!test_and_clear_bit(TCP_PACING_DEFERRED, &tp->pacing_flags))
+		return;
+
+	if (tcp_pacing_push(sk))
+		__sock_put(sk);
+}
+EXPORT_SYMBOL(tcp_release_cb);
+
+void __init tcp_pacing_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct tcp_pacing_queue *pq = &per_cpu(tcp_pacing_queue, cpu);
+
+		INIT_LIST_HEAD(&pq->head);
+		tasklet_init(&pq->tasklet, tcp_pacing_tasklet,
+			     (unsigned long)pq);
+	}
+}
+
+void tcp_init_pacing(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	hrtimer_init(&tp->pacing_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	tp->pacing_timer.function = tcp_pace_kick;
+	INIT_LIST_HEAD(&tp->pacing_node);
+	tp->pacing_flags = 0;
+	tp->pacing_ref = 0;
+}
+EXPORT_SYMBOL(tcp_init_pacing);
+
+/* Hold off the next transmit until skb has drained at the pacing rate. */
+static void tcp_pace_skb(struct sock *sk, const struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u64 len_ns = (u64)skb->len * NSEC_PER_SEC;
+
+	do_div(len_ns, tp->pacing_rate);
+	if (!tp->pacing_ref) {
+		sock_hold(sk);
+		tp->pacing_ref = 1;
+	}
+	hrtimer_start(&tp->pacing_timer, ns_to_ktime(len_ns),
+		      HRTIMER_MODE_REL);
+}
+
+static inline int tcp_pacing_active(const struct tcp_sock *tp)
+{
+	return tp->pacing_rate && hrtimer_active(&tp->pacing_timer);
+}
+
 static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 			  int push_one, gfp_t gfp)
 {
@@ -1547,6 +1783,10 @@ static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 	while ((skb = tcp_send_head(sk))) {
 		unsigned int limit;
 
+		/* The pacing timer will push the rest */
+		if (tcp_pacing_active(tp))
+			break;
+
 		tso_segs = tcp_init_tso_segs(sk, skb, mss_now);
 		BUG_ON(!tso_segs);
 
@@ -1554,6 +1794,12 @@ static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 		if (!cwnd_quota)
 			break;
 
+		/* When paced, size TSO bursts to about a millisecond's worth */
+		if (tp->pacing_rate)
+			cwnd_quota = min_t(int, cwnd_quota,
+					   max_t(u32, (tp->pacing_rate >> 10) /
+						      mss_now, 2));
+
 		if (unlikely(!tcp_snd_wnd_test(tp, skb, mss_now)))
 			break;
 
@@ -1589,15 +1835,71 @@ static int tcp_write_xmit(struct sock *sk, unsigned int mss_now, int nonagle,
 		tcp_minshall_update(tp, mss_now, skb);
 		sent_pkts++;
 
+		if (tp->pacing_rate)
+			tcp_pace_skb(sk, skb);
+
 		if (push_one)
 			break;
 	}
 
 	if (likely(sent_pkts)) {
+		tcp_schedule_loss_probe(sk);
 		tcp_cwnd_validate(sk);
 		return 0;
 	}
-	return !tp->packets_out && tcp_send_head(sk);
+	return !tp->packets_out && tcp_send_head(sk) &&
+	       !tcp_pacing_active(tp);
+}
+
+/* Arm the tail loss probe timer in place of the RTO, so that the loss
+ * of the last segments of a flight is repaired by fast recovery
+ * instead of a timeout.  Only SACK connections in Open state that are
+ * limited by cwnd or by the application get a probe.  Returns 1 if the
+ * timer was armed.
+ */
+int tcp_schedule_loss_probe(struct sock *sk)
+{
+	struct inet_connection_sock *icsk = inet_csk(sk);
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 timeout, tlp_time_stamp, rto_time_stamp;
+	u32 rtt = tp->srtt >> 3;
+
+	/* TLP is only scheduled when next timer event is RTO. */
+	if (icsk->icsk_pending != ICSK_TIME_RETRANS)
+		return 0;
+
+	/* Schedule a loss probe in 2*RTT for SACK capable connections
+	 * in Open state, that are either limited by cwnd or application.
+	 */
+	if (sysctl_tcp_early_retrans < 3 || !rtt || !tp->packets_out ||
+	    !tcp_is_sack(tp) || icsk->icsk_ca_state != TCP_CA_Open)
+		return 0;
+
+	if ((tp->snd_cwnd > tcp_packets_in_flight(tp)) &&
+	    tcp_send_head(sk))
+		return 0;
+
+	/* Probe timeout is at least 1.5*rtt + TCP_DELACK_MAX to account
+	 * for delayed ack when there's one outstanding packet.
+	 */
+	timeout = rtt << 1;
+	if (tp->packets_out == 1)
+		timeout = max_t(u32, timeout,
+				(rtt + (rtt >> 1) + TCP_DELACK_MAX));
+	timeout = max_t(u32, timeout, msecs_to_jiffies(10));
+
+	/* If RTO is shorter, just schedule TLP in its place. */
+	tlp_time_stamp = tcp_time_stamp + timeout;
+	rto_time_stamp = (u32)icsk->icsk_timeout;
+	if ((s32)(tlp_time_stamp - rto_time_stamp) > 0) {
+		s32 delta = rto_time_stamp - tcp_time_stamp;
+		if (delta > 0)
+			timeout = delta;
+	}
+
+	inet_csk_reset_xmit_timer(sk, ICSK_TIME_LOSS_PROBE, timeout,
+				  TCP_RTO_MAX);
+	return 1;
 }
 
 /* Push out any pending frames which were held back due to
@@ -1869,7 +2171,7 @@ static void tcp_retrans_try_collapse(struct sock *sk, struct sk_buff *to,
  * state updates are done by the caller.  Returns non-zero if an
  * error occurred which prevented the send.
  */
-int tcp_retransmit_skb(struct sock *sk, struct sk_buff *skb)
+static int __tcp_retransmit_skb(struct sock *sk, struct sk_buff *skb)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct inet_connection_sock *icsk = inet_csk(sk);
@@ -1943,7 +2245,16 @@ int tcp_retransmit_skb(struct sock *sk, struct sk_buff *skb)
 		TCP_INC_STATS(sock_net(sk), TCP_MIB_RETRANSSEGS);
 
 		tp->total_retrans++;
+	}
+	return err;
+}
 
+int tcp_retransmit_skb(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	int err = __tcp_retransmit_skb(sk, skb);
+
+	if (err == 0) {
 #if FASTRETRANS_DEBUG > 0
 		if (TCP_SKB_CB(skb)->sacked & TCPCB_SACKED_RETRANS) {
 			if (net_ratelimit())
@@ -1969,6 +2280,61 @@ int tcp_retransmit_skb(struct sock *sk, struct sk_buff *skb)
 	return err;
 }
 
+/* When probe timeout (PTO) fires, retransmit the last segment that was
+ * sent, so that its ACK carries the SACK information fast recovery
+ * needs.  The RTO is armed again afterwards.
+ */
+void tcp_send_loss_probe(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct sk_buff *skb;
+	int pcount;
+	int mss = tcp_current_mss(sk, 0);
+	int err = -1;
+
+	/* At most one outstanding TLP retransmission. */
+	if (tp->tlp_high_seq)
+		goto rearm_timer;
+
+	/* Retransmit last segment. */
+	if (tcp_send_head(sk))
+		skb = tcp_write_queue_prev(sk, tcp_send_head(sk));
+	else
+		skb = tcp_write_queue_tail(sk);
+	if (WARN_ON(!skb))
+		goto rearm_timer;
+
+	pcount = tcp_skb_pcount(skb);
+	if (WARN_ON(!pcount))
+		goto rearm_timer;
+
+	if ((pcount > 1) && (skb->len > (pcount - 1) * mss)) {
+		if (unlikely(tcp_fragment(sk, skb, (pcount - 1) * mss, mss)))
+			goto rearm_timer;
+		skb = tcp_write_queue_next(sk, skb);
+	}
+
+	if (WARN_ON(!skb || !tcp_skb_pcount(skb)))
+		goto rearm_timer;
+
+	/* Probe with zero data doesn't trigger fast recovery. */
+	if (skb->len > 0)
+		err = __tcp_retransmit_skb(sk, skb);
+
+	/* Record snd_nxt for loss detection. */
+	if (likely(!err)) {
+		TCP_SKB_CB(skb)->sacked |= TCPCB_EVER_RETRANS;
+		tp->tlp_high_seq = tp->snd_nxt;
+	}
+
+rearm_timer:
+	inet_csk_reset_xmit_timer(sk, ICSK_TIME_RETRANS,
+				  inet_csk(sk)->icsk_rto, TCP_RTO_MAX);
+
+	if (likely(!err))
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPLOSSPROBES);
+}
+
 static int tcp_can_forward_retransmit(struct sock *sk)
 {
 	const struct inet_connection_sock *icsk = inet_csk(sk);
@@ -0,0 +1,155 @@
+/*
+ * TCP delivery rate sampling.
+ *
+ * On every ACK we produce a sample of the rate at which data was
+ * delivered to the receiver: the number of packets newly delivered
+ * (cumulatively ACKed or SACKed, retransmits included) divided by the
+ * time it took.  Congestion controls get the sample through
+ * ->cong_control().
+ *
+ * When a packet is sent we record in its control block how much had been
+ * delivered so far (tp->delivered) and when (tp->delivered_mstamp), and
+ * when the current send phase started (tp->first_tx_mstamp).  When the
+ * packet is later (S)ACKed, the difference of those snapshots to the
+ * current values gives the delivery rate over the packet's flight.  The
+ * interval used is the longer of the send phase and the ACK phase, so
+ * that neither ACK compression nor send bursts inflate the estimate.
+ *
+ * Samples taken while the sender was limited by the application rather
+ * than by the network ("app-limited") only say that the bandwidth is at
+ * least that high; they are flagged so that a congestion control using
+ * a max filter can keep them out of its estimate unless they are larger.
+ */
+
+#include <linux/module.h>
+#include <net/tcp.h>
+
+/* Snapshot the delivery state into a packet that is being (re)sent. */
+void tcp_rate_skb_sent(struct sock *sk, struct sk_buff *skb)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 now = tcp_skb_timestamp_us(skb);
+
+	/* A send phase starts when nothing is in flight; count it from
+	 * the first packet's send time rather than from the last ACK.
+	 */
+	if (!tp->packets_out) {
+		tp->first_tx_mstamp  = now;
+		tp->delivered_mstamp = now;
+	}
+
+	TCP_SKB_CB(skb)->tx.first_tx_mstamp	= tp->first_tx_mstamp;
+	TCP_SKB_CB(skb)->tx.delivered_mstamp	= tp->delivered_mstamp;
+	TCP_SKB_CB(skb)->tx.delivered		= tp->delivered;
+	TCP_SKB_CB(skb)->tx.is_app_limited	= tp->app_limited ? 1 : 0;
+}
+
+/*
+ * A packet was (S)ACKed: if it is the most recently sent one this ACK
+ * covers, it defines the sample.  Packets already accounted for by an
+ * earlier SACK are skipped.
+ */
+void tcp_rate_skb_delivered(struct sock *sk, struct sk_buff *skb,
+			    struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct tcp_skb_cb *scb = TCP_SKB_CB(skb);
+
+	if (!scb->tx.delivered_mstamp)
+		return;
+
+	if (!rs->prior_delivered ||
+	    after(scb->tx.delivered, rs->prior_delivered)) {
+		rs->prior_delivered  = scb->tx.delivered;
+		rs->prior_mstamp     = scb->tx.delivered_mstamp;
+		rs->is_app_limited   = scb->tx.is_app_limited;
+		rs->is_retrans	     = scb->sacked & TCPCB_RETRANS;
+
+		/* Length of the send phase of this flight */
+		rs->interval_us = (s32)(tcp_skb_timestamp_us(skb) -
+					scb->tx.first_tx_mstamp);
+
+		/* The next send phase starts with this packet */
+		tp->first_tx_mstamp = tcp_skb_timestamp_us(skb);
+	}
+
+	/* Mark a SACKed packet as accounted for, so the cumulative ACK that
+	 * eventually covers it does not produce a second, stale sample.
+	 */
+	if (scb->sacked & TCPCB_SACKED_ACKED)
+		scb->tx.delivered_mstamp = 0;
+}
+
+/* Turn what this ACK (S)ACKed into a rate sample in rs. */
+void tcp_rate_gen(struct sock *sk, u32 delivered, u32 lost,
+		  struct rate_sample *rs)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	u32 now = tcp_clock_us();
+	long snd_us, ack_us;
+
+	/* Clear app limited if the bubble is acked and gone. */
+	if (tp->app_limited && after(tp->delivered, tp->app_limited))
+		tp->app_limited = 0;
+
+	if (delivered)
+		tp->delivered_mstamp = now;
+
+	rs->acked_sacked = delivered;
+	rs->losses = lost;
+
+	if (rs->rtt_us > 0 &&
+	    (!tp->rtt_min_us || rs->rtt_us < tp->rtt_min_us))
+		tp->rtt_min_us = rs->rtt_us;
+
+	/* Nothing newly delivered, or only packets sent before the last
+	 * idle period: no sample.
+	 */
+	if (!rs->prior_mstamp) {
+		rs->delivered = -1;
+		rs->interval_us = -1;
+		return;
+	}
+	rs->delivered = tp->delivered - rs->prior_delivered;
+
+	/* Use the longer of the send and ACK phases, so that neither
+	 * bursty sends nor compressed ACKs overestimate the rate.
+	 */
+	snd_us = rs->interval_us;
+	ack_us = (s32)(now - rs->prior_mstamp);
+	rs->interval_us = max(snd_us, ack_us);
+
+	/* Shorter than the path's RTT can only be an artifact */
+	if (unlikely(rs->interval_us < (long)tp->rtt_min_us ||
+		     rs->interval_us <= 0)) {
+		rs->interval_us = -1;
+		return;
+	}
+
+	/* Remember the latest sample in tp->rate_*, but let an app-limited
+	 * one replace a better one only if it shows a higher rate.
+	 */
+	if (!rs->is_app_limited ||
+	    ((u64)rs->delivered * tp->rate_interval_us >=
+	     (u64)tp->rate_delivered * rs->interval_us)) {
+		tp->rate_delivered = rs->delivered;
+		tp->rate_interval_us = rs->interval_us;
+		tp->rate_app_limited = rs->is_app_limited;
+	}
+}
+
+/*
+ * Called when the application has queued data: if the sender has run dry
+ * (less than a segment waiting, room in cwnd, nothing to retransmit), the
+ * samples taken until what is now in flight is delivered are app-limited.
+ */
+void tcp_rate_check_app_limited(struct sock *sk)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	if (tp->write_seq - tp->snd_nxt < tp->mss_cache &&
+	    tcp_packets_in_flight(tp) < tp->snd_cwnd &&
+	    tp->lost_out <= tp->retrans_out)
+		tp->app_limited = (tp->delivered + tcp_packets_in_flight(tp)) ? : 1;
+}
+EXPORT_SYMBOL_GPL(tcp_rate_check_app_limited);
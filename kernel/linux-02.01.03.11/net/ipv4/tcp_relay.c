@@ -0,0 +1,667 @@
+/*
+ * TCP socket relay: in-kernel forwarding of received data to another
+ * TCP socket, for proxies.
+ *
+ * setsockopt(TCP_RELAY) on a connected socket names a destination TCP
+ * socket.  From then on the source's data_ready callback kicks a work
+ * item that takes the in-order data off the receive queue with
+ * tcp_read_sock() and hands it to the destination's ->sendpage().  Page
+ * fragments of the received skbs are passed on by reference; only data
+ * in the linear part is copied, into pages that are filled up before a
+ * new one is taken.  Nothing is taken from the source beyond what fits
+ * into the destination's send buffer, so a slow receiver closes the
+ * source's window just as a userspace relay would.
+ *
+ * The relay ends, and the remaining data is left to the application,
+ * when the optional BPF program returns 0 for a segment, when max_bytes
+ * have been forwarded, at the end of the stream, on an error, when the
+ * application detaches it, or when either socket is closed.  The source
+ * is then woken up as if the data had just arrived.
+ *
+ * The work never holds both socket locks: data is collected under the
+ * source's lock and sent after it was released.  The relay holds plain
+ * socket references, not files, so closing either socket reaches
+ * tcp_close(), which ends the relay.  Sends to the destination are made
+ * under send_lock, which closing the destination takes before anything
+ * else, so no send is in progress once it goes away.
+ */
+
+#include <linux/module.h>
+#include <linux/file.h>
+#include <linux/filter.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/net.h>
+#include <linux/workqueue.h>
+#include <net/tcp.h>
+
+/* Taken from the source per round, at most */
+#define TCP_RELAY_BATCH		(64 * 1024)
+#define TCP_RELAY_CHUNKS	64
+/* Rounds per run of the work before it requeues itself */
+#define TCP_RELAY_ROUNDS	16
+
+struct tcp_relay_chunk {
+	struct page		*page;
+	unsigned int		offset;
+	unsigned int		len;
+};
+
+struct tcp_relay {
+	atomic_t		refcnt;
+	struct sock		*src;
+	struct sock		*dst;
+	struct work_struct	work;
+	struct mutex		send_lock;
+	int			dst_closed;	/* under send_lock */
+
+	struct sk_filter	*verdict;
+	u64			limit;
+	u64			bytes;
+	int			dead;		/* unhooked, under src lock */
+	int			end;		/* TCP_RELAY_END_* once decided */
+
+	/* Taken from the source, not yet sent.  Only the work touches
+	 * these until the relay is dead, then only whoever ended it.
+	 */
+	struct tcp_relay_chunk	chunks[TCP_RELAY_CHUNKS];
+	int			head;
+	int			nchunks;
+	struct page		*copy_page;
+	unsigned int		copy_off;
+
+	void			(*saved_data_ready)(struct sock *sk, int bytes);
+	void			(*saved_state_change)(struct sock *sk);
+	void			(*saved_write_space)(struct sock *sk);
+};
+
+static struct workqueue_struct *tcp_relay_wq;
+
+static void tcp_relay_drop_chunks(struct tcp_relay *relay)
+{
+	while (relay->head < relay->nchunks)
+		put_page(relay->chunks[relay->head++].page);
+	relay->head = relay->nchunks = 0;
+}
+
+static void tcp_relay_put(struct tcp_relay *relay)
+{
+	if (!atomic_dec_and_test(&relay->refcnt))
+		return;
+
+	tcp_relay_drop_chunks(relay);
+	if (relay->copy_page)
+		put_page(relay->copy_page);
+	if (relay->verdict)
+		sk_filter_uncharge(relay->src, relay->verdict);
+	sock_put(relay->dst);
+	sock_put(relay->src);
+	kfree(relay);
+}
+
+static void tcp_relay_kick(struct tcp_relay *relay)
+{
+	atomic_inc(&relay->refcnt);
+	if (!queue_work(tcp_relay_wq, &relay->work))
+		tcp_relay_put(relay);
+}
+
+static void tcp_relay_data_ready(struct sock *sk, int bytes)
+{
+	struct tcp_relay *relay;
+
+	read_lock(&sk->sk_callback_lock);
+	relay = tcp_sk(sk)->relay;
+	if (relay)
+		tcp_relay_kick(relay);
+	read_unlock(&sk->sk_callback_lock);
+
+	/* Detached meanwhile: the application reads again */
+	if (!relay)
+		sk->sk_data_ready(sk, bytes);
+}
+
+static void tcp_relay_state_change(struct sock *sk)
+{
+	void (*state_change)(struct sock *sk) = NULL;
+	struct tcp_relay *relay;
+
+	read_lock(&sk->sk_callback_lock);
+	relay = tcp_sk(sk)->relay;
+	if (relay) {
+		tcp_relay_kick(relay);
+		state_change = relay->saved_state_change;
+	}
+	read_unlock(&sk->sk_callback_lock);
+
+	if (state_change)
+		state_change(sk);
+	else
+		sk->sk_state_change(sk);
+}
+
+static void tcp_relay_write_space(struct sock *sk)
+{
+	void (*write_space)(struct sock *sk) = NULL;
+	struct tcp_relay *relay;
+
+	read_lock(&sk->sk_callback_lock);
+	relay = tcp_sk(sk)->relay_in;
+	if (relay) {
+		tcp_relay_kick(relay);
+		write_space = relay->saved_write_space;
+	}
+	read_unlock(&sk->sk_callback_lock);
+
+	if (write_space)
+		write_space(sk);
+	else
+		sk->sk_write_space(sk);
+}
+
+/* Restore the source's callbacks.  Called with the source locked. */
+static void tcp_relay_unhook(struct tcp_relay *relay, int end, int err)
+{
+	struct sock *src = relay->src;
+	struct tcp_sock *tp = tcp_sk(src);
+
+	write_lock_bh(&src->sk_callback_lock);
+	src->sk_data_ready = relay->saved_data_ready;
+	src->sk_state_change = relay->saved_state_change;
+	tp->relay = NULL;
+	write_unlock_bh(&src->sk_callback_lock);
+
+	relay->dead = 1;
+	tp->relay_end = end;
+	tp->relay_err = err;
+}
+
+/*
+ * Restore the destination's callback, once nothing more will be sent to
+ * it: until then, closing the destination must find the relay.
+ */
+static void tcp_relay_unhook_dst(struct tcp_relay *relay)
+{
+	struct sock *dst = relay->dst;
+
+	write_lock_bh(&dst->sk_callback_lock);
+	dst->sk_write_space = relay->saved_write_space;
+	tcp_sk(dst)->relay_in = NULL;
+	write_unlock_bh(&dst->sk_callback_lock);
+}
+
+/* Queue page[offset, offset + len) for the destination. */
+static int tcp_relay_add(struct tcp_relay *relay, struct page *page,
+			 unsigned int offset, unsigned int len)
+{
+	struct tcp_relay_chunk *c;
+
+	if (relay->nchunks) {
+		c = &relay->chunks[relay->nchunks - 1];
+		if (c->page == page && c->offset + c->len == offset) {
+			c->len += len;
+			return len;
+		}
+	}
+	if (relay->nchunks == TCP_RELAY_CHUNKS)
+		return 0;
+
+	c = &relay->chunks[relay->nchunks++];
+	get_page(page);
+	c->page = page;
+	c->offset = offset;
+	c->len = len;
+	return len;
+}
+
+/* Copy data that is not in a page fragment into the copy page. */
+static int tcp_relay_copy(struct tcp_relay *relay, struct sk_buff *skb,
+			  unsigned int pos, unsigned int len)
+{
+	unsigned int n;
+
+	if (!relay->copy_page || relay->copy_off == PAGE_SIZE) {
+		struct page *page = alloc_page(GFP_KERNEL);
+
+		if (!page)
+			return -ENOMEM;
+		if (relay->copy_page)
+			put_page(relay->copy_page);
+		relay->copy_page = page;
+		relay->copy_off = 0;
+	}
+
+	n = min_t(unsigned int, len, PAGE_SIZE - relay->copy_off);
+	if (skb_copy_bits(skb, pos, page_address(relay->copy_page) +
+			  relay->copy_off, n))
+		return -EFAULT;
+	n = tcp_relay_add(relay, relay->copy_page, relay->copy_off, n);
+	relay->copy_off += n;
+	return n;
+}
+
+static skb_frag_t *tcp_relay_find_frag(struct sk_buff *skb, unsigned int pos,
+				       unsigned int *frag_off)
+{
+	unsigned int start = skb_headlen(skb);
+	int i;
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		skb_frag_t *frag = &skb_shinfo(skb)->frags[i];
+
+		if (pos < start + frag->size) {
+			*frag_off = pos - start;
+			return frag;
+		}
+		start += frag->size;
+	}
+	return NULL;
+}
+
+static int tcp_relay_recv(read_descriptor_t *desc, struct sk_buff *skb,
+			  unsigned int offset, size_t len)
+{
+	struct tcp_relay *relay = desc->arg.data;
+	size_t used = 0;
+
+	/* The program sees each segment once, before any of it is sent */
+	if (relay->verdict && !offset &&
+	    !sk_run_filter(skb, relay->verdict->insns, relay->verdict->len)) {
+		relay->end = TCP_RELAY_END_VERDICT;
+		desc->count = 0;
+		return 0;
+	}
+
+	len = min_t(size_t, len, desc->count);
+	while (used < len) {
+		unsigned int pos = offset + used, frag_off;
+		skb_frag_t *frag = NULL;
+		int n;
+
+		if (pos >= skb_headlen(skb))
+			frag = tcp_relay_find_frag(skb, pos, &frag_off);
+		if (frag)
+			n = tcp_relay_add(relay, frag->page,
+					  frag->page_offset + frag_off,
+					  min_t(size_t, len - used,
+						frag->size - frag_off));
+		else if (pos < skb_headlen(skb))
+			n = tcp_relay_copy(relay, skb, pos,
+					   min_t(size_t, len - used,
+						 skb_headlen(skb) - pos));
+		else
+			n = tcp_relay_copy(relay, skb, pos, len - used);
+
+		if (n < 0) {
+			desc->error = n;
+			break;
+		}
+		if (!n)
+			break;
+		used += n;
+	}
+
+	desc->count -= used;
+	if (used < len)
+		desc->count = 0;
+	return used ? used : desc->error;
+}
+
+/* Take what fits into the destination off the source.  Source locked. */
+static int tcp_relay_read(struct tcp_relay *relay)
+{
+	struct sock *src = relay->src;
+	struct tcp_sock *tp = tcp_sk(src);
+	read_descriptor_t desc;
+	int budget, copied;
+
+	budget = min(TCP_RELAY_BATCH, sk_stream_wspace(relay->dst));
+	if (budget <= 0)
+		return 0;
+	if (relay->limit)
+		budget = min_t(u64, budget, relay->limit - relay->bytes);
+
+	desc.arg.data = relay;
+	desc.count = budget;
+	desc.error = 0;
+	copied = tcp_read_sock(src, &desc, tcp_relay_recv);
+	if (copied > 0) {
+		relay->bytes += copied;
+		tp->relay_bytes += copied;
+	}
+
+	if (relay->limit && relay->bytes >= relay->limit)
+		relay->end = TCP_RELAY_END_LIMIT;
+	else if (!relay->end && tp->urg_data && !copied)
+		relay->end = TCP_RELAY_END_VERDICT;
+	else if (!relay->end && (src->sk_shutdown & RCV_SHUTDOWN) &&
+		 skb_queue_empty(&src->sk_receive_queue))
+		relay->end = TCP_RELAY_END_EOF;
+
+	return copied;
+}
+
+/* Hand the queued chunks to the destination.  Called under send_lock. */
+static int tcp_relay_flush(struct tcp_relay *relay, int flags)
+{
+	struct sock *dst = relay->dst;
+
+	if (relay->dst_closed)
+		return -EPIPE;
+
+	while (relay->head < relay->nchunks) {
+		struct tcp_relay_chunk *c = &relay->chunks[relay->head];
+		int more = relay->head + 1 < relay->nchunks ? MSG_MORE : 0;
+		int ret;
+
+		ret = dst->sk_prot->sendpage(dst, c->page, c->offset, c->len,
+					     flags | more);
+		if (ret <= 0)
+			return ret ? ret : -EPIPE;
+
+		c->offset += ret;
+		c->len -= ret;
+		if (!c->len)
+			put_page(relay->chunks[relay->head++].page);
+	}
+	relay->head = relay->nchunks = 0;
+	return 0;
+}
+
+/*
+ * Room in the destination for another round?  If not, have its write
+ * space callback kick us; check again afterwards, as it may have run
+ * just before.
+ */
+static int tcp_relay_dst_room(struct tcp_relay *relay)
+{
+	struct sock *dst = relay->dst;
+
+	if (sk_stream_memory_free(dst))
+		return 1;
+	set_bit(SOCK_NOSPACE, &dst->sk_socket->flags);
+	smp_mb__after_clear_bit();
+	return sk_stream_memory_free(dst);
+}
+
+static void tcp_relay_work(struct work_struct *work)
+{
+	struct tcp_relay *relay = container_of(work, struct tcp_relay, work);
+	struct sock *src = relay->src;
+	int rounds, err = 0;
+
+	for (rounds = 0; rounds < TCP_RELAY_ROUNDS; rounds++) {
+		mutex_lock(&relay->send_lock);
+		if (relay->dead) {
+			/* Whoever ended it owns the chunks now */
+			mutex_unlock(&relay->send_lock);
+			break;
+		}
+		err = tcp_relay_flush(relay, MSG_DONTWAIT | MSG_NOSIGNAL);
+		mutex_unlock(&relay->send_lock);
+		if (err == -EAGAIN) {
+			err = 0;
+			if (!tcp_relay_dst_room(relay))
+				break;
+			continue;
+		}
+		if (err)
+			break;
+
+		lock_sock(src);
+		if (relay->dead || relay->end || !tcp_relay_dst_room(relay)) {
+			release_sock(src);
+			break;
+		}
+		err = tcp_relay_read(relay);
+		release_sock(src);
+		if (err <= 0)
+			break;
+		err = 0;
+	}
+
+	lock_sock(src);
+	if (relay->dead ||
+	    (!err && (!relay->end || relay->head < relay->nchunks))) {
+		/* Still relaying; let others run if there is more to do */
+		if (!relay->dead && rounds == TCP_RELAY_ROUNDS)
+			tcp_relay_kick(relay);
+		release_sock(src);
+		tcp_relay_put(relay);
+		return;
+	}
+
+	/* The last data is out, or it cannot be: give the source back */
+	tcp_relay_unhook(relay, err ? TCP_RELAY_END_ERROR : relay->end, err);
+	release_sock(src);
+
+	tcp_relay_unhook_dst(relay);
+	tcp_relay_drop_chunks(relay);
+	src->sk_data_ready(src, 0);
+
+	tcp_relay_put(relay);	/* the attachment's */
+	tcp_relay_put(relay);
+}
+
+/*
+ * End the relay from process context: stop the work, then send what was
+ * already taken from the source before returning.  With MSG_DONTWAIT in
+ * flags, what the destination has no room for is dropped instead.
+ */
+static int tcp_relay_detach(struct sock *sk, int end, int flags)
+{
+	struct tcp_relay *relay;
+	int err;
+
+	lock_sock(sk);
+	relay = tcp_sk(sk)->relay;
+	if (!relay) {
+		release_sock(sk);
+		return -ENOENT;
+	}
+	tcp_relay_unhook(relay, end, 0);
+	release_sock(sk);
+
+	if (cancel_work_sync(&relay->work))
+		tcp_relay_put(relay);
+
+	mutex_lock(&relay->send_lock);
+	err = tcp_relay_flush(relay, flags | MSG_NOSIGNAL);
+	mutex_unlock(&relay->send_lock);
+	tcp_relay_unhook_dst(relay);
+
+	if (err) {
+		lock_sock(sk);
+		tcp_sk(sk)->relay_end = TCP_RELAY_END_ERROR;
+		tcp_sk(sk)->relay_err = err;
+		release_sock(sk);
+	}
+
+	tcp_relay_put(relay);
+	return 0;
+}
+
+/*
+ * The destination is being closed: wait for a send to it in progress,
+ * refuse further ones and end the relay with EPIPE, unless it has ended
+ * already.
+ */
+static void tcp_relay_dst_release(struct sock *dst)
+{
+	struct tcp_relay *relay;
+	struct sock *src;
+	int ended = 0;
+
+	read_lock_bh(&dst->sk_callback_lock);
+	relay = tcp_sk(dst)->relay_in;
+	if (relay)
+		atomic_inc(&relay->refcnt);
+	read_unlock_bh(&dst->sk_callback_lock);
+	if (!relay)
+		return;
+
+	mutex_lock(&relay->send_lock);
+	relay->dst_closed = 1;
+	mutex_unlock(&relay->send_lock);
+
+	src = relay->src;
+	lock_sock(src);
+	if (!relay->dead) {
+		tcp_relay_unhook(relay, TCP_RELAY_END_ERROR, -EPIPE);
+		ended = 1;
+	}
+	release_sock(src);
+
+	if (ended) {
+		if (cancel_work_sync(&relay->work))
+			tcp_relay_put(relay);
+		tcp_relay_unhook_dst(relay);
+		tcp_relay_drop_chunks(relay);
+		src->sk_data_ready(src, 0);
+		tcp_relay_put(relay);	/* the attachment's */
+	}
+	tcp_relay_put(relay);
+}
+
+static int tcp_relay_attach(struct sock *sk, const struct tcp_relay_req *req)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct sk_filter *fp = NULL;
+	struct tcp_relay *relay;
+	struct socket *sock;
+	struct sock *dst;
+	int err;
+
+	sock = sockfd_lookup(req->fd, &err);
+	if (!sock)
+		return err;
+
+	err = -EINVAL;
+	dst = sock->sk;
+	if (!dst || dst == sk || dst->sk_type != SOCK_STREAM ||
+	    dst->sk_protocol != IPPROTO_TCP ||
+	    (dst->sk_family != AF_INET && dst->sk_family != AF_INET6))
+		goto out_put;
+
+	if (req->prog_len) {
+		unsigned int fsize = req->prog_len * sizeof(struct sock_filter);
+
+		if (req->prog_len > BPF_MAXINSNS)
+			goto out_put;
+		err = -ENOMEM;
+		fp = sock_kmalloc(sk, fsize + sizeof(*fp), GFP_KERNEL);
+		if (!fp)
+			goto out_put;
+		atomic_set(&fp->refcnt, 1);
+		fp->len = req->prog_len;
+
+		err = -EFAULT;
+		if (copy_from_user(fp->insns,
+				   (void __user *)(unsigned long)req->prog, fsize))
+			goto out_filter;
+		err = sk_chk_filter(fp->insns, fp->len);
+		if (err)
+			goto out_filter;
+	}
+
+	err = -ENOMEM;
+	relay = kzalloc(sizeof(*relay), GFP_KERNEL);
+	if (!relay)
+		goto out_filter;
+	atomic_set(&relay->refcnt, 1);
+	INIT_WORK(&relay->work, tcp_relay_work);
+	mutex_init(&relay->send_lock);
+	relay->src = sk;
+	relay->dst = dst;
+	relay->verdict = fp;
+	relay->limit = req->max_bytes;
+
+	lock_sock(sk);
+	err = -ENOTCONN;
+	if (sk->sk_state != TCP_ESTABLISHED ||
+	    ((1 << dst->sk_state) & ~(TCPF_ESTABLISHED | TCPF_CLOSE_WAIT)))
+		goto out_unlock;
+	err = -EBUSY;
+	if (tp->relay)
+		goto out_unlock;
+
+	write_lock_bh(&dst->sk_callback_lock);
+	if (tcp_sk(dst)->relay_in) {
+		write_unlock_bh(&dst->sk_callback_lock);
+		goto out_unlock;
+	}
+	relay->saved_write_space = dst->sk_write_space;
+	dst->sk_write_space = tcp_relay_write_space;
+	tcp_sk(dst)->relay_in = relay;
+	write_unlock_bh(&dst->sk_callback_lock);
+
+	write_lock_bh(&sk->sk_callback_lock);
+	relay->saved_data_ready = sk->sk_data_ready;
+	relay->saved_state_change = sk->sk_state_change;
+	sk->sk_data_ready = tcp_relay_data_ready;
+	sk->sk_state_change = tcp_relay_state_change;
+	tp->relay = relay;
+	write_unlock_bh(&sk->sk_callback_lock);
+
+	sock_hold(sk);
+	sock_hold(dst);
+	tp->relay_end = TCP_RELAY_END_NONE;
+	tp->relay_err = 0;
+
+	/* Forward whatever is queued already */
+	tcp_relay_kick(relay);
+	release_sock(sk);
+
+	/* The destination's file was only needed while attaching: from
+	 * now on closing it finds relay_in and ends the relay.
+	 */
+	sockfd_put(sock);
+	return 0;
+
+out_unlock:
+	release_sock(sk);
+	kfree(relay);
+out_filter:
+	if (fp)
+		sk_filter_uncharge(sk, fp);
+out_put:
+	sockfd_put(sock);
+	return err;
+}
+
+int tcp_relay_set(struct sock *sk, const struct tcp_relay_req *req)
+{
+	if (req->fd < 0)
+		return tcp_relay_detach(sk, TCP_RELAY_END_USER, 0);
+	return tcp_relay_attach(sk, req);
+}
+
+void tcp_relay_get_info(struct sock *sk, struct tcp_relay_info *info)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+
+	memset(info, 0, sizeof(*info));
+	info->bytes = tp->relay_bytes;
+	info->attached = tp->relay != NULL;
+	info->end = tp->relay_end;
+	info->error = tp->relay_err;
+}
+
+/*
+ * The socket is being closed: end the relay from it without waiting for
+ * the destination, and the one into it.
+ */
+void tcp_relay_release(struct sock *sk)
+{
+	if (tcp_sk(sk)->relay)
+		tcp_relay_detach(sk, TCP_RELAY_END_USER, MSG_DONTWAIT);
+	if (tcp_sk(sk)->relay_in)
+		tcp_relay_dst_release(sk);
+}
+
+void __init tcp_relay_init(void)
+{
+	tcp_relay_wq = create_workqueue("tcp_relay");
+	if (!tcp_relay_wq)
+		panic("Failed to create the TCP relay workqueue\n");
+}
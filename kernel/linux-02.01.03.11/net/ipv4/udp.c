@@ -81,6 +81,7 @@
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
 #include <linux/bootmem.h>
+#include <linux/jhash.h>
 #include <linux/highmem.h>
 #include <linux/swap.h>
 #include <linux/types.h>
@@ -141,18 +142,57 @@ static int udp_lib_lport_inuse(struct net *net, __u16 num,
 	return 0;
 }
 
+/*
+ * Note: we still hold spinlock of primary hash chain, so no other writer
+ * can insert/delete a socket with local_port == num
+ */
+static int udp_lib_lport_inuse2(struct net *net, __u16 num,
+				struct udp_hslot *hslot2,
+				struct sock *sk,
+				int (*saddr_comp)(const struct sock *sk1,
+						  const struct sock *sk2))
+{
+	struct udp_sock *up;
+	struct hlist_nulls_node *node;
+	int res = 0;
+
+	spin_lock(&hslot2->lock);
+	hlist_nulls_for_each_entry(up, node, &hslot2->head, udp_portaddr_node) {
+		struct sock *sk2 = (struct sock *)up;
+
+		if (net_eq(sock_net(sk2), net)			&&
+		    sk2 != sk					&&
+		    sk2->sk_hash == num				&&
+		    (!sk2->sk_reuse || !sk->sk_reuse)		&&
+		    (!sk2->sk_bound_dev_if || !sk->sk_bound_dev_if
+			|| sk2->sk_bound_dev_if == sk->sk_bound_dev_if) &&
+		    (*saddr_comp)(sk, sk2)) {
+			res = 1;
+			break;
+		}
+	}
+	spin_unlock(&hslot2->lock);
+	return res;
+}
+
 /**
  *  udp_lib_get_port  -  UDP/-Lite port lookup for IPv4 and IPv6
  *
  *  @sk:          socket struct in question
  *  @snum:        port number to look up
  *  @saddr_comp:  AF-dependent comparison of bound local IP addresses
+ *  @hash2_nulladdr: AF-dependent secondary hash of the wildcard address
+ *                   with port 0
+ *
+ *  The caller stores the secondary hash of the bound address with port 0 in
+ *  udp_sk(sk)->udp_portaddr_hash; the port is folded in once it is known.
  */
 int udp_lib_get_port(struct sock *sk, unsigned short snum,
 		       int (*saddr_comp)(const struct sock *sk1,
-					 const struct sock *sk2 )    )
+					 const struct sock *sk2 ),
+		       unsigned int hash2_nulladdr)
 {
-	struct udp_hslot *hslot;
+	struct udp_hslot *hslot, *hslot2;
 	struct udp_table *udptable = sk->sk_prot->h.udp_table;
 	int    error = 1;
 	struct net *net = sock_net(sk);
@@ -183,14 +223,57 @@ int udp_lib_get_port(struct sock *sk, unsigned short snum,
 	} else {
 		hslot = &udptable->hash[udp_hashfn(net, snum)];
 		spin_lock_bh(&hslot->lock);
+		/*
+		 * A socket bound to a given address can only clash with
+		 * sockets bound to the same address or to the wildcard, so
+		 * with a long primary chain it is cheaper to look at those
+		 * two secondary chains.  A wildcard bind clashes with any
+		 * address and always needs the primary chain.
+		 */
+		if (hslot->count > UDP_HSLOT_SCAN_MAX &&
+		    udp_sk(sk)->udp_portaddr_hash != hash2_nulladdr) {
+			unsigned int slot2, slot2_nulladdr;
+			int exist;
+
+			slot2 = (udp_sk(sk)->udp_portaddr_hash ^ snum) &
+				udptable->mask2;
+			slot2_nulladdr = (hash2_nulladdr ^ snum) &
+				udptable->mask2;
+
+			hslot2 = &udptable->hash2[slot2];
+			if (hslot->count < hslot2->count)
+				goto scan_primary_hash;
+
+			exist = udp_lib_lport_inuse2(net, snum, hslot2,
+						     sk, saddr_comp);
+			if (!exist && slot2 != slot2_nulladdr) {
+				hslot2 = &udptable->hash2[slot2_nulladdr];
+				exist = udp_lib_lport_inuse2(net, snum, hslot2,
+							     sk, saddr_comp);
+			}
+			if (exist)
+				goto fail_unlock;
+			goto found;
+		}
+scan_primary_hash:
 		if (udp_lib_lport_inuse(net, snum, hslot, sk, saddr_comp))
 			goto fail_unlock;
 	}
+found:
 	inet_sk(sk)->num = snum;
 	sk->sk_hash = snum;
 	if (sk_unhashed(sk)) {
 		sk_nulls_add_node_rcu(sk, &hslot->head);
+		hslot->count++;
 		sock_prot_inuse_add(sock_net(sk), sk->sk_prot, 1);
+
+		udp_sk(sk)->udp_portaddr_hash ^= snum;
+		hslot2 = udp_hashslot2(udptable, udp_sk(sk)->udp_portaddr_hash);
+		spin_lock(&hslot2->lock);
+		hlist_nulls_add_head_rcu(&udp_sk(sk)->udp_portaddr_node,
+					 &hslot2->head);
+		hslot2->count++;
+		spin_unlock(&hslot2->lock);
 	}
 	error = 0;
 fail_unlock:
@@ -208,9 +291,28 @@ static int ipv4_rcv_saddr_equal(const struct sock *sk1, const struct sock *sk2)
 		   inet1->rcv_saddr == inet2->rcv_saddr      ));
 }
 
+static unsigned int udp4_portaddr_hash(struct net *net, __be32 saddr,
+				       unsigned int port)
+{
+	return jhash_1word((__force u32)saddr, net_hash_mix(net)) ^ port;
+}
+
 int udp_v4_get_port(struct sock *sk, unsigned short snum)
 {
-	return udp_lib_get_port(sk, snum, ipv4_rcv_saddr_equal);
+	struct net *net = sock_net(sk);
+
+	/* precompute partial secondary hash */
+	udp_sk(sk)->udp_portaddr_hash =
+		udp4_portaddr_hash(net, inet_sk(sk)->rcv_saddr, 0);
+	return udp_lib_get_port(sk, snum, ipv4_rcv_saddr_equal,
+				udp4_portaddr_hash(net, htonl(INADDR_ANY), 0));
+}
+
+void udp_v4_rehash(struct sock *sk)
+{
+	udp_lib_rehash(sk, udp4_portaddr_hash(sock_net(sk),
+					      inet_sk(sk)->rcv_saddr,
+					      inet_sk(sk)->num));
 }
 
 static inline int compute_score(struct sock *sk, struct net *net, __be32 saddr,
@@ -248,6 +350,85 @@ static inline int compute_score(struct sock *sk, struct net *net, __be32 saddr,
 	return score;
 }
 
+/* Same as compute_score(), for sockets known to be bound to daddr:hnum */
+static inline int compute_score2(struct sock *sk, struct net *net,
+				 __be32 saddr, __be16 sport,
+				 __be32 daddr, unsigned int hnum, int dif)
+{
+	int score = -1;
+
+	if (net_eq(sock_net(sk), net) && !ipv6_only_sock(sk)) {
+		struct inet_sock *inet = inet_sk(sk);
+
+		if (inet->rcv_saddr != daddr)
+			return -1;
+		if (inet->num != hnum)
+			return -1;
+
+		score = (sk->sk_family == PF_INET ? 1 : 0);
+		if (inet->daddr) {
+			if (inet->daddr != saddr)
+				return -1;
+			score += 2;
+		}
+		if (inet->dport) {
+			if (inet->dport != sport)
+				return -1;
+			score += 2;
+		}
+		if (sk->sk_bound_dev_if) {
+			if (sk->sk_bound_dev_if != dif)
+				return -1;
+			score += 2;
+		}
+	}
+	return score;
+}
+
+/* called with rcu_read_lock() */
+static struct sock *udp4_lib_lookup2(struct net *net,
+		__be32 saddr, __be16 sport,
+		__be32 daddr, unsigned int hnum, int dif,
+		struct udp_hslot *hslot2, unsigned int slot2)
+{
+	struct sock *sk, *result;
+	struct udp_sock *up;
+	struct hlist_nulls_node *node;
+	int score, badness;
+
+begin:
+	result = NULL;
+	badness = -1;
+	hlist_nulls_for_each_entry_rcu(up, node, &hslot2->head,
+				       udp_portaddr_node) {
+		sk = (struct sock *)up;
+		score = compute_score2(sk, net, saddr, sport,
+				       daddr, hnum, dif);
+		if (score > badness) {
+			result = sk;
+			badness = score;
+		}
+	}
+	/*
+	 * if the nulls value we got at the end of this lookup is
+	 * not the expected one, we must restart lookup.
+	 * We probably met an item that was moved to another chain.
+	 */
+	if (get_nulls_value(node) != slot2)
+		goto begin;
+
+	if (result) {
+		if (unlikely(!atomic_inc_not_zero(&result->sk_refcnt)))
+			result = NULL;
+		else if (unlikely(compute_score2(result, net, saddr, sport,
+				  daddr, hnum, dif) < badness)) {
+			sock_put(result);
+			goto begin;
+		}
+	}
+	return result;
+}
+
 /* UDP is nearly always wildcards out the wazoo, it makes no sense to try
  * harder than this. -DaveM
  */
@@ -263,6 +444,37 @@ static struct sock *__udp4_lib_lookup(struct net *net, __be32 saddr,
 	int score, badness;
 
 	rcu_read_lock();
+	/*
+	 * Many sockets on this port (typically one per local address):
+	 * look for a socket bound to daddr, then for a wildcard one, in
+	 * the secondary hash.
+	 */
+	if (hslot->count > UDP_HSLOT_SCAN_MAX) {
+		unsigned int slot2;
+		struct udp_hslot *hslot2;
+
+		slot2 = udp4_portaddr_hash(net, daddr, hnum) & udptable->mask2;
+		hslot2 = &udptable->hash2[slot2];
+		if (hslot->count < hslot2->count)
+			goto begin;
+
+		result = udp4_lib_lookup2(net, saddr, sport,
+					  daddr, hnum, dif,
+					  hslot2, slot2);
+		if (!result) {
+			slot2 = udp4_portaddr_hash(net, htonl(INADDR_ANY), hnum) &
+				udptable->mask2;
+			hslot2 = &udptable->hash2[slot2];
+			if (hslot->count < hslot2->count)
+				goto begin;
+
+			result = udp4_lib_lookup2(net, saddr, sport,
+						  htonl(INADDR_ANY), hnum, dif,
+						  hslot2, slot2);
+		}
+		rcu_read_unlock();
+		return result;
+	}
 begin:
 	result = NULL;
 	badness = -1;
@@ -957,8 +1169,12 @@ int udp_disconnect(struct sock *sk, int flags)
 	inet->daddr = 0;
 	inet->dport = 0;
 	sk->sk_bound_dev_if = 0;
-	if (!(sk->sk_userlocks & SOCK_BINDADDR_LOCK))
+	if (!(sk->sk_userlocks & SOCK_BINDADDR_LOCK)) {
 		inet_reset_saddr(sk);
+		if (sk->sk_prot->rehash &&
+		    (sk->sk_userlocks & SOCK_BINDPORT_LOCK))
+			sk->sk_prot->rehash(sk);
+	}
 
 	if (!(sk->sk_userlocks & SOCK_BINDPORT_LOCK)) {
 		sk->sk_prot->unhash(sk);
@@ -975,16 +1191,60 @@ void udp_lib_unhash(struct sock *sk)
 		unsigned int hash = udp_hashfn(sock_net(sk), sk->sk_hash);
 		struct udp_hslot *hslot = &udptable->hash[hash];
 
+		struct udp_hslot *hslot2;
+
 		spin_lock_bh(&hslot->lock);
 		if (sk_nulls_del_node_init_rcu(sk)) {
+			hslot->count--;
 			inet_sk(sk)->num = 0;
 			sock_prot_inuse_add(sock_net(sk), sk->sk_prot, -1);
+
+			hslot2 = udp_hashslot2(udptable,
+					       udp_sk(sk)->udp_portaddr_hash);
+			spin_lock(&hslot2->lock);
+			hlist_nulls_del_init_rcu(&udp_sk(sk)->udp_portaddr_node);
+			hslot2->count--;
+			spin_unlock(&hslot2->lock);
 		}
 		spin_unlock_bh(&hslot->lock);
 	}
 }
 EXPORT_SYMBOL(udp_lib_unhash);
 
+/*
+ * inet_rcv_saddr was changed, e.g. by connect(): move the socket to the
+ * secondary chain matching its new (address, port).
+ */
+void udp_lib_rehash(struct sock *sk, unsigned int newhash)
+{
+	if (sk_hashed(sk)) {
+		struct udp_table *udptable = sk->sk_prot->h.udp_table;
+		unsigned int hash = udp_hashfn(sock_net(sk), sk->sk_hash);
+		struct udp_hslot *hslot = &udptable->hash[hash];
+		struct udp_hslot *hslot2, *nhslot2;
+
+		/* the primary chain lock serialises us against unhash */
+		spin_lock_bh(&hslot->lock);
+		hslot2 = udp_hashslot2(udptable, udp_sk(sk)->udp_portaddr_hash);
+		nhslot2 = udp_hashslot2(udptable, newhash);
+		udp_sk(sk)->udp_portaddr_hash = newhash;
+		if (hslot2 != nhslot2) {
+			spin_lock(&hslot2->lock);
+			hlist_nulls_del_init_rcu(&udp_sk(sk)->udp_portaddr_node);
+			hslot2->count--;
+			spin_unlock(&hslot2->lock);
+
+			spin_lock(&nhslot2->lock);
+			hlist_nulls_add_head_rcu(&udp_sk(sk)->udp_portaddr_node,
+						 &nhslot2->head);
+			nhslot2->count++;
+			spin_unlock(&nhslot2->lock);
+		}
+		spin_unlock_bh(&hslot->lock);
+	}
+}
+EXPORT_SYMBOL(udp_lib_rehash);
+
 static int __udp_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 {
 	int is_udplite = IS_UDPLITE(sk);
@@ -1213,6 +1473,9 @@ int __udp4_lib_rcv(struct sk_buff *skb, struct udp_table *udptable,
 	__be32 daddr = ip_hdr(skb)->daddr;
 	struct net *net = dev_net(skb->dev);
 
+	/* Take the socket early demux found, so no path leaks it */
+	sk = skb_steal_sock(skb);
+
 	/*
 	 *  Validate the packet.
 	 */
@@ -1233,14 +1496,27 @@ int __udp4_lib_rcv(struct sk_buff *skb, struct udp_table *udptable,
 	if (udp4_csum_init(skb, uh, proto))
 		goto csum_error;
 
-	if (rt->rt_flags & (RTCF_BROADCAST|RTCF_MULTICAST))
+	if (rt->rt_flags & (RTCF_BROADCAST|RTCF_MULTICAST)) {
+		if (sk)
+			sock_put(sk);
 		return __udp4_lib_mcast_deliver(net, skb, uh,
 				saddr, daddr, udptable);
+	}
 
-	sk = __udp4_lib_lookup_skb(skb, uh->source, uh->dest, udptable);
+	if (!sk)
+		sk = __udp4_lib_lookup_skb(skb, uh->source, uh->dest, udptable);
 
 	if (sk != NULL) {
-		int ret = udp_queue_rcv_skb(sk, skb);
+		int ret;
+
+		if (sk->sk_state == TCP_ESTABLISHED &&
+		    sk->sk_rx_dst != skb->dst) {
+			bh_lock_sock(sk);
+			ip_sk_rx_dst_set(sk, skb);
+			bh_unlock_sock(sk);
+		}
+
+		ret = udp_queue_rcv_skb(sk, skb);
 		sock_put(sk);
 
 		/* a return value > 0 means to resubmit the input, but
@@ -1293,11 +1569,50 @@ csum_error:
 		       ntohs(uh->dest),
 		       ulen);
 drop:
+	if (sk)
+		sock_put(sk);
 	UDP_INC_STATS_BH(net, UDP_MIB_INERRORS, proto == IPPROTO_UDPLITE);
 	kfree_skb(skb);
 	return 0;
 }
 
+/*
+ *	Early demux, from ip_rcv_finish() before the packet is routed: a
+ *	connected socket gives the packet the input route it cached, and
+ *	__udp4_lib_rcv() then takes the socket from skb->sk.
+ */
+void udp_v4_early_demux(struct sk_buff *skb)
+{
+	const struct iphdr *iph;
+	const struct udphdr *uh;
+	struct sock *sk;
+
+	if (skb->pkt_type != PACKET_HOST)
+		return;
+
+	if (!pskb_may_pull(skb, ip_hdrlen(skb) + sizeof(struct udphdr)))
+		return;
+
+	iph = ip_hdr(skb);
+	uh = (struct udphdr *)((char *)iph + ip_hdrlen(skb));
+
+	sk = __udp4_lib_lookup(dev_net(skb->dev), iph->saddr, uh->source,
+			       iph->daddr, uh->dest, skb->dev->ifindex,
+			       &udp_table);
+	if (!sk)
+		return;
+
+	/* Only a connected socket is the socket of every packet of the flow */
+	if (sk->sk_state != TCP_ESTABLISHED) {
+		sock_put(sk);
+		return;
+	}
+
+	skb->sk = sk;
+	skb->destructor = sock_edemux;
+	ip_sk_rx_dst_get(sk, skb);
+}
+
 int udp_rcv(struct sk_buff *skb)
 {
 	return __udp4_lib_rcv(skb, &udp_table, IPPROTO_UDP);
@@ -1536,6 +1851,7 @@ struct proto udp_prot = {
 	.backlog_rcv	   = __udp_queue_rcv_skb,
 	.hash		   = udp_lib_hash,
 	.unhash		   = udp_lib_unhash,
+	.rehash		   = udp_v4_rehash,
 	.get_port	   = udp_v4_get_port,
 	.memory_allocated  = &udp_memory_allocated,
 	.sysctl_mem	   = sysctl_udp_mem,
@@ -1748,21 +2064,40 @@ void udp4_proc_exit(void)
 }
 #endif /* CONFIG_PROC_FS */
 
-void __init udp_table_init(struct udp_table *table)
+void __init udp_table_init(struct udp_table *table, const char *name)
 {
-	int i;
+	unsigned int i;
 
 	for (i = 0; i < UDP_HTABLE_SIZE; i++) {
 		INIT_HLIST_NULLS_HEAD(&table->hash[i].head, i);
+		table->hash[i].count = 0;
 		spin_lock_init(&table->hash[i].lock);
 	}
+
+	/*
+	 * The secondary hash is sized with memory so that a host binding
+	 * one socket per local address keeps short chains.
+	 */
+	table->hash2 = alloc_large_system_hash(name,
+					       sizeof(struct udp_hslot),
+					       0,
+					       21, /* one slot per 2 MB */
+					       0,
+					       NULL,
+					       &table->mask2,
+					       64 * 1024);
+	for (i = 0; i <= table->mask2; i++) {
+		INIT_HLIST_NULLS_HEAD(&table->hash2[i].head, i);
+		table->hash2[i].count = 0;
+		spin_lock_init(&table->hash2[i].lock);
+	}
 }
 
 void __init udp_init(void)
 {
 	unsigned long nr_pages, limit;
 
-	udp_table_init(&udp_table);
+	udp_table_init(&udp_table, "UDP");
 	/* Set the pressure threshold up by the same strategy of TCP. It is a
 	 * fraction of global memory that is up to 1/2 at 256 MB, decreasing
 	 * toward zero with the amount of memory, with a floor of 128 pages.
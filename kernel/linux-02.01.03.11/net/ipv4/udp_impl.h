@@ -9,6 +9,7 @@ extern int  	__udp4_lib_rcv(struct sk_buff *, struct udp_table *, int );
 extern void 	__udp4_lib_err(struct sk_buff *, u32, struct udp_table *);
 
 extern int	udp_v4_get_port(struct sock *sk, unsigned short snum);
+extern void	udp_v4_rehash(struct sock *sk);
 
 extern int	udp_setsockopt(struct sock *sk, int level, int optname,
 			       char __user *optval, int optlen);
@@ -75,8 +75,6 @@ static DEFINE_RWLOCK(fib6_walker_lock);
 #define FWS_INIT FWS_L
 #endif
 
-static void fib6_prune_clones(struct net *net, struct fib6_node *fn,
-			      struct rt6_info *rt);
 static struct rt6_info *fib6_find_prefix(struct net *net, struct fib6_node *fn);
 static struct fib6_node *fib6_repair_tree(struct net *net, struct fib6_node *fn);
 static int fib6_walk(struct fib6_walker_t *w);
@@ -126,6 +124,17 @@ static __inline__ u32 fib6_new_sernum(void)
 	return n;
 }
 
+/*
+ *	A new exception hangs off a route rather than a tree node of its
+ *	own; invalidate the destinations cached against the route's node.
+ *	Called with the table lock held.
+ */
+void fib6_update_sernum(struct rt6_info *rt)
+{
+	if (rt->rt6i_node)
+		rt->rt6i_node->fn_sernum = fib6_new_sernum();
+}
+
 /*
  *	Auxiliary address test functions for the radix tree.
  *
@@ -153,15 +162,35 @@ static __inline__ struct fib6_node * node_alloc(void)
 	return fn;
 }
 
-static __inline__ void node_free(struct fib6_node * fn)
+static void node_free_rcu(struct rcu_head *head)
 {
+	struct fib6_node *fn = container_of(head, struct fib6_node, rcu);
+
 	kmem_cache_free(fib6_node_kmem, fn);
 }
 
+/*
+ *	Nodes and routes may still be visited by lockless lookups, so
+ *	they are only given back after a grace period.
+ */
+static __inline__ void node_free(struct fib6_node * fn)
+{
+	call_rcu_bh(&fn->rcu, node_free_rcu);
+}
+
+static void rt6_free_rcu(struct rcu_head *head)
+{
+	struct rt6_info *rt = container_of(head, struct rt6_info,
+					   u.dst.rcu_head);
+
+	rt6_free_cached(rt);
+	dst_free(&rt->u.dst);
+}
+
 static __inline__ void rt6_release(struct rt6_info *rt)
 {
 	if (atomic_dec_and_test(&rt->rt6i_ref))
-		dst_free(&rt->u.dst);
+		call_rcu_bh(&rt->u.dst.rcu_head, rt6_free_rcu);
 }
 
 #ifdef CONFIG_IPV6_MULTIPLE_TABLES
@@ -277,20 +306,32 @@ static void fib6_tables_init(struct net *net)
 
 static int fib6_dump_node(struct fib6_walker_t *w)
 {
-	int res;
+	int res, clones;
 	struct rt6_info *rt;
 
 	for (rt = w->leaf; rt; rt = rt->u.dst.rt6_next) {
-		res = rt6_dump_route(rt, w->args);
-		if (res < 0) {
-			/* Frame is full, suspend walking */
-			w->leaf = rt;
-			return 1;
+		if (!w->skip) {
+			res = rt6_dump_route(rt, w->args);
+			if (res < 0)
+				goto suspend;
+			WARN_ON(res == 0);
+			w->skip = 1;
 		}
-		WARN_ON(res == 0);
+		/* Host clones follow the route they were cloned from */
+		clones = w->skip - 1;
+		res = rt6_dump_exceptions(rt, w->args, &clones);
+		w->skip = clones + 1;
+		if (res < 0)
+			goto suspend;
+		w->skip = 0;
 	}
 	w->leaf = NULL;
 	return 0;
+
+suspend:
+	/* Frame is full, suspend walking */
+	w->leaf = rt;
+	return 1;
 }
 
 static void fib6_dump_end(struct netlink_callback *cb)
@@ -482,9 +523,9 @@ static struct fib6_node * fib6_add_1(struct fib6_node *root, void *addr,
 	ln->fn_sernum = sernum;
 
 	if (dir)
-		pn->right = ln;
+		rcu_assign_pointer(pn->right, ln);
 	else
-		pn->left  = ln;
+		rcu_assign_pointer(pn->left, ln);
 
 	return ln;
 
@@ -541,16 +582,9 @@ insert_above:
 
 		in->fn_sernum = sernum;
 
-		/* update parent pointer */
-		if (dir)
-			pn->right = in;
-		else
-			pn->left  = in;
-
 		ln->fn_bit = plen;
 
 		ln->parent = in;
-		fn->parent = in;
 
 		ln->fn_sernum = sernum;
 
@@ -561,6 +595,14 @@ insert_above:
 			in->left  = ln;
 			in->right = fn;
 		}
+
+		/* Readers may be below pn: link in only once it is complete */
+		if (dir)
+			rcu_assign_pointer(pn->right, in);
+		else
+			rcu_assign_pointer(pn->left, in);
+
+		fn->parent = in;
 	} else { /* plen <= bit */
 
 		/*
@@ -580,16 +622,16 @@ insert_above:
 
 		ln->fn_sernum = sernum;
 
-		if (dir)
-			pn->right = ln;
-		else
-			pn->left  = ln;
-
 		if (addr_bit_set(&key->addr, plen))
 			ln->right = fn;
 		else
 			ln->left  = fn;
 
+		if (dir)
+			rcu_assign_pointer(pn->right, ln);
+		else
+			rcu_assign_pointer(pn->left, ln);
+
 		fn->parent = ln;
 	}
 	return ln;
@@ -647,8 +689,8 @@ static int fib6_add_rt2node(struct fib6_node *fn, struct rt6_info *rt,
 	 */
 
 	rt->u.dst.rt6_next = iter;
-	*ins = rt;
 	rt->rt6i_node = fn;
+	rcu_assign_pointer(*ins, rt);
 	atomic_inc(&rt->rt6i_ref);
 	inet6_rt_notify(RTM_NEWROUTE, rt, info);
 	info->nl_net->ipv6.rt6_stats->fib_rt_entries++;
@@ -684,7 +726,10 @@ void fib6_force_start_gc(struct net *net)
 
 int fib6_add(struct fib6_node *root, struct rt6_info *rt, struct nl_info *info)
 {
-	struct fib6_node *fn, *pn = NULL;
+	struct fib6_node *fn;
+#ifdef CONFIG_IPV6_SUBTREES
+	struct fib6_node *pn = NULL;
+#endif
 	int err = -ENOMEM;
 
 	fn = fib6_add_1(root, &rt->rt6i_dst.addr, sizeof(struct in6_addr),
@@ -693,9 +738,9 @@ int fib6_add(struct fib6_node *root, struct rt6_info *rt, struct nl_info *info)
 	if (fn == NULL)
 		goto out;
 
+#ifdef CONFIG_IPV6_SUBTREES
 	pn = fn;
 
-#ifdef CONFIG_IPV6_SUBTREES
 	if (rt->rt6i_src.plen) {
 		struct fib6_node *sn;
 
@@ -739,7 +784,7 @@ int fib6_add(struct fib6_node *root, struct rt6_info *rt, struct nl_info *info)
 
 			/* Now link new subtree to main tree */
 			sfn->parent = fn;
-			fn->subtree = sfn;
+			rcu_assign_pointer(fn->subtree, sfn);
 		} else {
 			sn = fib6_add_1(fn->subtree, &rt->rt6i_src.addr,
 					sizeof(struct in6_addr), rt->rt6i_src.plen,
@@ -750,8 +795,8 @@ int fib6_add(struct fib6_node *root, struct rt6_info *rt, struct nl_info *info)
 		}
 
 		if (fn->leaf == NULL) {
-			fn->leaf = rt;
 			atomic_inc(&rt->rt6i_ref);
+			rcu_assign_pointer(fn->leaf, rt);
 		}
 		fn = sn;
 	}
@@ -759,11 +804,8 @@ int fib6_add(struct fib6_node *root, struct rt6_info *rt, struct nl_info *info)
 
 	err = fib6_add_rt2node(fn, rt, info);
 
-	if (err == 0) {
+	if (err == 0)
 		fib6_start_gc(info->nl_net, rt);
-		if (!(rt->rt6i_flags&RTF_CACHE))
-			fib6_prune_clones(info->nl_net, pn, rt);
-	}
 
 out:
 	if (err) {
@@ -806,6 +848,8 @@ st_failure:
 /*
  *	Routing tree lookup
  *
+ *	Runs under rcu_read_lock_bh() and may race with writers, so a node
+ *	can transiently be seen without a leaf; such nodes are skipped.
  */
 
 struct lookup_args {
@@ -833,7 +877,8 @@ static struct fib6_node * fib6_lookup_1(struct fib6_node *root,
 
 		dir = addr_bit_set(args->addr, fn->fn_bit);
 
-		next = dir ? fn->right : fn->left;
+		next = dir ? rcu_dereference(fn->right) :
+			     rcu_dereference(fn->left);
 
 		if (next) {
 			fn = next;
@@ -844,16 +889,20 @@ static struct fib6_node * fib6_lookup_1(struct fib6_node *root,
 	}
 
 	while(fn) {
-		if (FIB6_SUBTREE(fn) || fn->fn_flags & RTN_RTINFO) {
+		struct rt6_info *leaf = rcu_dereference(fn->leaf);
+
+		if (leaf && (FIB6_SUBTREE(fn) || fn->fn_flags & RTN_RTINFO)) {
 			struct rt6key *key;
 
-			key = (struct rt6key *) ((u8 *) fn->leaf +
-						 args->offset);
+			key = (struct rt6key *) ((u8 *) leaf + args->offset);
 
 			if (ipv6_prefix_equal(&key->addr, args->addr, key->plen)) {
 #ifdef CONFIG_IPV6_SUBTREES
-				if (fn->subtree)
-					fn = fib6_lookup_1(fn->subtree, args + 1);
+				struct fib6_node *subtree;
+
+				subtree = rcu_dereference(fn->subtree);
+				if (subtree)
+					fn = fib6_lookup_1(subtree, args + 1);
 #endif
 				if (!fn || fn->fn_flags & RTN_RTINFO)
 					return fn;
@@ -1013,14 +1062,16 @@ static struct fib6_node *fib6_repair_tree(struct net *net,
 		    || (children && fn->fn_flags&RTN_ROOT)
 #endif
 		    ) {
-			fn->leaf = fib6_find_prefix(net, fn);
+			struct rt6_info *leaf = fib6_find_prefix(net, fn);
+
 #if RT6_DEBUG >= 2
-			if (fn->leaf==NULL) {
-				WARN_ON(!fn->leaf);
-				fn->leaf = net->ipv6.ip6_null_entry;
+			if (leaf == NULL) {
+				WARN_ON(!leaf);
+				leaf = net->ipv6.ip6_null_entry;
 			}
 #endif
-			atomic_inc(&fn->leaf->rt6i_ref);
+			atomic_inc(&leaf->rt6i_ref);
+			rcu_assign_pointer(fn->leaf, leaf);
 			return fn->parent;
 		}
 
@@ -1101,9 +1152,15 @@ static void fib6_del_route(struct fib6_node *fn, struct rt6_info **rtp,
 	net->ipv6.rt6_stats->fib_rt_entries--;
 	net->ipv6.rt6_stats->fib_discarded_routes++;
 
-	/* Reset round-robin state, if necessary */
-	if (fn->rr_ptr == rt)
-		fn->rr_ptr = NULL;
+	/* Its host clones and per-CPU copies go with it */
+	rt6_flush_exceptions(rt);
+
+	/* Reset round-robin state, if necessary.  rt6_select() moves
+	 * rr_ptr without the table lock; pairs with the barrier implied
+	 * by its cmpxchg() before it rechecks rt6i_node.
+	 */
+	smp_mb();
+	cmpxchg(&fn->rr_ptr, rt, NULL);
 
 	/* Adjust walkers */
 	read_lock(&fib6_walker_lock);
@@ -1111,13 +1168,16 @@ static void fib6_del_route(struct fib6_node *fn, struct rt6_info **rtp,
 		if (w->state == FWS_C && w->leaf == rt) {
 			RT6_TRACE("walker %p adjusted by delroute\n", w);
 			w->leaf = rt->u.dst.rt6_next;
+			w->skip = 0;
 			if (w->leaf == NULL)
 				w->state = FWS_U;
 		}
 	}
 	read_unlock(&fib6_walker_lock);
 
-	rt->u.dst.rt6_next = NULL;
+	/* rt6_next is left intact for lookups still walking the leaf
+	 * list; it is reused for the dst garbage list once rt is freed.
+	 */
 
 	/* If it was last route, expunge its radix tree node */
 	if (fn->leaf == NULL) {
@@ -1135,8 +1195,10 @@ static void fib6_del_route(struct fib6_node *fn, struct rt6_info **rtp,
 		 */
 		while (fn) {
 			if (!(fn->fn_flags&RTN_RTINFO) && fn->leaf == rt) {
-				fn->leaf = fib6_find_prefix(net, fn);
-				atomic_inc(&fn->leaf->rt6i_ref);
+				struct rt6_info *leaf = fib6_find_prefix(net, fn);
+
+				atomic_inc(&leaf->rt6i_ref);
+				rcu_assign_pointer(fn->leaf, leaf);
 				rt6_release(rt);
 			}
 			fn = fn->parent;
@@ -1155,6 +1217,10 @@ int fib6_del(struct rt6_info *rt, struct nl_info *info)
 	struct fib6_node *fn = rt->rt6i_node;
 	struct rt6_info **rtp;
 
+	/* Host clones live in their route's exception table */
+	if (rt->rt6i_flags & RTF_CACHE)
+		return rt6_remove_exception_rt(rt);
+
 #if RT6_DEBUG >= 2
 	if (rt->u.dst.obsolete>0) {
 		WARN_ON(fn != NULL);
@@ -1166,19 +1232,6 @@ int fib6_del(struct rt6_info *rt, struct nl_info *info)
 
 	WARN_ON(!(fn->fn_flags & RTN_RTINFO));
 
-	if (!(rt->rt6i_flags&RTF_CACHE)) {
-		struct fib6_node *pn = fn;
-#ifdef CONFIG_IPV6_SUBTREES
-		/* clones of this route might be in another subtree */
-		if (rt->rt6i_src.plen) {
-			while (!(pn->fn_flags&RTN_ROOT))
-				pn = pn->parent;
-			pn = pn->parent;
-		}
-#endif
-		fib6_prune_clones(info->nl_net, pn, rt);
-	}
-
 	/*
 	 *	Walk the leaf entries looking for ourself
 	 */
@@ -1380,31 +1433,11 @@ void fib6_clean_all(struct net *net, int (*func)(struct rt6_info *, void *arg),
 	rcu_read_unlock();
 }
 
-static int fib6_prune_clone(struct rt6_info *rt, void *arg)
-{
-	if (rt->rt6i_flags & RTF_CACHE) {
-		RT6_TRACE("pruning clone %p\n", rt);
-		return -1;
-	}
-
-	return 0;
-}
-
-static void fib6_prune_clones(struct net *net, struct fib6_node *fn,
-			      struct rt6_info *rt)
-{
-	fib6_clean_tree(net, fn, fib6_prune_clone, 1, rt);
-}
-
 /*
  *	Garbage collection
  */
 
-static struct fib6_gc_args
-{
-	int			timeout;
-	int			more;
-} gc_args;
+static struct fib6_gc_args gc_args;
 
 static int fib6_age(struct rt6_info *rt, void *arg)
 {
@@ -1414,8 +1447,7 @@ static int fib6_age(struct rt6_info *rt, void *arg)
 	 *	check addrconf expiration here.
 	 *	Routes are expired even if they are in use.
 	 *
-	 *	Also age clones. Note, that clones are aged out
-	 *	only if they are not in use now.
+	 *	Also age the clones in the route's exception table.
 	 */
 
 	if (rt->rt6i_flags&RTF_EXPIRES && rt->rt6i_expires) {
@@ -1424,20 +1456,11 @@ static int fib6_age(struct rt6_info *rt, void *arg)
 			return -1;
 		}
 		gc_args.more++;
-	} else if (rt->rt6i_flags & RTF_CACHE) {
-		if (atomic_read(&rt->u.dst.__refcnt) == 0 &&
-		    time_after_eq(now, rt->u.dst.lastuse + gc_args.timeout)) {
-			RT6_TRACE("aging clone %p\n", rt);
-			return -1;
-		} else if ((rt->rt6i_flags & RTF_GATEWAY) &&
-			   (!(rt->rt6i_nexthop->flags & NTF_ROUTER))) {
-			RT6_TRACE("purging route %p via non-router but gateway\n",
-				  rt);
-			return -1;
-		}
-		gc_args.more++;
 	}
 
+	if (rt->rt6i_exception_bucket)
+		rt6_age_exceptions(rt, &gc_args);
+
 	return 0;
 }
 
@@ -1574,5 +1597,6 @@ out_kmem_cache_create:
 void fib6_gc_cleanup(void)
 {
 	unregister_pernet_subsys(&fib6_net_ops);
+	rcu_barrier_bh();
 	kmem_cache_destroy(fib6_node_kmem);
 }
@@ -121,16 +121,20 @@ static inline void frag_kfree_skb(struct sk_buff *skb, unsigned int *work)
 {
 	if (work)
 		*work -= skb->truesize;
-	atomic_sub(skb->truesize, &nf_init_frags.mem);
+	sub_frag_mem_limit(&nf_init_frags, skb->truesize);
 	nf_skb_free(skb);
 	kfree_skb(skb);
 }
 
 /* Destruction primitives. */
 
+/* Fragment memory accounting wants BH disabled, and we may run in process
+ * context (LOCAL_OUT). */
 static __inline__ void fq_put(struct nf_ct_frag6_queue *fq)
 {
+	local_bh_disable();
 	inet_frag_put(&fq->q, &nf_frags);
+	local_bh_enable();
 }
 
 /* Kill fq entry. It is not destroyed immediately,
@@ -141,13 +145,6 @@ static __inline__ void fq_kill(struct nf_ct_frag6_queue *fq)
 	inet_frag_kill(&fq->q, &nf_frags);
 }
 
-static void nf_ct_frag6_evictor(void)
-{
-	local_bh_disable();
-	inet_frag_evictor(&nf_init_frags, &nf_frags);
-	local_bh_enable();
-}
-
 static void nf_ct_frag6_expire(unsigned long data)
 {
 	struct nf_ct_frag6_queue *fq;
@@ -180,11 +177,9 @@ fq_find(__be32 id, struct in6_addr *src, struct in6_addr *dst)
 	arg.src = src;
 	arg.dst = dst;
 
-	read_lock_bh(&nf_frags.lock);
 	hash = inet6_hash_frag(id, src, dst, nf_frags.rnd);
 
 	q = inet_frag_find(&nf_init_frags, &nf_frags, &arg, hash);
-	local_bh_enable();
 	if (q == NULL)
 		goto oom;
 
@@ -353,7 +348,7 @@ static int nf_ct_frag6_queue(struct nf_ct_frag6_queue *fq, struct sk_buff *skb,
 	skb->dev = NULL;
 	fq->q.stamp = skb->tstamp;
 	fq->q.meat += skb->len;
-	atomic_add(skb->truesize, &nf_init_frags.mem);
+	add_frag_mem_limit(&nf_init_frags, skb->truesize);
 
 	/* The first fragment.
 	 * nhoffset is obtained from the first fragment, of course.
@@ -362,9 +357,6 @@ static int nf_ct_frag6_queue(struct nf_ct_frag6_queue *fq, struct sk_buff *skb,
 		fq->nhoffset = nhoff;
 		fq->q.last_in |= INET_FRAG_FIRST_IN;
 	}
-	write_lock(&nf_frags.lock);
-	list_move_tail(&fq->q.lru_list, &nf_init_frags.lru_list);
-	write_unlock(&nf_frags.lock);
 	return 0;
 
 err:
@@ -430,7 +422,7 @@ nf_ct_frag6_reasm(struct nf_ct_frag6_queue *fq, struct net_device *dev)
 		clone->ip_summed = head->ip_summed;
 
 		NFCT_FRAG6_CB(clone)->orig = NULL;
-		atomic_add(clone->truesize, &nf_init_frags.mem);
+		add_frag_mem_limit(&nf_init_frags, clone->truesize);
 	}
 
 	/* We have to remove fragment header from datagram and to relocate
@@ -444,7 +436,7 @@ nf_ct_frag6_reasm(struct nf_ct_frag6_queue *fq, struct net_device *dev)
 	skb_shinfo(head)->frag_list = head->next;
 	skb_reset_transport_header(head);
 	skb_push(head, head->data - skb_network_header(head));
-	atomic_sub(head->truesize, &nf_init_frags.mem);
+	sub_frag_mem_limit(&nf_init_frags, head->truesize);
 
 	for (fp=head->next; fp; fp = fp->next) {
 		head->data_len += fp->len;
@@ -454,7 +446,7 @@ nf_ct_frag6_reasm(struct nf_ct_frag6_queue *fq, struct net_device *dev)
 		else if (head->ip_summed == CHECKSUM_COMPLETE)
 			head->csum = csum_add(head->csum, fp->csum);
 		head->truesize += fp->truesize;
-		atomic_sub(fp->truesize, &nf_init_frags.mem);
+		sub_frag_mem_limit(&nf_init_frags, fp->truesize);
 	}
 
 	head->next = NULL;
@@ -604,9 +596,6 @@ struct sk_buff *nf_ct_frag6_gather(struct sk_buff *skb)
 		goto ret_orig;
 	}
 
-	if (atomic_read(&nf_init_frags.mem) > nf_init_frags.high_thresh)
-		nf_ct_frag6_evictor();
-
 	fq = fq_find(fhdr->identification, &hdr->saddr, &hdr->daddr);
 	if (fq == NULL) {
 		pr_debug("Can't find and can't create new queue\n");
@@ -661,6 +650,8 @@ void nf_ct_frag6_output(unsigned int hooknum, struct sk_buff *skb,
 
 int nf_ct_frag6_init(void)
 {
+	int ret;
+
 	nf_frags.hashfn = nf_hashfn;
 	nf_frags.constructor = ip6_frag_init;
 	nf_frags.destructor = NULL;
@@ -672,16 +663,18 @@ int nf_ct_frag6_init(void)
 	nf_init_frags.timeout = IPV6_FRAG_TIMEOUT;
 	nf_init_frags.high_thresh = 256 * 1024;
 	nf_init_frags.low_thresh = 192 * 1024;
-	inet_frags_init_net(&nf_init_frags);
-	inet_frags_init(&nf_frags);
-
-	return 0;
+	ret = inet_frags_init_net(&nf_init_frags);
+	if (ret)
+		return ret;
+	ret = inet_frags_init(&nf_frags);
+	if (ret)
+		percpu_counter_destroy(&nf_init_frags.mem);
+
+	return ret;
 }
 
 void nf_ct_frag6_cleanup(void)
 {
+	inet_frags_exit_net(&nf_init_frags, &nf_frags);
 	inet_frags_fini(&nf_frags);
-
-	nf_init_frags.low_thresh = 0;
-	nf_ct_frag6_evictor();
 }
@@ -40,6 +40,8 @@
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
 #include <linux/nsproxy.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
 #include <net/net_namespace.h>
 #include <net/snmp.h>
 #include <net/ipv6.h>
@@ -71,8 +73,6 @@
 #define RT6_TRACE(x...) do { ; } while (0)
 #endif
 
-#define CLONE_OFFLINK_ROUTE 0
-
 static struct rt6_info * ip6_rt_copy(struct rt6_info *ort);
 static struct dst_entry	*ip6_dst_check(struct dst_entry *dst, u32 cookie);
 static struct dst_entry *ip6_negative_advice(struct dst_entry *);
@@ -223,6 +223,320 @@ static __inline__ int rt6_check_expired(const struct rt6_info *rt)
 		time_after(jiffies, rt->rt6i_expires));
 }
 
+/*
+ *	Exception table.
+ *
+ *	Host clones are kept in the exception table of the route they were
+ *	cloned from, keyed by destination (and source, for routes with a
+ *	source prefix).  Writers hold the table lock of that route; lookups
+ *	run under rcu_read_lock_bh() or the table read lock.
+ */
+
+static u32 rt6_exception_rnd __read_mostly;
+
+static u32 rt6_exception_hash(const struct in6_addr *dst,
+			      const struct in6_addr *src)
+{
+	u32 val;
+
+	val = jhash2((const u32 *)dst, 4, rt6_exception_rnd);
+#ifdef CONFIG_IPV6_SUBTREES
+	if (src)
+		val = jhash2((const u32 *)src, 4, val);
+#endif
+	return val & (FIB6_EXCEPTION_BUCKET_SIZE - 1);
+}
+
+/* Clones carry a source key only when their route has a source prefix */
+static inline struct in6_addr *rt6_exception_src(struct rt6_info *from,
+						 struct in6_addr *saddr)
+{
+#ifdef CONFIG_IPV6_SUBTREES
+	if (from->rt6i_src.plen)
+		return saddr;
+#endif
+	return NULL;
+}
+
+static struct rt6_exception *
+__rt6_find_exception(struct rt6_exception_bucket *bucket,
+		     const struct in6_addr *daddr,
+		     const struct in6_addr *saddr)
+{
+	struct rt6_exception *rt6_ex;
+	struct hlist_node *node;
+
+	hlist_for_each_entry_rcu(rt6_ex, node, &bucket->chain, hlist) {
+		struct rt6_info *rt = rt6_ex->rt6i;
+
+		if (!ipv6_addr_equal(daddr, &rt->rt6i_dst.addr))
+			continue;
+#ifdef CONFIG_IPV6_SUBTREES
+		if (saddr && !ipv6_addr_equal(saddr, &rt->rt6i_src.addr))
+			continue;
+#endif
+		return rt6_ex;
+	}
+	return NULL;
+}
+
+static void rt6_exception_free_rcu(struct rcu_head *head)
+{
+	struct rt6_exception *rt6_ex = container_of(head, struct rt6_exception,
+						    rcu);
+
+	dst_free(&rt6_ex->rt6i->u.dst);
+	kfree(rt6_ex);
+}
+
+static void rt6_remove_exception(struct rt6_exception_bucket *bucket,
+				 struct rt6_exception *rt6_ex)
+{
+	struct rt6_info *rt = rt6_ex->rt6i;
+	struct net *net = dev_net(rt->rt6i_dev);
+
+	hlist_del_rcu(&rt6_ex->hlist);
+	bucket->depth--;
+	net->ipv6.rt6_stats->fib_rt_cache--;
+
+	/* Invalidates it for the sockets still caching it */
+	rt->rt6i_from = NULL;
+	rt->rt6i_node = NULL;
+	call_rcu_bh(&rt6_ex->rcu, rt6_exception_free_rcu);
+}
+
+static void rt6_exception_remove_oldest(struct rt6_exception_bucket *bucket)
+{
+	struct rt6_exception *rt6_ex, *oldest = NULL;
+	struct hlist_node *node;
+
+	hlist_for_each_entry(rt6_ex, node, &bucket->chain, hlist) {
+		/* Chains are added to at the head: on a tie, the later wins */
+		if (!oldest || !time_after(rt6_ex->stamp, oldest->stamp))
+			oldest = rt6_ex;
+	}
+	rt6_remove_exception(bucket, oldest);
+}
+
+static struct rt6_info *rt6_find_cached_rt(struct rt6_info *rt,
+					   struct in6_addr *daddr,
+					   struct in6_addr *saddr)
+{
+	struct rt6_exception_bucket *bucket;
+	struct rt6_exception *rt6_ex;
+	struct in6_addr *src_key;
+
+	bucket = rcu_dereference(rt->rt6i_exception_bucket);
+	if (!bucket)
+		return NULL;
+
+	src_key = rt6_exception_src(rt, saddr);
+	bucket += rt6_exception_hash(daddr, src_key);
+	rt6_ex = __rt6_find_exception(bucket, daddr, src_key);
+	if (rt6_ex && !rt6_check_expired(rt6_ex->rt6i))
+		return rt6_ex->rt6i;
+	return NULL;
+}
+
+/*
+ *	Link the host clone nrt into the exception table of ort, or of the
+ *	route ort was itself cloned from.  Any clone it replaces is dropped
+ *	and, as with ip6_ins_rt(), nrt is freed if this fails.
+ */
+static int rt6_insert_exception(struct rt6_info *nrt, struct rt6_info *ort)
+{
+	struct net *net = dev_net(ort->rt6i_dev);
+	struct fib6_table *table = ort->rt6i_table;
+	struct rt6_exception_bucket *bucket;
+	struct rt6_exception *rt6_ex, *old;
+	struct in6_addr *src_key;
+	int err = 0;
+
+	rt6_ex = kmalloc(sizeof(*rt6_ex), GFP_ATOMIC);
+	if (!rt6_ex) {
+		dst_free(&nrt->u.dst);
+		return -ENOMEM;
+	}
+
+	write_lock_bh(&table->tb6_lock);
+
+	if (ort->rt6i_flags & RTF_CACHE)
+		ort = ort->rt6i_from;
+
+	/* The route left the tree meanwhile */
+	if (!ort || !ort->rt6i_node) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	bucket = ort->rt6i_exception_bucket;
+	if (!bucket) {
+		bucket = kcalloc(FIB6_EXCEPTION_BUCKET_SIZE, sizeof(*bucket),
+				 GFP_ATOMIC);
+		if (!bucket) {
+			err = -ENOMEM;
+			goto out;
+		}
+		rcu_assign_pointer(ort->rt6i_exception_bucket, bucket);
+	}
+
+	src_key = rt6_exception_src(ort, &nrt->rt6i_src.addr);
+	bucket += rt6_exception_hash(&nrt->rt6i_dst.addr, src_key);
+
+	old = __rt6_find_exception(bucket, &nrt->rt6i_dst.addr, src_key);
+	if (old)
+		rt6_remove_exception(bucket, old);
+
+	nrt->rt6i_from = ort;
+	nrt->rt6i_node = ort->rt6i_node;
+	nrt->u.dst.obsolete = -1;
+
+	rt6_ex->rt6i = nrt;
+	rt6_ex->stamp = jiffies;
+	hlist_add_head_rcu(&rt6_ex->hlist, &bucket->chain);
+	bucket->depth++;
+	net->ipv6.rt6_stats->fib_rt_cache++;
+
+	if (bucket->depth > FIB6_MAX_DEPTH)
+		rt6_exception_remove_oldest(bucket);
+
+	/* Sockets may be caching ort itself or one of its per-CPU copies;
+	 * make them look up again.  On-link routes are only ever handed
+	 * out through their clones.
+	 */
+	if (ort->rt6i_nexthop || ort->rt6i_flags & RTF_NONEXTHOP)
+		fib6_update_sernum(ort);
+
+	fib6_force_start_gc(net);
+out:
+	write_unlock_bh(&table->tb6_lock);
+	if (err) {
+		kfree(rt6_ex);
+		dst_free(&nrt->u.dst);
+	}
+	return err;
+}
+
+/*
+ *	Called from fib6_del() with the table lock held.
+ */
+int rt6_remove_exception_rt(struct rt6_info *rt)
+{
+	struct rt6_info *from = rt->rt6i_from;
+	struct rt6_exception_bucket *bucket;
+	struct rt6_exception *rt6_ex;
+	struct in6_addr *src_key;
+
+	if (!from || !from->rt6i_exception_bucket)
+		return -ENOENT;
+
+	src_key = rt6_exception_src(from, &rt->rt6i_src.addr);
+	bucket = from->rt6i_exception_bucket +
+		 rt6_exception_hash(&rt->rt6i_dst.addr, src_key);
+
+	rt6_ex = __rt6_find_exception(bucket, &rt->rt6i_dst.addr, src_key);
+	if (!rt6_ex || rt6_ex->rt6i != rt)
+		return -ENOENT;
+
+	rt6_remove_exception(bucket, rt6_ex);
+	return 0;
+}
+
+/*
+ *	Called from fib6_del_route() with the table lock held, once rt has
+ *	left the tree: drop its clones and detach its per-CPU copies from
+ *	the node that is about to go away.
+ */
+void rt6_flush_exceptions(struct rt6_info *rt)
+{
+	struct rt6_exception_bucket *bucket = rt->rt6i_exception_bucket;
+	struct rt6_exception *rt6_ex;
+	struct hlist_node *node, *tmp;
+	struct rt6_info **p;
+	int i, cpu;
+
+	if (bucket) {
+		for (i = 0; i < FIB6_EXCEPTION_BUCKET_SIZE; i++, bucket++)
+			hlist_for_each_entry_safe(rt6_ex, node, tmp,
+						  &bucket->chain, hlist)
+				rt6_remove_exception(bucket, rt6_ex);
+	}
+
+	/* Pairs with the barrier in rt6_get_pcpu_route(): either a copy
+	 * made concurrently is seen here, or it sees rt6i_node cleared.
+	 */
+	smp_mb();
+	p = rt->rt6i_pcpu;
+	if (p) {
+		for_each_possible_cpu(cpu) {
+			if (p[cpu])
+				p[cpu]->rt6i_node = NULL;
+		}
+	}
+}
+
+void rt6_age_exceptions(struct rt6_info *rt, struct fib6_gc_args *gc_args)
+{
+	struct rt6_exception_bucket *bucket = rt->rt6i_exception_bucket;
+	struct rt6_exception *rt6_ex;
+	struct hlist_node *node, *tmp;
+	unsigned long now = jiffies;
+	int i;
+
+	for (i = 0; i < FIB6_EXCEPTION_BUCKET_SIZE; i++, bucket++) {
+		hlist_for_each_entry_safe(rt6_ex, node, tmp,
+					  &bucket->chain, hlist) {
+			struct rt6_info *rt6i = rt6_ex->rt6i;
+
+			/* Clones are aged out only if they are not in use */
+			if (rt6i->rt6i_flags & RTF_EXPIRES &&
+			    rt6i->rt6i_expires) {
+				if (time_after(now, rt6i->rt6i_expires)) {
+					RT6_TRACE("expiring clone %p\n", rt6i);
+					rt6_remove_exception(bucket, rt6_ex);
+					continue;
+				}
+			} else if (atomic_read(&rt6i->u.dst.__refcnt) == 0 &&
+				   time_after_eq(now, rt6i->u.dst.lastuse +
+						      gc_args->timeout)) {
+				RT6_TRACE("aging clone %p\n", rt6i);
+				rt6_remove_exception(bucket, rt6_ex);
+				continue;
+			} else if ((rt6i->rt6i_flags & RTF_GATEWAY) &&
+				   !(rt6i->rt6i_nexthop->flags & NTF_ROUTER)) {
+				RT6_TRACE("purging clone %p via non-router but gateway\n",
+					  rt6i);
+				rt6_remove_exception(bucket, rt6_ex);
+				continue;
+			}
+			gc_args->more++;
+		}
+	}
+}
+
+/*
+ *	Final release of rt, a grace period after it left the tree: no
+ *	lookup can reach its per-CPU copies or exception table any more.
+ */
+void rt6_free_cached(struct rt6_info *rt)
+{
+	struct rt6_info **p = rt->rt6i_pcpu;
+	int cpu;
+
+	if (p) {
+		for_each_possible_cpu(cpu) {
+			if (p[cpu]) {
+				p[cpu]->rt6i_node = NULL;
+				dst_free(&p[cpu]->u.dst);
+			}
+		}
+		kfree(p);
+		rt->rt6i_pcpu = NULL;
+	}
+	kfree(rt->rt6i_exception_bucket);
+	rt->rt6i_exception_bucket = NULL;
+}
+
 static inline int rt6_need_strict(struct in6_addr *daddr)
 {
 	return (ipv6_addr_type(daddr) &
@@ -230,7 +544,7 @@ static inline int rt6_need_strict(struct in6_addr *daddr)
 }
 
 /*
- *	Route lookup. Any table->tb6_lock is implied.
+ *	Route lookup. Either rcu_read_lock_bh() or table->tb6_lock is implied.
  */
 
 static inline struct rt6_info *rt6_device_match(struct net *net,
@@ -245,7 +559,7 @@ static inline struct rt6_info *rt6_device_match(struct net *net,
 	if (!oif && ipv6_addr_any(saddr))
 		goto out;
 
-	for (sprt = rt; sprt; sprt = sprt->u.dst.rt6_next) {
+	for (sprt = rt; sprt; sprt = rcu_dereference(sprt->u.dst.rt6_next)) {
 		struct net_device *dev = sprt->rt6i_dev;
 
 		if (oif) {
@@ -404,45 +718,57 @@ static struct rt6_info *find_rr_leaf(struct fib6_node *fn,
 
 	match = NULL;
 	for (rt = rr_head; rt && rt->rt6i_metric == metric;
-	     rt = rt->u.dst.rt6_next)
+	     rt = rcu_dereference(rt->u.dst.rt6_next))
 		match = find_match(rt, oif, strict, &mpri, match);
-	for (rt = fn->leaf; rt && rt != rr_head && rt->rt6i_metric == metric;
-	     rt = rt->u.dst.rt6_next)
+	for (rt = rcu_dereference(fn->leaf);
+	     rt && rt != rr_head && rt->rt6i_metric == metric;
+	     rt = rcu_dereference(rt->u.dst.rt6_next))
 		match = find_match(rt, oif, strict, &mpri, match);
 
 	return match;
 }
 
-static struct rt6_info *rt6_select(struct fib6_node *fn, int oif, int strict)
+static struct rt6_info *rt6_select(struct net *net, struct fib6_node *fn,
+				   int oif, int strict)
 {
-	struct rt6_info *match, *rt0;
-	struct net *net;
+	struct rt6_info *match, *rr, *rt0, *leaf;
+
+	leaf = rcu_dereference(fn->leaf);
 
 	RT6_TRACE("%s(fn->leaf=%p, oif=%d)\n",
-		  __func__, fn->leaf, oif);
+		  __func__, leaf, oif);
 
-	rt0 = fn->rr_ptr;
-	if (!rt0)
-		fn->rr_ptr = rt0 = fn->leaf;
+	/* Raced with the removal of the node's last route */
+	if (!leaf)
+		return net->ipv6.ip6_null_entry;
+
+	rr = rcu_dereference(fn->rr_ptr);
+	rt0 = rr ? rr : leaf;
 
 	match = find_rr_leaf(fn, rt0, rt0->rt6i_metric, oif, strict);
 
 	if (!match &&
 	    (strict & RT6_LOOKUP_F_REACHABLE)) {
-		struct rt6_info *next = rt0->u.dst.rt6_next;
+		struct rt6_info *next = rcu_dereference(rt0->u.dst.rt6_next);
 
 		/* no entries matched; do round-robin */
 		if (!next || next->rt6i_metric != rt0->rt6i_metric)
-			next = fn->leaf;
+			next = leaf;
 
-		if (next != rt0)
-			fn->rr_ptr = next;
+		/* Advance rr_ptr without tb6_lock; losing the race to
+		 * another lookup just skips one step.  fib6_del_route()
+		 * clears rt6i_node before it checks rr_ptr, so if next
+		 * is being unlinked one of us sees the other and
+		 * rr_ptr is not left pointing at it.
+		 */
+		if (next != rt0 && cmpxchg(&fn->rr_ptr, rr, next) == rr &&
+		    next->rt6i_node != fn)
+			cmpxchg(&fn->rr_ptr, next, NULL);
 	}
 
 	RT6_TRACE("%s() => %p\n",
 		  __func__, match);
 
-	net = dev_net(rt0->rt6i_dev);
 	return (match ? match : net->ipv6.ip6_null_entry);
 }
 
@@ -527,7 +853,7 @@ do { \
 		while (1) { \
 			if (fn->fn_flags & RTN_TL_ROOT) \
 				goto out; \
-			pn = fn->parent; \
+			pn = rcu_dereference(fn->parent); \
 			if (FIB6_SUBTREE(pn) && FIB6_SUBTREE(pn) != fn) \
 				fn = fib6_lookup(FIB6_SUBTREE(pn), NULL, saddr); \
 			else \
@@ -543,17 +869,27 @@ static struct rt6_info *ip6_pol_route_lookup(struct net *net,
 					     struct flowi *fl, int flags)
 {
 	struct fib6_node *fn;
-	struct rt6_info *rt;
+	struct rt6_info *rt, *rt_cache;
 
-	read_lock_bh(&table->tb6_lock);
+	rcu_read_lock_bh();
 	fn = fib6_lookup(&table->tb6_root, &fl->fl6_dst, &fl->fl6_src);
 restart:
-	rt = fn->leaf;
-	rt = rt6_device_match(net, rt, &fl->fl6_src, fl->oif, flags);
+	rt = rcu_dereference(fn->leaf);
+	if (!rt)
+		rt = net->ipv6.ip6_null_entry;
+	else
+		rt = rt6_device_match(net, rt, &fl->fl6_src, fl->oif, flags);
 	BACKTRACK(net, &fl->fl6_src);
+
+	/* Callers want the PMTU/redirect state for this destination */
+	if (rt != net->ipv6.ip6_null_entry) {
+		rt_cache = rt6_find_cached_rt(rt, &fl->fl6_dst, &fl->fl6_src);
+		if (rt_cache)
+			rt = rt_cache;
+	}
 out:
 	dst_use(&rt->u.dst, jiffies);
-	read_unlock_bh(&table->tb6_lock);
+	rcu_read_unlock_bh();
 	return rt;
 
 }
@@ -684,7 +1020,8 @@ static struct rt6_info *rt6_alloc_cow(struct rt6_info *ort, struct in6_addr *dad
 	return rt;
 }
 
-static struct rt6_info *rt6_alloc_clone(struct rt6_info *ort, struct in6_addr *daddr)
+static struct rt6_info *rt6_alloc_clone(struct rt6_info *ort, struct in6_addr *daddr,
+				       struct in6_addr *saddr)
 {
 	struct rt6_info *rt = ip6_rt_copy(ort);
 	if (rt) {
@@ -693,10 +1030,64 @@ static struct rt6_info *rt6_alloc_clone(struct rt6_info *ort, struct in6_addr *d
 		rt->rt6i_flags |= RTF_CACHE;
 		rt->u.dst.flags |= DST_HOST;
 		rt->rt6i_nexthop = neigh_clone(ort->rt6i_nexthop);
+#ifdef CONFIG_IPV6_SUBTREES
+		if (rt->rt6i_src.plen && saddr) {
+			ipv6_addr_copy(&rt->rt6i_src.addr, saddr);
+			rt->rt6i_src.plen = 128;
+		}
+#endif
 	}
 	return rt;
 }
 
+/*
+ *	Routes that need no per-destination state are handed out as one
+ *	private copy per CPU, so that the reference count and use stamps
+ *	of a busy route do not bounce between CPUs.  Called under
+ *	rcu_read_lock_bh(), which also keeps us on this CPU.
+ */
+static struct rt6_info *rt6_get_pcpu_route(struct rt6_info *rt)
+{
+	struct rt6_info **p, *pcpu_rt;
+
+	p = rcu_dereference(rt->rt6i_pcpu);
+	if (!p) {
+		p = kcalloc(nr_cpu_ids, sizeof(*p), GFP_ATOMIC);
+		if (!p)
+			return NULL;
+		if (cmpxchg(&rt->rt6i_pcpu, NULL, p) != NULL) {
+			kfree(p);
+			p = rt->rt6i_pcpu;
+		}
+	}
+
+	p += smp_processor_id();
+	pcpu_rt = *p;
+	if (pcpu_rt)
+		return pcpu_rt;
+
+	pcpu_rt = ip6_rt_copy(rt);
+	if (!pcpu_rt)
+		return NULL;
+
+	pcpu_rt->u.dst.obsolete = -1;
+	pcpu_rt->u.dst.flags = rt->u.dst.flags;
+	pcpu_rt->rt6i_nexthop = neigh_clone(rt->rt6i_nexthop);
+	pcpu_rt->rt6i_flags |= RTF_PCPU;
+	pcpu_rt->rt6i_metric = rt->rt6i_metric;
+	pcpu_rt->rt6i_protocol = rt->rt6i_protocol;
+	pcpu_rt->rt6i_node = rt->rt6i_node;
+
+	*p = pcpu_rt;
+
+	/* Pairs with the barrier in rt6_flush_exceptions() */
+	smp_mb();
+	if (!rt->rt6i_node)
+		pcpu_rt->rt6i_node = NULL;
+
+	return pcpu_rt;
+}
+
 static struct rt6_info *ip6_pol_route(struct net *net, struct fib6_table *table, int oif,
 				      struct flowi *fl, int flags)
 {
@@ -710,48 +1101,56 @@ static struct rt6_info *ip6_pol_route(struct net *net, struct fib6_table *table,
 	strict |= flags & RT6_LOOKUP_F_IFACE;
 
 relookup:
-	read_lock_bh(&table->tb6_lock);
+	rcu_read_lock_bh();
 
 restart_2:
 	fn = fib6_lookup(&table->tb6_root, &fl->fl6_dst, &fl->fl6_src);
 
 restart:
-	rt = rt6_select(fn, oif, strict | reachable);
+	rt = rt6_select(net, fn, oif, strict | reachable);
 
 	BACKTRACK(net, &fl->fl6_src);
-	if (rt == net->ipv6.ip6_null_entry ||
-	    rt->rt6i_flags & RTF_CACHE)
+	if (rt == net->ipv6.ip6_null_entry)
 		goto out;
 
-	dst_hold(&rt->u.dst);
-	read_unlock_bh(&table->tb6_lock);
-
-	if (!rt->rt6i_nexthop && !(rt->rt6i_flags & RTF_NONEXTHOP))
-		nrt = rt6_alloc_cow(rt, &fl->fl6_dst, &fl->fl6_src);
-	else {
-#if CLONE_OFFLINK_ROUTE
-		nrt = rt6_alloc_clone(rt, &fl->fl6_dst);
-#else
-		goto out2;
-#endif
+	/* A PMTU, redirect or on-link clone for this destination */
+	nrt = rt6_find_cached_rt(rt, &fl->fl6_dst, &fl->fl6_src);
+	if (nrt) {
+		rt = nrt;
+		goto out_hold;
 	}
 
-	dst_release(&rt->u.dst);
-	rt = nrt ? : net->ipv6.ip6_null_entry;
+	if (rt->rt6i_nexthop || rt->rt6i_flags & RTF_NONEXTHOP) {
+		/* Fall back to the shared route if no copy can be made */
+		nrt = rt6_get_pcpu_route(rt);
+		if (nrt)
+			rt = nrt;
+		goto out_hold;
+	}
 
 	dst_hold(&rt->u.dst);
+	rcu_read_unlock_bh();
+
+	nrt = rt6_alloc_cow(rt, &fl->fl6_dst, &fl->fl6_src);
 	if (nrt) {
-		err = ip6_ins_rt(nrt);
+		dst_hold(&nrt->u.dst);
+		err = rt6_insert_exception(nrt, rt);
+		dst_release(&rt->u.dst);
+		rt = nrt;
 		if (!err)
 			goto out2;
+	} else {
+		dst_release(&rt->u.dst);
+		rt = net->ipv6.ip6_null_entry;
+		dst_hold(&rt->u.dst);
 	}
 
 	if (--attempts <= 0)
 		goto out2;
 
 	/*
-	 * Race condition! In the gap, when table->tb6_lock was
-	 * released someone could insert this route.  Relookup.
+	 * Race condition! In the gap, when we left the RCU section,
+	 * the route could have been deleted.  Relookup.
 	 */
 	dst_release(&rt->u.dst);
 	goto relookup;
@@ -761,8 +1160,9 @@ out:
 		reachable = 0;
 		goto restart_2;
 	}
+out_hold:
 	dst_hold(&rt->u.dst);
-	read_unlock_bh(&table->tb6_lock);
+	rcu_read_unlock_bh();
 out2:
 	rt->u.dst.lastuse = jiffies;
 	rt->u.dst.__use++;
@@ -923,6 +1323,14 @@ static void ip6_rt_update_pmtu(struct dst_entry *dst, u32 mtu)
 	struct rt6_info *rt6 = (struct rt6_info*)dst;
 
 	if (mtu < dst_mtu(dst) && rt6->rt6i_dst.plen == 128) {
+		/* Other CPUs have copies of their own: record it as an
+		 * exception of the route instead.
+		 */
+		if (rt6->rt6i_flags & RTF_PCPU) {
+			rt6_pmtu_discovery(&rt6->rt6i_dst.addr, NULL,
+					   dst->dev, mtu);
+			return;
+		}
 		rt6->rt6i_flags |= RTF_MODIFIED;
 		if (mtu < IPV6_MIN_MTU) {
 			mtu = IPV6_MIN_MTU;
@@ -1403,7 +1811,7 @@ static struct rt6_info *__ip6_route_redirect(struct net *net,
 					     int flags)
 {
 	struct ip6rd_flowi *rdfl = (struct ip6rd_flowi *)fl;
-	struct rt6_info *rt;
+	struct rt6_info *rt, *rt_cache;
 	struct fib6_node *fn;
 
 	/*
@@ -1431,10 +1839,17 @@ restart:
 		 */
 		if (rt6_check_expired(rt))
 			continue;
-		if (!(rt->rt6i_flags & RTF_GATEWAY))
-			continue;
 		if (fl->oif != rt->rt6i_dev->ifindex)
 			continue;
+		/* The current nexthop may come from an earlier redirect */
+		rt_cache = rt6_find_cached_rt(rt, &fl->fl6_dst, &fl->fl6_src);
+		if (rt_cache && rt_cache->rt6i_flags & RTF_GATEWAY &&
+		    ipv6_addr_equal(&rdfl->gateway, &rt_cache->rt6i_gateway)) {
+			rt = rt_cache;
+			break;
+		}
+		if (!(rt->rt6i_flags & RTF_GATEWAY))
+			continue;
 		if (!ipv6_addr_equal(&rdfl->gateway, &rt->rt6i_gateway))
 			continue;
 		break;
@@ -1528,6 +1943,12 @@ void rt6_redirect(struct in6_addr *dest, struct in6_addr *src,
 	ipv6_addr_copy(&nrt->rt6i_dst.addr, dest);
 	nrt->rt6i_dst.plen = 128;
 	nrt->u.dst.flags |= DST_HOST;
+#ifdef CONFIG_IPV6_SUBTREES
+	if (nrt->rt6i_src.plen) {
+		ipv6_addr_copy(&nrt->rt6i_src.addr, src);
+		nrt->rt6i_src.plen = 128;
+	}
+#endif
 
 	ipv6_addr_copy(&nrt->rt6i_gateway, (struct in6_addr*)neigh->primary_key);
 	nrt->rt6i_nexthop = neigh_clone(neigh);
@@ -1536,7 +1957,7 @@ void rt6_redirect(struct in6_addr *dest, struct in6_addr *src,
 	nrt->u.dst.metrics[RTAX_ADVMSS-1] = ipv6_advmss(dev_net(neigh->dev),
 							dst_mtu(&nrt->u.dst));
 
-	if (ip6_ins_rt(nrt))
+	if (rt6_insert_exception(nrt, rt))
 		goto out;
 
 	netevent.old = &rt->u.dst;
@@ -1607,11 +2028,12 @@ void rt6_pmtu_discovery(struct in6_addr *daddr, struct in6_addr *saddr,
 	   Two cases are possible:
 	   1. It is connected route. Action: COW
 	   2. It is gatewayed route or NONEXTHOP route. Action: clone it.
+	   Either way the clone goes into the route's exception table.
 	 */
 	if (!rt->rt6i_nexthop && !(rt->rt6i_flags & RTF_NONEXTHOP))
 		nrt = rt6_alloc_cow(rt, daddr, saddr);
 	else
-		nrt = rt6_alloc_clone(rt, daddr);
+		nrt = rt6_alloc_clone(rt, daddr, saddr);
 
 	if (nrt) {
 		nrt->u.dst.metrics[RTAX_MTU-1] = pmtu;
@@ -1627,7 +2049,7 @@ void rt6_pmtu_discovery(struct in6_addr *daddr, struct in6_addr *saddr,
 		dst_set_expires(&nrt->u.dst, net->ipv6.sysctl.ip6_rt_mtu_expires);
 		nrt->rt6i_flags |= RTF_DYNAMIC|RTF_EXPIRES;
 
-		ip6_ins_rt(nrt);
+		rt6_insert_exception(nrt, rt);
 	}
 out:
 	dst_release(&rt->u.dst);
@@ -1658,7 +2080,7 @@ static struct rt6_info * ip6_rt_copy(struct rt6_info *ort)
 		rt->rt6i_expires = 0;
 
 		ipv6_addr_copy(&rt->rt6i_gateway, &ort->rt6i_gateway);
-		rt->rt6i_flags = ort->rt6i_flags & ~RTF_EXPIRES;
+		rt->rt6i_flags = ort->rt6i_flags & ~(RTF_EXPIRES | RTF_PCPU);
 		rt->rt6i_metric = 0;
 
 		memcpy(&rt->rt6i_dst, &ort->rt6i_dst, sizeof(struct rt6key));
@@ -2001,6 +2423,17 @@ struct rt6_mtu_change_arg
 	unsigned mtu;
 };
 
+static void rt6_mtu_change_dst(struct dst_entry *dst, unsigned mtu,
+			       struct inet6_dev *idev, struct net *net)
+{
+	if (!dst_metric_locked(dst, RTAX_MTU) &&
+	    (dst_mtu(dst) >= mtu ||
+	     (dst_mtu(dst) < mtu && dst_mtu(dst) == idev->cnf.mtu6))) {
+		dst->metrics[RTAX_MTU-1] = mtu;
+		dst->metrics[RTAX_ADVMSS-1] = ipv6_advmss(net, mtu);
+	}
+}
+
 static int rt6_mtu_change_route(struct rt6_info *rt, void *p_arg)
 {
 	struct rt6_mtu_change_arg *arg = (struct rt6_mtu_change_arg *) p_arg;
@@ -2031,13 +2464,26 @@ static int rt6_mtu_change_route(struct rt6_info *rt, void *p_arg)
 	   also have the lowest MTU, TOO BIG MESSAGE will be lead to
 	   PMTU discouvery.
 	 */
-	if (rt->rt6i_dev == arg->dev &&
-	    !dst_metric_locked(&rt->u.dst, RTAX_MTU) &&
-	    (dst_mtu(&rt->u.dst) >= arg->mtu ||
-	     (dst_mtu(&rt->u.dst) < arg->mtu &&
-	      dst_mtu(&rt->u.dst) == idev->cnf.mtu6))) {
-		rt->u.dst.metrics[RTAX_MTU-1] = arg->mtu;
-		rt->u.dst.metrics[RTAX_ADVMSS-1] = ipv6_advmss(net, arg->mtu);
+	if (rt->rt6i_dev == arg->dev) {
+		struct rt6_exception_bucket *bucket = rt->rt6i_exception_bucket;
+		struct rt6_exception *rt6_ex;
+		struct hlist_node *node;
+		int i, cpu;
+
+		rt6_mtu_change_dst(&rt->u.dst, arg->mtu, idev, net);
+
+		if (rt->rt6i_pcpu) {
+			for_each_possible_cpu(cpu) {
+				if (rt->rt6i_pcpu[cpu])
+					rt6_mtu_change_dst(&rt->rt6i_pcpu[cpu]->u.dst,
+							   arg->mtu, idev, net);
+			}
+		}
+
+		for (i = 0; bucket && i < FIB6_EXCEPTION_BUCKET_SIZE; i++)
+			hlist_for_each_entry(rt6_ex, node, &bucket[i].chain, hlist)
+				rt6_mtu_change_dst(&rt6_ex->rt6i->u.dst,
+						   arg->mtu, idev, net);
 	}
 	return 0;
 }
@@ -2304,6 +2750,35 @@ int rt6_dump_route(struct rt6_info *rt, void *p_arg)
 		     prefix, 0, NLM_F_MULTI);
 }
 
+/*
+ *	Dump the host clones in the exception table of rt, after the first
+ *	*skip of them, which an earlier frame took; *skip is advanced past
+ *	each one dumped.  Returns < 0 once the frame is full.  The caller
+ *	holds the table lock.
+ */
+int rt6_dump_exceptions(struct rt6_info *rt, void *p_arg, int *skip)
+{
+	struct rt6_exception_bucket *bucket = rt->rt6i_exception_bucket;
+	struct rt6_exception *rt6_ex;
+	struct hlist_node *node;
+	int i, n = 0, res;
+
+	if (!bucket)
+		return 0;
+
+	for (i = 0; i < FIB6_EXCEPTION_BUCKET_SIZE; i++, bucket++) {
+		hlist_for_each_entry(rt6_ex, node, &bucket->chain, hlist) {
+			if (n++ < *skip)
+				continue;
+			res = rt6_dump_route(rt6_ex->rt6i, p_arg);
+			if (res < 0)
+				return res;
+			(*skip)++;
+		}
+	}
+	return 0;
+}
+
 static int inet6_rtm_getroute(struct sk_buff *in_skb, struct nlmsghdr* nlh, void *arg)
 {
 	struct net *net = sock_net(in_skb->sk);
@@ -2468,10 +2943,28 @@ static int rt6_info_route(struct rt6_info *rt, void *p_arg)
 	return 0;
 }
 
+/* A route, then the host clones in its exception table */
+static int rt6_info_route_exceptions(struct rt6_info *rt, void *p_arg)
+{
+	struct rt6_exception_bucket *bucket = rt->rt6i_exception_bucket;
+	struct rt6_exception *rt6_ex;
+	struct hlist_node *node;
+	int i;
+
+	rt6_info_route(rt, p_arg);
+	if (!bucket)
+		return 0;
+
+	for (i = 0; i < FIB6_EXCEPTION_BUCKET_SIZE; i++, bucket++)
+		hlist_for_each_entry(rt6_ex, node, &bucket->chain, hlist)
+			rt6_info_route(rt6_ex->rt6i, p_arg);
+	return 0;
+}
+
 static int ipv6_route_show(struct seq_file *m, void *v)
 {
 	struct net *net = (struct net *)m->private;
-	fib6_clean_all(net, rt6_info_route, 0, m);
+	fib6_clean_all(net, rt6_info_route_exceptions, 0, m);
 	return 0;
 }
 
@@ -2758,6 +3251,8 @@ int __init ip6_route_init(void)
 	if (ret)
 		goto out_kmem_cache;
 
+	get_random_bytes(&rt6_exception_rnd, sizeof(rt6_exception_rnd));
+
 	ip6_dst_blackhole_ops.kmem_cachep = ip6_dst_ops_template.kmem_cachep;
 
 	/* Registering of the loopback is done before this portion of code,
@@ -33,6 +33,7 @@
 #include <linux/icmpv6.h>
 #include <linux/init.h>
 #include <linux/module.h>
+#include <linux/jhash.h>
 #include <linux/skbuff.h>
 #include <asm/uaccess.h>
 
@@ -49,9 +50,39 @@
 #include <linux/seq_file.h>
 #include "udp_impl.h"
 
+static unsigned int udp6_portaddr_hash(struct net *net,
+				       const struct in6_addr *addr6,
+				       unsigned int port)
+{
+	unsigned int hash, mix = net_hash_mix(net);
+
+	/* wildcard and v4-mapped addresses hash like their IPv4 forms */
+	if (ipv6_addr_any(addr6))
+		hash = jhash_1word(0, mix);
+	else if (ipv6_addr_v4mapped(addr6))
+		hash = jhash_1word((__force u32)addr6->s6_addr32[3], mix);
+	else
+		hash = jhash2((__force u32 *)addr6->s6_addr32, 4, mix);
+
+	return hash ^ port;
+}
+
 int udp_v6_get_port(struct sock *sk, unsigned short snum)
 {
-	return udp_lib_get_port(sk, snum, ipv6_rcv_saddr_equal);
+	struct net *net = sock_net(sk);
+
+	/* precompute partial secondary hash */
+	udp_sk(sk)->udp_portaddr_hash =
+		udp6_portaddr_hash(net, &inet6_sk(sk)->rcv_saddr, 0);
+	return udp_lib_get_port(sk, snum, ipv6_rcv_saddr_equal,
+				udp6_portaddr_hash(net, &in6addr_any, 0));
+}
+
+void udp_v6_rehash(struct sock *sk)
+{
+	udp_lib_rehash(sk, udp6_portaddr_hash(sock_net(sk),
+					      &inet6_sk(sk)->rcv_saddr,
+					      inet_sk(sk)->num));
 }
 
 static inline int compute_score(struct sock *sk, struct net *net,
@@ -92,6 +123,87 @@ static inline int compute_score(struct sock *sk, struct net *net,
 	return score;
 }
 
+/* Same as compute_score(), for sockets known to be bound to daddr:hnum */
+static inline int compute_score2(struct sock *sk, struct net *net,
+				 struct in6_addr *saddr, __be16 sport,
+				 struct in6_addr *daddr, unsigned short hnum,
+				 int dif)
+{
+	int score = -1;
+
+	if (net_eq(sock_net(sk), net) && sk->sk_family == PF_INET6) {
+		struct ipv6_pinfo *np = inet6_sk(sk);
+		struct inet_sock *inet = inet_sk(sk);
+
+		if (!ipv6_addr_equal(&np->rcv_saddr, daddr))
+			return -1;
+		if (inet->num != hnum)
+			return -1;
+
+		score = 0;
+		if (inet->dport) {
+			if (inet->dport != sport)
+				return -1;
+			score++;
+		}
+		if (!ipv6_addr_any(&np->daddr)) {
+			if (!ipv6_addr_equal(&np->daddr, saddr))
+				return -1;
+			score++;
+		}
+		if (sk->sk_bound_dev_if) {
+			if (sk->sk_bound_dev_if != dif)
+				return -1;
+			score++;
+		}
+	}
+	return score;
+}
+
+/* called with rcu_read_lock() */
+static struct sock *udp6_lib_lookup2(struct net *net,
+		struct in6_addr *saddr, __be16 sport,
+		struct in6_addr *daddr, unsigned int hnum, int dif,
+		struct udp_hslot *hslot2, unsigned int slot2)
+{
+	struct sock *sk, *result;
+	struct udp_sock *up;
+	struct hlist_nulls_node *node;
+	int score, badness;
+
+begin:
+	result = NULL;
+	badness = -1;
+	hlist_nulls_for_each_entry_rcu(up, node, &hslot2->head,
+				       udp_portaddr_node) {
+		sk = (struct sock *)up;
+		score = compute_score2(sk, net, saddr, sport,
+				       daddr, hnum, dif);
+		if (score > badness) {
+			result = sk;
+			badness = score;
+		}
+	}
+	/*
+	 * if the nulls value we got at the end of this lookup is
+	 * not the expected one, we must restart lookup.
+	 * We probably met an item that was moved to another chain.
+	 */
+	if (get_nulls_value(node) != slot2)
+		goto begin;
+
+	if (result) {
+		if (unlikely(!atomic_inc_not_zero(&result->sk_refcnt)))
+			result = NULL;
+		else if (unlikely(compute_score2(result, net, saddr, sport,
+				  daddr, hnum, dif) < badness)) {
+			sock_put(result);
+			goto begin;
+		}
+	}
+	return result;
+}
+
 static struct sock *__udp6_lib_lookup(struct net *net,
 				      struct in6_addr *saddr, __be16 sport,
 				      struct in6_addr *daddr, __be16 dport,
@@ -105,6 +217,32 @@ static struct sock *__udp6_lib_lookup(struct net *net,
 	int score, badness;
 
 	rcu_read_lock();
+	if (hslot->count > UDP_HSLOT_SCAN_MAX) {
+		unsigned int slot2;
+		struct udp_hslot *hslot2;
+
+		slot2 = udp6_portaddr_hash(net, daddr, hnum) & udptable->mask2;
+		hslot2 = &udptable->hash2[slot2];
+		if (hslot->count < hslot2->count)
+			goto begin;
+
+		result = udp6_lib_lookup2(net, saddr, sport,
+					  daddr, hnum, dif,
+					  hslot2, slot2);
+		if (!result) {
+			slot2 = udp6_portaddr_hash(net, &in6addr_any, hnum) &
+				udptable->mask2;
+			hslot2 = &udptable->hash2[slot2];
+			if (hslot->count < hslot2->count)
+				goto begin;
+
+			result = udp6_lib_lookup2(net, saddr, sport,
+						  (struct in6_addr *)&in6addr_any,
+						  hnum, dif, hslot2, slot2);
+		}
+		rcu_read_unlock();
+		return result;
+	}
 begin:
 	result = NULL;
 	badness = -1;
@@ -1092,6 +1230,7 @@ struct proto udpv6_prot = {
 	.backlog_rcv	   = udpv6_queue_rcv_skb,
 	.hash		   = udp_lib_hash,
 	.unhash		   = udp_lib_unhash,
+	.rehash		   = udp_v6_rehash,
 	.get_port	   = udp_v6_get_port,
 	.memory_allocated  = &udp_memory_allocated,
 	.sysctl_mem	   = sysctl_udp_mem,
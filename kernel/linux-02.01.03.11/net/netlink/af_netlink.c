@@ -52,6 +52,7 @@
 #include <linux/random.h>
 #include <linux/bitops.h>
 #include <linux/mm.h>
+#include <linux/poll.h>
 #include <linux/types.h>
 #include <linux/audit.h>
 #include <linux/mutex.h>
@@ -64,6 +65,20 @@
 #define NLGRPSZ(x)	(ALIGN(x, sizeof(unsigned long) * 8) / 8)
 #define NLGRPLONGS(x)	(NLGRPSZ(x)/sizeof(unsigned long))
 
+#ifdef CONFIG_NETLINK_MMAP
+struct netlink_ring {
+	char			**pg_vec;
+	unsigned int		head;
+	unsigned int		frames_per_block;
+	unsigned int		frame_size;
+	unsigned int		frame_max;
+
+	unsigned int		pg_vec_order;
+	unsigned int		pg_vec_pages;
+	unsigned int		pg_vec_len;
+};
+#endif
+
 struct netlink_sock {
 	/* struct sock has to be the first member of netlink_sock */
 	struct sock		sk;
@@ -81,6 +96,12 @@ struct netlink_sock {
 	struct mutex		cb_def_mutex;
 	void			(*netlink_rcv)(struct sk_buff *skb);
 	struct module		*module;
+#ifdef CONFIG_NETLINK_MMAP
+	struct mutex		pg_vec_lock;
+	struct netlink_ring	rx_ring;
+	struct netlink_ring	tx_ring;
+	atomic_t		mapped;
+#endif
 };
 
 #define NETLINK_KERNEL_SOCKET	0x1
@@ -126,6 +147,10 @@ static DECLARE_WAIT_QUEUE_HEAD(nl_table_wait);
 
 static int netlink_dump(struct sock *sk);
 static void netlink_destroy_callback(struct netlink_callback *cb);
+#ifdef CONFIG_NETLINK_MMAP
+static int netlink_set_ring(struct sock *sk, struct nl_mmap_req *req,
+			    int closing, int tx_ring);
+#endif
 
 static DEFINE_RWLOCK(nl_table_lock);
 static atomic_t nl_table_users = ATOMIC_INIT(0);
@@ -413,6 +438,9 @@ static int __netlink_create(struct net *net, struct socket *sock,
 		mutex_init(nlk->cb_mutex);
 	}
 	init_waitqueue_head(&nlk->wait);
+#ifdef CONFIG_NETLINK_MMAP
+	mutex_init(&nlk->pg_vec_lock);
+#endif
 
 	sk->sk_destruct = netlink_sock_destruct;
 	sk->sk_protocol = protocol;
@@ -488,6 +516,21 @@ static int netlink_release(struct socket *sock)
 
 	skb_queue_purge(&sk->sk_write_queue);
 
+#ifdef CONFIG_NETLINK_MMAP
+	if (nlk->rx_ring.pg_vec) {
+		struct nl_mmap_req req;
+
+		memset(&req, 0, sizeof(req));
+		netlink_set_ring(sk, &req, 1, 0);
+	}
+	if (nlk->tx_ring.pg_vec) {
+		struct nl_mmap_req req;
+
+		memset(&req, 0, sizeof(req));
+		netlink_set_ring(sk, &req, 1, 1);
+	}
+#endif
+
 	if (nlk->pid && !nlk->subscriptions) {
 		struct netlink_notify n = {
 						.net = sock_net(sk),
@@ -722,6 +765,127 @@ static void netlink_overrun(struct sock *sk)
 	}
 }
 
+#ifdef CONFIG_NETLINK_MMAP
+static struct nl_mmap_hdr *netlink_lookup_frame(struct netlink_ring *ring,
+						unsigned int pos,
+						unsigned int status)
+{
+	struct nl_mmap_hdr *hdr;
+
+	hdr = (void *)ring->pg_vec[pos / ring->frames_per_block] +
+	      (pos % ring->frames_per_block) * ring->frame_size;
+	if (ACCESS_ONCE(hdr->nm_status) != status)
+		return NULL;
+
+	/* user space hands the frame over by writing its status last */
+	smp_rmb();
+	return hdr;
+}
+
+static inline struct nl_mmap_hdr *netlink_current_frame(
+	struct netlink_ring *ring, unsigned int status)
+{
+	return netlink_lookup_frame(ring, ring->head, status);
+}
+
+static inline struct nl_mmap_hdr *netlink_previous_frame(
+	struct netlink_ring *ring, unsigned int status)
+{
+	unsigned int prev = ring->head ? ring->head - 1 : ring->frame_max;
+
+	return netlink_lookup_frame(ring, prev, status);
+}
+
+static inline void netlink_increment_head(struct netlink_ring *ring)
+{
+	ring->head = ring->head != ring->frame_max ? ring->head + 1 : 0;
+}
+
+static inline void netlink_set_status(struct nl_mmap_hdr *hdr,
+				      unsigned int status)
+{
+	/* the frame contents must be visible before its new status */
+	smp_wmb();
+	hdr->nm_status = status;
+}
+
+/*
+ * Write a message into the next free frame of the RX ring.  Messages that
+ * do not fit a frame are queued as usual and the frame is marked
+ * NL_MMAP_STATUS_COPY, telling user space to pick them up with recvmsg().
+ * Returns 0 if the ring went away and the caller has to queue the skb.
+ */
+static int netlink_ring_rcv_skb(struct sock *sk, struct sk_buff *skb)
+{
+	struct netlink_sock *nlk = nlk_sk(sk);
+	struct netlink_ring *ring = &nlk->rx_ring;
+	struct nl_mmap_hdr *hdr;
+	unsigned long flags;
+	unsigned int status;
+	int len = skb->len;
+
+	spin_lock_irqsave(&sk->sk_receive_queue.lock, flags);
+	if (ring->pg_vec == NULL) {
+		spin_unlock_irqrestore(&sk->sk_receive_queue.lock, flags);
+		return 0;
+	}
+
+	hdr = netlink_current_frame(ring, NL_MMAP_STATUS_UNUSED);
+	if (hdr == NULL) {
+		spin_unlock_irqrestore(&sk->sk_receive_queue.lock, flags);
+		netlink_overrun(sk);
+		kfree_skb(skb);
+		return 1;
+	}
+	netlink_increment_head(ring);
+
+	hdr->nm_len = len;
+	hdr->nm_group = NETLINK_CB(skb).dst_group;
+	hdr->nm_pid = NETLINK_CB(skb).pid;
+	hdr->nm_uid = NETLINK_CREDS(skb)->uid;
+	hdr->nm_gid = NETLINK_CREDS(skb)->gid;
+
+	if (len <= ring->frame_size - NL_MMAP_HDRLEN) {
+		skb_copy_bits(skb, 0, (void *)hdr + NL_MMAP_HDRLEN, len);
+		status = NL_MMAP_STATUS_VALID;
+	} else {
+		__skb_queue_tail(&sk->sk_receive_queue, skb);
+		skb = NULL;
+		status = NL_MMAP_STATUS_COPY;
+	}
+	netlink_set_status(hdr, status);
+	spin_unlock_irqrestore(&sk->sk_receive_queue.lock, flags);
+
+	sk->sk_data_ready(sk, len);
+	if (skb)
+		kfree_skb(skb);
+	return 1;
+}
+
+/*
+ * Dumps to a socket with an RX ring continue from poll() while it has
+ * room.  The caller holds pg_vec_lock, so the ring stays in place.
+ */
+static inline int netlink_dump_space(struct netlink_sock *nlk)
+{
+	return netlink_current_frame(&nlk->rx_ring,
+				     NL_MMAP_STATUS_UNUSED) != NULL;
+}
+#endif
+
+/* Queue a message for user space, the receive memory is already charged. */
+static void __netlink_sendskb(struct sock *sk, struct sk_buff *skb)
+{
+	int len = skb->len;
+
+#ifdef CONFIG_NETLINK_MMAP
+	if (nlk_sk(sk)->rx_ring.pg_vec && netlink_ring_rcv_skb(sk, skb))
+		return;
+#endif
+	skb_queue_tail(&sk->sk_receive_queue, skb);
+	sk->sk_data_ready(sk, len);
+}
+
 static struct sock *netlink_getsockbypid(struct sock *ssk, u32 pid)
 {
 	struct sock *sock;
@@ -811,8 +975,7 @@ int netlink_sendskb(struct sock *sk, struct sk_buff *skb)
 {
 	int len = skb->len;
 
-	skb_queue_tail(&sk->sk_receive_queue, skb);
-	sk->sk_data_ready(sk, len);
+	__netlink_sendskb(sk, skb);
 	sock_put(sk);
 	return len;
 }
@@ -937,8 +1100,7 @@ static inline int netlink_broadcast_deliver(struct sock *sk,
 	if (atomic_read(&sk->sk_rmem_alloc) <= sk->sk_rcvbuf &&
 	    !test_bit(0, &nlk->state)) {
 		skb_set_owner_r(skb, sk);
-		skb_queue_tail(&sk->sk_receive_queue, skb);
-		sk->sk_data_ready(sk, skb->len);
+		__netlink_sendskb(sk, skb);
 		return atomic_read(&sk->sk_rmem_alloc) > sk->sk_rcvbuf;
 	}
 	return -1;
@@ -1159,6 +1321,23 @@ static int netlink_setsockopt(struct socket *sock, int level, int optname,
 		err = 0;
 		break;
 	}
+#ifdef CONFIG_NETLINK_MMAP
+	case NETLINK_RX_RING:
+	case NETLINK_TX_RING: {
+		struct nl_mmap_req req;
+
+		/* Rings are not charged to the socket's buffer limits */
+		if (!capable(CAP_NET_ADMIN))
+			return -EPERM;
+		if (optlen < sizeof(req))
+			return -EINVAL;
+		if (copy_from_user(&req, optval, sizeof(req)))
+			return -EFAULT;
+		err = netlink_set_ring(sk, &req, 0,
+				       optname == NETLINK_TX_RING);
+		break;
+	}
+#endif
 	default:
 		err = -ENOPROTOOPT;
 	}
@@ -1205,6 +1384,87 @@ static void netlink_cmsg_recv_pktinfo(struct msghdr *msg, struct sk_buff *skb)
 	put_cmsg(msg, SOL_NETLINK, NETLINK_PKTINFO, sizeof(info), &info);
 }
 
+static void netlink_skb_set_creds(struct sk_buff *skb,
+				  struct netlink_sock *nlk, u32 dst_group,
+				  struct scm_cookie *scm)
+{
+	NETLINK_CB(skb).pid	= nlk->pid;
+	NETLINK_CB(skb).dst_group = dst_group;
+	NETLINK_CB(skb).loginuid = audit_get_loginuid(current);
+	NETLINK_CB(skb).sessionid = audit_get_sessionid(current);
+	security_task_getsecid(current, &(NETLINK_CB(skb).sid));
+	memcpy(NETLINK_CREDS(skb), &scm->creds, sizeof(struct ucred));
+}
+
+#ifdef CONFIG_NETLINK_MMAP
+/*
+ * Send every frame of the TX ring that user space marked valid.  Each one
+ * is copied out and its frame handed back before the message is delivered,
+ * so a sender cannot change a message under its receiver.
+ */
+static int netlink_mmap_sendmsg(struct sock *sk, struct msghdr *msg,
+				u32 dst_pid, u32 dst_group,
+				struct scm_cookie *scm)
+{
+	struct netlink_sock *nlk = nlk_sk(sk);
+	struct netlink_ring *ring = &nlk->tx_ring;
+	struct nl_mmap_hdr *hdr;
+	struct sk_buff *skb;
+	unsigned int len;
+	int err = 0, sent = 0;
+
+	mutex_lock(&nlk->pg_vec_lock);
+
+	if (ring->pg_vec == NULL) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	while ((hdr = netlink_current_frame(ring,
+					    NL_MMAP_STATUS_VALID)) != NULL) {
+		len = ACCESS_ONCE(hdr->nm_len);
+		if (len > ring->frame_size - NL_MMAP_HDRLEN) {
+			err = -EINVAL;
+			break;
+		}
+
+		skb = alloc_skb(len, GFP_KERNEL);
+		if (skb == NULL) {
+			err = -ENOBUFS;
+			break;
+		}
+		memcpy(skb_put(skb, len), (void *)hdr + NL_MMAP_HDRLEN, len);
+
+		netlink_set_status(hdr, NL_MMAP_STATUS_UNUSED);
+		netlink_increment_head(ring);
+
+		netlink_skb_set_creds(skb, nlk, dst_group, scm);
+
+		err = security_netlink_send(sk, skb);
+		if (err) {
+			kfree_skb(skb);
+			break;
+		}
+
+		if (dst_group) {
+			atomic_inc(&skb->users);
+			netlink_broadcast(sk, skb, dst_pid, dst_group,
+					  GFP_KERNEL);
+		}
+		err = netlink_unicast(sk, skb, dst_pid,
+				      msg->msg_flags & MSG_DONTWAIT);
+		if (err < 0)
+			break;
+		sent += err;
+		err = 0;
+	}
+
+out:
+	mutex_unlock(&nlk->pg_vec_lock);
+	return sent ? : err;
+}
+#endif
+
 static int netlink_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			   struct msghdr *msg, size_t len)
 {
@@ -1245,6 +1505,16 @@ static int netlink_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			goto out;
 	}
 
+#ifdef CONFIG_NETLINK_MMAP
+	/* a NULL buffer sends what is queued in the TX ring */
+	if (nlk->tx_ring.pg_vec && msg->msg_iovlen &&
+	    msg->msg_iov->iov_base == NULL) {
+		err = netlink_mmap_sendmsg(sk, msg, dst_pid, dst_group,
+					   siocb->scm);
+		goto out;
+	}
+#endif
+
 	err = -EMSGSIZE;
 	if (len > sk->sk_sndbuf - 32)
 		goto out;
@@ -1253,12 +1523,7 @@ static int netlink_sendmsg(struct kiocb *kiocb, struct socket *sock,
 	if (skb == NULL)
 		goto out;
 
-	NETLINK_CB(skb).pid	= nlk->pid;
-	NETLINK_CB(skb).dst_group = dst_group;
-	NETLINK_CB(skb).loginuid = audit_get_loginuid(current);
-	NETLINK_CB(skb).sessionid = audit_get_sessionid(current);
-	security_task_getsecid(current, &(NETLINK_CB(skb).sid));
-	memcpy(NETLINK_CREDS(skb), &siocb->scm->creds, sizeof(struct ucred));
+	netlink_skb_set_creds(skb, nlk, dst_group, siocb->scm);
 
 	/* What can I do? Netlink is asynchronous, so that
 	   we will have to save current capabilities to
@@ -1554,10 +1819,8 @@ static int netlink_dump(struct sock *sk)
 
 		if (sk_filter(sk, skb))
 			kfree_skb(skb);
-		else {
-			skb_queue_tail(&sk->sk_receive_queue, skb);
-			sk->sk_data_ready(sk, skb->len);
-		}
+		else
+			__netlink_sendskb(sk, skb);
 		return 0;
 	}
 
@@ -1569,10 +1832,8 @@ static int netlink_dump(struct sock *sk)
 
 	if (sk_filter(sk, skb))
 		kfree_skb(skb);
-	else {
-		skb_queue_tail(&sk->sk_receive_queue, skb);
-		sk->sk_data_ready(sk, skb->len);
-	}
+	else
+		__netlink_sendskb(sk, skb);
 
 	if (cb->done)
 		cb->done(cb);
@@ -1897,6 +2158,240 @@ int netlink_unregister_notifier(struct notifier_block *nb)
 }
 EXPORT_SYMBOL(netlink_unregister_notifier);
 
+#ifndef CONFIG_NETLINK_MMAP
+#define netlink_mmap sock_no_mmap
+#define netlink_poll datagram_poll
+#else
+
+static unsigned int netlink_poll(struct file *file, struct socket *sock,
+				 poll_table *wait)
+{
+	struct sock *sk = sock->sk;
+	struct netlink_sock *nlk = nlk_sk(sk);
+	unsigned int mask;
+	unsigned long flags;
+
+	if (nlk->rx_ring.pg_vec) {
+		/* netlink_set_ring() must not swap the ring under the check */
+		mutex_lock(&nlk->pg_vec_lock);
+		while (nlk->rx_ring.pg_vec && nlk->cb &&
+		       netlink_dump_space(nlk)) {
+			if (netlink_dump(sk) < 0) {
+				sk->sk_err = ENOBUFS;
+				sk->sk_error_report(sk);
+				break;
+			}
+		}
+		mutex_unlock(&nlk->pg_vec_lock);
+		netlink_rcv_wake(sk);
+	}
+
+	mask = datagram_poll(file, sock, wait);
+
+	spin_lock_irqsave(&sk->sk_receive_queue.lock, flags);
+	if (nlk->rx_ring.pg_vec &&
+	    !netlink_previous_frame(&nlk->rx_ring, NL_MMAP_STATUS_UNUSED))
+		mask |= POLLIN | POLLRDNORM;
+	if (nlk->tx_ring.pg_vec &&
+	    netlink_current_frame(&nlk->tx_ring, NL_MMAP_STATUS_UNUSED))
+		mask |= POLLOUT | POLLWRNORM;
+	spin_unlock_irqrestore(&sk->sk_receive_queue.lock, flags);
+
+	return mask;
+}
+
+static void netlink_mm_open(struct vm_area_struct *vma)
+{
+	struct file *file = vma->vm_file;
+	struct socket *sock = file->private_data;
+	struct sock *sk = sock->sk;
+
+	if (sk)
+		atomic_inc(&nlk_sk(sk)->mapped);
+}
+
+static void netlink_mm_close(struct vm_area_struct *vma)
+{
+	struct file *file = vma->vm_file;
+	struct socket *sock = file->private_data;
+	struct sock *sk = sock->sk;
+
+	if (sk)
+		atomic_dec(&nlk_sk(sk)->mapped);
+}
+
+static struct vm_operations_struct netlink_mmap_ops = {
+	.open	= netlink_mm_open,
+	.close	= netlink_mm_close,
+};
+
+static void free_pg_vec(char **pg_vec, unsigned int order, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		if (likely(pg_vec[i]))
+			free_pages((unsigned long)pg_vec[i], order);
+	}
+	kfree(pg_vec);
+}
+
+static char **alloc_pg_vec(struct nl_mmap_req *req, unsigned int order)
+{
+	unsigned int block_nr = req->nm_block_nr;
+	char **pg_vec;
+	unsigned int i;
+
+	pg_vec = kcalloc(block_nr, sizeof(char *), GFP_KERNEL);
+	if (pg_vec == NULL)
+		return NULL;
+
+	for (i = 0; i < block_nr; i++) {
+		pg_vec[i] = (char *)__get_free_pages(GFP_KERNEL | __GFP_COMP |
+						     __GFP_ZERO, order);
+		if (pg_vec[i] == NULL) {
+			free_pg_vec(pg_vec, order, block_nr);
+			return NULL;
+		}
+	}
+
+	/* __GFP_ZERO left every frame NL_MMAP_STATUS_UNUSED */
+	return pg_vec;
+}
+
+static int netlink_set_ring(struct sock *sk, struct nl_mmap_req *req,
+			    int closing, int tx_ring)
+{
+	struct netlink_sock *nlk = nlk_sk(sk);
+	struct netlink_ring *ring;
+	unsigned int order = 0, frames_per_block = 0;
+	char **pg_vec = NULL;
+	int err;
+
+	ring = tx_ring ? &nlk->tx_ring : &nlk->rx_ring;
+
+	if (req->nm_block_nr) {
+		if (ring->pg_vec != NULL)
+			return -EBUSY;
+
+		if ((int)req->nm_block_size <= 0)
+			return -EINVAL;
+		if (req->nm_block_size & (PAGE_SIZE - 1))
+			return -EINVAL;
+		if (req->nm_frame_size < NL_MMAP_HDRLEN + NLMSG_HDRLEN)
+			return -EINVAL;
+		if (req->nm_frame_size & (NL_MMAP_MSG_ALIGNMENT - 1))
+			return -EINVAL;
+
+		frames_per_block = req->nm_block_size / req->nm_frame_size;
+		if (frames_per_block == 0)
+			return -EINVAL;
+		if (frames_per_block * req->nm_block_nr != req->nm_frame_nr)
+			return -EINVAL;
+
+		order = get_order(req->nm_block_size);
+		pg_vec = alloc_pg_vec(req, order);
+		if (pg_vec == NULL)
+			return -ENOMEM;
+	} else {
+		if (req->nm_frame_nr)
+			return -EINVAL;
+	}
+
+	err = -EBUSY;
+	mutex_lock(&nlk->pg_vec_lock);
+	if (closing || atomic_read(&nlk->mapped) == 0) {
+		err = 0;
+
+		spin_lock_irq(&sk->sk_receive_queue.lock);
+		swap(ring->pg_vec, pg_vec);
+		ring->frames_per_block = frames_per_block;
+		ring->frame_size = req->nm_frame_size;
+		ring->frame_max = req->nm_frame_nr - 1;
+		ring->head = 0;
+		spin_unlock_irq(&sk->sk_receive_queue.lock);
+
+		swap(ring->pg_vec_order, order);
+		swap(ring->pg_vec_len, req->nm_block_nr);
+		ring->pg_vec_pages = req->nm_block_size / PAGE_SIZE;
+
+		/* messages marked NL_MMAP_STATUS_COPY lost their frames */
+		if (!tx_ring)
+			skb_queue_purge(&sk->sk_receive_queue);
+	}
+	mutex_unlock(&nlk->pg_vec_lock);
+
+	if (pg_vec)
+		free_pg_vec(pg_vec, order, req->nm_block_nr);
+	return err;
+}
+
+static unsigned long netlink_ring_size(struct netlink_ring *ring)
+{
+	if (ring->pg_vec == NULL)
+		return 0;
+	return (unsigned long)ring->pg_vec_len * ring->pg_vec_pages *
+	       PAGE_SIZE;
+}
+
+static int netlink_map_ring(struct vm_area_struct *vma,
+			    struct netlink_ring *ring, unsigned long *start)
+{
+	unsigned int i, pg_num;
+	int err;
+
+	if (ring->pg_vec == NULL)
+		return 0;
+
+	for (i = 0; i < ring->pg_vec_len; i++) {
+		struct page *page = virt_to_page(ring->pg_vec[i]);
+
+		for (pg_num = 0; pg_num < ring->pg_vec_pages; pg_num++, page++) {
+			err = vm_insert_page(vma, *start, page);
+			if (err)
+				return err;
+			*start += PAGE_SIZE;
+		}
+	}
+	return 0;
+}
+
+/* The RX ring, if any, is mapped first and the TX ring right behind it. */
+static int netlink_mmap(struct file *file, struct socket *sock,
+			struct vm_area_struct *vma)
+{
+	struct sock *sk = sock->sk;
+	struct netlink_sock *nlk = nlk_sk(sk);
+	unsigned long size, start;
+	int err = -EINVAL;
+
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	mutex_lock(&nlk->pg_vec_lock);
+
+	size = netlink_ring_size(&nlk->rx_ring) +
+	       netlink_ring_size(&nlk->tx_ring);
+	if (size == 0 || size != vma->vm_end - vma->vm_start)
+		goto out;
+
+	start = vma->vm_start;
+	err = netlink_map_ring(vma, &nlk->rx_ring, &start);
+	if (err)
+		goto out;
+	err = netlink_map_ring(vma, &nlk->tx_ring, &start);
+	if (err)
+		goto out;
+
+	atomic_inc(&nlk->mapped);
+	vma->vm_ops = &netlink_mmap_ops;
+
+out:
+	mutex_unlock(&nlk->pg_vec_lock);
+	return err;
+}
+#endif
+
 static const struct proto_ops netlink_ops = {
 	.family =	PF_NETLINK,
 	.owner =	THIS_MODULE,
@@ -1906,7 +2401,7 @@ static const struct proto_ops netlink_ops = {
 	.socketpair =	sock_no_socketpair,
 	.accept =	sock_no_accept,
 	.getname =	netlink_getname,
-	.poll =		datagram_poll,
+	.poll =		netlink_poll,
 	.ioctl =	sock_no_ioctl,
 	.listen =	sock_no_listen,
 	.shutdown =	sock_no_shutdown,
@@ -1914,7 +2409,7 @@ static const struct proto_ops netlink_ops = {
 	.getsockopt =	netlink_getsockopt,
 	.sendmsg =	netlink_sendmsg,
 	.recvmsg =	netlink_recvmsg,
-	.mmap =		sock_no_mmap,
+	.mmap =		netlink_mmap,
 	.sendpage =	sock_no_sendpage,
 };
 
@@ -37,6 +37,9 @@
  * - updates to tree and tree walking are only done under the rtnl mutex.
  */
 
+/* Packets handed to the driver per qdisc_restart(), see skb->xmit_more */
+int netdev_tx_bulk __read_mostly = 8;
+
 static inline int qdisc_qlen(struct Qdisc *q)
 {
 	return q->q.qlen;
@@ -51,20 +54,35 @@ static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 	return 0;
 }
 
+static inline int dev_requeue_batch(struct sk_buff_head *batch,
+				    struct Qdisc *q)
+{
+	/* ahead of anything dequeue_batch() set aside for another txq */
+	skb_queue_splice_init(batch, &q->requeue);
+	__netif_schedule(q);
+
+	return 0;
+}
+
 static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 {
 	struct sk_buff *skb = q->gso_skb;
 
+	if (unlikely(!skb))
+		skb = skb_peek(&q->requeue);
+
 	if (unlikely(skb)) {
 		struct net_device *dev = qdisc_dev(q);
 		struct netdev_queue *txq;
 
 		/* check the reason of requeuing without tx lock first */
 		txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
-		if (!netif_tx_queue_stopped(txq) && !netif_tx_queue_frozen(txq))
+		if (netif_tx_queue_stopped(txq) || netif_tx_queue_frozen(txq))
+			skb = NULL;
+		else if (skb == q->gso_skb)
 			q->gso_skb = NULL;
 		else
-			skb = NULL;
+			__skb_unlink(skb, &q->requeue);
 	} else {
 		skb = q->dequeue(q);
 	}
@@ -72,6 +90,35 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 	return skb;
 }
 
+/*
+ * Pull up to netdev_tx_bulk - 1 more packets for the same tx queue, so
+ * the driver can be told that more follow and ring its doorbell once.
+ * Only fresh packets are batched; requeued ones go out one by one.
+ */
+static inline void dequeue_batch(struct Qdisc *q, struct sk_buff *skb,
+				 struct sk_buff_head *batch)
+{
+	u16 queue_mapping = skb_get_queue_mapping(skb);
+	int n;
+
+	if (skb->next || q->gso_skb || !skb_queue_empty(&q->requeue))
+		return;
+
+	for (n = 1; n < netdev_tx_bulk; n++) {
+		struct sk_buff *nskb = q->dequeue(q);
+
+		if (!nskb)
+			break;
+		if (skb_get_queue_mapping(nskb) != queue_mapping) {
+			/* goes first next time round */
+			__skb_queue_tail(&q->requeue, nskb);
+			__netif_schedule(q);
+			break;
+		}
+		__skb_queue_tail(batch, nskb);
+	}
+}
+
 static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 					   struct netdev_queue *dev_queue,
 					   struct Qdisc *q)
@@ -128,11 +175,15 @@ static inline int qdisc_restart(struct Qdisc *q)
 	struct net_device *dev;
 	spinlock_t *root_lock;
 	struct sk_buff *skb;
+	struct sk_buff_head batch;
 
 	/* Dequeue packet */
 	if (unlikely((skb = dequeue_skb(q)) == NULL))
 		return 0;
 
+	__skb_queue_head_init(&batch);
+	dequeue_batch(q, skb, &batch);
+
 	root_lock = qdisc_lock(q);
 
 	/* And release qdisc */
@@ -142,9 +193,20 @@ static inline int qdisc_restart(struct Qdisc *q)
 	txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
-	if (!netif_tx_queue_stopped(txq) &&
-	    !netif_tx_queue_frozen(txq))
+	while (!netif_tx_queue_stopped(txq) &&
+	       !netif_tx_queue_frozen(txq)) {
+		/*
+		 * A driver that defers its doorbell on xmit_more must still
+		 * ring it when it stops the queue, so stopping mid batch
+		 * never strands packets on the ring.
+		 */
+		skb->xmit_more = !skb_queue_empty(&batch);
 		ret = dev_hard_start_xmit(skb, dev, txq);
+		if (ret != NETDEV_TX_OK || skb_queue_empty(&batch))
+			break;
+		skb = __skb_dequeue(&batch);
+		ret = NETDEV_TX_BUSY;
+	}
 	HARD_TX_UNLOCK(dev, txq);
 
 	spin_lock(root_lock);
@@ -170,6 +232,9 @@ static inline int qdisc_restart(struct Qdisc *q)
 		break;
 	}
 
+	if (unlikely(!skb_queue_empty(&batch)))
+		ret = dev_requeue_batch(&batch, q);
+
 	if (ret && (netif_tx_queue_stopped(txq) ||
 		    netif_tx_queue_frozen(txq)))
 		ret = 0;
@@ -484,6 +549,7 @@ struct Qdisc *qdisc_alloc(struct netdev_queue *dev_queue,
 	sch->padded = (char *) sch - (char *) p;
 
 	INIT_LIST_HEAD(&sch->list);
+	skb_queue_head_init(&sch->requeue);
 	skb_queue_head_init(&sch->q);
 	sch->ops = ops;
 	sch->enqueue = ops->enqueue;
@@ -529,6 +595,7 @@ void qdisc_reset(struct Qdisc *qdisc)
 
 	kfree_skb(qdisc->gso_skb);
 	qdisc->gso_skb = NULL;
+	__skb_queue_purge(&qdisc->requeue);
 }
 EXPORT_SYMBOL(qdisc_reset);
 
@@ -555,6 +622,7 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	dev_put(qdisc_dev(qdisc));
 
 	kfree_skb(qdisc->gso_skb);
+	__skb_queue_purge(&qdisc->requeue);
 	kfree((char *) qdisc - qdisc->padded);
 }
 EXPORT_SYMBOL(qdisc_destroy);
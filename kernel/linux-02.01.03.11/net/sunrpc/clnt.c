@@ -247,6 +247,89 @@ out_no_rpciod:
 	return ERR_PTR(err);
 }
 
+static void rpc_free_xprt_switch(struct kref *kref)
+{
+	struct rpc_xprt_switch *xps =
+		container_of(kref, struct rpc_xprt_switch, xps_kref);
+	unsigned int i;
+
+	for (i = 0; i < xps->xps_nxprts; i++)
+		xprt_put(xps->xps_xprt[i]);
+	kfree(xps);
+}
+
+/*
+ * Open nconnect - 1 more transports to the server of clnt.  Tasks are
+ * spread over all of them by rpc_task_get_xprt(); each one connects,
+ * binds and reconnects on its own.
+ */
+static int rpc_clnt_add_xprts(struct rpc_clnt *clnt, struct xprt_create *args,
+			      unsigned int nconnect)
+{
+	struct rpc_xprt_switch *xps;
+
+	xps = kzalloc(sizeof(*xps) + nconnect * sizeof(xps->xps_xprt[0]),
+		      GFP_KERNEL);
+	if (xps == NULL)
+		return -ENOMEM;
+	kref_init(&xps->xps_kref);
+	xps->xps_xprt[0] = xprt_get(clnt->cl_xprt);
+	xps->xps_nxprts = 1;
+
+	while (xps->xps_nxprts < nconnect) {
+		struct rpc_xprt *xprt = xprt_create_transport(args);
+
+		if (IS_ERR(xprt)) {
+			kref_put(&xps->xps_kref, rpc_free_xprt_switch);
+			return PTR_ERR(xprt);
+		}
+		xprt->resvport = clnt->cl_xprt->resvport;
+		xps->xps_xprt[xps->xps_nxprts++] = xprt;
+	}
+
+	clnt->cl_xps = xps;
+	return 0;
+}
+
+/**
+ * rpc_task_get_xprt - pick the transport for a new task
+ * @clnt: the task's RPC client
+ *
+ * Returns the client's transport with the fewest tasks assigned; the
+ * search starts from a rotating position so that ties go round robin.
+ * The client's reference keeps the transport alive for as long as the
+ * task holds the client.
+ */
+struct rpc_xprt *rpc_task_get_xprt(struct rpc_clnt *clnt)
+{
+	struct rpc_xprt_switch *xps = clnt->cl_xps;
+	struct rpc_xprt *xprt = clnt->cl_xprt;
+
+	if (xps != NULL) {
+		unsigned int n = xps->xps_nxprts;
+		unsigned int start = atomic_inc_return(&xps->xps_next);
+		unsigned int i;
+
+		xprt = xps->xps_xprt[start % n];
+		for (i = 1; i < n; i++) {
+			struct rpc_xprt *next = xps->xps_xprt[(start + i) % n];
+
+			if (atomic_read(&next->queuelen) <
+			    atomic_read(&xprt->queuelen))
+				xprt = next;
+		}
+	}
+	atomic_inc(&xprt->queuelen);
+	return xprt;
+}
+EXPORT_SYMBOL_GPL(rpc_task_get_xprt);
+
+void rpc_task_put_xprt(struct rpc_xprt *xprt)
+{
+	atomic_dec(&xprt->queuelen);
+}
+EXPORT_SYMBOL_GPL(rpc_task_put_xprt);
+
 /*
  * rpc_create - create an RPC client and transport with one call
  * @args: rpc_clnt create argument structure
@@ -316,6 +399,17 @@ struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 	if (IS_ERR(clnt))
 		return clnt;
 
+	/* Only stream transports are worth multiplying */
+	if (args->nconnect > 1 && xprt->prot == IPPROTO_TCP) {
+		int err = rpc_clnt_add_xprts(clnt, &xprtargs,
+				min_t(unsigned int, args->nconnect,
+				      RPC_MAX_XPRTS));
+		if (err != 0) {
+			rpc_shutdown_client(clnt);
+			return ERR_PTR(err);
+		}
+	}
+
 	if (!(args->flags & RPC_CLNT_CREATE_NOPING)) {
 		int err = rpc_ping(clnt, RPC_TASK_SOFT);
 		if (err != 0) {
@@ -374,6 +468,8 @@ rpc_clone_client(struct rpc_clnt *clnt)
 	if (new->cl_auth)
 		atomic_inc(&new->cl_auth->au_count);
 	xprt_get(clnt->cl_xprt);
+	if (new->cl_xps)
+		kref_get(&new->cl_xps->xps_kref);
 	kref_get(&clnt->cl_kref);
 	rpc_register_client(new);
 	rpciod_up();
@@ -434,6 +530,8 @@ out_free:
 	rpc_free_iostats(clnt->cl_metrics);
 	kfree(clnt->cl_principal);
 	clnt->cl_metrics = NULL;
+	if (clnt->cl_xps)
+		kref_put(&clnt->cl_xps->xps_kref, rpc_free_xprt_switch);
 	xprt_put(clnt->cl_xprt);
 	rpciod_down();
 	kfree(clnt);
@@ -689,8 +787,17 @@ EXPORT_SYMBOL_GPL(rpc_max_payload);
  */
 void rpc_force_rebind(struct rpc_clnt *clnt)
 {
-	if (clnt->cl_autobind)
+	struct rpc_xprt_switch *xps = clnt->cl_xps;
+	unsigned int i;
+
+	if (!clnt->cl_autobind)
+		return;
+	if (xps == NULL) {
 		xprt_clear_bound(clnt->cl_xprt);
+		return;
+	}
+	for (i = 0; i < xps->xps_nxprts; i++)
+		xprt_clear_bound(xps->xps_xprt[i]);
 }
 EXPORT_SYMBOL_GPL(rpc_force_rebind);
 
@@ -798,6 +798,7 @@ static void rpc_init_task(struct rpc_task *task, const struct rpc_task_setup *ta
 	task->tk_client = task_setup_data->rpc_client;
 	if (task->tk_client != NULL) {
 		kref_get(&task->tk_client->cl_kref);
+		task->tk_xprt = rpc_task_get_xprt(task->tk_client);
 		if (task->tk_client->cl_softrtry)
 			task->tk_flags |= RPC_TASK_SOFT;
 	}
@@ -877,6 +878,10 @@ void rpc_put_task(struct rpc_task *task)
 		xprt_release(task);
 	if (task->tk_msg.rpc_cred)
 		rpcauth_unbindcred(task);
+	if (task->tk_xprt) {
+		rpc_task_put_xprt(task->tk_xprt);
+		task->tk_xprt = NULL;
+	}
 	if (task->tk_client) {
 		rpc_release_client(task->tk_client);
 		task->tk_client = NULL;
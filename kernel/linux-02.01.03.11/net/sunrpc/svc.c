@@ -29,6 +29,7 @@
 #define RPCDBG_FACILITY	RPCDBG_SVCDSP
 
 static void svc_unregister(const struct svc_serv *serv);
+static void svc_pool_spawn(struct work_struct *work);
 
 #define svc_serv_is_pooled(serv)    ((serv)->sv_function)
 
@@ -115,6 +116,21 @@ param_get_pool_mode(char *buf, struct kernel_param *kp)
 module_param_call(pool_mode, param_set_pool_mode, param_get_pool_mode,
 		 &svc_pool_map.mode, 0644);
 
+/*
+ * Dynamic thread pools: how long a transport may wait for an idle
+ * thread before another one is started, and how long a thread may stay
+ * idle before it exits.
+ */
+static unsigned int svc_spawn_delay_ms = 5;
+module_param_named(spawn_delay_ms, svc_spawn_delay_ms, uint, 0644);
+MODULE_PARM_DESC(spawn_delay_ms,
+		 "Queueing delay after which a dynamic pool adds a thread");
+
+static unsigned int svc_idle_timeout = 60;
+module_param_named(thread_idle_timeout, svc_idle_timeout, uint, 0644);
+MODULE_PARM_DESC(thread_idle_timeout,
+		 "Seconds after which an idle thread leaves a dynamic pool");
+
 /*
  * Detect best pool mapping mode heuristically,
  * according to the machine's topology.
@@ -413,6 +429,8 @@ __svc_create(struct svc_program *prog, unsigned int bufsize, int npools,
 				i, serv->sv_name);
 
 		pool->sp_id = i;
+		pool->sp_serv = serv;
+		INIT_DELAYED_WORK(&pool->sp_spawn_work, svc_pool_spawn);
 		INIT_LIST_HEAD(&pool->sp_threads);
 		INIT_LIST_HEAD(&pool->sp_sockets);
 		INIT_LIST_HEAD(&pool->sp_all_threads);
@@ -459,6 +477,8 @@ EXPORT_SYMBOL_GPL(svc_create_pooled);
 void
 svc_destroy(struct svc_serv *serv)
 {
+	unsigned int i;
+
 	dprintk("svc: svc_destroy(%s, %d)\n",
 				serv->sv_program->pg_name,
 				serv->sv_nrthreads);
@@ -489,6 +509,14 @@ svc_destroy(struct svc_serv *serv)
 		svc_pool_map_put();
 
 	svc_unregister(serv);
+
+	/*
+	 * With the transports gone nothing queues the spawn work any
+	 * more.  It never blocks on sv_thread_mutex, which our caller
+	 * may hold, so waiting for it here is safe.
+	 */
+	for (i = 0; i < serv->sv_nrpools; i++)
+		cancel_delayed_work_sync(&serv->sv_pools[i].sp_spawn_work);
 	kfree(serv->sv_pools);
 	kfree(serv);
 }
@@ -569,6 +597,37 @@ out_enomem:
 }
 EXPORT_SYMBOL_GPL(svc_prepare_thread);
 
+/*
+ * Start one more thread in the given pool.  Must be called with
+ * the lock that protects the serv's thread counts held.
+ */
+static int
+svc_start_thread(struct svc_serv *serv, struct svc_pool *pool)
+{
+	struct svc_rqst	*rqstp;
+	struct task_struct *task;
+
+	rqstp = svc_prepare_thread(serv, pool);
+	if (IS_ERR(rqstp))
+		return PTR_ERR(rqstp);
+
+	__module_get(serv->sv_module);
+	task = kthread_create(serv->sv_function, rqstp, serv->sv_name);
+	if (IS_ERR(task)) {
+		module_put(serv->sv_module);
+		svc_exit_thread(rqstp);
+		return PTR_ERR(task);
+	}
+
+	rqstp->rq_task = task;
+	if (serv->sv_nrpools > 1)
+		svc_pool_map_set_cpumask(task, pool->sp_id);
+
+	svc_sock_update_bufs(serv);
+	wake_up_process(task);
+	return 0;
+}
+
 /*
  * Choose a pool in which to create a new thread, for svc_set_num_threads
  */
@@ -638,7 +697,6 @@ found_pool:
 int
 svc_set_num_threads(struct svc_serv *serv, struct svc_pool *pool, int nrservs)
 {
-	struct svc_rqst	*rqstp;
 	struct task_struct *task;
 	struct svc_pool *chosen_pool;
 	int error = 0;
@@ -658,27 +716,9 @@ svc_set_num_threads(struct svc_serv *serv, struct svc_pool *pool, int nrservs)
 		nrservs--;
 		chosen_pool = choose_pool(serv, pool, &state);
 
-		rqstp = svc_prepare_thread(serv, chosen_pool);
-		if (IS_ERR(rqstp)) {
-			error = PTR_ERR(rqstp);
-			break;
-		}
-
-		__module_get(serv->sv_module);
-		task = kthread_create(serv->sv_function, rqstp, serv->sv_name);
-		if (IS_ERR(task)) {
-			error = PTR_ERR(task);
-			module_put(serv->sv_module);
-			svc_exit_thread(rqstp);
+		error = svc_start_thread(serv, chosen_pool);
+		if (error)
 			break;
-		}
-
-		rqstp->rq_task = task;
-		if (serv->sv_nrpools > 1)
-			svc_pool_map_set_cpumask(task, chosen_pool->sp_id);
-
-		svc_sock_update_bufs(serv);
-		wake_up_process(task);
 	}
 	/* destroy old threads */
 	while (nrservs < 0 &&
@@ -691,6 +731,135 @@ svc_set_num_threads(struct svc_serv *serv, struct svc_pool *pool, int nrservs)
 }
 EXPORT_SYMBOL_GPL(svc_set_num_threads);
 
+/*
+ * Let the number of threads in a pool float between min (at least
+ * one) and max, or fix it again if max is zero, in which case a
+ * pending spawn is cancelled.  The pool's current threads are left
+ * alone; the count moves into the range as load comes and goes.
+ * Only for services created with svc_create_pooled() that have set
+ * sv_thread_mutex.
+ */
+int
+svc_set_pool_limits(struct svc_serv *serv, struct svc_pool *pool,
+		    unsigned int min, unsigned int max)
+{
+	if (max && (!svc_serv_is_pooled(serv) || !serv->sv_thread_mutex))
+		return -EINVAL;
+	if (max && min > max)
+		return -EINVAL;
+
+	spin_lock_bh(&pool->sp_lock);
+	pool->sp_min_threads = min;
+	pool->sp_max_threads = max;
+	spin_unlock_bh(&pool->sp_lock);
+
+	/*
+	 * A fixed pool must not grow behind the caller's back.  Nothing
+	 * queues the spawn work any more with max at zero, and it never
+	 * blocks on sv_thread_mutex, so waiting for it is safe.
+	 */
+	if (!max) {
+		cancel_delayed_work_sync(&pool->sp_spawn_work);
+		clear_bit(SP_SPAWN_PENDING, &pool->sp_flags);
+	}
+	return 0;
+}
+EXPORT_SYMBOL_GPL(svc_set_pool_limits);
+
+/*
+ * A transport found no idle thread in a dynamic pool: make sure the
+ * spawner looks at the pool once the spawn delay has passed.  Called
+ * with pool->sp_lock held.
+ */
+void
+svc_pool_wake_spawner(struct svc_pool *pool)
+{
+	if (pool->sp_nrthreads >= pool->sp_max_threads)
+		return;
+	if (!test_and_set_bit(SP_SPAWN_PENDING, &pool->sp_flags))
+		schedule_delayed_work(&pool->sp_spawn_work,
+				      msecs_to_jiffies(svc_spawn_delay_ms));
+}
+
+/*
+ * Start a thread if the oldest transport waiting in the pool has been
+ * there for the spawn delay, and keep looking while transports wait.
+ */
+static void
+svc_pool_spawn(struct work_struct *work)
+{
+	struct svc_pool *pool = container_of(work, struct svc_pool,
+					     sp_spawn_work.work);
+	struct svc_serv *serv = pool->sp_serv;
+	unsigned long delay = msecs_to_jiffies(svc_spawn_delay_ms);
+	struct svc_xprt *xprt;
+	s64 waited = 0;
+	int spawn = 0;
+
+	/* svc_destroy() waits for us with the mutex held: don't block */
+	if (!mutex_trylock(serv->sv_thread_mutex)) {
+		schedule_delayed_work(&pool->sp_spawn_work, 1);
+		return;
+	}
+
+	spin_lock_bh(&pool->sp_lock);
+	if (!list_empty(&pool->sp_sockets) &&
+	    pool->sp_nrthreads < pool->sp_max_threads) {
+		xprt = list_first_entry(&pool->sp_sockets,
+					struct svc_xprt, xpt_ready);
+		waited = ktime_us_delta(ktime_get(), xprt->xpt_qtime);
+		spawn = waited >= (s64)svc_spawn_delay_ms * USEC_PER_MSEC;
+	} else {
+		clear_bit(SP_SPAWN_PENDING, &pool->sp_flags);
+		spin_unlock_bh(&pool->sp_lock);
+		goto out;
+	}
+	spin_unlock_bh(&pool->sp_lock);
+
+	if (spawn) {
+		if (svc_start_thread(serv, pool) == 0) {
+			spin_lock_bh(&pool->sp_lock);
+			pool->sp_stats.threads_spawned++;
+			spin_unlock_bh(&pool->sp_lock);
+		}
+	} else
+		delay -= min_t(unsigned long, delay,
+			       usecs_to_jiffies((unsigned int)waited));
+	schedule_delayed_work(&pool->sp_spawn_work, delay);
+out:
+	mutex_unlock(serv->sv_thread_mutex);
+}
+
+/*
+ * How long an idle thread in the pool should sleep waiting for work.
+ */
+long
+svc_pool_idle_timeout(struct svc_pool *pool, long timeout)
+{
+	if (pool->sp_max_threads && svc_idle_timeout)
+		timeout = min_t(long, timeout, svc_idle_timeout * HZ);
+	return timeout;
+}
+
+/*
+ * A thread has been idle for the whole idle timeout: take it out of
+ * the pool if the pool may shrink.  The caller then exits the thread
+ * as if it had been signalled.  Called with pool->sp_lock held.
+ */
+int
+svc_pool_retire_thread(struct svc_pool *pool, struct svc_rqst *rqstp)
+{
+	if (!pool->sp_max_threads || !svc_idle_timeout ||
+	    pool->sp_nrthreads <= max_t(unsigned int, pool->sp_min_threads, 1))
+		return 0;
+
+	pool->sp_nrthreads--;
+	list_del_init(&rqstp->rq_all);
+	rqstp->rq_retired = 1;
+	pool->sp_stats.threads_retired++;
+	return 1;
+}
+
 /*
  * Called from a server thread as it's exiting. Caller must hold the BKL or
  * the "service mutex", whichever is appropriate for the service.
@@ -707,7 +876,8 @@ svc_exit_thread(struct svc_rqst *rqstp)
 	kfree(rqstp->rq_auth_data);
 
 	spin_lock_bh(&pool->sp_lock);
-	pool->sp_nrthreads--;
+	if (!rqstp->rq_retired)
+		pool->sp_nrthreads--;
 	list_del(&rqstp->rq_all);
 	spin_unlock_bh(&pool->sp_lock);
 
@@ -8,6 +8,7 @@
 #include <linux/errno.h>
 #include <linux/freezer.h>
 #include <linux/kthread.h>
+#include <linux/seq_file.h>
 #include <net/sock.h>
 #include <linux/sunrpc/stats.h>
 #include <linux/sunrpc/svc_xprt.h>
@@ -309,6 +310,8 @@ void svc_xprt_enqueue(struct svc_xprt *xprt)
 
 	spin_lock_bh(&pool->sp_lock);
 
+	pool->sp_stats.packets++;
+
 	if (!list_empty(&pool->sp_threads) &&
 	    !list_empty(&pool->sp_sockets))
 		printk(KERN_ERR
@@ -368,12 +371,17 @@ void svc_xprt_enqueue(struct svc_xprt *xprt)
 		svc_xprt_get(xprt);
 		rqstp->rq_reserved = serv->sv_max_mesg;
 		atomic_add(rqstp->rq_reserved, &xprt->xpt_reserved);
+		pool->sp_stats.threads_woken++;
 		BUG_ON(xprt->xpt_pool != pool);
 		wake_up(&rqstp->rq_wait);
 	} else {
 		dprintk("svc: transport %p put into queue\n", xprt);
+		xprt->xpt_qtime = ktime_get();
 		list_add_tail(&xprt->xpt_ready, &pool->sp_sockets);
+		pool->sp_stats.sockets_queued++;
 		BUG_ON(xprt->xpt_pool != pool);
+		if (pool->sp_max_threads)
+			svc_pool_wake_spawner(pool);
 	}
 
 out_unlock:
@@ -387,6 +395,7 @@ EXPORT_SYMBOL_GPL(svc_xprt_enqueue);
 static struct svc_xprt *svc_xprt_dequeue(struct svc_pool *pool)
 {
 	struct svc_xprt	*xprt;
+	unsigned long	waited;
 
 	if (list_empty(&pool->sp_sockets))
 		return NULL;
@@ -395,6 +404,11 @@ static struct svc_xprt *svc_xprt_dequeue(struct svc_pool *pool)
 			  struct svc_xprt, xpt_ready);
 	list_del_init(&xprt->xpt_ready);
 
+	waited = ktime_us_delta(ktime_get(), xprt->xpt_qtime);
+	pool->sp_stats.queue_time_us += waited;
+	if (waited > pool->sp_stats.queue_time_max_us)
+		pool->sp_stats.queue_time_max_us = waited;
+
 	dprintk("svc: transport %p dequeued, inuse=%d\n",
 		xprt, atomic_read(&xprt->xpt_ref.refcount));
 
@@ -584,6 +598,7 @@ int svc_recv(struct svc_rqst *rqstp, long timeout)
 	int			len, i;
 	int			pages;
 	struct xdr_buf		*arg;
+	long			left;
 	DECLARE_WAITQUEUE(wait, current);
 
 	dprintk("svc: server %p waiting for data (to = %ld)\n",
@@ -665,7 +680,7 @@ int svc_recv(struct svc_rqst *rqstp, long timeout)
 		add_wait_queue(&rqstp->rq_wait, &wait);
 		spin_unlock_bh(&pool->sp_lock);
 
-		schedule_timeout(timeout);
+		left = schedule_timeout(svc_pool_idle_timeout(pool, timeout));
 
 		try_to_freeze();
 
@@ -675,6 +690,15 @@ int svc_recv(struct svc_rqst *rqstp, long timeout)
 		xprt = rqstp->rq_xprt;
 		if (!xprt) {
 			svc_thread_dequeue(pool, rqstp);
+			if (!left) {
+				pool->sp_stats.threads_timedout++;
+				/* Idle for too long: leave a dynamic pool */
+				if (svc_pool_retire_thread(pool, rqstp)) {
+					spin_unlock_bh(&pool->sp_lock);
+					dprintk("svc: server %p retired\n", rqstp);
+					return -EINTR;
+				}
+			}
 			spin_unlock_bh(&pool->sp_lock);
 			dprintk("svc: server %p, no data yet\n", rqstp);
 			if (signalled() || kthread_should_stop())
@@ -1103,3 +1127,89 @@ int svc_xprt_names(struct svc_serv *serv, char *buf, int buflen)
 	return totlen;
 }
 EXPORT_SYMBOL_GPL(svc_xprt_names);
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Per-pool statistics, one line per pool.  The caller of
+ * svc_pool_stats_open() keeps the serv alive until the file is released.
+ */
+static void *svc_pool_stats_start(struct seq_file *m, loff_t *pos)
+{
+	unsigned int pidx = (unsigned int)*pos;
+	struct svc_serv *serv = m->private;
+
+	if (!pidx)
+		return SEQ_START_TOKEN;
+	return (pidx > serv->sv_nrpools ? NULL : &serv->sv_pools[pidx-1]);
+}
+
+static void *svc_pool_stats_next(struct seq_file *m, void *p, loff_t *pos)
+{
+	struct svc_pool *pool = p;
+	struct svc_serv *serv = m->private;
+
+	if (p == SEQ_START_TOKEN) {
+		pool = &serv->sv_pools[0];
+	} else {
+		unsigned int pidx = (pool - &serv->sv_pools[0]);
+		if (pidx < serv->sv_nrpools-1)
+			pool = &serv->sv_pools[pidx+1];
+		else
+			pool = NULL;
+	}
+	++*pos;
+	return pool;
+}
+
+static void svc_pool_stats_stop(struct seq_file *m, void *p)
+{
+}
+
+static int svc_pool_stats_show(struct seq_file *m, void *p)
+{
+	struct svc_pool *pool = p;
+	struct svc_pool_stats st;
+
+	if (p == SEQ_START_TOKEN) {
+		seq_puts(m, "# pool packets-arrived sockets-enqueued "
+			 "threads-woken threads-timedout threads-spawned "
+			 "threads-retired queue-time-us max-queue-time-us\n");
+		return 0;
+	}
+
+	spin_lock_bh(&pool->sp_lock);
+	st = pool->sp_stats;
+	spin_unlock_bh(&pool->sp_lock);
+
+	seq_printf(m, "%u %lu %lu %lu %lu %lu %lu %llu %lu\n",
+		pool->sp_id,
+		st.packets,
+		st.sockets_queued,
+		st.threads_woken,
+		st.threads_timedout,
+		st.threads_spawned,
+		st.threads_retired,
+		(unsigned long long)st.queue_time_us,
+		st.queue_time_max_us);
+
+	return 0;
+}
+
+static const struct seq_operations svc_pool_stats_seq_ops = {
+	.start	= svc_pool_stats_start,
+	.next	= svc_pool_stats_next,
+	.stop	= svc_pool_stats_stop,
+	.show	= svc_pool_stats_show,
+};
+
+int svc_pool_stats_open(struct svc_serv *serv, struct file *file)
+{
+	int err;
+
+	err = seq_open(file, &svc_pool_stats_seq_ops);
+	if (!err)
+		((struct seq_file *) file->private_data)->private = serv;
+	return err;
+}
+EXPORT_SYMBOL_GPL(svc_pool_stats_open);
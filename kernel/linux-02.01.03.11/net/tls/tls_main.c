@@ -0,0 +1,359 @@
+/*
+ * TLS upper layer protocol for TCP sockets.
+ *
+ * Attaching the "tls" ULP to a connected TCP socket points sk->sk_prot at
+ * a copy of the TCP proto whose socket options understand SOL_TLS.  When
+ * the transmit keys are set with TLS_TX, sendmsg and sendpage are
+ * replaced as well, and everything sent on the socket from then on is
+ * framed into TLS records and encrypted (see tls_sw.c).  Receiving is
+ * left to userspace.
+ */
+
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <net/tcp.h>
+#include <net/tls.h>
+
+MODULE_DESCRIPTION("Transport Layer Security Support");
+MODULE_LICENSE("GPL");
+
+enum {
+	TLS_IPV4,
+	TLS_IPV6,
+	TLS_NUM_PROTS,
+};
+
+/*
+ * Per family: the proto of sockets that have the ULP but no keys yet,
+ * and of those that transmit through it.  The IPv6 ones are made from
+ * the first IPv6 socket seen, as tcpv6_prot may live in a module.
+ */
+static struct proto tls_base_prot[TLS_NUM_PROTS];
+static struct proto tls_sw_prot[TLS_NUM_PROTS];
+static struct proto *saved_tcpv6_prot;
+static DEFINE_MUTEX(tcpv6_prot_mutex);
+
+static int tls_setsockopt(struct sock *sk, int level, int optname,
+			  char __user *optval, int optlen);
+static int tls_getsockopt(struct sock *sk, int level, int optname,
+			  char __user *optval, int __user *optlen);
+#ifdef CONFIG_COMPAT
+static int tls_compat_setsockopt(struct sock *sk, int level, int optname,
+				 char __user *optval, int optlen);
+static int tls_compat_getsockopt(struct sock *sk, int level, int optname,
+				 char __user *optval, int __user *optlen);
+#endif
+static void tls_sk_proto_close(struct sock *sk, long timeout);
+
+static void build_protos(struct proto *base, struct proto *sw,
+			 const struct proto *tcp)
+{
+	*base = *tcp;
+	base->setsockopt	= tls_setsockopt;
+	base->getsockopt	= tls_getsockopt;
+#ifdef CONFIG_COMPAT
+	base->compat_setsockopt	= tls_compat_setsockopt;
+	base->compat_getsockopt	= tls_compat_getsockopt;
+#endif
+	base->close		= tls_sk_proto_close;
+
+	*sw = *base;
+	sw->sendmsg		= tls_sw_sendmsg;
+	sw->sendpage		= tls_sw_sendpage;
+}
+
+static int tls_prot_idx(struct sock *sk)
+{
+	return sk->sk_family == AF_INET6 ? TLS_IPV6 : TLS_IPV4;
+}
+
+/* Push what is left of the last record once TCP has room again. */
+static void tls_tx_work_handler(struct work_struct *work)
+{
+	struct tls_context *ctx = container_of(work, struct tls_context,
+					       tx_work);
+	struct sock *sk = ctx->sk;
+
+	lock_sock(sk);
+	if (ctx->pending_len)
+		tls_push_pending_record(sk, MSG_DONTWAIT | MSG_NOSIGNAL);
+	release_sock(sk);
+	sock_put(sk);
+}
+
+static void tls_write_space(struct sock *sk)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	/* do_tcp_sendpages() may sleep: leave the push to process context */
+	if (ctx->pending_len && !ctx->in_tcp_sendpages) {
+		sock_hold(sk);
+		if (!schedule_work(&ctx->tx_work))
+			sock_put(sk);
+	}
+
+	ctx->sk_write_space(sk);
+}
+
+static int do_tls_getsockopt_tx(struct sock *sk, char __user *optval,
+				int __user *optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	int len;
+	int rc = 0;
+
+	if (get_user(len, optlen))
+		return -EFAULT;
+
+	if (!optval || len < sizeof(struct tls_crypto_info))
+		return -EINVAL;
+
+	lock_sock(sk);
+	if (!ctx->tx_conf) {
+		rc = -EBUSY;
+		goto out;
+	}
+
+	switch (ctx->crypto_send.cipher_type) {
+	case TLS_CIPHER_AES_GCM_128: {
+		struct tls12_crypto_info_aes_gcm_128 *info =
+			&ctx->crypto_send_aes_gcm_128;
+
+		if (len != sizeof(*info)) {
+			rc = -EINVAL;
+			goto out;
+		}
+		/* Report where the record sequence stands now; the key
+		 * was wiped once it was handed to the cipher.
+		 */
+		memcpy(info->rec_seq, ctx->rec_seq, sizeof(info->rec_seq));
+		memcpy(info->iv, ctx->iv, sizeof(info->iv));
+		if (copy_to_user(optval, info, sizeof(*info)))
+			rc = -EFAULT;
+		break;
+	}
+	default:
+		rc = -EINVAL;
+	}
+out:
+	release_sock(sk);
+	return rc;
+}
+
+static int tls_getsockopt(struct sock *sk, int level, int optname,
+			  char __user *optval, int __user *optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (level != SOL_TLS)
+		return ctx->sk_proto->getsockopt(sk, level, optname,
+						 optval, optlen);
+
+	switch (optname) {
+	case TLS_TX:
+		return do_tls_getsockopt_tx(sk, optval, optlen);
+	}
+	return -ENOPROTOOPT;
+}
+
+static int do_tls_setsockopt_tx(struct sock *sk, char __user *optval,
+				int optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	struct tls_crypto_info *crypto_info = &ctx->crypto_send;
+	int rc;
+
+	if (!optval || optlen < sizeof(*crypto_info))
+		return -EINVAL;
+
+	lock_sock(sk);
+
+	/* Keys can only be set once */
+	rc = -EBUSY;
+	if (ctx->tx_conf)
+		goto out;
+
+	rc = -EFAULT;
+	if (copy_from_user(crypto_info, optval, sizeof(*crypto_info)))
+		goto out;
+
+	rc = -EINVAL;
+	if (crypto_info->version != TLS_1_2_VERSION)
+		goto err_crypto_info;
+
+	switch (crypto_info->cipher_type) {
+	case TLS_CIPHER_AES_GCM_128:
+		rc = -EINVAL;
+		if (optlen != sizeof(struct tls12_crypto_info_aes_gcm_128))
+			goto err_crypto_info;
+		rc = -EFAULT;
+		if (copy_from_user(crypto_info + 1, optval + sizeof(*crypto_info),
+				   optlen - sizeof(*crypto_info)))
+			goto err_crypto_info;
+		break;
+	default:
+		goto err_crypto_info;
+	}
+
+	rc = tls_set_sw_offload(sk, ctx);
+	if (rc)
+		goto err_crypto_info;
+
+	ctx->tx_conf = 1;
+	sk->sk_prot = &tls_sw_prot[tls_prot_idx(sk)];
+	goto out;
+
+err_crypto_info:
+	memset(&ctx->crypto_send_aes_gcm_128, 0,
+	       sizeof(ctx->crypto_send_aes_gcm_128));
+out:
+	release_sock(sk);
+	return rc;
+}
+
+static int tls_setsockopt(struct sock *sk, int level, int optname,
+			  char __user *optval, int optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (level != SOL_TLS)
+		return ctx->sk_proto->setsockopt(sk, level, optname,
+						 optval, optlen);
+
+	switch (optname) {
+	case TLS_TX:
+		return do_tls_setsockopt_tx(sk, optval, optlen);
+	}
+	return -ENOPROTOOPT;
+}
+
+#ifdef CONFIG_COMPAT
+/* struct tls12_crypto_info_aes_gcm_128 has the same layout everywhere */
+static int tls_compat_setsockopt(struct sock *sk, int level, int optname,
+				 char __user *optval, int optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (level != SOL_TLS)
+		return ctx->sk_proto->compat_setsockopt(sk, level, optname,
+							optval, optlen);
+	return tls_setsockopt(sk, level, optname, optval, optlen);
+}
+
+static int tls_compat_getsockopt(struct sock *sk, int level, int optname,
+				 char __user *optval, int __user *optlen)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (level != SOL_TLS)
+		return ctx->sk_proto->compat_getsockopt(sk, level, optname,
+							optval, optlen);
+	return tls_getsockopt(sk, level, optname, optval, optlen);
+}
+#endif
+
+/*
+ * Hand the socket back to TCP: send what is left of the last record,
+ * restore the original proto and free the context, then close as TCP.
+ */
+static void tls_sk_proto_close(struct sock *sk, long timeout)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	struct proto *sk_proto = ctx->sk_proto;
+
+	lock_sock(sk);
+	if (ctx->pending_len)
+		tls_push_pending_record(sk, MSG_NOSIGNAL);
+	tls_free_pending_record(ctx);
+
+	sk->sk_write_space = ctx->sk_write_space;
+	sk->sk_prot = sk_proto;
+	inet_csk(sk)->icsk_ulp_data = NULL;
+	release_sock(sk);
+
+	if (cancel_work_sync(&ctx->tx_work))
+		sock_put(sk);
+
+	tls_sw_free_resources(ctx);
+	kfree(ctx);
+
+	sk_proto->close(sk, timeout);
+}
+
+static int tls_init(struct sock *sk)
+{
+	struct inet_connection_sock *icsk = inet_csk(sk);
+	struct tls_context *ctx;
+	int idx = tls_prot_idx(sk);
+
+	/* The TLS ulp is currently supported only for TCP sockets
+	 * in ESTABLISHED state.  Supporting sockets in LISTEN state
+	 * would require the children to inherit the context.
+	 */
+	if (sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+
+	/* The IPv6 protos are built from the first IPv6 socket */
+	if (idx == TLS_IPV6 && sk->sk_prot != saved_tcpv6_prot) {
+		mutex_lock(&tcpv6_prot_mutex);
+		if (sk->sk_prot != saved_tcpv6_prot) {
+			build_protos(&tls_base_prot[TLS_IPV6],
+				     &tls_sw_prot[TLS_IPV6], sk->sk_prot);
+			saved_tcpv6_prot = sk->sk_prot;
+		}
+		mutex_unlock(&tcpv6_prot_mutex);
+	}
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	INIT_WORK(&ctx->tx_work, tls_tx_work_handler);
+	ctx->sk = sk;
+	ctx->sk_proto = sk->sk_prot;
+	ctx->sk_write_space = sk->sk_write_space;
+
+	icsk->icsk_ulp_data = ctx;
+	sk->sk_write_space = tls_write_space;
+	sk->sk_prot = &tls_base_prot[idx];
+	return 0;
+}
+
+/* The socket went away without being closed through us */
+static void tls_release(struct sock *sk)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+
+	if (!ctx)
+		return;
+
+	tls_free_pending_record(ctx);
+	tls_sw_free_resources(ctx);
+	kfree(ctx);
+	inet_csk(sk)->icsk_ulp_data = NULL;
+}
+
+static struct tcp_ulp_ops tcp_tls_ulp_ops __read_mostly = {
+	.name			= "tls",
+	.owner			= THIS_MODULE,
+	.init			= tls_init,
+	.release		= tls_release,
+};
+
+static int __init tls_register(void)
+{
+	build_protos(&tls_base_prot[TLS_IPV4], &tls_sw_prot[TLS_IPV4],
+		     &tcp_prot);
+
+	return tcp_register_ulp(&tcp_tls_ulp_ops);
+}
+
+static void __exit tls_unregister(void)
+{
+	tcp_unregister_ulp(&tcp_tls_ulp_ops);
+}
+
+module_init(tls_register);
+module_exit(tls_unregister);
+MODULE_ALIAS("tcp-ulp-tls");
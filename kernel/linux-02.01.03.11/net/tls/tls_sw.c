@@ -0,0 +1,344 @@
+/*
+ * TLS record layer, software transmit path.
+ *
+ * Every sendmsg() or sendpage() call is cut into records of at most
+ * TLS_MAX_PAYLOAD_SIZE bytes.  A record is built in freshly allocated
+ * pages: the 5 byte header and the explicit nonce, then the AES-GCM
+ * ciphertext and tag.  The pages are then handed to TCP with
+ * do_tcp_sendpages(), so they are not copied again on the way out.
+ *
+ * sendmsg() copies the user data into the record and encrypts it in
+ * place.  sendpage(), which sendfile() and splice() end up in, encrypts
+ * straight from the page it is given into the record, so file data is
+ * read once and never copied to or from userspace.
+ *
+ * Only one record is ever held back: when TCP cannot take all of it, the
+ * rest is pushed before anything new is sent, or from the write space
+ * callback.
+ */
+
+#include <linux/module.h>
+#include <linux/crypto.h>
+#include <linux/mm.h>
+#include <linux/scatterlist.h>
+#include <net/tcp.h>
+#include <net/tls.h>
+
+void tls_free_pending_record(struct tls_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < ctx->pending_npages; i++)
+		put_page(ctx->pending_pages[i]);
+
+	ctx->pending_npages = 0;
+	ctx->pending_offset = 0;
+	ctx->pending_len = 0;
+}
+
+/*
+ * Hand the pending record to TCP.  Returns 0 once all of it is queued,
+ * or the error of do_tcp_sendpages() with the rest still pending.
+ */
+int tls_push_pending_record(struct sock *sk, int flags)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	int ret;
+
+	flags &= MSG_DONTWAIT | MSG_NOSIGNAL | MSG_MORE;
+
+	ctx->in_tcp_sendpages = 1;
+	while (ctx->pending_len) {
+		ret = do_tcp_sendpages(sk, ctx->pending_pages,
+				       ctx->pending_offset, ctx->pending_len,
+				       flags);
+		if (ret <= 0) {
+			ctx->in_tcp_sendpages = 0;
+			return ret ? ret : -EPIPE;
+		}
+		ctx->pending_offset += ret;
+		ctx->pending_len -= ret;
+	}
+	ctx->in_tcp_sendpages = 0;
+
+	tls_free_pending_record(ctx);
+	return 0;
+}
+
+/* Allocate the pages of a record carrying len bytes of payload. */
+static int tls_alloc_record(struct sock *sk, struct tls_context *ctx,
+			    size_t len)
+{
+	int npages = DIV_ROUND_UP(TLS_OVERHEAD_SIZE + len, PAGE_SIZE);
+	int left = len + TLS_CIPHER_AES_GCM_128_TAG_SIZE;
+	int offset = TLS_PREPEND_SIZE;
+	int i;
+
+	sg_init_table(ctx->sg_dst, npages);
+	for (i = 0; i < npages; i++) {
+		struct page *page = alloc_page(sk->sk_allocation);
+		int n = min_t(int, left, PAGE_SIZE - offset);
+
+		if (!page) {
+			tls_free_pending_record(ctx);
+			return -ENOMEM;
+		}
+		ctx->pending_pages[i] = page;
+		ctx->pending_npages++;
+
+		/* The ciphertext and tag follow the header and nonce */
+		sg_set_page(&ctx->sg_dst[i], page, n, offset);
+		left -= n;
+		offset = 0;
+	}
+	return 0;
+}
+
+static void tls_advance_seq(u8 *seq, int len)
+{
+	int i;
+
+	for (i = len - 1; i >= 0; i--)
+		if (++seq[i])
+			break;
+}
+
+/*
+ * Fill in the header and encrypt len bytes from src into the record
+ * allocated by tls_alloc_record(), which then becomes the pending one.
+ */
+static int tls_encrypt_record(struct tls_context *ctx, unsigned char type,
+			      struct scatterlist *src, size_t len)
+{
+	struct aead_request *req = ctx->aead_req;
+	u8 *hdr = page_address(ctx->pending_pages[0]);
+	size_t rec_len = TLS_CIPHER_AES_GCM_128_IV_SIZE + len +
+			 TLS_CIPHER_AES_GCM_128_TAG_SIZE;
+	int rc;
+
+	hdr[0] = type;
+	hdr[1] = TLS_1_2_VERSION_MAJOR;
+	hdr[2] = TLS_1_2_VERSION_MINOR;
+	hdr[3] = rec_len >> 8;
+	hdr[4] = rec_len & 0xff;
+	memcpy(hdr + TLS_HEADER_SIZE, ctx->iv, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+
+	/* additional data: sequence number, type, version, length */
+	memcpy(ctx->aad, ctx->rec_seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	ctx->aad[8] = type;
+	ctx->aad[9] = TLS_1_2_VERSION_MAJOR;
+	ctx->aad[10] = TLS_1_2_VERSION_MINOR;
+	ctx->aad[11] = len >> 8;
+	ctx->aad[12] = len & 0xff;
+
+	aead_request_set_assoc(req, &ctx->sg_aad, TLS_AAD_SPACE_SIZE);
+	aead_request_set_crypt(req, src, ctx->sg_dst, len, ctx->iv);
+	rc = crypto_aead_encrypt(req);
+	if (rc) {
+		tls_free_pending_record(ctx);
+		return rc;
+	}
+
+	ctx->pending_offset = 0;
+	ctx->pending_len = TLS_OVERHEAD_SIZE + len;
+
+	tls_advance_seq(ctx->rec_seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	tls_advance_seq(ctx->iv, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+	return 0;
+}
+
+static int tls_process_cmsg(struct msghdr *msg, unsigned char *record_type)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (!CMSG_OK(msg, cmsg))
+			return -EINVAL;
+		if (cmsg->cmsg_level != SOL_TLS)
+			continue;
+
+		switch (cmsg->cmsg_type) {
+		case TLS_SET_RECORD_TYPE:
+			if (cmsg->cmsg_len < CMSG_LEN(sizeof(*record_type)))
+				return -EINVAL;
+			*record_type = *(unsigned char *)CMSG_DATA(cmsg);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+int tls_sw_sendmsg(struct kiocb *iocb, struct sock *sk,
+		   struct msghdr *msg, size_t size)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	unsigned char record_type = TLS_RECORD_TYPE_DATA;
+	int flags = msg->msg_flags;
+	size_t copied = 0;
+	int ret;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	ret = tls_process_cmsg(msg, &record_type);
+	if (ret)
+		return ret;
+
+	lock_sock(sk);
+
+	if (ctx->pending_len) {
+		ret = tls_push_pending_record(sk, flags);
+		if (ret)
+			goto out;
+	}
+
+	while (copied < size) {
+		size_t len = min_t(size_t, size - copied, TLS_MAX_PAYLOAD_SIZE);
+		int offset = TLS_PREPEND_SIZE;
+		size_t left = len;
+		int i;
+
+		ret = tls_alloc_record(sk, ctx, len);
+		if (ret)
+			break;
+
+		for (i = 0; left; i++) {
+			int n = min_t(size_t, left, PAGE_SIZE - offset);
+
+			ret = memcpy_fromiovec(page_address(ctx->pending_pages[i]) +
+					       offset, msg->msg_iov, n);
+			if (ret)
+				break;
+			left -= n;
+			offset = 0;
+		}
+		if (ret) {
+			tls_free_pending_record(ctx);
+			break;
+		}
+
+		ret = tls_encrypt_record(ctx, record_type, ctx->sg_dst, len);
+		if (ret)
+			break;
+
+		/* Once encrypted the record is part of the stream */
+		copied += len;
+
+		ret = tls_push_pending_record(sk, copied < size ?
+					      flags | MSG_MORE : flags);
+		if (ret)
+			break;
+	}
+
+out:
+	release_sock(sk);
+	return copied ? copied : ret;
+}
+
+int tls_sw_sendpage(struct sock *sk, struct page *page,
+		    int offset, size_t size, int flags)
+{
+	struct tls_context *ctx = tls_get_ctx(sk);
+	struct scatterlist sg_src;
+	size_t copied = 0;
+	int ret;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	lock_sock(sk);
+
+	if (ctx->pending_len) {
+		ret = tls_push_pending_record(sk, flags);
+		if (ret)
+			goto out;
+	}
+
+	while (copied < size) {
+		size_t len = min_t(size_t, size - copied, TLS_MAX_PAYLOAD_SIZE);
+
+		ret = tls_alloc_record(sk, ctx, len);
+		if (ret)
+			break;
+
+		sg_init_table(&sg_src, 1);
+		sg_set_page(&sg_src, page, len, offset + copied);
+		ret = tls_encrypt_record(ctx, TLS_RECORD_TYPE_DATA, &sg_src, len);
+		if (ret)
+			break;
+
+		copied += len;
+
+		ret = tls_push_pending_record(sk, copied < size ?
+					      flags | MSG_MORE : flags);
+		if (ret)
+			break;
+	}
+
+out:
+	release_sock(sk);
+	return copied ? copied : ret;
+}
+
+int tls_set_sw_offload(struct sock *sk, struct tls_context *ctx)
+{
+	struct tls12_crypto_info_aes_gcm_128 *info =
+		&ctx->crypto_send_aes_gcm_128;
+	u8 keysalt[TLS_CIPHER_AES_GCM_128_KEY_SIZE +
+		   TLS_CIPHER_AES_GCM_128_SALT_SIZE];
+	int rc;
+
+	/* rfc4106 takes the salt after the key and the explicit nonce as IV */
+	ctx->aead_send = crypto_alloc_aead("rfc4106(gcm(aes))", 0,
+					   CRYPTO_ALG_ASYNC);
+	if (IS_ERR(ctx->aead_send)) {
+		rc = PTR_ERR(ctx->aead_send);
+		ctx->aead_send = NULL;
+		return rc;
+	}
+
+	memcpy(keysalt, info->key, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+	memcpy(keysalt + TLS_CIPHER_AES_GCM_128_KEY_SIZE, info->salt,
+	       TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+	rc = crypto_aead_setkey(ctx->aead_send, keysalt, sizeof(keysalt));
+	memset(keysalt, 0, sizeof(keysalt));
+	if (rc)
+		goto free_aead;
+
+	rc = crypto_aead_setauthsize(ctx->aead_send,
+				     TLS_CIPHER_AES_GCM_128_TAG_SIZE);
+	if (rc)
+		goto free_aead;
+
+	rc = -ENOMEM;
+	ctx->aead_req = aead_request_alloc(ctx->aead_send, sk->sk_allocation);
+	if (!ctx->aead_req)
+		goto free_aead;
+	aead_request_set_callback(ctx->aead_req, 0, NULL, NULL);
+
+	memcpy(ctx->iv, info->iv, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+	memcpy(ctx->rec_seq, info->rec_seq, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+	sg_init_one(&ctx->sg_aad, ctx->aad, sizeof(ctx->aad));
+
+	/* The cipher has its own copy of the key */
+	memset(info->key, 0, sizeof(info->key));
+	memset(info->salt, 0, sizeof(info->salt));
+	return 0;
+
+free_aead:
+	crypto_free_aead(ctx->aead_send);
+	ctx->aead_send = NULL;
+	return rc;
+}
+
+void tls_sw_free_resources(struct tls_context *ctx)
+{
+	if (ctx->aead_req)
+		aead_request_free(ctx->aead_req);
+	if (ctx->aead_send)
+		crypto_free_aead(ctx->aead_send);
+	ctx->aead_req = NULL;
+	ctx->aead_send = NULL;
+}